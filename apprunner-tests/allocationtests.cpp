@@ -0,0 +1,92 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+
+#include "AllocationTracker.h"
+#include "PhaseTimings.h"
+#include "check.h"
+
+using doo::metrodriver::AllocationTracker;
+using doo::metrodriver::PhaseTimings;
+using namespace doo::tests;
+
+#ifdef APPRUNNER_ALLOCATION_TRACKING
+static AllocationTracker::Usage findUsage(AllocationTracker::Dimension dimension, const std::string& name) {
+  std::vector<AllocationTracker::Usage> usages = AllocationTracker::getUsage(dimension);
+  auto usage = std::find_if(usages.begin(), usages.end(), [&name](const AllocationTracker::Usage& usage) {
+    return usage.name == name;
+  });
+  if (usage == usages.end()) {
+    AllocationTracker::Usage none = { name, 0, 0, 0, 0 };
+    return none;
+  }
+  return *usage;
+}
+
+/************************************************************************/
+/* Memory is charged to the phase and component of the allocating       */
+/* thread and credited back when freed, on whatever thread that is      */
+/************************************************************************/
+TEST(allocationTracking) {
+  PhaseTimings timings;
+  std::vector<char>* outer;
+  std::vector<char>* inner;
+  {
+    PhaseTimings::Scope phase(timings, "tests.phase");
+    AllocationTracker_COMPONENT("tests.outer");
+    outer = new std::vector<char>(1000);
+    {
+      AllocationTracker_COMPONENT("tests.inner");
+      inner = new std::vector<char>(3000);
+    }
+    // the inner scope ended, the outer component is current again
+    delete new char[500];
+  }
+  AllocationTracker::Usage phase = findUsage(AllocationTracker::Phase, "tests.phase");
+  AllocationTracker::Usage outerComponent = findUsage(AllocationTracker::Component, "tests.outer");
+  AllocationTracker::Usage innerComponent = findUsage(AllocationTracker::Component, "tests.inner");
+  CHECK(outerComponent.allocations == 3 && outerComponent.bytes == sizeof(std::vector<char>) + 1500);
+  CHECK(outerComponent.live == static_cast<int64>(sizeof(std::vector<char>) + 1000));
+  CHECK(outerComponent.peak == sizeof(std::vector<char>) + 1500);
+  CHECK(innerComponent.allocations == 2 && innerComponent.live == static_cast<int64>(innerComponent.bytes));
+  // the phase covers both components, and the Scope's own bookkeeping
+  CHECK(phase.bytes >= outerComponent.bytes + innerComponent.bytes);
+  CHECK(phase.peak >= sizeof(std::vector<char>) * 2 + 4500);
+
+  std::thread([=]() {
+    delete outer;
+    delete inner;
+  }).join();
+  CHECK(findUsage(AllocationTracker::Component, "tests.outer").live == 0);
+  CHECK(findUsage(AllocationTracker::Component, "tests.inner").live == 0);
+  CHECK(findUsage(AllocationTracker::Component, "tests.inner").peak == innerComponent.peak);
+  CHECK(AllocationTracker::getPeak() >= phase.peak);
+}
+#endif
+
+/************************************************************************/
+/* What a tracked allocation costs when several threads allocate at     */
+/* once, built without APPRUNNER_ALLOCATION_TRACKING it measures plain  */
+/* operator new for comparison                                          */
+/************************************************************************/
+BENCHMARK(allocations) {
+  const int rounds = 1000000;
+  for (unsigned threadCount = 1; threadCount <= 8; threadCount *= 2) {
+    double start = now();
+    std::vector<std::thread> threads;
+    for (unsigned thread = 0; thread < threadCount; thread++) {
+      threads.push_back(std::thread([rounds]() {
+        AllocationTracker_COMPONENT("tests.benchmark");
+        for (int round = 0; round < rounds; round++) {
+          delete new std::string(64, 'x');
+        }
+      }));
+    }
+    for (auto thread = threads.begin(); thread != threads.end(); ++thread) {
+      thread->join();
+    }
+    printf("  %u threads: %.0f ns per allocation and free\n", threadCount, (now() - start) * 1e9 / (rounds * threadCount));
+  }
+}
@@ -0,0 +1,152 @@
+#include "stdafx.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include "check.h"
+#include "fixtures.h"
+#include "mappedfile.h"
+#include "ziparchive.h"
+#include "zipformat.h"
+
+using doo::zip::MappedFile;
+using doo::zip::ZipArchive;
+using namespace doo::tests;
+
+// extract all entries of archive with ExtractBatch, returns how many were handed out more than once
+static size_t extractAll(const ZipArchive& archive, unsigned queueDepth, std::vector<std::vector<byte>>& contents) {
+  std::vector<size_t> indices;
+  size_t size = 0;
+  for (size_t i = 0; i < archive.GetEntries().GetCount(); i++) {
+    indices.push_back(i);
+    size += static_cast<size_t>(archive.GetEntries().GetUncompressedSize(i));
+  }
+  std::vector<byte> buffer(size + 1);
+  contents.assign(indices.size(), std::vector<byte>());
+  std::vector<int> seen(indices.size());
+  size_t repeated = 0;
+  archive.ExtractBatch(indices, buffer.data(), buffer.size(), queueDepth, [&](size_t index, const byte* data, size_t length) {
+    repeated += seen[index]++ > 0;
+    contents[index].assign(data, data + length);
+  });
+  return repeated;
+}
+
+/************************************************************************/
+/* Whatever the queue depth, every entry is handed out once with its    */
+/* contents, with offsets from the local headers or from the sidecar    */
+/************************************************************************/
+TEST(batchExtraction) {
+  const size_t fileCount = 300;
+  std::string path = createArchive("batch", fileCount, 6000, 48);
+  for (int sidecar = 0; sidecar < 2; sidecar++) {
+    ZipArchive archive(path, sidecar != 0);
+    unsigned depths[] = { 0, 1, 3, 16, 200 };
+    for (size_t depth = 0; depth < sizeof(depths) / sizeof(depths[0]); depth++) {
+      std::vector<std::vector<byte>> contents;
+      CHECK(extractAll(archive, depths[depth], contents) == 0);
+      for (size_t i = 0; i < fileCount; i++) {
+        CHECK(contents[archive.GetEntries().Find(layoutFileName(i))] == layoutFileContents(i, 6000, 48));
+      }
+    }
+  }
+
+  // entries may come in any order and more than once
+  ZipArchive archive(path);
+  std::vector<size_t> indices;
+  indices.push_back(5);
+  indices.push_back(2);
+  indices.push_back(5);
+  std::vector<byte> buffer(archive.GetEntries().GetUncompressedSize(5) * 2 + archive.GetEntries().GetUncompressedSize(2));
+  size_t calls = 0;
+  archive.ExtractBatch(indices, buffer.data(), buffer.size(), 4, [&](size_t index, const byte* data, size_t length) {
+    calls++;
+    CHECK(std::vector<byte>(data, data + length) == archive.GetFileContents(index));
+  });
+  CHECK(calls == 3);
+  CHECK_THROWS(archive.ExtractBatch(indices, buffer.data(), buffer.size() - 1, 4, [](size_t, const byte*, size_t) {}));
+}
+
+/************************************************************************/
+/* An entry whose compressed size reaches past the end of the archive   */
+/* is rejected, also when its data offset comes from the sidecar        */
+/************************************************************************/
+TEST(batchOversizedEntry) {
+  std::string path = createArchive("oversized", 20, 2000, 49);
+  std::vector<byte> data = readFile(path);
+  doo::zip::EndOfCentralDirectoryRecord end;
+  memcpy(&end, &data[data.size() - sizeof(end)], sizeof(end));
+  CHECK(end.signature == ZipArchive_END_OF_CENTRAL_RECORD_SIGNATURE);
+  // the last entry in the directory, local and central header claim the same size
+  size_t position = end.centralDirectoryOffset;
+  doo::zip::CentralDirectoryHeader central;
+  for (uint16 entry = 0; entry < end.entryCountTotal; entry++) {
+    memcpy(&central, &data[position], sizeof(central));
+    if (entry + 1 < end.entryCountTotal) {
+      position += sizeof(central) + central.filenameLength + central.extraFieldLength + central.fileCommentLength;
+    }
+  }
+  std::string name(reinterpret_cast<const char*>(&data[position + sizeof(central)]), central.filenameLength);
+  uint32 oversized = static_cast<uint32>(data.size() * 2);
+  memcpy(&data[position + offsetof(doo::zip::CentralDirectoryHeader, compressedSize)], &oversized, sizeof(oversized));
+  memcpy(&data[central.localHeaderOffset + offsetof(doo::zip::LocalFileHeader, compressedSize)], &oversized, sizeof(oversized));
+  writeFile(path, data);
+
+  for (int sidecar = 0; sidecar < 2; sidecar++) {
+    ZipArchive archive(path, sidecar != 0);
+    size_t index = archive.GetEntries().Find(name);
+    CHECK(archive.GetEntries().GetCompressedSize(index) == oversized);
+    std::vector<size_t> indices(1, index);
+    std::vector<byte> buffer(static_cast<size_t>(archive.GetEntries().GetUncompressedSize(index)));
+    CHECK_THROWS(archive.ExtractBatch(indices, buffer.data(), buffer.size(), 4, [](size_t, const byte*, size_t) {}));
+    CHECK_THROWS(archive.GetFileContents(index));
+  }
+}
+
+/************************************************************************/
+/* Extracting an archive that is not in the cache: entry by entry, in   */
+/* batches at increasing queue depths, and reading it through a mapping */
+/* for comparison. Evicting the file needs a file system that honours   */
+/* it, numbers from a warm cache mostly measure decompression           */
+/************************************************************************/
+BENCHMARK(batchQueueDepth) {
+  const size_t fileCount = 2000;
+  std::string path = createArchive("batch-benchmark", fileCount, 16384, 50);
+  ZipArchive archive(path);
+  std::vector<size_t> indices;
+  size_t size = 0;
+  for (size_t i = 0; i < fileCount; i++) {
+    indices.push_back(i);
+    size += static_cast<size_t>(archive.GetEntries().GetUncompressedSize(i));
+  }
+  std::vector<byte> buffer(size);
+  double archiveSize = static_cast<double>(readFile(path).size());
+
+  evictFromCache(path);
+  double start = now();
+  for (size_t i = 0; i < fileCount; i++) {
+    archive.ExtractTo(i, buffer.data(), buffer.size());
+  }
+  double seconds = now() - start;
+  printf("  entry by entry: %.1f ms, %.1f MB/s of archive\n", seconds * 1000, archiveSize / 1e6 / seconds);
+
+  unsigned depths[] = { 1, 2, 4, 8, 16, 32, 64 };
+  for (size_t depth = 0; depth < sizeof(depths) / sizeof(depths[0]); depth++) {
+    evictFromCache(path);
+    start = now();
+    archive.ExtractBatch(indices, buffer.data(), buffer.size(), depths[depth], [](size_t, const byte*, size_t) {});
+    seconds = now() - start;
+    printf("  queue depth %2u: %.1f ms, %.1f MB/s of archive\n", depths[depth], seconds * 1000, archiveSize / 1e6 / seconds);
+  }
+
+  // reading only, no decompression
+  evictFromCache(path);
+  start = now();
+  MappedFile mapped(path);
+  uint32 sum = 0;
+  for (uint64 offset = 0; offset < mapped.GetSize(); offset += 4096) {
+    sum += mapped.GetData()[offset];
+  }
+  seconds = now() - start;
+  printf("  touching every page of a mapping: %.1f ms, %.1f MB/s (%u)\n", seconds * 1000, archiveSize / 1e6 / seconds, sum & 1);
+}
@@ -0,0 +1,157 @@
+#include "stdafx.h"
+
+#include <chrono>
+#include <cstdio>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "check.h"
+
+using doo::tests::Registration;
+using doo::tests::RegisteredTest;
+
+// created by the first call to temporaryDirectory()
+static std::string runDirectory;
+
+std::vector<RegisteredTest>& doo::tests::registeredTests() {
+  // registrations run during static initialization, before any thread is started
+  static std::vector<RegisteredTest> tests;
+  return tests;
+}
+
+Registration::Registration(const char* name, TestFunction function, bool benchmark) {
+  RegisteredTest test = { name, function, benchmark };
+  registeredTests().push_back(test);
+}
+
+void doo::tests::fail(const char* file, int line, const char* expression) {
+  char message[1024];
+  snprintf(message, sizeof(message), "%s(%d): %s", file, line, expression);
+  Failure failure;
+  failure.message = message;
+  throw failure;
+}
+
+const std::string& doo::tests::temporaryDirectory() {
+  if (runDirectory.empty()) {
+#ifdef _WIN32
+    char base[MAX_PATH];
+    GetTempPathA(MAX_PATH, base);
+    char name[64];
+    snprintf(name, sizeof(name), "apprunner-tests-%u", static_cast<unsigned>(GetCurrentProcessId()));
+    runDirectory = std::string(base) + name;
+#else
+    char name[64];
+    snprintf(name, sizeof(name), "/tmp/apprunner-tests-%u", static_cast<unsigned>(getpid()));
+    runDirectory = name;
+#endif
+    createDirectory(runDirectory);
+  }
+  return runDirectory;
+}
+
+std::string doo::tests::temporaryPath(const std::string& name) {
+  return joinPath(temporaryDirectory(), name);
+}
+
+std::string doo::tests::joinPath(const std::string& directory, const std::string& name) {
+#ifdef _WIN32
+  return directory + "\\" + name;
+#else
+  return directory + "/" + name;
+#endif
+}
+
+void doo::tests::createDirectory(const std::string& path) {
+#ifdef _WIN32
+  CreateDirectoryA(path.c_str(), NULL);
+#else
+  mkdir(path.c_str(), 0755);
+#endif
+}
+
+void doo::tests::removeDirectory(const std::string& path) {
+#ifdef _WIN32
+  WIN32_FIND_DATAA found;
+  HANDLE search = FindFirstFileA((path + "\\*").c_str(), &found);
+  if (search != INVALID_HANDLE_VALUE) {
+    do {
+      std::string name = found.cFileName;
+      if (name == "." || name == "..") {
+        continue;
+      }
+      if (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+        removeDirectory(joinPath(path, name));
+      } else {
+        DeleteFileA(joinPath(path, name).c_str());
+      }
+    } while (FindNextFileA(search, &found));
+    FindClose(search);
+  }
+  RemoveDirectoryA(path.c_str());
+#else
+  DIR* search = opendir(path.c_str());
+  if (search) {
+    while (dirent* found = readdir(search)) {
+      std::string name = found->d_name;
+      if (name == "." || name == "..") {
+        continue;
+      }
+      struct stat status;
+      if (stat(joinPath(path, name).c_str(), &status) == 0 && S_ISDIR(status.st_mode)) {
+        removeDirectory(joinPath(path, name));
+      } else {
+        unlink(joinPath(path, name).c_str());
+      }
+    }
+    closedir(search);
+  }
+  rmdir(path.c_str());
+#endif
+}
+
+void doo::tests::writeFile(const std::string& path, const std::vector<byte>& data) {
+  std::ofstream output(path, std::ios::binary | std::ios::trunc);
+  if (!data.empty()) {
+    output.write(reinterpret_cast<const char*>(data.data()), data.size());
+  }
+  if (!output) {
+    fail(__FILE__, __LINE__, ("could not write " + path).c_str());
+  }
+}
+
+void doo::tests::writeFile(const std::string& path, const std::string& data) {
+  writeFile(path, std::vector<byte>(data.begin(), data.end()));
+}
+
+std::vector<byte> doo::tests::readFile(const std::string& path) {
+  std::ifstream input(path, std::ios::binary);
+  return std::vector<byte>(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+}
+
+void doo::tests::evictFromCache(const std::string& path) {
+#ifdef _WIN32
+  // opening a file without buffering makes the cache manager throw away what it holds of it
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+    OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, NULL);
+  if (file != INVALID_HANDLE_VALUE) {
+    CloseHandle(file);
+  }
+#else
+  int file = open(path.c_str(), O_RDONLY);
+  if (file >= 0) {
+    fdatasync(file);
+    posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+    close(file);
+  }
+#endif
+}
+
+double doo::tests::now() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
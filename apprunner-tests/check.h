@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// A minimal harness: checks and benchmarks register themselves by name, main() runs the checks by
+// default and the benchmarks with "bench". Benchmarks print their measurements, they don't fail.
+namespace doo {
+  namespace tests {
+    typedef void (*TestFunction)();
+
+    struct Registration {
+      Registration(const char* name, TestFunction function, bool benchmark);
+    };
+
+    struct RegisteredTest {
+      const char* name;
+      TestFunction function;
+      bool benchmark;
+    };
+    std::vector<RegisteredTest>& registeredTests();
+
+    // thrown by CHECK, ends the current check
+    struct Failure {
+      std::string message;
+    };
+    void fail(const char* file, int line, const char* expression);
+
+    // a directory for the files of the current run, removed when main() returns
+    const std::string& temporaryDirectory();
+    // a path below the temporary directory
+    std::string temporaryPath(const std::string& name);
+    std::string joinPath(const std::string& directory, const std::string& name);
+    void createDirectory(const std::string& path);
+    void removeDirectory(const std::string& path);
+    void writeFile(const std::string& path, const std::vector<byte>& data);
+    void writeFile(const std::string& path, const std::string& data);
+    std::vector<byte> readFile(const std::string& path);
+    // drop the file from the system's cache as far as the system lets us, so the next read goes to the disk
+    void evictFromCache(const std::string& path);
+
+    // seconds since some fixed point, for measuring
+    double now();
+  }
+}
+
+#define TEST(name) \
+  static void name(); \
+  static doo::tests::Registration name##Registration(#name, name, false); \
+  static void name()
+
+#define BENCHMARK(name) \
+  static void name(); \
+  static doo::tests::Registration name##Registration(#name, name, true); \
+  static void name()
+
+#define CHECK(expression) \
+  if (!(expression)) { \
+    doo::tests::fail(__FILE__, __LINE__, #expression); \
+  }
+
+#define CHECK_THROWS(statement) { \
+    bool thrown = false; \
+    try { \
+      statement; \
+    } catch (Platform::Exception^) { \
+      thrown = true; \
+    } \
+    if (!thrown) { \
+      doo::tests::fail(__FILE__, __LINE__, "throws: " #statement); \
+    } \
+  }
@@ -0,0 +1,104 @@
+#include "stdafx.h"
+
+#include <cstdio>
+#include <thread>
+
+#include "check.h"
+#include "codec.h"
+#include "fixtures.h"
+#include "randomaccessfile.h"
+#include "ziparchive.h"
+#include "zipformat.h"
+
+using doo::zip::Codec;
+using doo::zip::CodecRegistry;
+using doo::zip::LocalFileHeader;
+using doo::zip::RandomAccessFile;
+using doo::zip::ZipArchive;
+using doo::zip::ZipEntryTable;
+using namespace doo::tests;
+
+/************************************************************************/
+/* Changes are accepted until the first lookup and rejected after it    */
+/************************************************************************/
+TEST(codecRegistryFreezes) {
+  CodecRegistry registry;
+  std::shared_ptr<Codec> deflate = registry.GetCodecs(ZipArchive_METHOD_DEFLATE).front();
+  CodecRegistry unfrozen;
+  unfrozen.Register(deflate);
+  unfrozen.SetPreferred(ZipArchive_METHOD_DEFLATE, "parallel");
+  CHECK(strcmp(unfrozen.Find(ZipArchive_METHOD_DEFLATE)->GetName(), "parallel") == 0);
+  CHECK_THROWS(unfrozen.Register(deflate));
+  CHECK_THROWS(unfrozen.SetPreferred(ZipArchive_METHOD_DEFLATE, "tinfl"));
+
+  CHECK(registry.Find(ZipArchive_METHOD_STORED));
+  CHECK(registry.Find(ZipArchive_METHOD_DEFLATE));
+  CHECK(registry.Find(ZipArchive_METHOD_DEFLATE64));
+  CHECK(!registry.Find(1));
+  CHECK(!registry.Find(0xFFFF));
+  CHECK(registry.GetCodecs(0xFFFF).empty());
+}
+
+/************************************************************************/
+/* Lookups from many threads see the same codecs                        */
+/************************************************************************/
+TEST(concurrentCodecLookups) {
+  CodecRegistry registry;
+  std::vector<std::thread> threads;
+  std::vector<Codec*> found(8);
+  for (size_t t = 0; t < found.size(); t++) {
+    threads.push_back(std::thread([&, t]() {
+      for (int i = 0; i < 100000; i++) {
+        found[t] = registry.Find(ZipArchive_METHOD_DEFLATE).get();
+      }
+    }));
+  }
+  for (auto thread = threads.begin(); thread != threads.end(); ++thread) {
+    thread->join();
+  }
+  for (size_t t = 0; t < found.size(); t++) {
+    CHECK(found[t] == registry.Find(ZipArchive_METHOD_DEFLATE).get());
+  }
+}
+
+// where the data of entry index starts behind its local header
+static uint64 getDataOffset(const RandomAccessFile& file, const ZipEntryTable& entries, size_t index) {
+  LocalFileHeader header;
+  file.ReadAt(entries.GetLocalHeaderOffset(index), &header, sizeof(header));
+  return entries.GetLocalHeaderOffset(index) + sizeof(header) + header.filenameLength + header.extraFieldLength;
+}
+
+// decompress every entry of archive with each backend for its method and print the throughput
+static void compareCodecs(const std::string& path) {
+  ZipArchive archive(path);
+  RandomAccessFile file(path);
+  const ZipEntryTable& entries = archive.GetEntries();
+  uint16 method = entries.GetCompressionMethod(0);
+  const std::vector<std::shared_ptr<Codec>>& codecs = CodecRegistry::Shared().GetCodecs(method);
+  for (auto codec = codecs.begin(); codec != codecs.end(); ++codec) {
+    uint64 total = 0;
+    double seconds = 0;
+    for (size_t i = 0; i < entries.GetCount(); i++) {
+      CHECK(entries.GetCompressionMethod(i) == method);
+      uint64 offset = getDataOffset(file, entries, i);
+      std::vector<byte> contents(static_cast<size_t>(entries.GetUncompressedSize(i)));
+      double start = now();
+      (*codec)->Decompress(file, offset, entries.GetCompressedSize(i), contents.data(), contents.size(), entries.GetFlags(i));
+      seconds += now() - start;
+      CHECK(contents == archive.GetFileContents(i));
+      total += contents.size();
+    }
+    printf("  %-10s %6u entries, %8.1f MB/s\n", (*codec)->GetName(),
+      static_cast<unsigned>(entries.GetCount()), total / seconds / (1024 * 1024));
+  }
+}
+
+/************************************************************************/
+/* Every backend the build includes on the same entries: many small     */
+/* ones and a single large one, still below the size the parallel       */
+/* backend splits up, see parallelInflate for that                      */
+/************************************************************************/
+BENCHMARK(codecs) {
+  compareCodecs(createArchive("codecs-small", 2000, 16384, 33));
+  compareCodecs(createArchive("codecs-large", 1, 80 * 1024 * 1024, 33));
+}
@@ -0,0 +1,176 @@
+#include "stdafx.h"
+
+#include <cstdio>
+
+#include "DeploymentTrace.h"
+#include "SimulatedDeploymentBackend.h"
+#include "check.h"
+
+using doo::metrodriver::DeploymentBackend;
+using doo::metrodriver::DeploymentTrace;
+using doo::metrodriver::DeploymentTraceEvent;
+using doo::metrodriver::OperationModel;
+using doo::metrodriver::PackageIdentity;
+using doo::metrodriver::RecordingDeploymentBackend;
+using doo::metrodriver::SimulatedDeploymentBackend;
+using namespace doo::tests;
+
+static PackageIdentity createIdentity(const wchar_t* version) {
+  PackageIdentity package;
+  package.name = L"doo.Sample";
+  package.publisher = L"CN=doo";
+  package.version = version;
+  package.fullName = L"doo.Sample_" + package.version + L"_x86__abcdefghijklm";
+  return package;
+}
+
+static const wchar_t* appUserModelId = L"doo.Sample_abcdefghijklm!App";
+
+/************************************************************************/
+/* The simulator follows PackageManager's rules, and only apps it       */
+/* started can be waited for, once                                      */
+/************************************************************************/
+TEST(simulatedDeployment) {
+  SimulatedDeploymentBackend backend(1, 0);
+  std::vector<std::wstring> none;
+  PackageIdentity first = createIdentity(L"1.0.0.0");
+  PackageIdentity second = createIdentity(L"1.0.0.1");
+  CHECK(backend.findPackages(first.name, first.publisher).empty());
+  CHECK(!backend.updatePackage(first, L"first.appx", none).empty());
+  CHECK_THROWS(backend.activateApplication(appUserModelId));
+  CHECK(backend.stagePackage(first, L"first.appx", none).empty());
+  CHECK(backend.registerPackage(first, L"AppxManifest.xml", none).empty());
+  CHECK(backend.findPackages(first.name, first.publisher).size() == 1);
+  CHECK(!backend.registerPackage(second, L"AppxManifest.xml", none).empty());
+  CHECK(!backend.updatePackage(first, L"first.appx", none).empty());
+  CHECK(backend.updatePackage(second, L"second.appx", none).empty());
+  CHECK(backend.getInstalledPackages().size() == 1 && backend.getInstalledPackages()[0].version == L"1.0.0.1");
+  CHECK(!backend.setDebugging(first.fullName, true));
+  CHECK(backend.setDebugging(second.fullName, true));
+
+  uint32 processId = backend.activateApplication(appUserModelId);
+  CHECK(processId >= SimulatedDeploymentBackend_FIRST_PROCESS_ID);
+  uint32 otherProcessId = backend.activateApplication(appUserModelId);
+  CHECK(otherProcessId != processId);
+  CHECK_THROWS(backend.waitForApplication(processId + 100, nullptr));
+  uint64 peakWorkingSet = 1;
+  CHECK(backend.waitForApplication(processId, &peakWorkingSet) == 0 && peakWorkingSet == 0);
+  CHECK_THROWS(backend.waitForApplication(processId, nullptr));
+  CHECK(backend.waitForApplication(otherProcessId, nullptr) == 0);
+
+  CHECK(!backend.removePackage(first.fullName).empty());
+  CHECK(backend.removePackage(second.fullName).empty());
+  CHECK(backend.getInstalledPackages().empty());
+  CHECK(backend.getSimulatedMilliseconds() > 0);
+
+  // durations are drawn from the model, the same seed gives the same ones
+  SimulatedDeploymentBackend seeded(7, 0);
+  SimulatedDeploymentBackend sameSeed(7, 0);
+  OperationModel failing = { 100, 0.5, 1 };
+  seeded.setModel(DeploymentBackend::StagePackage, failing);
+  sameSeed.setModel(DeploymentBackend::StagePackage, failing);
+  CHECK(seeded.stagePackage(first, L"first.appx", none) == L"Simulated failure");
+  sameSeed.stagePackage(first, L"first.appx", none);
+  CHECK(seeded.getSimulatedMilliseconds() == sameSeed.getSimulatedMilliseconds());
+}
+
+/************************************************************************/
+/* Events survive formatting and parsing, text outside the BMP and      */
+/* separators in the fields included                                    */
+/************************************************************************/
+TEST(deploymentTraceFormat) {
+  DeploymentTraceEvent event;
+  event.operation = DeploymentBackend::WaitForApplication;
+  event.milliseconds = 1234.56;
+  event.package = L"doo.Sample_1.0.0.0_x86__abcdefghijklm caf\u00e9 \U0001F600";
+  event.error = L"first\tsecond\nthird";
+  std::string line = DeploymentTrace::format(event);
+  CHECK(line == "wait\t1234.6\tdoo.Sample_1.0.0.0_x86__abcdefghijklm caf\xc3\xa9 \xf0\x9f\x98\x80\tfirst second third");
+
+  DeploymentTraceEvent parsed;
+  CHECK(DeploymentTrace::parse(line, parsed));
+  CHECK(parsed.operation == DeploymentBackend::WaitForApplication);
+  CHECK(parsed.milliseconds > 1234.5 && parsed.milliseconds < 1234.7);
+  CHECK(parsed.package == event.package);
+  CHECK(parsed.error == L"first second third");
+
+  CHECK(!DeploymentTrace::parse("", parsed));
+  CHECK(!DeploymentTrace::parse("launch\t1.0\tpackage\t", parsed));
+  CHECK(!DeploymentTrace::parse("stage\t-1\tpackage\t", parsed));
+  CHECK(!DeploymentTrace::parse("stage\t1.0\tpackage", parsed));
+}
+
+/************************************************************************/
+/* A recorded run replays with the recorded durations and errors, even  */
+/* where the inventory would allow the operation                        */
+/************************************************************************/
+TEST(deploymentTraceReplay) {
+  std::string path = temporaryPath("deployment.trace");
+  remove(path.c_str());
+  std::vector<std::wstring> none;
+  PackageIdentity package = createIdentity(L"1.0.0.0");
+  uint32 processId;
+  // the trace gets the time actually waited, a fraction of the modelled one
+  std::shared_ptr<SimulatedDeploymentBackend> simulated = std::make_shared<SimulatedDeploymentBackend>(3, 0.002);
+  {
+    RecordingDeploymentBackend recording(simulated, path);
+    recording.findPackages(package.name, package.publisher);
+    recording.stagePackage(package, L"sample.appx", none);
+    recording.registerPackage(package, L"AppxManifest.xml", none);
+    CHECK(!recording.removePackage(L"doo.Other").empty());
+    processId = recording.activateApplication(appUserModelId);
+    recording.waitForApplication(processId, nullptr);
+    CHECK_THROWS(recording.waitForApplication(processId, nullptr));
+  }
+  std::vector<DeploymentTraceEvent> events = DeploymentTrace::load(path);
+  CHECK(events.size() == 7);
+  CHECK(events[5].operation == DeploymentBackend::WaitForApplication && events[5].error.empty());
+  CHECK(events[6].operation == DeploymentBackend::WaitForApplication && !events[6].error.empty());
+  double recorded = 0;
+  for (auto event = events.begin(); event != events.end(); ++event) {
+    recorded += event->milliseconds;
+  }
+  CHECK(recorded > 0);
+
+  // the recorded removal failed, so the replayed one does with the package installed
+  SimulatedDeploymentBackend replayed(5, 0);
+  replayed.replay(events);
+  CHECK(replayed.stagePackage(package, L"sample.appx", none).empty());
+  CHECK(replayed.registerPackage(package, L"AppxManifest.xml", none).empty());
+  replayed.findPackages(package.name, package.publisher);
+  CHECK(!replayed.removePackage(package.fullName).empty());
+  CHECK(replayed.getInstalledPackages().size() == 1);
+  processId = replayed.activateApplication(appUserModelId);
+  CHECK(replayed.waitForApplication(processId, nullptr) == 0);
+  CHECK_THROWS(replayed.waitForApplication(processId, nullptr));
+  // durations are traced to a tenth of a millisecond
+  CHECK(replayed.getSimulatedMilliseconds() > recorded - 0.5 && replayed.getSimulatedMilliseconds() < recorded + 0.5);
+  CHECK_THROWS(DeploymentTrace::load(temporaryPath("missing.trace")));
+}
+
+/************************************************************************/
+/* What the default models predict for a watch session: one install     */
+/* and run, then updates, each followed by a run                        */
+/************************************************************************/
+BENCHMARK(simulatedWatchSession) {
+  std::vector<std::wstring> none;
+  SimulatedDeploymentBackend backend(11, 0);
+  const int builds = 100;
+  double start = now();
+  for (int build = 0; build < builds; build++) {
+    wchar_t version[32];
+    swprintf(version, 32, L"1.0.%d.0", build);
+    PackageIdentity package = createIdentity(version);
+    if (build == 0) {
+      backend.stagePackage(package, L"sample.appx", none);
+      backend.registerPackage(package, L"AppxManifest.xml", none);
+    } else {
+      backend.updatePackage(package, L"sample.appx", none);
+    }
+    backend.setDebugging(package.fullName, true);
+    backend.waitForApplication(backend.activateApplication(appUserModelId), nullptr);
+  }
+  double seconds = now() - start;
+  printf("  %d builds: %.1f simulated s, %.1f s per build, simulated in %.2f ms\n", builds,
+    backend.getSimulatedMilliseconds() / 1000, backend.getSimulatedMilliseconds() / 1000 / builds, seconds * 1000);
+}
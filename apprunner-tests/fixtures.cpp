@@ -0,0 +1,116 @@
+#include "stdafx.h"
+
+#include <cstdio>
+
+#include "check.h"
+#include "crc32.h"
+#include "fixtures.h"
+#include "zipformat.h"
+#include "zippacker.h"
+
+// how many subdirectories a layout spreads its files over
+#define Fixtures_DIRECTORY_COUNT 8
+
+static const char* words[] = {
+  "the", "package", "archive", "entry", "return", "const", "size_t", "index", "buffer", "length",
+  "if", "for", "while", "std::vector<byte>", "throw", "ref", "new", "Platform::String^", "data", "{", "}",
+  "(", ")", ";", "=", "==", "<", ">", "0", "1", "uint64", "offset", "file", "name", "manifest", "version"
+};
+
+std::vector<byte> doo::tests::generateText(size_t length, uint32 seed) {
+  std::vector<byte> text;
+  text.reserve(length + 32);
+  uint32 state = seed * 2654435761U + 1;
+  while (text.size() < length) {
+    state = state * 1103515245U + 12345U;
+    const char* word = words[(state >> 16) % (sizeof(words) / sizeof(words[0]))];
+    text.insert(text.end(), word, word + strlen(word));
+    text.push_back((state >> 8) % 11 == 0 ? '\n' : ' ');
+  }
+  text.resize(length);
+  return text;
+}
+
+std::string doo::tests::layoutFileName(size_t index) {
+  char name[64];
+  snprintf(name, sizeof(name), "dir%u/file%u.txt", static_cast<unsigned>(index % Fixtures_DIRECTORY_COUNT), static_cast<unsigned>(index));
+  return name;
+}
+
+std::vector<byte> doo::tests::layoutFileContents(size_t index, size_t averageSize, uint32 seed) {
+  // between half and one and a half times the average
+  size_t size = averageSize / 2 + (index * 2654435761U) % (averageSize + 1);
+  return generateText(size, seed + static_cast<uint32>(index));
+}
+
+std::string doo::tests::createLayout(const std::string& name, size_t fileCount, size_t averageSize, uint32 seed) {
+  std::string directory = temporaryPath(name);
+  createDirectory(directory);
+  for (size_t i = 0; i < Fixtures_DIRECTORY_COUNT && i < fileCount; i++) {
+    char subdirectory[32];
+    snprintf(subdirectory, sizeof(subdirectory), "dir%u", static_cast<unsigned>(i));
+    createDirectory(joinPath(directory, subdirectory));
+  }
+  for (size_t i = 0; i < fileCount; i++) {
+    std::string fileName = layoutFileName(i);
+    size_t separator = fileName.find('/');
+    std::string path = joinPath(joinPath(directory, fileName.substr(0, separator)), fileName.substr(separator + 1));
+    writeFile(path, layoutFileContents(i, averageSize, seed));
+  }
+  return directory;
+}
+
+std::string doo::tests::createArchive(const std::string& name, size_t fileCount, size_t averageSize, uint32 seed) {
+  std::string directory = createLayout(name, fileCount, averageSize, seed);
+  std::string archive = directory + ".zip";
+  doo::zip::ZipPacker().Pack(directory, archive, false);
+  return archive;
+}
+
+// append the bytes of value to data
+template <class T>
+static void append(std::vector<byte>& data, const T& value) {
+  const byte* bytes = reinterpret_cast<const byte*>(&value);
+  data.insert(data.end(), bytes, bytes + sizeof(value));
+}
+
+std::vector<byte> doo::tests::buildStoredArchive(const std::vector<std::string>& names, const std::vector<std::vector<byte>>& contents) {
+  std::vector<byte> archive;
+  std::vector<byte> directory;
+  for (size_t i = 0; i < names.size(); i++) {
+    uint32 offset = static_cast<uint32>(archive.size());
+    uint32 size = static_cast<uint32>(contents[i].size());
+    uint32 crc = doo::zip::UpdateCrc32(0, contents[i].data(), contents[i].size());
+
+    doo::zip::LocalFileHeader local = {};
+    local.signature = ZipArchive_ENTRY_LOCAL_HEADER_SIGNATURE;
+    local.version = 20;
+    local.compressionMethod = ZipArchive_METHOD_STORED;
+    local.crc32 = crc;
+    local.compressedSize = local.uncompressedSize = size;
+    local.filenameLength = static_cast<uint16>(names[i].size());
+    append(archive, local);
+    archive.insert(archive.end(), names[i].begin(), names[i].end());
+    archive.insert(archive.end(), contents[i].begin(), contents[i].end());
+
+    doo::zip::CentralDirectoryHeader central = {};
+    central.signature = ZipArchive_CENTRAL_DIRECTORY_RECORD_SIGNATURE;
+    central.versionCreated = central.versionNeeded = 20;
+    central.compressionMethod = ZipArchive_METHOD_STORED;
+    central.crc32 = crc;
+    central.compressedSize = central.uncompressedSize = size;
+    central.filenameLength = static_cast<uint16>(names[i].size());
+    central.localHeaderOffset = offset;
+    append(directory, central);
+    directory.insert(directory.end(), names[i].begin(), names[i].end());
+  }
+
+  doo::zip::EndOfCentralDirectoryRecord end = {};
+  end.signature = ZipArchive_END_OF_CENTRAL_RECORD_SIGNATURE;
+  end.entryCountThisDisk = end.entryCountTotal = static_cast<uint16>(names.size());
+  end.centralDirectorySize = static_cast<uint32>(directory.size());
+  end.centralDirectoryOffset = static_cast<uint32>(archive.size());
+  archive.insert(archive.end(), directory.begin(), directory.end());
+  append(archive, end);
+  return archive;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Archives and directories the checks and benchmarks work on. Everything is generated, the same
+// arguments always give the same bytes, so expected contents can be computed instead of stored.
+namespace doo {
+  namespace tests {
+    // words separated by spaces and line breaks, deflates about as well as source code
+    std::vector<byte> generateText(size_t length, uint32 seed);
+
+    // the name and contents of file index of a generated layout, names use '/' like ZIP does
+    std::string layoutFileName(size_t index);
+    std::vector<byte> layoutFileContents(size_t index, size_t averageSize, uint32 seed);
+
+    // fileCount files of averageSize bytes on average below temporaryPath(name), spread over
+    // a few subdirectories. Returns the directory.
+    std::string createLayout(const std::string& name, size_t fileCount, size_t averageSize, uint32 seed);
+
+    // the layout packed with ZipPacker into temporaryPath(name + ".zip"), returns the archive's path
+    std::string createArchive(const std::string& name, size_t fileCount, size_t averageSize, uint32 seed);
+
+    // an archive of the files stored uncompressed, the way a bundle holds its packages
+    std::vector<byte> buildStoredArchive(const std::vector<std::string>& names, const std::vector<std::vector<byte>>& contents);
+  }
+}
@@ -0,0 +1,170 @@
+#include "stdafx.h"
+
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+#include "RunHistory.h"
+#include "check.h"
+
+using doo::metrodriver::PhaseTimings;
+using doo::metrodriver::Regression;
+using doo::metrodriver::RunHistory;
+using doo::metrodriver::RunRecord;
+using doo::metrodriver::VersionBaseline;
+using namespace doo::tests;
+
+// indices into RunHistory_PHASE_NAMES
+#define HistoryTests_LAUNCH 4
+
+// a run of packageName with launch and application phases within 5% of the given durations
+static RunRecord createRun(const std::string& packageName, const std::string& version, double launch, double application,
+    uint64 peakMemory, uint32& noise) {
+  noise = noise * 1103515245U + 12345U;
+  double launchJitter = 1 + (static_cast<int>((noise >> 16) % 1001) - 500) / 10000.0;
+  noise = noise * 1103515245U + 12345U;
+  double applicationJitter = 1 + (static_cast<int>((noise >> 16) % 1001) - 500) / 10000.0;
+  PhaseTimings timings;
+  timings.record("launch", launch * launchJitter);
+  timings.record("application", application * applicationJitter);
+  RunRecord record = RunRecord::create(packageName, version, timings);
+  record.peakMemory = peakMemory;
+  return record;
+}
+
+TEST(runRecordCreation) {
+  PhaseTimings timings;
+  timings.record("staging", 10);
+  timings.record("registration", 20);
+  // the watch mode runs a phase several times
+  timings.record("staging", 5);
+  timings.record("not a phase", 1000);
+  RunRecord record = RunRecord::create("doo.Sample", "1.2.30.4", timings);
+  CHECK(std::string(record.packageName) == "doo.Sample");
+  CHECK(record.version[0] == 1 && record.version[1] == 2 && record.version[2] == 30 && record.version[3] == 4);
+  CHECK(RunHistory::formatVersion(record.version) == "1.2.30.4");
+  CHECK(record.phaseMilliseconds[0] == 15 && record.phaseMilliseconds[1] == 20);
+  for (unsigned phase = 2; phase < RunHistory_PHASE_COUNT; phase++) {
+    CHECK(record.phaseMilliseconds[phase] == 0);
+  }
+  CHECK(record.startTime != 0);
+
+  // missing parts stay 0
+  record = RunRecord::create(std::string(80, 'x'), "3.1", timings);
+  CHECK(record.version[0] == 3 && record.version[1] == 1 && record.version[2] == 0 && record.version[3] == 0);
+  CHECK(record.packageName[sizeof(record.packageName) - 1] == 0);
+}
+
+/************************************************************************/
+/* Records survive a reopen, a record cut short is padded over and      */
+/* left out of the baselines                                            */
+/************************************************************************/
+TEST(runHistoryFile) {
+  std::string path = temporaryPath("history.bin");
+  CHECK(RunHistory(path).getCount() == 0);
+
+  uint32 noise = 1;
+  for (int i = 0; i < 3; i++) {
+    RunRecord record = createRun("doo.Sample", "1.0.0.0", 100, 1000, 1000000, noise);
+    record.exitCode = i;
+    RunHistory::append(path, record);
+  }
+  {
+    RunHistory history(path);
+    CHECK(history.getCount() == 3);
+    CHECK(history.getRecord(2).exitCode == 2);
+    CHECK(history.getRecord(1).peakMemory == 1000000);
+  }
+
+  // a crash in the middle of writing a record
+  std::ofstream(path.c_str(), std::ios::binary | std::ios::app).write("partial record", 14);
+  RunHistory::append(path, createRun("doo.Sample", "1.0.0.0", 100, 1000, 1000000, noise));
+  RunHistory::append(path, createRun("doo.Other", "1.0.0.0", 100, 1000, 1000000, noise));
+  RunHistory history(path);
+  CHECK(history.getCount() == 6);
+  CHECK(std::string(history.getRecord(5).packageName) == "doo.Other");
+  std::vector<VersionBaseline> baselines = history.getBaselines("doo.Sample");
+  CHECK(baselines.size() == 1);
+  CHECK(baselines[0].metrics[HistoryTests_LAUNCH].runs == 4);
+  CHECK(baselines[0].metrics[RunHistory_PEAK_MEMORY].mean == 1000000);
+  // phases that never ran have no baseline
+  CHECK(baselines[0].metrics[0].runs == 0);
+  CHECK(history.getBaselines("doo.Missing").empty());
+
+  std::string notHistory = temporaryPath("not-history.bin");
+  writeFile(notHistory, std::string(256, 'x'));
+  CHECK_THROWS(RunHistory history(notHistory));
+}
+
+/************************************************************************/
+/* Only increases that are both large enough and significant against    */
+/* the noise of both versions are reported                              */
+/************************************************************************/
+TEST(regressionDetection) {
+  std::string path = temporaryPath("regressions.bin");
+  uint32 noise = 7;
+  // older runs of the first version were slow, the window leaves them out
+  for (int i = 0; i < 10; i++) {
+    RunHistory::append(path, createRun("doo.Sample", "1.0.0.0", 500, 1000, 50000000, noise));
+  }
+  for (int i = 0; i < 20; i++) {
+    RunHistory::append(path, createRun("doo.Sample", "1.0.0.0", 100, 1000, 50000000, noise));
+    // 30% slower launches
+    RunHistory::append(path, createRun("doo.Sample", "1.1.0.0", 130, 1000, 50000000, noise));
+    // 2% slower launches and 20% more memory
+    RunHistory::append(path, createRun("doo.Sample", "1.2.0.0", 133, 1000, 60000000, noise));
+    // another package's runs don't count
+    RunHistory::append(path, createRun("doo.Other", "1.1.0.0", 1000, 10000, 50000000, noise));
+  }
+  // a 10% slower application phase, but only measured once
+  RunHistory::append(path, createRun("doo.Sample", "1.3.0.0", 133, 1100, 60000000, noise));
+
+  RunHistory history(path);
+  std::vector<VersionBaseline> baselines = history.getBaselines("doo.Sample");
+  CHECK(baselines.size() == 4);
+  CHECK(RunHistory::formatVersion(baselines[1].version) == "1.1.0.0");
+  CHECK(baselines[0].metrics[HistoryTests_LAUNCH].runs == RunHistory_DEFAULT_WINDOW);
+  CHECK(fabs(baselines[0].metrics[HistoryTests_LAUNCH].mean - 100) < 5);
+  CHECK(baselines[0].metrics[HistoryTests_LAUNCH].deviation > 0);
+  CHECK(history.getBaselines("doo.Sample", 30)[0].metrics[HistoryTests_LAUNCH].mean > 150);
+
+  std::vector<Regression> regressions = RunHistory::findRegressions(baselines);
+  CHECK(regressions.size() == 2);
+  CHECK(regressions[0].fromVersion == 0 && regressions[0].toVersion == 1);
+  CHECK(regressions[0].metric == HistoryTests_LAUNCH);
+  CHECK(fabs(regressions[0].increase - 0.3) < 0.05);
+  CHECK(regressions[1].fromVersion == 1 && regressions[1].toVersion == 2);
+  CHECK(regressions[1].metric == RunHistory_PEAK_MEMORY);
+  CHECK(std::string(RunHistory::getMetricName(regressions[1].metric)) == "peak memory");
+
+  // without any noise every increase above the minimum is significant
+  CHECK(regressions[1].t == std::numeric_limits<double>::infinity());
+}
+
+/************************************************************************/
+/* Appending one run at a time, then one scan for the baselines         */
+/************************************************************************/
+BENCHMARK(runHistory) {
+  std::string path = temporaryPath("history-benchmark.bin");
+  const int runs = 200000;
+  uint32 noise = 3;
+  std::vector<RunRecord> records;
+  for (int i = 0; i < runs; i++) {
+    char version[16];
+    snprintf(version, sizeof(version), "1.%d.0.0", i / 10000);
+    records.push_back(createRun(i % 4 == 0 ? "doo.Sample" : "doo.Other", version, 100, 1000, 50000000, noise));
+  }
+
+  double start = now();
+  for (auto record = records.begin(); record != records.end(); ++record) {
+    RunHistory::append(path, *record);
+  }
+  double appended = now();
+  RunHistory history(path);
+  std::vector<VersionBaseline> baselines = history.getBaselines("doo.Sample");
+  std::vector<Regression> regressions = RunHistory::findRegressions(baselines);
+  double scanned = now();
+  printf("  %d runs: %.2f us per append, %.1f ms to open and scan, %u versions, %u regressions\n", runs,
+    (appended - start) * 1e6 / runs, (scanned - appended) * 1000, static_cast<unsigned>(baselines.size()),
+    static_cast<unsigned>(regressions.size()));
+}
@@ -0,0 +1,210 @@
+#include "stdafx.h"
+
+#include <cstring>
+#include <sstream>
+
+#include "check.h"
+#include "deflateindex.h"
+#include "fixtures.h"
+#include "randomaccessfile.h"
+#include "ziparchive.h"
+#include "zipformat.h"
+#include "zippacker.h"
+
+using doo::zip::DeflateIndex;
+using doo::zip::RandomAccessFile;
+using doo::zip::ZipArchive;
+using namespace doo::tests;
+
+// distance between checkpoints in the checks, the size of a packer block
+#define IndexTests_SPAN (64 * 1024)
+
+// bytes in front of the first checkpoint in a saved index, and the size of each checkpoint
+#define IndexTests_SAVED_HEADER (4 + 4 + 8 + 8 + 4 + 8)
+#define IndexTests_SAVED_CHECKPOINT (8 + 8 + 8 + 4 + 32768)
+
+// a directory with big.txt and other.txt packed next to it, returns the archive's path
+static std::string createIndexArchive(const std::string& name, const std::vector<byte>& big) {
+  std::string directory = temporaryPath(name);
+  createDirectory(directory);
+  writeFile(joinPath(directory, "big.txt"), big);
+  writeFile(joinPath(directory, "other.txt"), generateText(300 * 1024, 141));
+  std::string path = directory + ".zip";
+  doo::zip::ZipPacker().Pack(directory, path, false);
+  return path;
+}
+
+static size_t findEntry(const ZipArchive& archive, const std::string& filename) {
+  for (size_t i = 0; i < archive.GetEntries().GetCount(); i++) {
+    if (archive.GetEntries().GetName(i) == filename) {
+      return i;
+    }
+  }
+  throw ref new Platform::FailureException(L"Entry not found");
+}
+
+// the index of filename with checkpoints every span bytes, built from the data behind its local header
+static std::shared_ptr<DeflateIndex> buildIndex(const std::string& path, const ZipArchive& archive,
+  const std::string& filename, uint64 span)
+{
+  const doo::zip::ZipEntryTable& entries = archive.GetEntries();
+  size_t index = findEntry(archive, filename);
+  RandomAccessFile file(path);
+  doo::zip::LocalFileHeader local;
+  file.ReadAt(entries.GetLocalHeaderOffset(index), reinterpret_cast<byte*>(&local), sizeof(local));
+  uint64 dataOffset = entries.GetLocalHeaderOffset(index) + sizeof(local) + local.filenameLength + local.extraFieldLength;
+  return DeflateIndex::Build(file, dataOffset, entries.GetCompressedSize(index), entries.GetUncompressedSize(index),
+    entries.GetCrc32(index), span);
+}
+
+// ReadRange() gives what the whole contents hold there, the range is cut off at the end of the file
+static bool matchesRange(const ZipArchive& archive, const std::string& filename, const std::vector<byte>& contents,
+  uint64 offset, size_t length)
+{
+  offset = std::min<uint64>(offset, contents.size());
+  length = static_cast<size_t>(std::min<uint64>(length, contents.size() - offset));
+  std::vector<byte> range = archive.ReadRange(filename, offset, length);
+  return range.size() == length && (length == 0 || memcmp(range.data(), contents.data() + offset, length) == 0);
+}
+
+// ranges starting at, just before and just behind every checkpoint, and ones reaching over the next checkpoint
+static void checkRangesAroundCheckpoints(const ZipArchive& archive, const DeflateIndex& index, const std::vector<byte>& contents) {
+  const std::vector<DeflateIndex::Checkpoint>& checkpoints = index.GetCheckpoints();
+  for (auto checkpoint = checkpoints.begin(); checkpoint != checkpoints.end(); ++checkpoint) {
+    uint64 offset = checkpoint->outputOffset;
+    CHECK(matchesRange(archive, "big.txt", contents, offset, 1000));
+    CHECK(matchesRange(archive, "big.txt", contents, offset - 1, 1));
+    CHECK(matchesRange(archive, "big.txt", contents, offset - 1, 2));
+    CHECK(matchesRange(archive, "big.txt", contents, offset + 1, 100));
+    CHECK(matchesRange(archive, "big.txt", contents, offset - 100, 2 * IndexTests_SPAN + 200));
+  }
+  CHECK(matchesRange(archive, "big.txt", contents, 0, 100));
+  CHECK(matchesRange(archive, "big.txt", contents, contents.size() - 100, 100));
+  CHECK(matchesRange(archive, "big.txt", contents, 0, contents.size()));
+  CHECK(matchesRange(archive, "big.txt", contents, contents.size(), 0));
+}
+
+/************************************************************************/
+/* Reads resuming at checkpoints a few blocks apart in a 5MB entry give */
+/* what the whole file holds, wherever the range starts and ends        */
+/************************************************************************/
+TEST(deflateIndexCheckpoints) {
+  std::vector<byte> big = generateText(5 * 1024 * 1024, 140);
+  std::string path = createIndexArchive("index-checkpoints", big);
+  ZipArchive archive(path);
+  CHECK(archive.GetFileContents("big.txt") == big);
+
+  std::shared_ptr<DeflateIndex> index = buildIndex(path, archive, "big.txt", IndexTests_SPAN);
+  const std::vector<DeflateIndex::Checkpoint>& checkpoints = index->GetCheckpoints();
+  CHECK(checkpoints.size() >= big.size() / (4 * IndexTests_SPAN));
+  for (size_t i = 0; i < checkpoints.size(); i++) {
+    CHECK(checkpoints[i].outputOffset >= (i + 1) * IndexTests_SPAN && checkpoints[i].outputOffset < big.size());
+    CHECK(checkpoints[i].window.size() == 32768);
+    CHECK(memcmp(checkpoints[i].window.data(), big.data() + checkpoints[i].outputOffset - 32768, 32768) == 0);
+  }
+  archive.SetIndex("big.txt", index);
+  CHECK(archive.GetIndex("big.txt") == index);
+  checkRangesAroundCheckpoints(archive, *index, big);
+
+  CHECK_THROWS(archive.ReadRange("big.txt", big.size() - 10, 11));
+  CHECK_THROWS(archive.ReadRange("big.txt", big.size() + 1, 0));
+
+  // the index built on first use has the default span
+  ZipArchive defaultIndex(path);
+  CHECK(matchesRange(defaultIndex, "big.txt", big, 3 * 1024 * 1024, 5000));
+  CHECK(defaultIndex.GetIndex("big.txt")->GetCheckpoints().size() <= big.size() / DeflateIndex_DEFAULT_SPAN);
+}
+
+/************************************************************************/
+/* A saved index reads back to the same checkpoints and serves ranges   */
+/* in another archive object. Truncated and damaged ones, and ones for  */
+/* a different entry, are turned down.                                  */
+/************************************************************************/
+TEST(deflateIndexSaveLoad) {
+  std::vector<byte> big = generateText(3 * 1024 * 1024, 142);
+  std::string path = createIndexArchive("index-saved", big);
+  std::string saved;
+  size_t checkpointCount;
+  {
+    ZipArchive archive(path);
+    std::shared_ptr<DeflateIndex> index = buildIndex(path, archive, "big.txt", IndexTests_SPAN);
+    checkpointCount = index->GetCheckpoints().size();
+    CHECK(checkpointCount > 2);
+    std::ostringstream output;
+    index->Save(output);
+    saved = output.str();
+    CHECK(saved.size() == IndexTests_SAVED_HEADER + checkpointCount * IndexTests_SAVED_CHECKPOINT);
+  }
+
+  std::istringstream input(saved);
+  std::shared_ptr<DeflateIndex> loaded = DeflateIndex::Load(input);
+  CHECK(loaded->GetCheckpoints().size() == checkpointCount);
+  ZipArchive archive(path);
+  archive.SetIndex("big.txt", loaded);
+  checkRangesAroundCheckpoints(archive, *loaded, big);
+
+  // cut off in the header, in a window and by a single byte
+  size_t cuts[] = { 10, IndexTests_SAVED_HEADER + IndexTests_SAVED_CHECKPOINT / 2, saved.size() - 1 };
+  for (size_t i = 0; i < sizeof(cuts) / sizeof(cuts[0]); i++) {
+    std::istringstream truncated(saved.substr(0, cuts[i]));
+    CHECK_THROWS(DeflateIndex::Load(truncated));
+  }
+
+  // an unknown format, a checkpoint beyond the data, out of order, and one with more bits than the buffer holds
+  const uint64 beyond = big.size() + 1;
+  const uint32 tooManyBits = 64;
+  struct Damage {
+    size_t position;
+    const void* value;
+    size_t length;
+  } damages[] = {
+    { 0, "DIDY", 4 },
+    { IndexTests_SAVED_HEADER, &beyond, sizeof(beyond) },
+    { IndexTests_SAVED_HEADER + 8, &beyond, sizeof(beyond) },
+    { IndexTests_SAVED_HEADER + IndexTests_SAVED_CHECKPOINT + 8, saved.data() + IndexTests_SAVED_HEADER + 8, 8 },
+    { IndexTests_SAVED_HEADER + 24, &tooManyBits, sizeof(tooManyBits) }
+  };
+  for (size_t i = 0; i < sizeof(damages) / sizeof(damages[0]); i++) {
+    std::string damaged = saved;
+    memcpy(&damaged[damages[i].position], damages[i].value, damages[i].length);
+    std::istringstream damagedInput(damaged);
+    CHECK_THROWS(DeflateIndex::Load(damagedInput));
+  }
+
+  // the index doesn't fit the other entry, nor big.txt with one byte changed
+  CHECK_THROWS(archive.SetIndex("other.txt", loaded));
+  big[1000] = big[1000] == 'x' ? 'y' : 'x';
+  std::string changedPath = createIndexArchive("index-changed", big);
+  ZipArchive changed(changedPath);
+  CHECK_THROWS(changed.SetIndex("big.txt", loaded));
+  CHECK(matchesRange(changed, "big.txt", big, 990, 20));
+}
+
+/************************************************************************/
+/* Stored entries are read in place and can't be indexed                */
+/************************************************************************/
+TEST(storedRanges) {
+  std::vector<std::string> names;
+  std::vector<std::vector<byte>> contents;
+  for (size_t i = 0; i < 4; i++) {
+    names.push_back(layoutFileName(i));
+    contents.push_back(layoutFileContents(i, 200 * 1024, 143));
+  }
+  names.push_back("empty.txt");
+  contents.push_back(std::vector<byte>());
+  std::string path = temporaryPath("stored-ranges.zip");
+  writeFile(path, buildStoredArchive(names, contents));
+
+  ZipArchive archive(path);
+  for (size_t i = 0; i < names.size(); i++) {
+    uint64 size = contents[i].size();
+    CHECK(matchesRange(archive, names[i], contents[i], 0, static_cast<size_t>(size)));
+    CHECK(matchesRange(archive, names[i], contents[i], size / 3, 5000));
+    CHECK(matchesRange(archive, names[i], contents[i], size - size / 10, 100 * 1024));
+    CHECK(matchesRange(archive, names[i], contents[i], size, 0));
+    CHECK_THROWS(archive.ReadRange(names[i], size, 1));
+    CHECK_THROWS(archive.GetIndex(names[i]));
+  }
+  ZipArchive packed(createIndexArchive("index-stored", generateText(100 * 1024, 144)));
+  CHECK_THROWS(archive.SetIndex(names[0], packed.GetIndex("big.txt")));
+}
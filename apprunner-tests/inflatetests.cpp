@@ -0,0 +1,98 @@
+#include "stdafx.h"
+
+#include <cstdio>
+
+#include "check.h"
+#include "fixtures.h"
+#include "tinflcodec.h"
+#include "ziparchive.h"
+#include "zipformat.h"
+
+using doo::zip::TinflCodec;
+using doo::zip::ZipArchive;
+using namespace doo::tests;
+
+// pattern count times over
+static std::vector<byte> repeat(const char* pattern, size_t count) {
+  std::vector<byte> data;
+  for (size_t i = 0; i < count; i++) {
+    data.insert(data.end(), pattern, pattern + strlen(pattern));
+  }
+  return data;
+}
+
+// inflate stream with tinfl and compare the output with expected
+static void checkInflate(const std::vector<byte>& expected, const byte* stream, size_t streamLength) {
+  TinflCodec codec(ZipArchive_METHOD_DEFLATE);
+  std::vector<byte> output(expected.size());
+  codec.DecompressBuffer(stream, streamLength, output.data(), output.size(), 0);
+  CHECK(output == expected);
+}
+
+/************************************************************************/
+/* Single fixed Huffman blocks as zlib writes them: 8 and 9 bit         */
+/* literals, short matches, and runs of the longest match length        */
+/************************************************************************/
+TEST(fixedHuffmanBlocks) {
+  const byte single[] = { 0x4b, 0x04, 0x00 };
+  checkInflate(repeat("a", 1), single, sizeof(single));
+
+  const byte hello[] = { 0xcb, 0x48, 0xcd, 0xc9, 0xc9, 0x57, 0xc8, 0x40, 0x27, 0x01 };
+  std::vector<byte> helloData = repeat("hello ", 4);
+  helloData.pop_back();
+  checkInflate(helloData, hello, sizeof(hello));
+
+  const byte runs[] = { 0xab, 0xa8, 0x18, 0x05, 0xa3, 0x60, 0x14, 0x0c, 0x77, 0x50, 0x59, 0x59, 0x39, 0x1a, 0x08,
+    0x23, 0x0f, 0x00, 0x00 };
+  std::vector<byte> runsData = repeat("x", 1000);
+  std::vector<byte> tail = repeat("x", 500);
+  runsData.push_back('y');
+  runsData.push_back('y');
+  runsData.push_back('y');
+  runsData.insert(runsData.end(), tail.begin(), tail.end());
+  checkInflate(runsData, runs, sizeof(runs));
+
+  const byte high[] = { 0x3b, 0x71, 0xf2, 0xdf, 0x89, 0x51, 0x34, 0x8a, 0xa8, 0x8d, 0x00 };
+  checkInflate(repeat("\xc8\xc9\xfe", 200), high, sizeof(high));
+
+  // the same stream cut short must not decode
+  std::vector<byte> output(runsData.size());
+  TinflCodec codec(ZipArchive_METHOD_DEFLATE);
+  CHECK_THROWS(codec.DecompressBuffer(runs, sizeof(runs) - 4, output.data(), output.size(), 0));
+}
+
+/************************************************************************/
+/* An archive of 1-4KB files, most of them deflated into a single       */
+/* fixed or dynamic block, extracts correctly                           */
+/************************************************************************/
+TEST(smallEntriesRoundTrip) {
+  const size_t fileCount = 500;
+  ZipArchive archive(createArchive("small", fileCount, 2560, 35));
+  for (size_t i = 0; i < fileCount; i++) {
+    CHECK(archive.GetFileContents(layoutFileName(i)) == layoutFileContents(i, 2560, 35));
+  }
+}
+
+/************************************************************************/
+/* Time per entry for extracting thousands of 1-4KB files on one        */
+/* thread, where setting up each entry costs as much as decoding it     */
+/************************************************************************/
+BENCHMARK(smallEntries) {
+  const size_t fileCount = 5000;
+  ZipArchive archive(createArchive("small-bench", fileCount, 2560, 35));
+  std::vector<byte> buffer(4096);
+  const int rounds = 10;
+  uint64 total = 0;
+  double start = now();
+  for (int round = 0; round < rounds; round++) {
+    for (size_t i = 0; i < fileCount; i++) {
+      size_t size = static_cast<size_t>(archive.GetEntries().GetUncompressedSize(i));
+      archive.ExtractTo(i, buffer.data(), size);
+      total += size;
+    }
+  }
+  double seconds = now() - start;
+  printf("  %u entries of %.0f bytes on average: %.2f us per entry, %.1f MB/s\n",
+    static_cast<unsigned>(fileCount), static_cast<double>(total) / (rounds * fileCount),
+    seconds * 1e6 / (rounds * fileCount), total / seconds / (1024 * 1024));
+}
@@ -0,0 +1,224 @@
+#include "stdafx.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+#include "Log.h"
+#include "check.h"
+
+using doo::metrodriver::JsonLinesLogSink;
+using doo::metrodriver::Log;
+using doo::metrodriver::LogFields;
+using doo::metrodriver::LogRecord;
+using doo::metrodriver::LogSink;
+using namespace doo::tests;
+
+// keeps what the writer thread hands it, optionally holding the writer in its first write
+class CapturingLogSink : public LogSink {
+public:
+  CapturingLogSink(bool holdFirstWrite = false)
+    : holding(holdFirstWrite), entered(false) {}
+
+  virtual void write(const LogRecord& record, uint64) {
+    std::unique_lock<std::mutex> guard(lock);
+    records.push_back(record);
+    entered = true;
+    changed.notify_all();
+    changed.wait(guard, [this]() {
+      return !holding;
+    });
+  }
+
+  void waitUntilEntered() {
+    std::unique_lock<std::mutex> guard(lock);
+    changed.wait(guard, [this]() {
+      return entered;
+    });
+  }
+
+  void release() {
+    std::lock_guard<std::mutex> guard(lock);
+    holding = false;
+    changed.notify_all();
+  }
+
+  std::vector<LogRecord> records;
+
+private:
+  std::mutex lock;
+  std::condition_variable changed;
+  bool holding;
+  bool entered;
+};
+
+static void startLog(const std::shared_ptr<LogSink>& sink, doo::metrodriver::LogLevel minimumLevel) {
+  std::vector<std::shared_ptr<LogSink>> sinks;
+  sinks.push_back(sink);
+  Log::start(sinks, minimumLevel);
+}
+
+TEST(logLevelsAndFields) {
+  std::shared_ptr<CapturingLogSink> sink = std::make_shared<CapturingLogSink>();
+  startLog(sink, doo::metrodriver::LogInfo);
+  CHECK_THROWS(startLog(sink, doo::metrodriver::LogInfo));
+  Log::debug(LogFields(), L"not written");
+  Log::info(LogFields(L"doo.Sample", "launch", 12.5), L"launched in %.1f ms", 12.5);
+  Log::warning(L"no arguments");
+  Log::error(L"code %d", -5);
+  Log::flush();
+  Log::shutdown();
+
+  CHECK(sink->records.size() == 3);
+  const LogRecord& launched = sink->records[0];
+  CHECK(launched.level == doo::metrodriver::LogInfo);
+  CHECK(std::wstring(launched.message) == L"launched in 12.5 ms");
+  CHECK(std::wstring(launched.package) == L"doo.Sample");
+  CHECK(std::string(launched.phase) == "launch");
+  CHECK(launched.durationMilliseconds == 12.5);
+  // messages without a % are copied as they are
+  CHECK(std::wstring(sink->records[1].message) == L"no arguments");
+  CHECK(sink->records[1].level == doo::metrodriver::LogWarning);
+  CHECK(sink->records[1].package[0] == 0 && sink->records[1].durationMilliseconds < 0);
+  CHECK(std::wstring(sink->records[2].message) == L"code -5");
+
+  // long messages are cut off, formatted or not
+  sink = std::make_shared<CapturingLogSink>();
+  startLog(sink, doo::metrodriver::LogDebug);
+  std::wstring longMessage(Log_MESSAGE_LENGTH * 2, L'x');
+  Log::debug(LogFields(), longMessage.c_str());
+  Log::debug(LogFields(), L"%s", longMessage.c_str());
+  // %s takes wide strings and %S narrow ones, as on Windows
+  Log::debug(LogFields(), L"%s and %S, %5.1f%%", L"wide", "narrow", 2.5);
+  Log::shutdown();
+  CHECK(sink->records.size() == 3);
+  CHECK(wcslen(sink->records[0].message) == Log_MESSAGE_LENGTH - 1);
+  CHECK(wcslen(sink->records[1].message) == Log_MESSAGE_LENGTH - 1);
+  CHECK(std::wstring(sink->records[2].message) == L"wide and narrow,   2.5%");
+}
+
+/************************************************************************/
+/* Records of several threads all arrive, those of one thread in the    */
+/* order it logged them                                                 */
+/************************************************************************/
+TEST(logOrderAcrossThreads) {
+  std::shared_ptr<CapturingLogSink> sink = std::make_shared<CapturingLogSink>();
+  startLog(sink, doo::metrodriver::LogInfo);
+  const int threadCount = 4;
+  const int messageCount = 100;
+  std::vector<std::thread> threads;
+  for (int thread = 0; thread < threadCount; thread++) {
+    threads.push_back(std::thread([thread, messageCount]() {
+      for (int message = 0; message < messageCount; message++) {
+        Log::info(L"%d %d", thread, message);
+      }
+    }));
+  }
+  for (auto thread = threads.begin(); thread != threads.end(); ++thread) {
+    thread->join();
+  }
+  Log::shutdown();
+
+  CHECK(sink->records.size() == threadCount * messageCount);
+  std::vector<int> next(threadCount);
+  for (size_t i = 0; i < sink->records.size(); i++) {
+    int thread, message;
+    CHECK(swscanf(sink->records[i].message, L"%d %d", &thread, &message) == 2);
+    CHECK(thread >= 0 && thread < threadCount && message == next[thread]);
+    next[thread]++;
+  }
+}
+
+/************************************************************************/
+/* A thread whose ring is full loses messages instead of waiting, the   */
+/* writer reports how many                                              */
+/************************************************************************/
+TEST(logDroppedMessages) {
+  std::shared_ptr<CapturingLogSink> sink = std::make_shared<CapturingLogSink>(true);
+  startLog(sink, doo::metrodriver::LogInfo);
+  Log::info(L"first");
+  // the writer now holds the first record's slot until the sink lets it go
+  sink->waitUntilEntered();
+  for (int message = 0; message < 1000; message++) {
+    Log::info(L"message %d", message);
+  }
+  sink->release();
+  Log::shutdown();
+
+  CHECK(sink->records.size() == Log_RING_SIZE + 1);
+  CHECK(std::wstring(sink->records[0].message) == L"first");
+  CHECK(std::wstring(sink->records[Log_RING_SIZE - 1].message) == L"message 254");
+  wchar_t dropped[64];
+  swprintf(dropped, 64, L"%u log messages were dropped", 1000 - (Log_RING_SIZE - 1));
+  CHECK(std::wstring(sink->records.back().message) == dropped);
+  CHECK(sink->records.back().level == doo::metrodriver::LogWarning);
+}
+
+TEST(logJsonLines) {
+  std::string path = temporaryPath("log.jsonl");
+  startLog(std::make_shared<JsonLinesLogSink>(path), doo::metrodriver::LogInfo);
+  Log::info(LogFields(L"doo.Sample", "launch", 12.5), L"say \"hi\" \\ \n caf\u00e9");
+  Log::warning(L"plain");
+  Log::shutdown();
+  // let go of the file
+  startLog(std::make_shared<CapturingLogSink>(), doo::metrodriver::LogInfo);
+  Log::shutdown();
+
+  std::vector<byte> contents = readFile(path);
+  std::string text(contents.begin(), contents.end());
+  size_t lineEnd = text.find('\n');
+  CHECK(lineEnd != std::string::npos && text.find('\n', lineEnd + 1) == text.size() - 1);
+  std::string first = text.substr(0, lineEnd);
+  CHECK(first.compare(0, 10, "{\"time\":\"2") == 0);
+  CHECK(first.find("Z\",\"level\":\"info\",\"thread\":") != std::string::npos);
+  CHECK(first.find(",\"package\":\"doo.Sample\",\"phase\":\"launch\",\"duration_ms\":12.500,") != std::string::npos);
+  CHECK(first.find(",\"message\":\"say \\\"hi\\\" \\\\ \\u000a caf\xc3\xa9\"}") != std::string::npos);
+  std::string second = text.substr(lineEnd + 1);
+  CHECK(second.find("\"level\":\"warning\"") != std::string::npos);
+  CHECK(second.find("package") == std::string::npos && second.find("duration_ms") == std::string::npos);
+}
+
+// does nothing, so the benchmark measures the log calls and not a console
+class DiscardingLogSink : public LogSink {
+public:
+  virtual void write(const LogRecord&, uint64) {}
+};
+
+/************************************************************************/
+/* The cost of a log call on the calling thread, in batches that fit    */
+/* the ring so nothing is dropped                                       */
+/************************************************************************/
+BENCHMARK(logCalls) {
+  startLog(std::make_shared<DiscardingLogSink>(), doo::metrodriver::LogInfo);
+  const int batchSize = Log_RING_SIZE / 2;
+  const int batchCount = 2000;
+  double plain = 0;
+  double formatted = 0;
+  double filtered = 0;
+  for (int batch = 0; batch < batchCount; batch++) {
+    double start = now();
+    for (int i = 0; i < batchSize; i++) {
+      Log::info(L"Registering the package");
+    }
+    plain += now() - start;
+    Log::flush();
+
+    start = now();
+    for (int i = 0; i < batchSize; i++) {
+      Log::info(LogFields(L"doo.Sample", "staging", 1.5), L"Staged %d files in %.1f ms", i, 1.5);
+    }
+    formatted += now() - start;
+    Log::flush();
+
+    start = now();
+    for (int i = 0; i < batchSize; i++) {
+      Log::debug(LogFields(nullptr, "staging", 1.5), L"staging took %.1f ms", 1.5);
+    }
+    filtered += now() - start;
+  }
+  Log::shutdown();
+  double calls = static_cast<double>(batchSize) * batchCount;
+  printf("  %.0f ns per plain message, %.0f ns formatted with fields, %.0f ns below the level\n",
+    plain * 1e9 / calls, formatted * 1e9 / calls, filtered * 1e9 / calls);
+}
@@ -0,0 +1,70 @@
+#include "stdafx.h"
+
+#include <cstdio>
+#include <exception>
+
+#include "check.h"
+#include "zipcounters.h"
+
+using doo::tests::Failure;
+using doo::tests::RegisteredTest;
+
+/*
+  apprunner-tests [bench] [filter]
+
+  Runs every check, or with "bench" every benchmark, whose name contains filter.
+  Returns the number of failed checks. Built with APPRUNNER_ZIP_COUNTERS, each benchmark is
+  followed by the package reading counters of its run.
+*/
+int main(int argc, char** argv) {
+  int argument = 1;
+  bool benchmarks = argc > argument && strcmp(argv[argument], "bench") == 0;
+  if (benchmarks) {
+    argument++;
+  }
+  const char* filter = argc > argument ? argv[argument] : "";
+
+  int run = 0;
+  int failed = 0;
+  std::vector<RegisteredTest>& tests = doo::tests::registeredTests();
+  for (auto test = tests.begin(); test != tests.end(); ++test) {
+    if (test->benchmark != benchmarks || strstr(test->name, filter) == nullptr) {
+      continue;
+    }
+    run++;
+    printf("%s\n", test->name);
+    fflush(stdout);
+    std::string error;
+#ifdef APPRUNNER_ZIP_COUNTERS
+    doo::zip::ZipCounters::Reset();
+#endif
+    try {
+      test->function();
+    } catch (const Failure& failure) {
+      error = failure.message;
+    } catch (Platform::Exception^ e) {
+      std::wstring message = e->Message->Data();
+      error = "exception: " + std::string(message.begin(), message.end());
+    } catch (const std::exception& e) {
+      error = std::string("exception: ") + e.what();
+    }
+    if (!error.empty()) {
+      failed++;
+      printf("  FAILED %s\n", error.c_str());
+    }
+#ifdef APPRUNNER_ZIP_COUNTERS
+    if (benchmarks) {
+      // the counters are plain ASCII
+      std::wstring counters = doo::zip::ZipCounters::Total().Format();
+      std::istringstream lines(std::string(counters.begin(), counters.end()));
+      std::string line;
+      while (std::getline(lines, line)) {
+        printf("  | %s\n", line.c_str());
+      }
+    }
+#endif
+  }
+  doo::tests::removeDirectory(doo::tests::temporaryDirectory());
+  printf("%d of %d %s passed\n", run - failed, run, benchmarks ? "benchmarks" : "checks");
+  return failed;
+}
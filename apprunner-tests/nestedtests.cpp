@@ -0,0 +1,156 @@
+#include "stdafx.h"
+
+#include <cstring>
+
+#include "check.h"
+#include "crc32.h"
+#include "fixtures.h"
+#include "ziparchive.h"
+#include "zipformat.h"
+
+using doo::zip::ZipArchive;
+using namespace doo::tests;
+
+// the same entries with the same contents, extracted every way there is
+static bool hasSameEntries(const ZipArchive& archive, const ZipArchive& expected) {
+  const doo::zip::ZipEntryTable& entries = archive.GetEntries();
+  const doo::zip::ZipEntryTable& expectedEntries = expected.GetEntries();
+  if (entries.GetCount() != expectedEntries.GetCount()) {
+    return false;
+  }
+  std::vector<size_t> indices;
+  size_t totalSize = 0;
+  for (size_t i = 0; i < entries.GetCount(); i++) {
+    std::string name = entries.GetName(i);
+    std::vector<byte> contents = archive.GetFileContents(i);
+    std::vector<byte> streamed;
+    archive.ExtractStreaming(i, [&](const byte* data, size_t length) {
+      streamed.insert(streamed.end(), data, data + length);
+    });
+    if (name != expectedEntries.GetName(i)
+      || entries.GetCrc32(i) != expectedEntries.GetCrc32(i)
+      || entries.GetCompressedSize(i) != expectedEntries.GetCompressedSize(i)
+      || contents != expected.GetFileContents(i)
+      || streamed != contents
+      || archive.ReadRange(name, contents.size() / 2, contents.size() / 4) != expected.ReadRange(name, contents.size() / 2, contents.size() / 4)) {
+      return false;
+    }
+    indices.push_back(i);
+    totalSize += contents.size();
+  }
+  std::vector<byte> buffer(totalSize);
+  bool matches = true;
+  archive.ExtractBatch(indices, buffer.data(), buffer.size(), 4, [&](size_t index, const byte* data, size_t length) {
+    matches &= std::vector<byte>(data, data + length) == expected.GetFileContents(index);
+  });
+  return matches;
+}
+
+// a packed archive stored between two text files, the way a bundle holds its packages
+static std::vector<byte> buildOuterArchive(const std::vector<byte>& inner) {
+  std::vector<std::string> names;
+  std::vector<std::vector<byte>> contents;
+  names.push_back("first.txt");
+  contents.push_back(generateText(10000, 160));
+  names.push_back("inner.zip");
+  contents.push_back(inner);
+  names.push_back("last.txt");
+  contents.push_back(generateText(10000, 161));
+  return buildStoredArchive(names, contents);
+}
+
+static doo::zip::EndOfCentralDirectoryRecord readEndRecord(const std::vector<byte>& data) {
+  doo::zip::EndOfCentralDirectoryRecord end;
+  memcpy(&end, &data[data.size() - sizeof(end)], sizeof(end));
+  return end;
+}
+
+/************************************************************************/
+/* A stored archive opened in place lists and extracts what it does on  */
+/* its own. Its end record is searched for in its window only, the      */
+/* outer archive's one behind it is never found.                        */
+/************************************************************************/
+TEST(nestedArchive) {
+  std::string innerPath = createArchive("nested-inner", 40, 6000, 162);
+  ZipArchive standalone(innerPath);
+  std::string path = temporaryPath("nested-outer.zip");
+  std::vector<byte> outer = buildOuterArchive(readFile(innerPath));
+  writeFile(path, outer);
+
+  ZipArchive archive(path);
+  CHECK(archive.GetEntries().GetCount() == 3);
+  std::shared_ptr<ZipArchive> nested = archive.OpenNestedArchive("inner.zip");
+  CHECK(hasSameEntries(*nested, standalone));
+  CHECK_THROWS(archive.OpenNestedArchive("first.txt"));
+  CHECK_THROWS(archive.OpenNestedArchive("missing.zip"));
+  // deflated packages can't be opened in place
+  CHECK_THROWS(standalone.OpenNestedArchive(standalone.GetEntries().GetName(0)));
+
+  // through an outer directory parsed and then mapped from the sidecar
+  for (int open = 0; open < 2; open++) {
+    ZipArchive sidecar(path, true);
+    CHECK(hasSameEntries(*sidecar.OpenNestedArchive("inner.zip"), standalone));
+  }
+
+  // through an outer archive that lost its directory
+  writeFile(path, std::vector<byte>(outer.begin(), outer.begin() + readEndRecord(outer).centralDirectoryOffset));
+  std::shared_ptr<ZipArchive> salvaged = ZipArchive::Salvage(path);
+  CHECK(salvaged->GetEntries().GetCount() == 3);
+  CHECK(hasSameEntries(*salvaged->OpenNestedArchive("inner.zip"), standalone));
+}
+
+/************************************************************************/
+/* A nested directory pointing past its window fails like it would in   */
+/* a file of its own, even where the bytes behind the window would pass */
+/* every other check                                                    */
+/************************************************************************/
+TEST(nestedArchiveWindow) {
+  std::vector<std::string> names(1, "escape.txt");
+  std::vector<std::vector<byte>> contents(1, generateText(5000, 163));
+  std::vector<byte> inner = buildStoredArchive(names, contents);
+  doo::zip::EndOfCentralDirectoryRecord end = readEndRecord(inner);
+  size_t central = end.centralDirectoryOffset;
+  size_t dataOffset = sizeof(doo::zip::LocalFileHeader) + names[0].size();
+
+  // the entry runs 10 bytes into the outer archive, its CRC includes them
+  std::vector<byte> outer = buildOuterArchive(inner);
+  size_t innerOffset = 0;
+  while (memcmp(&outer[innerOffset], inner.data(), inner.size()) != 0) {
+    innerOffset++;
+  }
+  std::vector<byte> escaping(inner.begin() + dataOffset, inner.end());
+  escaping.insert(escaping.end(), outer.begin() + innerOffset + inner.size(), outer.begin() + innerOffset + inner.size() + 10);
+  doo::zip::CentralDirectoryHeader header;
+  memcpy(&header, &inner[central], sizeof(header));
+  header.compressedSize = header.uncompressedSize = static_cast<uint32>(escaping.size());
+  header.crc32 = doo::zip::UpdateCrc32(0, escaping.data(), escaping.size());
+  std::vector<byte> tooLong = inner;
+  memcpy(&tooLong[central], &header, sizeof(header));
+
+  std::string path = temporaryPath("nested-window.zip");
+  writeFile(path, buildOuterArchive(tooLong));
+  {
+    ZipArchive archive(path);
+    std::shared_ptr<ZipArchive> nested = archive.OpenNestedArchive("inner.zip");
+    CHECK(nested->GetEntries().GetUncompressedSize(0) == escaping.size());
+    CHECK_THROWS(nested->GetFileContents(0));
+    CHECK_THROWS(nested->ReadRange("escape.txt", escaping.size() - 5, 5));
+    CHECK_THROWS(nested->ExtractStreaming(0, [](const byte*, size_t) {}));
+    std::vector<size_t> indices(1, 0);
+    std::vector<byte> buffer(escaping.size());
+    CHECK_THROWS(nested->ExtractBatch(indices, buffer.data(), buffer.size(), 1, [](size_t, const byte*, size_t) {}));
+  }
+  // the same archive on its own can't read past its end either
+  std::string tooLongPath = temporaryPath("nested-window-inner.zip");
+  writeFile(tooLongPath, tooLong);
+  CHECK_THROWS(ZipArchive(tooLongPath).GetFileContents(0));
+
+  // a local header behind the window
+  memcpy(&header, &inner[central], sizeof(header));
+  header.localHeaderOffset = static_cast<uint32>(inner.size() - 10);
+  std::vector<byte> misplaced = inner;
+  memcpy(&misplaced[central], &header, sizeof(header));
+  writeFile(path, buildOuterArchive(misplaced));
+  ZipArchive archive(path);
+  CHECK_THROWS(archive.OpenNestedArchive("inner.zip")->GetFileContents(0));
+}
@@ -0,0 +1,114 @@
+#include "stdafx.h"
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
+#include "check.h"
+#include "fixtures.h"
+#include "overlayfilesystem.h"
+
+using doo::zip::OverlayFileSystem;
+using namespace doo::tests;
+
+/************************************************************************/
+/* Earlier mounts hide the same names in later ones, names are found    */
+/* regardless of case and separator                                     */
+/************************************************************************/
+TEST(overlayPrecedence) {
+  OverlayFileSystem overlay;
+  CHECK(overlay.Mount(createArchive("overlay-main", 100, 1024, 410)) == 0);
+  CHECK(overlay.Mount(createArchive("overlay-dependency", 150, 1024, 411)) == 1);
+  CHECK(overlay.GetMountCount() == 2);
+  CHECK(overlay.GetFileCount() == 150);
+  for (size_t i = 0; i < 150; i++) {
+    std::string name = layoutFileName(i);
+    size_t mountIndex = i < 100 ? 0 : 1;
+    std::vector<byte> expected = layoutFileContents(i, 1024, 410 + static_cast<uint32>(mountIndex));
+    CHECK(overlay.GetMountIndex(name) == mountIndex);
+    CHECK(overlay.GetSize(name) == expected.size());
+    CHECK(overlay.GetFileContents(name) == expected);
+  }
+
+  CHECK(overlay.Exists("DIR3\\FILE3.TXT"));
+  CHECK(overlay.GetFileContents("Dir3\\File3.txt") == layoutFileContents(3, 1024, 410));
+  std::vector<byte> range = overlay.ReadRange("dir3/file3.txt", 10, 20);
+  std::vector<byte> expected = layoutFileContents(3, 1024, 410);
+  CHECK(range == std::vector<byte>(expected.begin() + 10, expected.begin() + 30));
+  CHECK(!overlay.Exists("dir3/file3.tx"));
+  CHECK_THROWS(overlay.GetFileContents("missing.txt"));
+
+  // the file hidden by the main package
+  CHECK(overlay.GetArchive(1)->GetFileContents(layoutFileName(3)) == layoutFileContents(3, 1024, 411));
+}
+
+/************************************************************************/
+/* Reads from many threads across more archives than may be open keep   */
+/* within the limit and return the right contents                       */
+/************************************************************************/
+TEST(overlayOpenArchiveLimit) {
+  const size_t mountCount = 6;
+  OverlayFileSystem overlay(2);
+  for (size_t m = 0; m < mountCount; m++) {
+    char name[32];
+    snprintf(name, sizeof(name), "overlay-limit%u", static_cast<unsigned>(m));
+    // every archive has one more file than the one before, the last file is only in this one
+    overlay.Mount(createArchive(name, 10 + m, 512, 420 + static_cast<uint32>(m)));
+  }
+  CHECK(overlay.GetFileCount() == 10 + mountCount - 1);
+
+  std::atomic<int> mismatches(0);
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < 4; t++) {
+    threads.push_back(std::thread([&, t]() {
+      for (size_t i = 0; i < 200; i++) {
+        size_t m = (i + t) % mountCount;
+        size_t index = 9 + m;
+        std::vector<byte> expected = layoutFileContents(index, 512, 420 + static_cast<uint32>(m));
+        if (overlay.GetFileContents(layoutFileName(index)) != expected) {
+          mismatches++;
+        }
+      }
+    }));
+  }
+  for (auto thread = threads.begin(); thread != threads.end(); ++thread) {
+    thread->join();
+  }
+  CHECK(mismatches == 0);
+  CHECK(overlay.GetOpenArchiveCount() <= 2);
+}
+
+/************************************************************************/
+/* Lookup time stays the same however many archives are mounted, for    */
+/* names that exist and for names that exist nowhere                    */
+/************************************************************************/
+BENCHMARK(overlayLookups) {
+  const size_t fileCount = 2000;
+  std::string archive = createArchive("overlay-bench", fileCount, 16, 430);
+  std::vector<std::string> names;
+  for (size_t i = 0; i < 10000; i++) {
+    std::string name = layoutFileName((i * 7919) % fileCount);
+    if (i % 2) {
+      name += ".missing";
+    }
+    names.push_back(name);
+  }
+  for (size_t mountCount = 1; mountCount <= 64; mountCount *= 4) {
+    OverlayFileSystem overlay;
+    for (size_t m = 0; m < mountCount; m++) {
+      overlay.Mount(archive);
+    }
+    const int rounds = 20;
+    size_t found = 0;
+    double start = now();
+    for (int round = 0; round < rounds; round++) {
+      for (auto name = names.begin(); name != names.end(); ++name) {
+        found += overlay.Exists(*name);
+      }
+    }
+    double seconds = now() - start;
+    CHECK(found == rounds * names.size() / 2);
+    printf("  %2u archives: %.0f ns per lookup\n", static_cast<unsigned>(mountCount),
+      seconds * 1e9 / (rounds * names.size()));
+  }
+}
@@ -0,0 +1,177 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "BlockMap.h"
+#include "check.h"
+#include "fixtures.h"
+#include "sha256.h"
+#include "ziparchive.h"
+#include "zippacker.h"
+
+using doo::metrodriver::BlockMap;
+using doo::metrodriver::BlockMapDifference;
+using doo::zip::Sha256;
+using doo::zip::ZipArchive;
+using doo::zip::ZipPacker;
+using namespace doo::tests;
+
+static std::string encodeBase64(const byte* data, size_t length) {
+  static const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string encoded;
+  for (size_t i = 0; i < length; i += 3) {
+    uint32 group = (data[i] << 16) | (i + 1 < length ? data[i + 1] << 8 : 0) | (i + 2 < length ? data[i + 2] : 0);
+    encoded += alphabet[group >> 18];
+    encoded += alphabet[(group >> 12) & 63];
+    encoded += i + 1 < length ? alphabet[(group >> 6) & 63] : '=';
+    encoded += i + 2 < length ? alphabet[group & 63] : '=';
+  }
+  return encoded;
+}
+
+// bytes deflate can't shrink
+static std::vector<byte> generateNoise(size_t length, uint32 seed) {
+  std::vector<byte> noise(length);
+  for (size_t i = 0; i < length; i++) {
+    seed = seed * 1103515245U + 12345U;
+    noise[i] = static_cast<byte>(seed >> 16);
+  }
+  return noise;
+}
+
+/************************************************************************/
+/* A layout with the cases the packer treats specially: empty files,    */
+/* files of many blocks, names that need escaping in a package and the  */
+/* files it generates itself                                            */
+/************************************************************************/
+static std::string createPackLayout(const std::string& name, std::vector<std::string>& names) {
+  const size_t fileCount = 40;
+  std::string directory = createLayout(name, fileCount, 3000, 47);
+  for (size_t i = 0; i < fileCount; i++) {
+    names.push_back(layoutFileName(i));
+  }
+  createDirectory(joinPath(directory, "Assets"));
+  writeFile(joinPath(joinPath(directory, "Assets"), "Logo 1.png"), generateNoise(5000, 1));
+  writeFile(joinPath(directory, "empty.txt"), std::vector<byte>());
+  std::vector<byte> large = generateText(5 * ZipPacker_BLOCK_SIZE + 123, 2);
+  std::vector<byte> noise = generateNoise(2 * ZipPacker_BLOCK_SIZE, 3);
+  large.insert(large.end(), noise.begin(), noise.end());
+  writeFile(joinPath(directory, "large.bin"), large);
+  writeFile(joinPath(directory, "AppxManifest.xml"), std::string("<Package/>"));
+  names.push_back("Assets/Logo 1.png");
+  names.push_back("empty.txt");
+  names.push_back("large.bin");
+  names.push_back("AppxManifest.xml");
+  // stale, a package gets new ones and no signature
+  writeFile(joinPath(directory, "AppxBlockMap.xml"), std::string("<BlockMap/>"));
+  writeFile(joinPath(directory, "AppxSignature.p7x"), std::string("signature"));
+  return directory;
+}
+
+static std::string toPath(const std::string& directory, const std::string& name) {
+  std::string path = directory;
+  for (size_t start = 0; start <= name.size();) {
+    size_t end = std::min(name.find('/', start), name.size());
+    path = joinPath(path, name.substr(start, end - start));
+    start = end + 1;
+  }
+  return path;
+}
+
+/************************************************************************/
+/* Every file reads back unchanged, and the archive is the same however */
+/* many threads compressed it                                           */
+/************************************************************************/
+TEST(packRoundTrip) {
+  std::vector<std::string> names;
+  std::string directory = createPackLayout("pack", names);
+  std::string single = temporaryPath("pack1.zip");
+  std::string parallel = temporaryPath("pack3.zip");
+  ZipPacker::Statistics statistics = ZipPacker(1).Pack(directory, single, false);
+  ZipPacker(3).Pack(directory, parallel, false);
+  CHECK(readFile(single) == readFile(parallel));
+  // a plain archive keeps everything
+  CHECK(statistics.files == names.size() + 2);
+  CHECK(statistics.archiveSize == readFile(single).size());
+
+  ZipArchive archive(parallel);
+  CHECK(archive.GetEntries().GetCount() == names.size() + 2);
+  uint64 uncompressed = 0;
+  for (auto name = names.begin(); name != names.end(); ++name) {
+    std::vector<byte> expected = readFile(toPath(directory, *name));
+    CHECK(archive.GetFileContents(*name) == expected);
+    uncompressed += expected.size();
+  }
+  CHECK(statistics.uncompressedSize == uncompressed + strlen("<BlockMap/>") + strlen("signature"));
+  // text compresses, the noise in large.bin doesn't
+  size_t large = archive.GetEntries().Find("large.bin");
+  CHECK(archive.GetEntries().GetCompressedSize(large) < archive.GetEntries().GetUncompressedSize(large) / 2);
+  CHECK(archive.GetEntries().GetCompressedSize(large) > 2 * ZipPacker_BLOCK_SIZE);
+}
+
+/************************************************************************/
+/* A package gets part names as URIs and a block map with the hash of   */
+/* every 64KB block, computed in the same pass                          */
+/************************************************************************/
+TEST(packAppx) {
+  std::vector<std::string> names;
+  std::string directory = createPackLayout("pack-appx", names);
+  std::string path = temporaryPath("pack.appx");
+  ZipPacker(2).Pack(directory, path, true);
+  ZipArchive package(path);
+  CHECK(package.GetEntries().GetCount() == names.size() + 2);
+  CHECK(package.GetFileContents("Assets/Logo%201.png") == readFile(toPath(directory, "Assets/Logo 1.png")));
+  CHECK_THROWS(package.GetFileContents("AppxSignature.p7x"));
+  std::vector<byte> contentTypes = package.GetFileContents("[Content_Types].xml");
+  std::string types(contentTypes.begin(), contentTypes.end());
+  CHECK(types.find("<Default Extension=\"png\" ContentType=\"image/png\"/>") != std::string::npos);
+  CHECK(types.find("<Override PartName=\"/AppxManifest.xml\"") != std::string::npos);
+
+  std::vector<byte> blockMapData = package.GetFileContents("AppxBlockMap.xml");
+  std::string blockMapXml(blockMapData.begin(), blockMapData.end());
+  BlockMap blockMap = BlockMap::read(package);
+  CHECK(blockMap.getFileCount() == names.size());
+  CHECK(blockMapXml.find("<File Name=\"Assets\\Logo 1.png\" Size=\"5000\"") != std::string::npos);
+  CHECK(blockMapXml.find("<File Name=\"empty.txt\" Size=\"0\" LfhSize=\"39\"></File>") != std::string::npos);
+  std::vector<byte> large = readFile(joinPath(directory, "large.bin"));
+  for (size_t offset = 0; offset < large.size(); offset += ZipPacker_BLOCK_SIZE) {
+    byte digest[Sha256_DIGEST_SIZE];
+    Sha256::Hash(large.data() + offset, std::min<size_t>(ZipPacker_BLOCK_SIZE, large.size() - offset), digest);
+    CHECK(blockMapXml.find("<Block Hash=\"" + encodeBase64(digest, sizeof(digest)) + "\" Size=\"") != std::string::npos);
+  }
+
+  // repacking after a change shows up in the block maps
+  std::string changedPath = toPath(directory, layoutFileName(7));
+  std::vector<byte> changed = readFile(changedPath);
+  changed[0] ^= 1;
+  writeFile(changedPath, changed);
+  std::string repacked = temporaryPath("repacked.appx");
+  ZipPacker(1).Pack(directory, repacked, true);
+  BlockMapDifference difference = blockMap.compare(BlockMap::read(ZipArchive(repacked)));
+  CHECK(difference.added.empty() && difference.removed.empty());
+  CHECK(difference.modified.size() == 1 && difference.modified[0] == "dir7\\file7.txt");
+}
+
+/************************************************************************/
+/* Packing many small files and one large one with more and more        */
+/* threads                                                              */
+/************************************************************************/
+BENCHMARK(packThreadScaling) {
+  std::string directory = createLayout("pack-benchmark", 400, 32768, 48);
+  writeFile(joinPath(directory, "large.bin"), generateText(16 << 20, 49));
+  std::vector<byte> first;
+  for (unsigned threadCount = 1; threadCount <= 8; threadCount *= 2) {
+    std::string archive = temporaryPath("pack-benchmark.zip");
+    double start = now();
+    ZipPacker::Statistics statistics = ZipPacker(threadCount).Pack(directory, archive, true);
+    double seconds = now() - start;
+    std::vector<byte> packed = readFile(archive);
+    if (first.empty()) {
+      first = packed;
+    }
+    printf("  %u threads: %.1f MB into %.1f MB in %.0f ms, %.1f MB/s%s\n", threadCount, statistics.uncompressedSize / 1e6,
+      statistics.archiveSize / 1e6, seconds * 1000, statistics.uncompressedSize / 1e6 / seconds,
+      packed == first ? "" : ", DIFFERENT OUTPUT");
+  }
+}
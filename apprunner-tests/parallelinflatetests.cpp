@@ -0,0 +1,254 @@
+#include "stdafx.h"
+
+#include <cstdio>
+#include <thread>
+
+#include "check.h"
+#include "deflateencoder.h"
+#include "fixtures.h"
+#include "parallelinflatecodec.h"
+#include "randomaccessfile.h"
+#include "tinflcodec.h"
+#include "zipformat.h"
+
+using doo::zip::DeflateEncoder;
+using doo::zip::ParallelInflateCodec;
+using doo::zip::RandomAccessFile;
+using doo::zip::TinflCodec;
+using namespace doo::tests;
+
+/************************************************************************/
+/* A raw deflate stream put together from pieces of DeflateEncoder      */
+/* output and blocks written by hand, along with what it inflates to.   */
+/* Every piece starts and ends on a byte boundary.                      */
+/************************************************************************/
+class DeflateStreamBuilder {
+public:
+  DeflateStreamBuilder()
+    : bitBuffer(0), bitCount(0) {}
+
+  // data compressed by DeflateEncoder into dynamic blocks mostly, matches may reach into what came before
+  void AddEncoded(const std::vector<byte>& data, bool final) {
+    size_t start = expected.size();
+    expected.insert(expected.end(), data.begin(), data.end());
+    size_t dictionaryLength = std::min<size_t>(start, DeflateEncoder_WINDOW_SIZE);
+    encoder.Compress(expected.data() + start, data.size(), dictionaryLength, final, stream);
+  }
+
+  // data as stored blocks of up to blockLength bytes
+  void AddStored(const std::vector<byte>& data, size_t blockLength) {
+    for (size_t offset = 0; offset < data.size(); offset += blockLength) {
+      size_t length = std::min(blockLength, data.size() - offset);
+      stream.push_back(0);
+      stream.push_back(static_cast<byte>(length));
+      stream.push_back(static_cast<byte>(length >> 8));
+      stream.push_back(static_cast<byte>(~length));
+      stream.push_back(static_cast<byte>(~length >> 8));
+      stream.insert(stream.end(), data.begin() + offset, data.begin() + offset + length);
+      expected.insert(expected.end(), data.begin() + offset, data.begin() + offset + length);
+    }
+  }
+
+  // A fixed Huffman block of literals, then a match of length bytes from distance back, which may
+  // reach in front of the block. Followed by an empty stored block to get back to a byte boundary.
+  void AddFixed(const std::vector<byte>& literals, unsigned length, unsigned distance) {
+    WriteBits(0, 1);
+    WriteBits(1, 2);
+    for (auto literal = literals.begin(); literal != literals.end(); ++literal) {
+      WriteLiteral(*literal);
+      expected.push_back(*literal);
+    }
+    // lengths 3-10 have a code each without extra bits, 258 has the last one
+    WriteLiteral(length == 258 ? 285 : 254 + length);
+    // distance codes 0-3 stand for 1-4, every further pair doubles the range and adds an extra bit
+    unsigned code = 0;
+    unsigned base = 1;
+    unsigned extraBits = 0;
+    while (code < 29 && base + (1U << extraBits) <= distance) {
+      base += 1U << extraBits;
+      code++;
+      extraBits = code < 4 ? 0 : (code - 2) / 2;
+    }
+    WriteCode(code, 5);
+    WriteBits(distance - base, extraBits);
+    for (unsigned i = 0; i < length; i++) {
+      expected.push_back(expected[expected.size() - distance]);
+    }
+    WriteLiteral(256);
+    WriteBits(0, 3);
+    if (bitCount > 0) {
+      WriteBits(0, 8 - bitCount);
+    }
+    const byte emptyStored[] = { 0x00, 0x00, 0xFF, 0xFF };
+    stream.insert(stream.end(), emptyStored, emptyStored + sizeof(emptyStored));
+  }
+
+  // end the stream with an empty final stored block
+  void Finish() {
+    const byte emptyFinal[] = { 0x01, 0x00, 0x00, 0xFF, 0xFF };
+    stream.insert(stream.end(), emptyFinal, emptyFinal + sizeof(emptyFinal));
+  }
+
+  std::vector<byte> stream;
+  std::vector<byte> expected;
+
+private:
+  void WriteBits(uint32 value, unsigned count) {
+    bitBuffer |= static_cast<uint64>(value) << bitCount;
+    bitCount += count;
+    while (bitCount >= 8) {
+      stream.push_back(static_cast<byte>(bitBuffer));
+      bitBuffer >>= 8;
+      bitCount -= 8;
+    }
+  }
+
+  // Huffman codes go out starting with their most significant bit
+  void WriteCode(uint32 code, unsigned length) {
+    for (unsigned bit = length; bit-- > 0;) {
+      WriteBits((code >> bit) & 1, 1);
+    }
+  }
+
+  void WriteLiteral(unsigned symbol) {
+    if (symbol < 144) {
+      WriteCode(0x30 + symbol, 8);
+    } else if (symbol < 256) {
+      WriteCode(0x190 + symbol - 144, 9);
+    } else if (symbol < 280) {
+      WriteCode(symbol - 256, 7);
+    } else {
+      WriteCode(0xC0 + symbol - 280, 8);
+    }
+  }
+
+  DeflateEncoder encoder;
+  uint64 bitBuffer;
+  unsigned bitCount;
+};
+
+// inflate stream with codec and with tinfl, both have to give expected
+static void checkParallelInflate(const ParallelInflateCodec& codec, const DeflateStreamBuilder& builder, const char* name) {
+  std::string path = temporaryPath(name);
+  writeFile(path, builder.stream);
+  RandomAccessFile file(path);
+  std::vector<byte> serial(builder.expected.size());
+  TinflCodec(ZipArchive_METHOD_DEFLATE).Decompress(file, 0, file.GetSize(), serial.data(), serial.size(), 0);
+  CHECK(serial == builder.expected);
+  std::vector<byte> parallel(builder.expected.size());
+  codec.Decompress(file, 0, file.GetSize(), parallel.data(), parallel.size(), 0);
+  CHECK(parallel == serial);
+}
+
+/************************************************************************/
+/* Dynamic blocks as DeflateEncoder writes them, one stream and one of  */
+/* pieces joined by empty stored blocks, are split at guessed block     */
+/* starts for any number of threads                                     */
+/************************************************************************/
+TEST(parallelInflateDynamicBlocks) {
+  DeflateStreamBuilder single;
+  single.AddEncoded(generateText(3 * 1024 * 1024, 61), true);
+  DeflateStreamBuilder pieces;
+  for (uint32 piece = 0; piece < 6; piece++) {
+    pieces.AddEncoded(generateText(512 * 1024, 62 + piece), piece == 5);
+  }
+  const unsigned threadCounts[] = { 2, 3, 4, 8 };
+  for (size_t i = 0; i < sizeof(threadCounts) / sizeof(threadCounts[0]); i++) {
+    ParallelInflateCodec codec(threadCounts[i], 0, 0);
+    checkParallelInflate(codec, single, "parallel-single.deflate");
+    checkParallelInflate(codec, pieces, "parallel-pieces.deflate");
+    CHECK(codec.GetParallelCount() == 2 && codec.GetFallbackCount() == 0);
+  }
+
+  // with the default smallest chunk it is too little to split up
+  ParallelInflateCodec defaultChunks(4, 0);
+  checkParallelInflate(defaultChunks, single, "parallel-single.deflate");
+  CHECK(defaultChunks.GetParallelCount() == 0 && defaultChunks.GetFallbackCount() == 1);
+}
+
+/************************************************************************/
+/* Stored and fixed blocks between the dynamic ones, with matches       */
+/* reaching back through the stored data into the dynamic blocks        */
+/************************************************************************/
+TEST(parallelInflateMixedBlocks) {
+  DeflateStreamBuilder builder;
+  for (uint32 round = 0; round < 8; round++) {
+    builder.AddEncoded(generateText(256 * 1024, 70 + round), false);
+    builder.AddStored(generateText(6000 + round * 1000, 80 + round), 4000);
+    builder.AddFixed(generateText(300, 90 + round), 258, 30000 + round);
+    builder.AddFixed(generateText(10, 100 + round), 4, 1);
+  }
+  builder.AddEncoded(generateText(256 * 1024, 110), true);
+  ParallelInflateCodec codec(4, 0, 0);
+  checkParallelInflate(codec, builder, "parallel-mixed.deflate");
+  CHECK(codec.GetParallelCount() == 1 && codec.GetFallbackCount() == 0);
+}
+
+/************************************************************************/
+/* Data that can't be split goes to tinfl: a stream without dynamic     */
+/* blocks, and one where the search finds a dynamic block inside        */
+/* stored data, whose guessed start the chunk in front never reaches    */
+/************************************************************************/
+TEST(parallelInflateFallback) {
+  DeflateStreamBuilder storedOnly;
+  storedOnly.AddStored(generateText(2 * 1024 * 1024, 120), 65535);
+  storedOnly.AddFixed(generateText(100, 121), 258, 30000);
+  storedOnly.Finish();
+  ParallelInflateCodec codec(4, 0, 0);
+  checkParallelInflate(codec, storedOnly, "parallel-stored.deflate");
+  CHECK(codec.GetParallelCount() == 0 && codec.GetFallbackCount() == 1);
+
+  // stored blocks holding copies of a compressed piece look like dynamic blocks to the search
+  DeflateStreamBuilder piece;
+  piece.AddEncoded(generateText(64 * 1024, 122), false);
+  std::vector<byte> decoys;
+  while (decoys.size() < 3 * 1024 * 1024) {
+    decoys.insert(decoys.end(), piece.stream.begin(), piece.stream.end());
+  }
+  DeflateStreamBuilder decoyed;
+  decoyed.AddEncoded(generateText(1024 * 1024, 123), false);
+  decoyed.AddStored(decoys, 65535);
+  decoyed.AddEncoded(generateText(1024 * 1024, 124), true);
+  checkParallelInflate(codec, decoyed, "parallel-decoys.deflate");
+  CHECK(codec.GetParallelCount() == 0 && codec.GetFallbackCount() == 2);
+
+  // a corrupt stream fails like it does with tinfl
+  DeflateStreamBuilder corrupt;
+  corrupt.AddEncoded(generateText(2 * 1024 * 1024, 125), true);
+  corrupt.stream.resize(corrupt.stream.size() / 2);
+  std::string path = temporaryPath("parallel-corrupt.deflate");
+  writeFile(path, corrupt.stream);
+  RandomAccessFile file(path);
+  std::vector<byte> output(corrupt.expected.size());
+  CHECK_THROWS(codec.Decompress(file, 0, file.GetSize(), output.data(), output.size(), 0));
+}
+
+/************************************************************************/
+/* One 80MB entry inflated with the threshold lifted, against tinfl on  */
+/* one thread                                                           */
+/************************************************************************/
+BENCHMARK(parallelInflate) {
+  DeflateStreamBuilder builder;
+  builder.AddEncoded(generateText(80 * 1024 * 1024, 33), true);
+  std::string path = temporaryPath("parallel-benchmark.deflate");
+  writeFile(path, builder.stream);
+  RandomAccessFile file(path);
+  std::vector<byte> output(builder.expected.size());
+  double start = now();
+  TinflCodec(ZipArchive_METHOD_DEFLATE).Decompress(file, 0, file.GetSize(), output.data(), output.size(), 0);
+  double serialSeconds = now() - start;
+  printf("  %.1f MB deflated to %.1f MB, %u cores\n", output.size() / 1e6, file.GetSize() / 1e6,
+    std::thread::hardware_concurrency());
+  printf("  tinfl       %7.1f ms\n", serialSeconds * 1000);
+
+  const unsigned threadCounts[] = { 1, 2, 4, 8, 16 };
+  for (size_t i = 0; i < sizeof(threadCounts) / sizeof(threadCounts[0]); i++) {
+    ParallelInflateCodec codec(threadCounts[i], 0);
+    start = now();
+    codec.Decompress(file, 0, file.GetSize(), output.data(), output.size(), 0);
+    double seconds = now() - start;
+    CHECK(output == builder.expected);
+    printf("  %2u threads  %7.1f ms, %.2fx%s\n", threadCounts[i], seconds * 1000, serialSeconds / seconds,
+      codec.GetParallelCount() == 1 ? "" : " (inflated serially)");
+  }
+}
@@ -0,0 +1,116 @@
+#include "stdafx.h"
+
+#include <cstdio>
+
+#ifdef APPRUNNER_TEST_PLUGINS
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "CallbackPlugin.h"
+#include "check.h"
+
+using doo::metrodriver::CallbackPlugin;
+using doo::metrodriver::PhaseTimings;
+using namespace doo::tests;
+
+/************************************************************************/
+/* Only shared libraries of the platform are taken for plugins          */
+/************************************************************************/
+TEST(callbackPluginExtension) {
+  CHECK(!CallbackPlugin::isPlugin("callback.exe"));
+  CHECK(!CallbackPlugin::isPlugin("callback"));
+#ifdef _WIN32
+  CHECK(CallbackPlugin::isPlugin("C:\\build\\plugin.dll"));
+  CHECK(CallbackPlugin::isPlugin("PLUGIN.DLL"));
+  CHECK(!CallbackPlugin::isPlugin(".dll"));
+  CHECK(!CallbackPlugin::isPlugin("plugin.so"));
+#else
+  CHECK(CallbackPlugin::isPlugin("/build/plugin.so"));
+  CHECK(CallbackPlugin::isPlugin("PLUGIN.SO"));
+  CHECK(!CallbackPlugin::isPlugin(".so"));
+  CHECK(!CallbackPlugin::isPlugin("plugin.dll"));
+#endif
+}
+
+// the plugins are built along with the checks by CMakeLists.txt
+#ifdef APPRUNNER_TEST_PLUGINS
+
+static std::string pluginPath(const char* name) {
+  return joinPath(APPRUNNER_TEST_PLUGINS, name);
+}
+
+static CallbackPlugin::RunResult createRunResult(int exitCode) {
+  CallbackPlugin::RunResult run;
+  run.packageName = "doo.Sample";
+  run.packageFullName = "doo.Sample_1.0.0.0_x86__abcdefghijklm";
+  run.packageFamilyName = "doo.Sample_abcdefghijklm!App";
+  run.packageVersion = "1.0.0.0";
+  run.publisher = "CN=doo";
+  run.architecture = "x86";
+  run.appId = "App";
+  run.exitCode = exitCode;
+  PhaseTimings timings;
+  timings.record("staging", 12.5);
+  timings.record("application", 1500.5);
+  run.phases = timings.getPhases();
+  run.localStatePath = "/packages/doo.Sample/LocalState";
+  return run;
+}
+
+// what the plugin prints to stdout while it handles run
+static std::string invokeCapturingOutput(CallbackPlugin& plugin, const CallbackPlugin::RunResult& run, int& result) {
+  std::string path = temporaryPath("plugin-output.txt");
+  fflush(stdout);
+  int savedOutput = dup(STDOUT_FILENO);
+  int captured = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  dup2(captured, STDOUT_FILENO);
+  close(captured);
+  result = plugin.invoke(run);
+  fflush(stdout);
+  dup2(savedOutput, STDOUT_FILENO);
+  close(savedOutput);
+  std::vector<byte> output = readFile(path);
+  return std::string(output.begin(), output.end());
+}
+
+/************************************************************************/
+/* sample-plugin.c receives the identity, exit code and phases of the   */
+/* run, and a plugin's result comes back from invoke()                  */
+/************************************************************************/
+TEST(callbackPluginInvoke) {
+  CallbackPlugin sample(pluginPath("sample-plugin.so"));
+  int result = -1;
+  std::string output = invokeCapturingOutput(sample, createRunResult(3), result);
+  CHECK(result == 0);
+  CHECK(output ==
+    "doo.Sample 1.0.0.0 (doo.Sample_1.0.0.0_x86__abcdefghijklm) exited with code 3\n"
+    "  staging              12.5 ms\n"
+    "  application        1500.5 ms\n"
+    "LocalState: /packages/doo.Sample/LocalState\n");
+
+  // loaded once more while the first is still loaded
+  CallbackPlugin resultPlugin(pluginPath("result-plugin.so"));
+  CHECK(resultPlugin.invoke(createRunResult(42)) == 42);
+  CHECK(resultPlugin.invoke(createRunResult(-7)) == -7);
+  CallbackPlugin runWithoutPhases(pluginPath("result-plugin.so"));
+  CallbackPlugin::RunResult run = createRunResult(5);
+  run.phases.clear();
+  CHECK(runWithoutPhases.invoke(run) == 5);
+}
+
+/************************************************************************/
+/* Libraries built for another ABI version or missing either function   */
+/* are turned down, like files that aren't libraries at all             */
+/************************************************************************/
+TEST(callbackPluginRejected) {
+  CHECK_THROWS(CallbackPlugin plugin(pluginPath("wrong-abi-plugin.so")));
+  CHECK_THROWS(CallbackPlugin plugin(pluginPath("no-abi-plugin.so")));
+  CHECK_THROWS(CallbackPlugin plugin(pluginPath("no-callback-plugin.so")));
+  CHECK_THROWS(CallbackPlugin plugin(pluginPath("missing-plugin.so")));
+  std::string text = temporaryPath("text-plugin.so");
+  writeFile(text, std::string("not a shared library"));
+  CHECK_THROWS(CallbackPlugin plugin(text));
+}
+
+#endif
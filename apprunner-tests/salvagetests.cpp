@@ -0,0 +1,242 @@
+#include "stdafx.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include "check.h"
+#include "crc32.h"
+#include "fixtures.h"
+#include "ziparchive.h"
+#include "zipformat.h"
+
+using doo::zip::ZipArchive;
+using namespace doo::tests;
+
+// append the bytes of value to data
+template <class T>
+static void append(std::vector<byte>& data, const T& value) {
+  const byte* bytes = reinterpret_cast<const byte*>(&value);
+  data.insert(data.end(), bytes, bytes + sizeof(value));
+}
+
+static doo::zip::EndOfCentralDirectoryRecord readEndRecord(const std::vector<byte>& data) {
+  doo::zip::EndOfCentralDirectoryRecord end;
+  memcpy(&end, &data[data.size() - sizeof(end)], sizeof(end));
+  return end;
+}
+
+// every entry is a file of the layout createArchive() packed with averageSize and seed
+static bool hasLayoutContents(const ZipArchive& archive, size_t averageSize, uint32 seed) {
+  for (size_t i = 0; i < archive.GetEntries().GetCount(); i++) {
+    unsigned directory, file;
+    if (sscanf(archive.GetEntries().GetName(i).c_str(), "dir%u/file%u.txt", &directory, &file) != 2
+      || archive.GetFileContents(i) != layoutFileContents(file, averageSize, seed)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/************************************************************************/
+/* Stored entries without a central directory, as an interrupted        */
+/* upload leaves them. Entries with a data descriptor alternate between */
+/* one with a signature, one without and one of the zip64 size          */
+/************************************************************************/
+static std::vector<byte> buildEntries(const std::vector<std::string>& names, const std::vector<std::vector<byte>>& contents,
+  bool dataDescriptors)
+{
+  std::vector<byte> archive;
+  for (size_t i = 0; i < names.size(); i++) {
+    uint32 crc = doo::zip::UpdateCrc32(0, contents[i].data(), contents[i].size());
+    uint32 size = static_cast<uint32>(contents[i].size());
+    bool zip64 = dataDescriptors && i % 3 == 2;
+    doo::zip::LocalFileHeader local = {};
+    local.signature = ZipArchive_ENTRY_LOCAL_HEADER_SIGNATURE;
+    local.version = zip64 ? 45 : 20;
+    local.compressionMethod = ZipArchive_METHOD_STORED;
+    local.filenameLength = static_cast<uint16>(names[i].size());
+    if (dataDescriptors) {
+      local.flags = ZipArchive_FLAG_DATA_DESCRIPTOR;
+    } else {
+      local.crc32 = crc;
+      local.compressedSize = local.uncompressedSize = size;
+    }
+    local.extraFieldLength = zip64 ? 4 + 16 : 0;
+    append(archive, local);
+    archive.insert(archive.end(), names[i].begin(), names[i].end());
+    if (zip64) {
+      // the sizes aren't known yet, the field only announces a zip64 descriptor
+      append(archive, static_cast<uint16>(ZipArchive_ZIP64_EXTRA_FIELD));
+      append(archive, static_cast<uint16>(16));
+      append(archive, static_cast<uint64>(0));
+      append(archive, static_cast<uint64>(0));
+    }
+    archive.insert(archive.end(), contents[i].begin(), contents[i].end());
+
+    if (zip64) {
+      doo::zip::Zip64DataDescriptor descriptor = { crc, size, size };
+      append(archive, static_cast<uint32>(ZipArchive_DATA_DESCRIPTOR_SIGNATURE));
+      append(archive, descriptor);
+    } else if (dataDescriptors) {
+      doo::zip::DataDescriptor descriptor = { crc, size, size };
+      if (i % 3 == 0) {
+        append(archive, static_cast<uint32>(ZipArchive_DATA_DESCRIPTOR_SIGNATURE));
+      }
+      append(archive, descriptor);
+    }
+  }
+  return archive;
+}
+
+/************************************************************************/
+/* The end record is found behind a comment of any length, also one     */
+/* holding a signature of its own, and behind padding                   */
+/************************************************************************/
+TEST(endRecordBehindComment) {
+  std::string path = createArchive("comment", 30, 2000, 51);
+  std::vector<byte> data = readFile(path);
+  doo::zip::EndOfCentralDirectoryRecord end = readEndRecord(data);
+  CHECK(end.signature == ZipArchive_END_OF_CENTRAL_RECORD_SIGNATURE && end.zipFileCommentLength == 0);
+  data.resize(data.size() - sizeof(end));
+
+  // a record in the comment whose directory would start behind it
+  std::vector<byte> commented = data;
+  end.zipFileCommentLength = ZipArchive_MAX_COMMENT_LENGTH;
+  append(commented, end);
+  doo::zip::EndOfCentralDirectoryRecord fake = end;
+  fake.centralDirectoryOffset = 0xFFFFFF00;
+  fake.zipFileCommentLength = 0;
+  commented.insert(commented.end(), ZipArchive_MAX_COMMENT_LENGTH - sizeof(fake) - 10, 'c');
+  append(commented, fake);
+  commented.insert(commented.end(), 10, 'c');
+  writeFile(path, commented);
+  {
+    ZipArchive archive(path);
+    CHECK(archive.GetEntries().GetCount() == 30 && hasLayoutContents(archive, 2000, 51));
+  }
+
+  // a short comment followed by padding
+  std::vector<byte> padded = data;
+  end.zipFileCommentLength = 5;
+  append(padded, end);
+  padded.insert(padded.end(), 5, 'c');
+  padded.insert(padded.end(), 4096, 0);
+  writeFile(path, padded);
+  {
+    ZipArchive archive(path);
+    CHECK(archive.GetEntries().GetCount() == 30 && hasLayoutContents(archive, 2000, 51));
+  }
+
+  // a record further from the end than the longest comment isn't looked for, salvage still finds the entries
+  padded.insert(padded.end(), ZipArchive_MAX_COMMENT_LENGTH, 0);
+  writeFile(path, padded);
+  CHECK_THROWS(ZipArchive archive(path));
+  std::shared_ptr<ZipArchive> salvaged = ZipArchive::Salvage(path);
+  CHECK(salvaged->GetEntries().GetCount() == 30 && hasLayoutContents(*salvaged, 2000, 51));
+}
+
+/************************************************************************/
+/* A cut off archive gives up the entries whose data is incomplete, and */
+/* an archive stored in another one adds no entries of its own          */
+/************************************************************************/
+TEST(salvageTruncatedArchive) {
+  const size_t fileCount = 40;
+  std::string path = createArchive("truncated", fileCount, 3000, 52);
+  std::vector<byte> data = readFile(path);
+  uint32 directoryOffset = readEndRecord(data).centralDirectoryOffset;
+
+  // the directory is gone, all data is there
+  writeFile(path, std::vector<byte>(data.begin(), data.begin() + directoryOffset + 10));
+  CHECK_THROWS(ZipArchive archive(path));
+  std::shared_ptr<ZipArchive> salvaged = ZipArchive::Salvage(path);
+  CHECK(salvaged->GetEntries().GetCount() == fileCount && hasLayoutContents(*salvaged, 3000, 52));
+  // the salvaged offsets let batches skip the local headers
+  std::vector<size_t> indices;
+  size_t size = 0;
+  for (size_t i = 0; i < fileCount; i++) {
+    indices.push_back(i);
+    size += static_cast<size_t>(salvaged->GetEntries().GetUncompressedSize(i));
+  }
+  std::vector<byte> buffer(size);
+  size_t extracted = 0;
+  salvaged->ExtractBatch(indices, buffer.data(), buffer.size(), 4, [&](size_t, const byte*, size_t) {
+    extracted++;
+  });
+  CHECK(extracted == fileCount);
+
+  // the last entry lost its final byte
+  writeFile(path, std::vector<byte>(data.begin(), data.begin() + directoryOffset - 1));
+  salvaged = ZipArchive::Salvage(path);
+  CHECK(salvaged->GetEntries().GetCount() == fileCount - 1 && hasLayoutContents(*salvaged, 3000, 52));
+
+  // nothing but the start of a header
+  writeFile(path, std::vector<byte>(data.begin(), data.begin() + 20));
+  CHECK(ZipArchive::Salvage(path)->GetEntries().GetCount() == 0);
+
+  // a complete archive stored as an entry, with a truncated one behind it
+  std::vector<std::string> names;
+  std::vector<std::vector<byte>> contents;
+  names.push_back("nested.zip");
+  contents.push_back(data);
+  names.push_back("after.txt");
+  contents.push_back(generateText(5000, 53));
+  std::vector<byte> outer = buildEntries(names, contents, false);
+  writeFile(path, std::vector<byte>(outer.begin(), outer.end() - 1));
+  salvaged = ZipArchive::Salvage(path);
+  CHECK(salvaged->GetEntries().GetCount() == 1 && salvaged->GetFileContents("nested.zip") == data);
+}
+
+/************************************************************************/
+/* Entries with data descriptors get their sizes and checksums from the */
+/* descriptor, with or without its signature, and signatures inside     */
+/* their data don't pass for one                                        */
+/************************************************************************/
+TEST(salvageDataDescriptors) {
+  std::vector<std::string> names;
+  std::vector<std::vector<byte>> contents;
+  for (size_t i = 0; i < 12; i++) {
+    names.push_back(layoutFileName(i));
+    contents.push_back(layoutFileContents(i, 1500, 54));
+  }
+  // a local header and a descriptor signature in the middle of the data
+  const char* signatures = "PK\x03\x04 PK\x07\x08 PK\x01\x02";
+  contents[4].insert(contents[4].begin() + 100, signatures, signatures + 14);
+  std::vector<byte> archive = buildEntries(names, contents, true);
+  std::string path = temporaryPath("descriptors.zip");
+  writeFile(path, archive);
+
+  std::shared_ptr<ZipArchive> salvaged = ZipArchive::Salvage(path);
+  CHECK(salvaged->GetEntries().GetCount() == names.size());
+  for (size_t i = 0; i < names.size(); i++) {
+    CHECK(salvaged->GetEntries().GetName(i) == names[i]);
+    CHECK(salvaged->GetEntries().GetUncompressedSize(i) == contents[i].size());
+    CHECK(salvaged->GetFileContents(i) == contents[i]);
+  }
+
+  // the descriptor of the last entry is cut off
+  writeFile(path, std::vector<byte>(archive.begin(), archive.end() - 2));
+  CHECK(ZipArchive::Salvage(path)->GetEntries().GetCount() == names.size() - 1);
+}
+
+/************************************************************************/
+/* Salvaging scans the whole file, opening reads the end and the        */
+/* directory                                                            */
+/************************************************************************/
+BENCHMARK(salvageScan) {
+  std::string path = createArchive("salvage-benchmark", 4000, 8192, 55);
+  double archiveSize = static_cast<double>(readFile(path).size());
+  const int rounds = 5;
+  double start = now();
+  for (int round = 0; round < rounds; round++) {
+    ZipArchive archive(path);
+  }
+  double opened = (now() - start) / rounds;
+  start = now();
+  size_t count = 0;
+  for (int round = 0; round < rounds; round++) {
+    count = ZipArchive::Salvage(path)->GetEntries().GetCount();
+  }
+  double salvaged = (now() - start) / rounds;
+  printf("  %.1f MB, %u entries: opened in %.2f ms, salvaged in %.1f ms, %.0f MB/s of archive\n", archiveSize / 1e6,
+    static_cast<unsigned>(count), opened * 1000, salvaged * 1000, archiveSize / 1e6 / salvaged);
+}
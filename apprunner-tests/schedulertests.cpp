@@ -0,0 +1,113 @@
+#include "stdafx.h"
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
+#include "check.h"
+#include "extractionscheduler.h"
+#include "fixtures.h"
+#include "zippacker.h"
+
+using doo::zip::ExtractionScheduler;
+using doo::zip::MemoryBudget;
+using doo::zip::ZipArchive;
+using namespace doo::tests;
+
+// a generated layout plus a few files large enough to be streamed
+static std::string createMixedArchive(const std::string& name, size_t largeFileCount, size_t largeFileSize) {
+  std::string directory = createLayout(name, 400, 16384, 37);
+  for (size_t i = 0; i < largeFileCount; i++) {
+    char fileName[32];
+    snprintf(fileName, sizeof(fileName), "large%u.txt", static_cast<unsigned>(i));
+    writeFile(joinPath(directory, fileName), generateText(largeFileSize, 370 + static_cast<uint32>(i)));
+  }
+  std::string archive = directory + ".zip";
+  doo::zip::ZipPacker().Pack(directory, archive, false);
+  return archive;
+}
+
+// extract every entry through the scheduler and compare with what the archive extracts by itself
+static ExtractionScheduler::Statistics extractAll(const ZipArchive& archive, const ExtractionScheduler& scheduler) {
+  size_t count = archive.GetEntries().GetCount();
+  std::vector<std::vector<byte>> contents(count);
+  std::vector<size_t> indices;
+  for (size_t i = 0; i < count; i++) {
+    contents[i].resize(static_cast<size_t>(archive.GetEntries().GetUncompressedSize(i)));
+    indices.push_back(i);
+  }
+  ExtractionScheduler::Statistics statistics = scheduler.Extract(indices,
+    [&](size_t index, uint64 offset, const byte* data, size_t length) {
+      memcpy(contents[index].data() + offset, data, length);
+    });
+  for (size_t i = 0; i < count; i++) {
+    CHECK(contents[i] == archive.GetFileContents(i));
+  }
+  return statistics;
+}
+
+/************************************************************************/
+/* Small entries are batched, large ones streamed, and the reservations */
+/* never exceed the budget                                              */
+/************************************************************************/
+TEST(budgetedExtraction) {
+  ZipArchive archive(createMixedArchive("budget", 4, 3 * 1024 * 1024));
+  const uint64 budget = 1024 * 1024;
+  ExtractionScheduler scheduler(archive, budget, 4);
+  CHECK(scheduler.GetStreamingThreshold() <= budget);
+  ExtractionScheduler::Statistics statistics = extractAll(archive, scheduler);
+  CHECK(statistics.peakReserved <= budget);
+  CHECK(statistics.streamedEntries == 4);
+  CHECK(statistics.batches > 0 && statistics.batches < 400);
+
+  ExtractionScheduler queued(archive, budget, 4, 0, 8);
+  statistics = extractAll(archive, queued);
+  CHECK(statistics.peakReserved <= budget);
+}
+
+/************************************************************************/
+/* Requests wait for released bytes, oversized ones take the whole      */
+/* budget                                                               */
+/************************************************************************/
+TEST(memoryBudget) {
+  MemoryBudget budget(1000);
+  CHECK(budget.Acquire(600) == 600);
+  bool acquired = false;
+  std::thread waiting([&]() {
+    MemoryBudget::Reservation reservation(budget, 500);
+    acquired = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  CHECK(!acquired);
+  budget.Release(600);
+  waiting.join();
+  CHECK(acquired);
+  CHECK(budget.Acquire(5000) == 1000);
+  budget.Release(1000);
+  CHECK(budget.GetPeak() == 1000);
+}
+
+/************************************************************************/
+/* Peak reservation and working set for growing budgets. The data is    */
+/* only counted, and the working set is a peak over the whole process,  */
+/* so each line shows what the budget it ran with added                 */
+/************************************************************************/
+BENCHMARK(extractionBudget) {
+  ZipArchive archive(createMixedArchive("budget-bench", 8, 16 * 1024 * 1024));
+  std::vector<size_t> indices;
+  for (size_t i = 0; i < archive.GetEntries().GetCount(); i++) {
+    indices.push_back(i);
+  }
+  for (uint64 budget = 1024 * 1024; budget <= 256 * 1024 * 1024; budget *= 4) {
+    ExtractionScheduler scheduler(archive, budget);
+    std::atomic<uint64> extracted(0);
+    double start = now();
+    ExtractionScheduler::Statistics statistics = scheduler.Extract(indices,
+      [&](size_t, uint64, const byte*, size_t length) {
+        extracted += length;
+      });
+    printf("  budget %6.1f MB: %.2f s, peak reserved %6.1f MB, peak working set %6.1f MB, %u batches, %u streamed\n",
+      budget / 1048576.0, now() - start, statistics.peakReserved / 1048576.0, statistics.peakWorkingSet / 1048576.0,
+      static_cast<unsigned>(statistics.batches), static_cast<unsigned>(statistics.streamedEntries));
+  }
+}
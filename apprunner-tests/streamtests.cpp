@@ -0,0 +1,258 @@
+#include "stdafx.h"
+
+#include <cstddef>
+#include <cstring>
+#include <streambuf>
+
+#include "check.h"
+#include "fixtures.h"
+#include "randomaccessfile.h"
+#include "ziparchive.h"
+#include "zipformat.h"
+#include "zipstreamreader.h"
+
+using doo::zip::RandomAccessFile;
+using doo::zip::ZipArchive;
+using doo::zip::ZipStreamReader;
+using namespace doo::tests;
+
+// how many bytes the producer hands over at a time
+#define StreamTests_TRICKLE 7
+
+// append the bytes of value to data
+template <class T>
+static void append(std::vector<byte>& data, const T& value) {
+  const byte* bytes = reinterpret_cast<const byte*>(&value);
+  data.insert(data.end(), bytes, bytes + sizeof(value));
+}
+
+/************************************************************************/
+/* Hands out the data a few bytes per read, like a pipe whose producer  */
+/* writes in small pieces                                               */
+/************************************************************************/
+class TrickleBuffer : public std::streambuf {
+public:
+  TrickleBuffer(const std::vector<byte>& data)
+    : data(data), position(0), reads(0) {}
+
+  size_t GetReads() const {
+    return reads;
+  }
+
+protected:
+  virtual int_type underflow() {
+    if (position == data.size()) {
+      return traits_type::eof();
+    }
+    char* start = const_cast<char*>(reinterpret_cast<const char*>(data.data())) + position;
+    size_t length = std::min<size_t>(StreamTests_TRICKLE, data.size() - position);
+    setg(start, start, start + length);
+    position += length;
+    reads++;
+    return traits_type::to_int_type(*start);
+  }
+
+private:
+  const std::vector<byte>& data;
+  size_t position;
+  size_t reads;
+};
+
+/************************************************************************/
+/* The archive as a producer writes it without seeking back: deflated   */
+/* entries get zeros in their local headers and a data descriptor after */
+/* their data, every other one with a signature. Every third entry      */
+/* keeps its sizes in the local header instead.                         */
+/************************************************************************/
+static std::vector<byte> addDataDescriptors(const std::string& path) {
+  ZipArchive archive(path);
+  RandomAccessFile file(path);
+  const doo::zip::ZipEntryTable& entries = archive.GetEntries();
+  std::vector<byte> streamed;
+  std::vector<byte> directory;
+  for (size_t i = 0; i < entries.GetCount(); i++) {
+    doo::zip::LocalFileHeader local;
+    file.ReadAt(entries.GetLocalHeaderOffset(i), reinterpret_cast<byte*>(&local), sizeof(local));
+    std::vector<byte> rest(local.filenameLength + local.extraFieldLength + static_cast<size_t>(entries.GetCompressedSize(i)));
+    file.ReadAt(entries.GetLocalHeaderOffset(i) + sizeof(local), rest.data(), rest.size());
+
+    uint32 offset = static_cast<uint32>(streamed.size());
+    bool descriptor = local.compressionMethod == ZipArchive_METHOD_DEFLATE && i % 3 != 2;
+    if (descriptor) {
+      local.flags |= ZipArchive_FLAG_DATA_DESCRIPTOR;
+      local.crc32 = local.compressedSize = local.uncompressedSize = 0;
+    }
+    append(streamed, local);
+    streamed.insert(streamed.end(), rest.begin(), rest.end());
+    if (descriptor) {
+      if (i % 2 == 0) {
+        append(streamed, static_cast<uint32>(ZipArchive_DATA_DESCRIPTOR_SIGNATURE));
+      }
+      doo::zip::DataDescriptor values = { entries.GetCrc32(i), static_cast<uint32>(entries.GetCompressedSize(i)),
+        static_cast<uint32>(entries.GetUncompressedSize(i)) };
+      append(streamed, values);
+    }
+
+    doo::zip::CentralDirectoryHeader central = {};
+    central.signature = ZipArchive_CENTRAL_DIRECTORY_RECORD_SIGNATURE;
+    central.versionCreated = central.versionNeeded = 20;
+    central.flags = local.flags;
+    central.compressionMethod = local.compressionMethod;
+    central.crc32 = entries.GetCrc32(i);
+    central.compressedSize = static_cast<uint32>(entries.GetCompressedSize(i));
+    central.uncompressedSize = static_cast<uint32>(entries.GetUncompressedSize(i));
+    central.filenameLength = local.filenameLength;
+    central.localHeaderOffset = offset;
+    append(directory, central);
+    std::string name = entries.GetName(i);
+    directory.insert(directory.end(), name.begin(), name.end());
+  }
+
+  doo::zip::EndOfCentralDirectoryRecord end = {};
+  end.signature = ZipArchive_END_OF_CENTRAL_RECORD_SIGNATURE;
+  end.entryCountThisDisk = end.entryCountTotal = static_cast<uint16>(entries.GetCount());
+  end.centralDirectorySize = static_cast<uint32>(directory.size());
+  end.centralDirectoryOffset = static_cast<uint32>(streamed.size());
+  streamed.insert(streamed.end(), directory.begin(), directory.end());
+  append(streamed, end);
+  return streamed;
+}
+
+// stream data through a reader, every entry has to be what archive extracts. Returns the number of entries read.
+static size_t checkStreamedEntries(const std::vector<byte>& data, const ZipArchive& archive) {
+  TrickleBuffer trickle(data);
+  std::istream input(&trickle);
+  ZipStreamReader reader(input);
+  size_t index = 0;
+  while (reader.NextEntry()) {
+    CHECK(index < archive.GetEntries().GetCount());
+    // some entries are skipped without being read
+    if (index % 5 != 4) {
+      std::vector<byte> contents;
+      reader.ReadEntry([&](const byte* chunk, size_t length) {
+        contents.insert(contents.end(), chunk, chunk + length);
+      });
+      CHECK(contents == archive.GetFileContents(index));
+      CHECK(reader.CurrentEntry().crc32 == archive.GetEntries().GetCrc32(index));
+      CHECK(reader.CurrentEntry().compressedSize == archive.GetEntries().GetCompressedSize(index));
+      CHECK(reader.CurrentEntry().uncompressedSize == archive.GetEntries().GetUncompressedSize(index));
+    }
+    CHECK(reader.CurrentEntry().filename == archive.GetEntries().GetName(index));
+    index++;
+  }
+  CHECK(trickle.GetReads() >= data.size() / StreamTests_TRICKLE);
+  return index;
+}
+
+// streaming data to its end has to fail
+static bool failsStreaming(const std::vector<byte>& data) {
+  TrickleBuffer trickle(data);
+  std::istream input(&trickle);
+  ZipStreamReader reader(input);
+  try {
+    while (reader.NextEntry()) {
+      reader.ReadEntry([](const byte*, size_t) {});
+    }
+  } catch (Platform::Exception^) {
+    return true;
+  }
+  return false;
+}
+
+/************************************************************************/
+/* Deflated entries arriving a few bytes at a time, with their sizes in */
+/* the local headers or in data descriptors with and without signature  */
+/************************************************************************/
+TEST(streamDeflatedEntries) {
+  const size_t fileCount = 40;
+  std::string path = createArchive("stream-deflated", fileCount, 100 * 1024, 150);
+  ZipArchive archive(path);
+  for (size_t i = 0; i < fileCount; i++) {
+    CHECK(archive.GetEntries().GetCompressionMethod(i) == ZipArchive_METHOD_DEFLATE);
+  }
+  CHECK(checkStreamedEntries(readFile(path), archive) == fileCount);
+
+  std::vector<byte> streamed = addDataDescriptors(path);
+  std::string streamedPath = temporaryPath("stream-descriptors.zip");
+  writeFile(streamedPath, streamed);
+  ZipArchive streamedArchive(streamedPath);
+  CHECK(streamedArchive.GetEntries().GetFlags(0) & ZipArchive_FLAG_DATA_DESCRIPTOR);
+  CHECK(checkStreamedEntries(streamed, streamedArchive) == fileCount);
+}
+
+/************************************************************************/
+/* A stream cut off anywhere fails instead of ending early, also in a   */
+/* data descriptor and in the end record                                */
+/************************************************************************/
+TEST(streamTruncated) {
+  std::vector<byte> streamed = addDataDescriptors(createArchive("stream-truncated", 10, 20 * 1024, 151));
+  std::string path = temporaryPath("stream-truncated-descriptors.zip");
+  writeFile(path, streamed);
+  ZipArchive archive(path);
+  size_t secondHeader = static_cast<size_t>(archive.GetEntries().GetLocalHeaderOffset(1));
+  doo::zip::EndOfCentralDirectoryRecord end;
+  memcpy(&end, &streamed[streamed.size() - sizeof(end)], sizeof(end));
+
+  // in the first local header, its deflated data, its descriptor, the second header, the directory and the end record
+  size_t cuts[] = {
+    10,
+    secondHeader / 2,
+    secondHeader - 6,
+    secondHeader + 12,
+    static_cast<size_t>(end.centralDirectoryOffset) + 20,
+    streamed.size() - 1
+  };
+  CHECK(!failsStreaming(streamed));
+  for (size_t i = 0; i < sizeof(cuts) / sizeof(cuts[0]); i++) {
+    CHECK(failsStreaming(std::vector<byte>(streamed.begin(), streamed.begin() + cuts[i])));
+  }
+}
+
+/************************************************************************/
+/* A central directory that doesn't describe the streamed entries is    */
+/* rejected once it arrives                                             */
+/************************************************************************/
+TEST(streamMismatchedDirectory) {
+  std::string path = createArchive("stream-mismatched", 12, 10 * 1024, 152);
+  std::vector<byte> streamed = addDataDescriptors(path);
+  CHECK(!failsStreaming(streamed));
+  doo::zip::EndOfCentralDirectoryRecord end;
+  memcpy(&end, &streamed[streamed.size() - sizeof(end)], sizeof(end));
+  // the third entry's header, its data has no descriptor
+  size_t third = end.centralDirectoryOffset;
+  for (int i = 0; i < 2; i++) {
+    doo::zip::CentralDirectoryHeader header;
+    memcpy(&header, &streamed[third], sizeof(header));
+    third += sizeof(header) + header.filenameLength;
+  }
+
+  // a CRC, a size, an offset and a name that differ, in entries with and without descriptor
+  const size_t fields[] = {
+    end.centralDirectoryOffset + offsetof(doo::zip::CentralDirectoryHeader, crc32),
+    third + offsetof(doo::zip::CentralDirectoryHeader, crc32),
+    third + offsetof(doo::zip::CentralDirectoryHeader, compressedSize),
+    end.centralDirectoryOffset + offsetof(doo::zip::CentralDirectoryHeader, uncompressedSize),
+    third + offsetof(doo::zip::CentralDirectoryHeader, localHeaderOffset),
+    third + sizeof(doo::zip::CentralDirectoryHeader)
+  };
+  for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+    std::vector<byte> mismatched = streamed;
+    mismatched[fields[i]] ^= 1;
+    CHECK(failsStreaming(mismatched));
+  }
+
+  // one entry less in the directory and the end record
+  doo::zip::CentralDirectoryHeader last;
+  std::vector<byte> missing(streamed.begin(), streamed.end() - sizeof(end));
+  size_t lastHeader = end.centralDirectoryOffset;
+  for (uint16 i = 0; i + 1 < end.entryCountTotal; i++) {
+    memcpy(&last, &streamed[lastHeader], sizeof(last));
+    lastHeader += sizeof(last) + last.filenameLength;
+  }
+  missing.resize(lastHeader);
+  end.entryCountThisDisk--;
+  end.entryCountTotal--;
+  end.centralDirectorySize = static_cast<uint32>(lastHeader - end.centralDirectoryOffset);
+  append(missing, end);
+  CHECK(failsStreaming(missing));
+}
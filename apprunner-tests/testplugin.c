@@ -0,0 +1,23 @@
+/*
+  Callback plugin for the checks, built as it is and as broken variants apprunner has to turn down:
+  TestPlugin_WRONG_ABI_VERSION reports the next ABI version, TestPlugin_NO_ABI_VERSION and
+  TestPlugin_NO_RUN_COMPLETE leave out one of the two functions.
+*/
+#include "apprunner_plugin.h"
+
+#ifndef TestPlugin_NO_ABI_VERSION
+APPRUNNER_PLUGIN_EXPORT int APPRUNNER_PLUGIN_CALL apprunner_plugin_abi_version(void) {
+#ifdef TestPlugin_WRONG_ABI_VERSION
+  return APPRUNNER_PLUGIN_ABI_VERSION + 1;
+#else
+  return APPRUNNER_PLUGIN_ABI_VERSION;
+#endif
+}
+#endif
+
+#ifndef TestPlugin_NO_RUN_COMPLETE
+// hands the exit code back if the result has the size this plugin was built for
+APPRUNNER_PLUGIN_EXPORT int APPRUNNER_PLUGIN_CALL apprunner_plugin_run_complete(const apprunner_run_result* result) {
+  return result->struct_size == sizeof(apprunner_run_result) ? result->exit_code : -1;
+}
+#endif
@@ -0,0 +1,234 @@
+#include "stdafx.h"
+
+#include <cmath>
+#include <cstdio>
+
+#include "TestResults.h"
+#include "check.h"
+
+using doo::metrodriver::TestResults;
+using doo::metrodriver::TestSummary;
+using namespace doo::tests;
+
+static TestSummary parseText(const std::string& text) {
+  TestSummary summary;
+  TestResults::parse(text.data(), text.size(), "results.xml", summary);
+  return summary;
+}
+
+/************************************************************************/
+/* fileCount JUnit files like the ones test frameworks write, with 2%   */
+/* failures, 1% errors and 2% skipped tests. expected gets the totals   */
+/************************************************************************/
+static std::vector<std::string> createResultCorpus(const std::string& name, size_t fileCount, size_t testsPerFile,
+    TestSummary& expected) {
+  std::string directory = temporaryPath(name);
+  createDirectory(directory);
+  std::vector<std::string> files;
+  uint32 state = 46;
+  for (size_t file = 0; file < fileCount; file++) {
+    std::string text = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<!-- generated -->\n<testsuites>";
+    char line[512];
+    snprintf(line, sizeof(line), "<testsuite name=\"suite%u\" tests=\"%u\">\n", static_cast<unsigned>(file),
+      static_cast<unsigned>(testsPerFile));
+    text += line;
+    for (size_t test = 0; test < testsPerFile; test++) {
+      state = state * 1103515245U + 12345U;
+      unsigned outcome = (state >> 16) % 100;
+      unsigned milliseconds = (state >> 8) % 2000;
+      const char* format;
+      if (outcome < 2) {
+        format = "<testcase classname=\"pkg.Class%u\" name=\"test%u\" time=\"%u.%03u\"><failure message=\"expected "
+          "&lt;1&gt; but was &#x32;\">at Class.test()\n  at Runner.run()</failure></testcase>\n";
+        expected.failed++;
+      } else if (outcome < 3) {
+        format = "<testcase classname=\"pkg.Class%u\" name=\"test%u\" time=\"%u.%03u\"><error type=\"Crash\">"
+          "<![CDATA[boom <here>]]></error></testcase>\n";
+        expected.errors++;
+      } else if (outcome < 5) {
+        format = "<testcase classname=\"pkg.Class%u\" name=\"test%u\" time=\"%u.%03u\"><skipped/></testcase>\n";
+        expected.skipped++;
+      } else {
+        format = "<testcase classname=\"pkg.Class%u\" name=\"test%u\" time=\"%u.%03u\"/>\n";
+        expected.passed++;
+      }
+      snprintf(line, sizeof(line), format, static_cast<unsigned>(file), static_cast<unsigned>(test), milliseconds / 1000,
+        milliseconds % 1000);
+      text += line;
+      expected.tests++;
+      expected.seconds += milliseconds / 1000.0;
+    }
+    text += "</testsuite></testsuites>\n";
+    snprintf(line, sizeof(line), "results%05u.xml", static_cast<unsigned>(file));
+    files.push_back(joinPath(directory, line));
+    writeFile(files.back(), text);
+    expected.files++;
+  }
+  return files;
+}
+
+TEST(junitResults) {
+  TestSummary summary = parseText(
+    "<?xml version=\"1.0\"?>\n"
+    "<!DOCTYPE testsuite [ <!ENTITY x \"y\"> ]>\n"
+    "<testsuite name=\"suite\">\n"
+    "  <properties><property name=\"a\" value=\"b\"/></properties>\n"
+    "  <testcase classname=\"pkg.A\" name=\"passes\" time=\"1.5\"/>\n"
+    "  <testcase classname=\"pkg.A\" name=\"fails\" time=\"0.25\">\n"
+    "    <failure message=\"expected &lt;1&gt; but was &#50;&#x21; &quot;&amp;&apos;\">stack</failure>\n"
+    "  </testcase>\n"
+    "  <testcase name=\"crashes\" time=\"3\"><error><![CDATA[boom <here> &amp;]]></error></testcase>\n"
+    "  <testcase classname=\"pkg.B\" name=\"skipped\"><skipped/></testcase>\n"
+    "  <testcase classname=\"pkg.B\" name=\"traced\"><failure>line &amp; one\nline two</failure></testcase>\n"
+    "</testsuite>\n");
+  CHECK(summary.files == 1 && summary.tests == 5);
+  CHECK(summary.passed == 1 && summary.failed == 2 && summary.errors == 1 && summary.skipped == 1);
+  CHECK(summary.seconds == 4.75);
+  CHECK(summary.failures.size() == 3);
+  CHECK(summary.failures[0].name == "pkg.A.fails" && !summary.failures[0].isError);
+  CHECK(summary.failures[0].message == "expected <1> but was 2! \"&'");
+  CHECK(summary.failures[0].file == "results.xml");
+  CHECK(summary.failures[1].name == "crashes" && summary.failures[1].isError);
+  CHECK(summary.failures[1].message == "boom <here> &amp;");
+  CHECK(summary.failures[2].message == "line & one\nline two");
+  CHECK(summary.slowest.size() == 5);
+
+  // stack traces are cut off
+  summary = parseText("<testsuite><testcase name=\"a\"><failure>" + std::string(5000, 'x') + "</failure></testcase></testsuite>");
+  CHECK(summary.failures.size() == 1 && summary.failures[0].message.size() == TestResults_MESSAGE_LENGTH);
+}
+
+/************************************************************************/
+/* TRX files as Visual Studio writes them, UTF-8 with a BOM or UTF-16   */
+/************************************************************************/
+TEST(trxResults) {
+  std::string trx =
+    "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+    "<TestRun xmlns=\"http://microsoft.com/schemas/VisualStudio/TeamTest/2010\"><Results>\n"
+    "<UnitTestResult testName=\"Passes\" duration=\"00:00:01.5000000\" outcome=\"Passed\" />\n"
+    "<UnitTestResult testName=\"Fails\" duration=\"00:01:00.0000000\" outcome=\"Failed\"><Output><ErrorInfo>"
+    "<Message>Assert.AreEqual failed \xC3\xBC</Message><StackTrace>at Fails()</StackTrace></ErrorInfo></Output></UnitTestResult>\n"
+    "<UnitTestResult testName=\"Skipped\" outcome=\"NotExecuted\"/>\n"
+    "<UnitTestResult testName=\"Driven\" duration=\"01:00:00\" outcome=\"Passed\"><InnerResults>"
+    "<UnitTestResult testName=\"Driven (1)\" outcome=\"Failed\"/></InnerResults></UnitTestResult>\n"
+    "</Results></TestRun>\n";
+  std::string utf8Path = temporaryPath("utf8.trx");
+  writeFile(utf8Path, "\xEF\xBB\xBF" + trx);
+  std::vector<byte> utf16;
+  utf16.push_back(0xFF);
+  utf16.push_back(0xFE);
+  for (size_t i = 0; i < trx.size(); i++) {
+    unsigned c = static_cast<byte>(trx[i]);
+    if (c == 0xC3) {
+      // the only non-ASCII character, U+00FC
+      c = 0xFC;
+      i++;
+    }
+    utf16.push_back(static_cast<byte>(c));
+    utf16.push_back(0);
+  }
+  std::string utf16Path = temporaryPath("utf16.trx");
+  writeFile(utf16Path, utf16);
+
+  TestSummary summaries[2];
+  TestResults::parseFile(utf8Path, summaries[0]);
+  TestResults::parseFile(utf16Path, summaries[1]);
+  for (int i = 0; i < 2; i++) {
+    const TestSummary& summary = summaries[i];
+    // the inner result is part of the data driven test
+    CHECK(summary.tests == 4 && summary.passed == 2 && summary.failed == 1 && summary.skipped == 1);
+    CHECK(summary.seconds == 3661.5);
+    CHECK(summary.failures.size() == 1 && summary.failures[0].name == "Fails");
+    CHECK(summary.failures[0].message == "Assert.AreEqual failed \xC3\xBC");
+    CHECK(summary.slowest.size() == 4);
+  }
+  std::vector<std::string> files;
+  files.push_back(utf8Path);
+  files.push_back(utf16Path);
+  TestSummary summary = TestResults::aggregate(files, 1);
+  CHECK(summary.tests == 8 && summary.slowest[0].name == "Driven" && summary.slowest[0].seconds == 3600);
+}
+
+TEST(malformedResults) {
+  CHECK_THROWS(parseText(""));
+  CHECK_THROWS(parseText("<testsuite><testcase name=\"a\"/>"));
+  CHECK_THROWS(parseText("<testsuite/><testsuite/>"));
+  CHECK_THROWS(parseText("<testsuite><testcase name=\"a"));
+  CHECK_THROWS(parseText("<testsuite><!-- never closed </testsuite>"));
+
+  std::string directory = temporaryPath("malformed");
+  createDirectory(directory);
+  writeFile(joinPath(directory, "a.xml"), std::string("<testsuite><testcase name=\"a\"/></testsuite>"));
+  writeFile(joinPath(directory, "b.XML"), std::string("<testsuite><testcase name=\"b\"/>"));
+  writeFile(joinPath(directory, "c.trx"), std::string());
+  writeFile(joinPath(directory, "d.txt"), std::string("<testsuite/>"));
+  createDirectory(joinPath(directory, "e.xml"));
+  std::vector<std::string> files = TestResults::findFiles(directory);
+  CHECK(files.size() == 3);
+  CHECK(files[0] == joinPath(directory, "a.xml") && files[1] == joinPath(directory, "b.XML"));
+
+  TestSummary summary = TestResults::aggregateDirectory(directory, 2);
+  CHECK(summary.files == 1 && summary.tests == 1 && summary.passed == 1);
+  CHECK(summary.unreadableFiles.size() == 2);
+  CHECK(summary.unreadableFiles[0] == files[1] && summary.unreadableFiles[1] == files[2]);
+  CHECK_THROWS(TestResults::findFiles(joinPath(directory, "missing")));
+}
+
+/************************************************************************/
+/* The summary doesn't depend on how many threads read the files        */
+/************************************************************************/
+TEST(deterministicAggregation) {
+  TestSummary expected;
+  std::vector<std::string> files = createResultCorpus("corpus", 200, 40, expected);
+  std::string single = TestResults::aggregate(files, 1).toJson();
+  for (unsigned threadCount = 2; threadCount <= 8; threadCount *= 2) {
+    CHECK(TestResults::aggregate(files, threadCount).toJson() == single);
+  }
+
+  TestSummary summary = TestResults::aggregate(files, 4);
+  CHECK(summary.files == expected.files && summary.tests == expected.tests);
+  CHECK(summary.passed == expected.passed && summary.failed == expected.failed);
+  CHECK(summary.errors == expected.errors && summary.skipped == expected.skipped);
+  CHECK(fabs(summary.seconds - expected.seconds) < 0.001);
+  CHECK(summary.failures.size() == expected.failed + expected.errors);
+  CHECK(summary.slowest.size() == TestResults_SLOWEST_COUNT);
+  for (size_t i = 1; i < summary.slowest.size(); i++) {
+    CHECK(summary.slowest[i - 1].seconds >= summary.slowest[i].seconds);
+  }
+  for (size_t i = 1; i < summary.failures.size(); i++) {
+    CHECK(summary.failures[i - 1].file <= summary.failures[i].file);
+  }
+
+  char totals[256];
+  snprintf(totals, sizeof(totals), "{\"files\":200,\"tests\":8000,\"passed\":%u,\"failed\":%u,\"errors\":%u,\"skipped\":%u,",
+    static_cast<unsigned>(expected.passed), static_cast<unsigned>(expected.failed), static_cast<unsigned>(expected.errors),
+    static_cast<unsigned>(expected.skipped));
+  CHECK(single.compare(0, strlen(totals), totals) == 0);
+  CHECK(single.find("\"message\":\"expected <1> but was 2\"") != std::string::npos);
+  CHECK(single.find("\"type\":\"error\",\"message\":\"boom <here>\"") != std::string::npos);
+  std::string end = "\"unreadableFiles\":[]}";
+  CHECK(single.compare(single.size() - end.size(), end.size(), end) == 0);
+}
+
+/************************************************************************/
+/* Summarizing a large corpus like a CI run harvests it, with one       */
+/* thread and more                                                      */
+/************************************************************************/
+BENCHMARK(resultAggregation) {
+  TestSummary expected;
+  std::vector<std::string> files = createResultCorpus("large-corpus", 4000, 60, expected);
+  uint64 bytes = 0;
+  for (auto file = files.begin(); file != files.end(); ++file) {
+    bytes += readFile(*file).size();
+  }
+  for (unsigned threadCount = 1; threadCount <= 8; threadCount *= 2) {
+    double start = now();
+    TestSummary summary = TestResults::aggregate(files, threadCount);
+    std::string json = summary.toJson();
+    double seconds = now() - start;
+    printf("  %u threads: %u files, %.1f MB, %u tests in %.1f ms, %.0f MB/s, %u bytes of JSON%s\n", threadCount,
+      static_cast<unsigned>(files.size()), bytes / 1e6, static_cast<unsigned>(summary.tests), seconds * 1000,
+      bytes / 1e6 / seconds, static_cast<unsigned>(json.size()),
+      summary.tests == expected.tests && summary.failed == expected.failed ? "" : ", WRONG COUNTS");
+  }
+}
@@ -0,0 +1,184 @@
+#include "stdafx.h"
+
+#include <cstdio>
+
+#include "check.h"
+#include "transcode.h"
+
+using namespace doo::text;
+using namespace doo::tests;
+
+#define TranscodeTests_REPLACEMENT 0xFFFD
+
+// code point as UTF-8
+static void appendUtf8(std::string& text, uint32 codePoint) {
+  if (codePoint < 0x80) {
+    text += static_cast<char>(codePoint);
+  } else if (codePoint < 0x800) {
+    text += static_cast<char>(0xC0 | (codePoint >> 6));
+    text += static_cast<char>(0x80 | (codePoint & 0x3F));
+  } else if (codePoint < 0x10000) {
+    text += static_cast<char>(0xE0 | (codePoint >> 12));
+    text += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+    text += static_cast<char>(0x80 | (codePoint & 0x3F));
+  } else {
+    text += static_cast<char>(0xF0 | (codePoint >> 18));
+    text += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+    text += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+    text += static_cast<char>(0x80 | (codePoint & 0x3F));
+  }
+}
+
+// code point as UTF-16
+static void appendUtf16(std::vector<utf16unit>& text, uint32 codePoint) {
+  if (codePoint < 0x10000) {
+    text.push_back(static_cast<utf16unit>(codePoint));
+  } else {
+    text.push_back(static_cast<utf16unit>(0xD800 + ((codePoint - 0x10000) >> 10)));
+    text.push_back(static_cast<utf16unit>(0xDC00 + ((codePoint - 0x10000) & 0x3FF)));
+  }
+}
+
+// length code points, asciiPercent of them ASCII and the rest spread over all other planes
+static std::vector<uint32> generateCodePoints(size_t length, int asciiPercent, uint32 seed) {
+  std::vector<uint32> codePoints;
+  uint32 state = seed;
+  while (codePoints.size() < length) {
+    state = state * 1103515245U + 12345U;
+    uint32 random = state >> 8;
+    uint32 codePoint;
+    if (static_cast<int>(random % 100) < asciiPercent) {
+      codePoint = 0x20 + random % 0x5F;
+    } else {
+      switch (random % 3) {
+      case 0:
+        codePoint = 0x80 + (random >> 2) % 0x780;
+        break;
+      case 1:
+        codePoint = 0x800 + (random >> 2) % 0xF800;
+        break;
+      default:
+        codePoint = 0x10000 + (random >> 2) % 0x100000;
+        break;
+      }
+      if (codePoint >= 0xD800 && codePoint < 0xE000) {
+        continue;
+      }
+    }
+    codePoints.push_back(codePoint);
+  }
+  return codePoints;
+}
+
+static std::vector<utf16unit> toUtf16(const std::string& text) {
+  std::vector<utf16unit> output(MaximumUtf16Length(text.size()));
+  output.resize(Utf8ToUtf16(text.data(), text.size(), output.data()));
+  return output;
+}
+
+static std::string toUtf8(const std::vector<utf16unit>& text) {
+  std::string output(MaximumUtf8Length(text.size()), '\0');
+  output.resize(Utf16ToUtf8(text.data(), text.size(), &output[0]));
+  return output;
+}
+
+/************************************************************************/
+/* Valid text in all planes converts both ways exactly, with every      */
+/* length and alignment of the ASCII runs the SSE2 path handles         */
+/************************************************************************/
+TEST(transcodeRoundTrip) {
+  int percentages[] = { 0, 50, 90, 100 };
+  for (int p = 0; p < 4; p++) {
+    for (size_t length = 0; length < 100; length++) {
+      std::vector<uint32> codePoints = generateCodePoints(length, percentages[p], static_cast<uint32>(length * 4 + p));
+      std::string utf8;
+      std::vector<utf16unit> utf16;
+      for (auto codePoint = codePoints.begin(); codePoint != codePoints.end(); ++codePoint) {
+        appendUtf8(utf8, *codePoint);
+        appendUtf16(utf16, *codePoint);
+      }
+      CHECK(IsValidUtf8(utf8.data(), utf8.size()));
+      CHECK(Utf16Length(utf8.data(), utf8.size()) == utf16.size());
+      CHECK(Utf8Length(utf16.data(), utf16.size()) == utf8.size());
+      CHECK(toUtf16(utf8) == utf16);
+      CHECK(toUtf8(utf16) == utf8);
+    }
+  }
+  // a non-ASCII character at every position of a run, so it lands in every lane of a vector
+  for (size_t position = 0; position < 40; position++) {
+    std::string utf8(40, 'a');
+    utf8.replace(position, 1, "\xC3\xA9");
+    std::vector<utf16unit> utf16(40, 'a');
+    utf16[position] = 0xE9;
+    CHECK(toUtf16(utf8) == utf16);
+    CHECK(toUtf8(utf16) == utf8);
+  }
+}
+
+/************************************************************************/
+/* Every byte of a broken sequence and every unpaired surrogate becomes */
+/* U+FFFD                                                               */
+/************************************************************************/
+TEST(transcodeInvalidInput) {
+  const char* invalid[] = {
+    "\xC0\x80",         // overlong
+    "\xED\xA0\x80",     // an encoded surrogate
+    "\xF4\x90\x80\x80", // beyond U+10FFFF
+    "\xE2\x82",         // cut short
+    "\x80",             // a continuation byte on its own
+    "\xFF"
+  };
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+    std::string text = std::string("ab") + invalid[i] + "cd";
+    CHECK(!IsValidUtf8(text.data(), text.size()));
+    std::vector<utf16unit> expected(text.size(), TranscodeTests_REPLACEMENT);
+    expected.front() = 'a';
+    expected[1] = 'b';
+    expected[expected.size() - 2] = 'c';
+    expected.back() = 'd';
+    CHECK(toUtf16(text) == expected);
+    CHECK(Utf16Length(text.data(), text.size()) == expected.size());
+  }
+
+  utf16unit unpaired[] = { 'a', 0xD800, 'b', 0xDC00, 0xDBFF };
+  std::vector<utf16unit> utf16(unpaired, unpaired + 5);
+  CHECK(toUtf8(utf16) == "a\xEF\xBF\xBD" "b\xEF\xBF\xBD\xEF\xBF\xBD");
+  CHECK(Utf8Length(utf16.data(), utf16.size()) == 11);
+}
+
+// convert text both ways rounds times and print the throughput
+static void measure(const char* name, int asciiPercent) {
+  std::vector<uint32> codePoints = generateCodePoints(1024 * 1024, asciiPercent, 40);
+  std::string utf8;
+  std::vector<utf16unit> utf16;
+  for (auto codePoint = codePoints.begin(); codePoint != codePoints.end(); ++codePoint) {
+    appendUtf8(utf8, *codePoint);
+    appendUtf16(utf16, *codePoint);
+  }
+  std::vector<utf16unit> wide(MaximumUtf16Length(utf8.size()));
+  std::string narrow(MaximumUtf8Length(utf16.size()), '\0');
+  const int rounds = 20;
+  double start = now();
+  for (int i = 0; i < rounds; i++) {
+    Utf8ToUtf16(utf8.data(), utf8.size(), wide.data());
+  }
+  double toWide = now() - start;
+  start = now();
+  for (int i = 0; i < rounds; i++) {
+    Utf16ToUtf8(utf16.data(), utf16.size(), &narrow[0]);
+  }
+  double toNarrow = now() - start;
+  printf("  %-6s UTF-8 to UTF-16 %7.1f MB/s, UTF-16 to UTF-8 %7.1f MB/s\n", name,
+    rounds * utf8.size() / toWide / (1024 * 1024), rounds * utf8.size() / toNarrow / (1024 * 1024));
+}
+
+/************************************************************************/
+/* Throughput in MB of UTF-8 per second for text like manifests and     */
+/* paths, which are almost all ASCII, and for text that mostly isn't    */
+/************************************************************************/
+BENCHMARK(transcode) {
+  measure("ascii", 100);
+  measure("mostly", 95);
+  measure("mixed", 50);
+  measure("none", 0);
+}
@@ -0,0 +1,125 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "BlockMap.h"
+#include "DirectoryWatcher.h"
+#include "check.h"
+
+using doo::metrodriver::BlockMap;
+using doo::metrodriver::BlockMapDifference;
+using doo::metrodriver::ChangeDebouncer;
+using doo::metrodriver::DirectoryWatcher;
+using namespace doo::tests;
+
+/************************************************************************/
+/* A name settles once it was left alone for the quiet period, another  */
+/* change restarts the period                                           */
+/************************************************************************/
+TEST(changeDebouncer) {
+  ChangeDebouncer debouncer(1000);
+  CHECK(!debouncer.isPending());
+  CHECK(debouncer.getTimeToNextSettle(0, 5000) == 5000);
+  debouncer.notify("a.appx", 0);
+  debouncer.notify("b.appx", 500);
+  CHECK(debouncer.isPending());
+  CHECK(debouncer.getTimeToNextSettle(200, 5000) == 800);
+  CHECK(debouncer.getTimeToNextSettle(200, 100) == 100);
+  CHECK(debouncer.takeSettled(999).empty());
+
+  std::vector<std::string> settled = debouncer.takeSettled(1000);
+  CHECK(settled.size() == 1 && settled[0] == "a.appx");
+  // b is written to again before it settled
+  debouncer.notify("b.appx", 1400);
+  CHECK(debouncer.takeSettled(1600).empty());
+  CHECK(debouncer.getTimeToNextSettle(1600, 5000) == 800);
+  settled = debouncer.takeSettled(2400);
+  CHECK(settled.size() == 1 && settled[0] == "b.appx");
+  CHECK(!debouncer.isPending());
+  CHECK(debouncer.takeSettled(10000).empty());
+}
+
+// a block map document with one File element per "name:size:hash,hash" description
+static BlockMap parseBlockMap(const std::vector<std::string>& files) {
+  std::string xml = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<BlockMap xmlns=\"http://schemas.microsoft.com/appx/2010/blockmap\" HashMethod=\"http://www.w3.org/2001/04/xmlenc#sha256\">\n";
+  for (auto file = files.begin(); file != files.end(); ++file) {
+    size_t first = file->find(':');
+    size_t second = file->find(':', first + 1);
+    std::string hashes = file->substr(second + 1);
+    xml += "<File Name=\"" + file->substr(0, first) + "\" Size=\"" + file->substr(first + 1, second - first - 1) +
+      "\" LfhSize=\"40\"";
+    if (hashes.empty()) {
+      xml += "/>\n";
+      continue;
+    }
+    xml += ">\n";
+    for (size_t position = 0; position <= hashes.size();) {
+      size_t end = std::min(hashes.find(',', position), hashes.size());
+      xml += "  <Block Hash=\"" + hashes.substr(position, end - position) + "\" Size=\"100\"/>\n";
+      position = end + 1;
+    }
+    xml += "</File>\n";
+  }
+  xml += "</BlockMap>\n";
+  return BlockMap::parse(xml.data(), xml.size());
+}
+
+/************************************************************************/
+/* Files are added, removed or modified by their size or any block hash */
+/************************************************************************/
+TEST(blockMapDifference) {
+  std::vector<std::string> deployed;
+  deployed.push_back("AppxManifest.xml:1200:m1");
+  deployed.push_back("App.exe:200000:e1,e2,e3,e4");
+  deployed.push_back("Assets\\Logo.png:5000:l1");
+  deployed.push_back("empty.txt:0:");
+  deployed.push_back("old.dll:100:o1");
+  BlockMap before = parseBlockMap(deployed);
+  CHECK(before.getFileCount() == 5);
+  CHECK(before.compare(parseBlockMap(deployed)).isEmpty());
+
+  std::vector<std::string> rebuilt;
+  rebuilt.push_back("AppxManifest.xml:1200:m1");
+  // one block in the middle changed
+  rebuilt.push_back("App.exe:200000:e1,e2,x3,e4");
+  // same hashes, different size
+  rebuilt.push_back("Assets\\Logo.png:5001:l1");
+  rebuilt.push_back("empty.txt:0:");
+  rebuilt.push_back("new &amp; shiny.dll:100:n1");
+  BlockMapDifference difference = before.compare(parseBlockMap(rebuilt));
+  CHECK(difference.added.size() == 1 && difference.added[0] == "new & shiny.dll");
+  CHECK(difference.removed.size() == 1 && difference.removed[0] == "old.dll");
+  CHECK(difference.modified.size() == 2);
+  CHECK(std::find(difference.modified.begin(), difference.modified.end(), "App.exe") != difference.modified.end());
+  CHECK(std::find(difference.modified.begin(), difference.modified.end(), "Assets\\Logo.png") != difference.modified.end());
+
+  CHECK(BlockMap().compare(before).added.size() == 5);
+  CHECK_THROWS(parseBlockMap(std::vector<std::string>()));
+}
+
+/************************************************************************/
+/* Writing a file is reported with its name, nothing happening times    */
+/* out                                                                  */
+/************************************************************************/
+TEST(directoryWatcher) {
+  std::string directory = temporaryPath("watched");
+  createDirectory(directory);
+  DirectoryWatcher watcher(directory);
+  std::vector<std::string> changed;
+  CHECK(!watcher.wait(50, changed));
+  CHECK(changed.empty());
+
+  std::thread writer([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    writeFile(joinPath(directory, "package.appx"), std::string("first build"));
+  });
+  bool notified = watcher.wait(5000, changed);
+  writer.join();
+  CHECK(notified);
+  // further notifications of the same write may still arrive
+  while (watcher.wait(100, changed)) {
+  }
+  CHECK(std::find(changed.begin(), changed.end(), "package.appx") != changed.end());
+}
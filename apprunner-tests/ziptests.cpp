@@ -0,0 +1,464 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include "check.h"
+#include "crc32.h"
+#include "fixtures.h"
+#include "inflatecontextpool.h"
+#include "randomaccessfile.h"
+#include "ziparchive.h"
+#include "zipcounters.h"
+#include "zipformat.h"
+#include "zippacker.h"
+#include "zipstreamreader.h"
+
+using doo::zip::InflateContext;
+using doo::zip::InflateContextPool;
+using doo::zip::RandomAccessFile;
+using doo::zip::ZipArchive;
+using doo::zip::ZipEntryTable;
+using namespace doo::tests;
+
+// threads hammering the same file or archive in the concurrency checks
+#define ZipTests_THREADS 8
+
+/************************************************************************/
+/* Concurrent positional reads at random offsets all return what is     */
+/* in the file there                                                    */
+/************************************************************************/
+TEST(concurrentPositionalReads) {
+  std::vector<byte> contents = generateText(4 * 1024 * 1024, 29);
+  std::string path = temporaryPath("positional.bin");
+  writeFile(path, contents);
+  RandomAccessFile file(path);
+  CHECK(file.GetSize() == contents.size());
+
+  std::atomic<int> mismatches(0);
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < ZipTests_THREADS; t++) {
+    threads.push_back(std::thread([&, t]() {
+      uint32 state = t + 1;
+      std::vector<byte> buffer(256 * 1024);
+      for (int i = 0; i < 2000; i++) {
+        state = state * 1103515245U + 12345U;
+        size_t length = state % buffer.size();
+        state = state * 1103515245U + 12345U;
+        size_t offset = state % (contents.size() - length);
+        file.ReadAt(offset, buffer.data(), length);
+        if (memcmp(buffer.data(), contents.data() + offset, length) != 0) {
+          mismatches++;
+        }
+      }
+    }));
+  }
+  for (auto thread = threads.begin(); thread != threads.end(); ++thread) {
+    thread->join();
+  }
+  CHECK(mismatches == 0);
+  CHECK_THROWS(file.ReadAt(contents.size() - 10, contents.data(), 11));
+}
+
+/************************************************************************/
+/* Every thread extracts all entries of one archive in its own order    */
+/************************************************************************/
+TEST(concurrentEntryExtraction) {
+  const size_t fileCount = 300;
+  ZipArchive archive(createArchive("concurrent", fileCount, 8192, 29));
+  CHECK(archive.GetEntries().GetCount() == fileCount);
+
+  std::atomic<int> mismatches(0);
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < ZipTests_THREADS; t++) {
+    threads.push_back(std::thread([&, t]() {
+      for (size_t i = 0; i < fileCount; i++) {
+        size_t index = (i * 7 + t * 37) % fileCount;
+        if (archive.GetFileContents(layoutFileName(index)) != layoutFileContents(index, 8192, 29)) {
+          mismatches++;
+        }
+      }
+    }));
+  }
+  for (auto thread = threads.begin(); thread != threads.end(); ++thread) {
+    thread->join();
+  }
+  CHECK(mismatches == 0);
+}
+
+/************************************************************************/
+/* Extract all entries of one archive with 1 to N threads sharing it,   */
+/* N being at least the number of cores                                 */
+/************************************************************************/
+BENCHMARK(readerThreadScaling) {
+  const size_t fileCount = 2000;
+  ZipArchive archive(createArchive("scaling", fileCount, 16384, 29));
+  unsigned maximum = std::max(4U, std::thread::hardware_concurrency());
+  double single = 0;
+  for (unsigned threadCount = 1; threadCount <= maximum; threadCount *= 2) {
+    std::atomic<size_t> next(0);
+    std::atomic<uint64> extracted(0);
+    double start = now();
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < threadCount; t++) {
+      threads.push_back(std::thread([&]() {
+        for (size_t index = next++; index < fileCount * 4; index = next++) {
+          extracted += archive.GetFileContents(index % fileCount).size();
+        }
+      }));
+    }
+    for (auto thread = threads.begin(); thread != threads.end(); ++thread) {
+      thread->join();
+    }
+    double seconds = now() - start;
+    double rate = extracted / seconds / (1024 * 1024);
+    if (threadCount == 1) {
+      single = rate;
+    }
+    printf("  %2u threads: %8.1f MB/s, %.2fx\n", threadCount, rate, rate / single);
+  }
+}
+
+/************************************************************************/
+/* Every entry is found by its name at its own index                    */
+/************************************************************************/
+TEST(entryTableLookup) {
+  const size_t fileCount = 1000;
+  ZipArchive archive(createArchive("lookup", fileCount, 64, 30));
+  const ZipEntryTable& entries = archive.GetEntries();
+  CHECK(entries.GetCount() == fileCount);
+  for (size_t i = 0; i < entries.GetCount(); i++) {
+    CHECK(entries.Find(entries.GetName(i)) == i);
+  }
+  for (size_t i = 0; i < fileCount; i++) {
+    size_t index = entries.Find(layoutFileName(i));
+    CHECK(index != ZipEntryTable::npos);
+    CHECK(entries.GetUncompressedSize(index) == layoutFileContents(i, 64, 30).size());
+  }
+  CHECK(entries.Find("dir0/file1.txt") == ZipEntryTable::npos);
+  CHECK(entries.Find("DIR0/FILE0.TXT") == ZipEntryTable::npos);
+  CHECK(entries.Find("") == ZipEntryTable::npos);
+}
+
+/************************************************************************/
+/* Open time, table memory per entry and lookup time for an archive    */
+/* with many small entries                                              */
+/************************************************************************/
+BENCHMARK(entryTableOpen) {
+  const size_t fileCount = 20000;
+  std::string path = createArchive("many", fileCount, 64, 30);
+  const int rounds = 20;
+  double start = now();
+  size_t memory = 0;
+  for (int i = 0; i < rounds; i++) {
+    ZipArchive archive(path);
+    memory = archive.GetEntries().GetMemoryUsage();
+  }
+  double open = (now() - start) / rounds;
+
+  ZipArchive archive(path);
+  const ZipEntryTable& entries = archive.GetEntries();
+  std::vector<std::string> names;
+  for (size_t i = 0; i < fileCount; i++) {
+    names.push_back(layoutFileName((i * 7919) % fileCount));
+  }
+  start = now();
+  size_t found = 0;
+  for (int i = 0; i < rounds; i++) {
+    for (auto name = names.begin(); name != names.end(); ++name) {
+      found += entries.Find(*name) != ZipEntryTable::npos;
+    }
+  }
+  double lookup = (now() - start) / (rounds * fileCount);
+  CHECK(found == rounds * fileCount);
+
+  printf("  %u entries: open %.2f ms, %.1f bytes per entry, lookup %.0f ns\n",
+    static_cast<unsigned>(fileCount), open * 1000, static_cast<double>(memory) / fileCount, lookup * 1e9);
+}
+
+/************************************************************************/
+/* A thread gets its own context back, nested leases and leases on      */
+/* other threads at the same time get different ones                    */
+/************************************************************************/
+TEST(inflateContextReuse) {
+  InflateContextPool& pool = InflateContextPool::Shared();
+  InflateContext* first;
+  {
+    InflateContextPool::Lease lease(pool);
+    first = lease.operator->();
+  }
+  InflateContextPool::Lease lease(pool);
+  CHECK(lease.operator->() == first);
+  {
+    InflateContextPool::Lease nested(pool);
+    CHECK(nested.operator->() != first);
+  }
+  InflateContext* other = nullptr;
+  std::thread([&]() {
+    InflateContextPool::Lease lease(pool);
+    other = lease.operator->();
+  }).join();
+  CHECK(other != first);
+}
+
+/************************************************************************/
+/* Lease and return a context with 1 to N threads at once               */
+/************************************************************************/
+BENCHMARK(inflateContextLeases) {
+  InflateContextPool& pool = InflateContextPool::Shared();
+  const int leases = 1000000;
+  unsigned maximum = std::max(4U, std::thread::hardware_concurrency());
+  for (unsigned threadCount = 1; threadCount <= maximum; threadCount *= 2) {
+    double start = now();
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < threadCount; t++) {
+      threads.push_back(std::thread([&]() {
+        for (int i = 0; i < leases; i++) {
+          InflateContextPool::Lease lease(pool);
+        }
+      }));
+    }
+    for (auto thread = threads.begin(); thread != threads.end(); ++thread) {
+      thread->join();
+    }
+    double seconds = now() - start;
+    printf("  %2u threads: %.1f ns per lease\n", threadCount, seconds * 1e9 / leases);
+  }
+}
+
+#ifdef APPRUNNER_ZIP_COUNTERS
+/************************************************************************/
+/* The counters of all threads add up to what was extracted             */
+/************************************************************************/
+TEST(zipCounters) {
+  const size_t fileCount = 200;
+  ZipArchive archive(createArchive("counters", fileCount, 8192, 36));
+  doo::zip::ZipCounters::Reset();
+  uint64 extracted = 0;
+  for (size_t i = 0; i < fileCount / 2; i++) {
+    extracted += archive.GetFileContents(i).size();
+  }
+  std::thread([&]() {
+    for (size_t i = fileCount / 2; i < fileCount; i++) {
+      extracted += archive.GetFileContents(i).size();
+    }
+  }).join();
+
+  doo::zip::ZipCounters total = doo::zip::ZipCounters::Total();
+  CHECK(total.entriesExtracted == fileCount);
+  CHECK(total.bytesExtracted == extracted);
+  CHECK(total.reads >= fileCount);
+  CHECK(total.bytesRead > 0 && total.bytesRead < extracted);
+#ifndef APPRUNNER_USE_ZLIB
+  // blocks are counted by tinfl, which zlib is preferred over
+  CHECK(total.fixedBlocks + total.dynamicBlocks + total.storedBlocks >= fileCount);
+  CHECK(total.tableBuilds == 3 * total.dynamicBlocks);
+#endif
+
+  doo::zip::ZipCounters::Reset();
+  CHECK(doo::zip::ZipCounters::Total().entriesExtracted == 0);
+}
+#endif
+
+// every name of archive with its uncompressed size
+static std::vector<std::pair<std::string, uint64>> listEntries(const ZipArchive& archive) {
+  std::vector<std::pair<std::string, uint64>> list;
+  const ZipEntryTable& entries = archive.GetEntries();
+  for (size_t i = 0; i < entries.GetCount(); i++) {
+    list.push_back(std::make_pair(entries.GetName(i), entries.GetUncompressedSize(i)));
+  }
+  return list;
+}
+
+/************************************************************************/
+/* A sidecar is written on the first open, read on the next ones, and   */
+/* replaced when the archive changed or the sidecar was damaged         */
+/************************************************************************/
+TEST(sidecarIndex) {
+  std::string directory = createLayout("sidecar", 300, 4096, 38);
+  std::string path = directory + ".zip";
+  doo::zip::ZipPacker().Pack(directory, path, false);
+  std::string sidecar = path + ZipArchive_SIDECAR_EXTENSION;
+  std::vector<std::pair<std::string, uint64>> expected = listEntries(ZipArchive(path));
+
+  {
+    ZipArchive archive(path, true);
+    CHECK(listEntries(archive) == expected);
+  }
+  std::vector<byte> written = readFile(sidecar);
+  CHECK(!written.empty());
+  {
+    ZipArchive archive(path, true);
+    CHECK(listEntries(archive) == expected);
+    for (size_t i = 0; i < 300; i++) {
+      CHECK(archive.GetFileContents(layoutFileName(i)) == layoutFileContents(i, 4096, 38));
+    }
+  }
+  CHECK(readFile(sidecar) == written);
+
+  // repacked with one more file, the old sidecar must not be used
+  writeFile(joinPath(directory, "added.txt"), std::string("added"));
+  doo::zip::ZipPacker().Pack(directory, path, false);
+  {
+    ZipArchive archive(path, true);
+    CHECK(archive.GetEntries().GetCount() == 301);
+    std::vector<byte> added = archive.GetFileContents("added.txt");
+    CHECK(std::string(added.begin(), added.end()) == "added");
+  }
+  CHECK(readFile(sidecar) != written);
+  written = readFile(sidecar);
+
+  // cut short and then overwritten with garbage, both are rejected and replaced
+  writeFile(sidecar, std::vector<byte>(written.begin(), written.begin() + written.size() / 2));
+  CHECK(ZipArchive(path, true).GetEntries().GetCount() == 301);
+  CHECK(readFile(sidecar) == written);
+  writeFile(sidecar, generateText(written.size(), 38));
+  CHECK(ZipArchive(path, true).GetEntries().GetCount() == 301);
+  CHECK(readFile(sidecar) == written);
+}
+
+/************************************************************************/
+/* Opening a large directory by parsing it and through its sidecar      */
+/************************************************************************/
+BENCHMARK(sidecarOpen) {
+  const size_t fileCount = 20000;
+  std::string path = createArchive("sidecar-bench", fileCount, 64, 38);
+  ZipArchive(path, true);
+  const int rounds = 20;
+  double start = now();
+  for (int i = 0; i < rounds; i++) {
+    ZipArchive archive(path);
+  }
+  double parsed = (now() - start) / rounds;
+  start = now();
+  for (int i = 0; i < rounds; i++) {
+    ZipArchive archive(path, true);
+  }
+  double mapped = (now() - start) / rounds;
+  printf("  %u entries: parsed %.2f ms, from the sidecar %.2f ms\n", static_cast<unsigned>(fileCount),
+    parsed * 1000, mapped * 1000);
+}
+
+// append the bytes of value to data
+template <class T>
+static void append(std::vector<byte>& data, const T& value) {
+  const byte* bytes = reinterpret_cast<const byte*>(&value);
+  data.insert(data.end(), bytes, bytes + sizeof(value));
+}
+
+/************************************************************************/
+/* Stored entries whose sizes and offsets are all kept in zip64 extra   */
+/* fields, behind a zip64 end of central directory record               */
+/************************************************************************/
+static std::vector<byte> buildZip64Archive(const std::vector<std::string>& names, const std::vector<std::vector<byte>>& contents) {
+  std::vector<byte> archive;
+  std::vector<byte> directory;
+  for (size_t i = 0; i < names.size(); i++) {
+    uint64 offset = archive.size();
+    uint64 size = contents[i].size();
+    uint32 crc = doo::zip::UpdateCrc32(0, contents[i].data(), contents[i].size());
+
+    doo::zip::LocalFileHeader local = {};
+    local.signature = ZipArchive_ENTRY_LOCAL_HEADER_SIGNATURE;
+    local.version = 45;
+    local.compressionMethod = ZipArchive_METHOD_STORED;
+    local.crc32 = crc;
+    local.compressedSize = local.uncompressedSize = ZipArchive_ZIP64_MARKER;
+    local.filenameLength = static_cast<uint16>(names[i].size());
+    local.extraFieldLength = 4 + 16;
+    append(archive, local);
+    archive.insert(archive.end(), names[i].begin(), names[i].end());
+    append(archive, static_cast<uint16>(ZipArchive_ZIP64_EXTRA_FIELD));
+    append(archive, static_cast<uint16>(16));
+    append(archive, size);
+    append(archive, size);
+    archive.insert(archive.end(), contents[i].begin(), contents[i].end());
+
+    doo::zip::CentralDirectoryHeader central = {};
+    central.signature = ZipArchive_CENTRAL_DIRECTORY_RECORD_SIGNATURE;
+    central.versionCreated = central.versionNeeded = 45;
+    central.compressionMethod = ZipArchive_METHOD_STORED;
+    central.crc32 = crc;
+    central.compressedSize = central.uncompressedSize = central.localHeaderOffset = ZipArchive_ZIP64_MARKER;
+    central.filenameLength = static_cast<uint16>(names[i].size());
+    // an unrelated field comes first
+    central.extraFieldLength = 4 + 5 + 4 + 24;
+    append(directory, central);
+    directory.insert(directory.end(), names[i].begin(), names[i].end());
+    append(directory, static_cast<uint16>(0x5455));
+    append(directory, static_cast<uint16>(5));
+    directory.insert(directory.end(), 5, 0);
+    append(directory, static_cast<uint16>(ZipArchive_ZIP64_EXTRA_FIELD));
+    append(directory, static_cast<uint16>(24));
+    append(directory, size);
+    append(directory, size);
+    append(directory, offset);
+  }
+  uint64 directoryOffset = archive.size();
+  archive.insert(archive.end(), directory.begin(), directory.end());
+
+  doo::zip::Zip64EndOfCentralDirectoryRecord record = {};
+  record.signature = ZipArchive_ZIP64_END_OF_CENTRAL_RECORD_SIGNATURE;
+  record.recordSize = sizeof(record) - 12;
+  record.versionMadeBy = record.versionToExtract = 45;
+  record.entryCountThisDisk = record.totalEntryCount = names.size();
+  record.centralDirectorySize = directory.size();
+  record.startingDiskCentralDirectoryOffset = directoryOffset;
+  doo::zip::Zip64EndOfCentralDirectoryRecordLocator locator = {};
+  locator.signature = ZipArchive_ZIP64_END_OF_CENTRAL_LOCATOR_SIGNATURE;
+  locator.centralDirectoryOffset = archive.size();
+  locator.numberOfDisks = 1;
+  append(archive, record);
+  append(archive, locator);
+
+  doo::zip::EndOfCentralDirectoryRecord end = {};
+  end.signature = ZipArchive_END_OF_CENTRAL_RECORD_SIGNATURE;
+  end.entryCountThisDisk = end.entryCountTotal = 0xFFFF;
+  end.centralDirectorySize = end.centralDirectoryOffset = ZipArchive_ZIP64_MARKER;
+  append(archive, end);
+  return archive;
+}
+
+/************************************************************************/
+/* Sizes and offsets are taken from the zip64 extra fields by the       */
+/* archive and by the streaming reader                                  */
+/************************************************************************/
+TEST(zip64ExtraFields) {
+  std::vector<std::string> names;
+  std::vector<std::vector<byte>> contents;
+  for (size_t i = 0; i < 20; i++) {
+    names.push_back(layoutFileName(i));
+    contents.push_back(layoutFileContents(i, 1000, 39));
+  }
+  std::string path = temporaryPath("zip64.zip");
+  writeFile(path, buildZip64Archive(names, contents));
+
+  // parsed, then written to a sidecar and mapped from it
+  for (int open = 0; open < 3; open++) {
+    ZipArchive archive(path, open > 0);
+    CHECK(archive.GetEntries().GetCount() == names.size());
+    for (size_t i = 0; i < names.size(); i++) {
+      CHECK(archive.GetEntries().GetUncompressedSize(i) == contents[i].size());
+      CHECK(archive.GetFileContents(names[i]) == contents[i]);
+    }
+  }
+
+  std::ifstream input(path, std::ios::binary);
+  doo::zip::ZipStreamReader reader(input);
+  size_t index = 0;
+  while (reader.NextEntry()) {
+    std::vector<byte> data;
+    reader.ReadEntry([&](const byte* chunk, size_t length) {
+      data.insert(data.end(), chunk, chunk + length);
+    });
+    CHECK(index < names.size());
+    CHECK(reader.CurrentEntry().filename == names[index]);
+    CHECK(reader.CurrentEntry().uncompressedSize == contents[index].size());
+    CHECK(data == contents[index]);
+    index++;
+  }
+  CHECK(index == names.size());
+}
@@ -0,0 +1,187 @@
+#include "stdafx.h"
+
+#ifdef APPRUNNER_ALLOCATION_TRACKING
+
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+
+#include "AllocationTracker.h"
+
+using doo::metrodriver::AllocationTracker;
+
+#ifdef _MSC_VER
+#define AllocationTracker_THREAD_LOCAL __declspec(thread)
+#else
+#define AllocationTracker_THREAD_LOCAL __thread
+#endif
+
+// in front of every tracked block, keeps the block 16 byte aligned
+struct AllocationHeader {
+  uint64 size;
+  uint16 tags[2];
+  uint32 reserved;
+};
+
+struct TagCounters {
+  std::atomic<uint64> bytes;
+  std::atomic<uint64> allocations;
+  std::atomic<int64> live;
+  std::atomic<int64> peak;
+};
+
+// Tag 0 of each dimension stands for allocations outside any scope, named tags follow. Names are string
+// literals and are only ever added, under the lock, so the counting paths read them without locking.
+static std::mutex tagsLock;
+static const char* tagNames[2][AllocationTracker_MAX_TAGS] = { { "(none)" }, { "(none)" } };
+static std::atomic<unsigned> namedTagCounts[2];
+static TagCounters counters[2][AllocationTracker_MAX_TAGS];
+static std::atomic<int64> totalLive;
+static std::atomic<int64> totalPeak;
+
+static AllocationTracker_THREAD_LOCAL uint16 currentTags[2];
+
+static void raisePeak(std::atomic<int64>& peak, int64 value) {
+  int64 current = peak.load(std::memory_order_relaxed);
+  while (value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+  }
+}
+
+static uint16 findTag(unsigned dimension, const char* name) {
+  unsigned count = namedTagCounts[dimension].load(std::memory_order_acquire);
+  for (unsigned tag = 1; tag <= count; tag++) {
+    if (tagNames[dimension][tag] == name || strcmp(tagNames[dimension][tag], name) == 0) {
+      return static_cast<uint16>(tag);
+    }
+  }
+  std::lock_guard<std::mutex> guard(tagsLock);
+  count = namedTagCounts[dimension].load(std::memory_order_relaxed);
+  for (unsigned tag = 1; tag <= count; tag++) {
+    if (strcmp(tagNames[dimension][tag], name) == 0) {
+      return static_cast<uint16>(tag);
+    }
+  }
+  if (count + 1 == AllocationTracker_MAX_TAGS) {
+    return 0;
+  }
+  tagNames[dimension][count + 1] = name;
+  namedTagCounts[dimension].store(count + 1, std::memory_order_release);
+  return static_cast<uint16>(count + 1);
+}
+
+AllocationTracker::Scope::Scope(Dimension scopeDimension, const char* name)
+  : dimension(scopeDimension)
+{
+  previous = currentTags[dimension];
+  currentTags[dimension] = findTag(dimension, name);
+}
+
+AllocationTracker::Scope::~Scope() {
+  currentTags[dimension] = previous;
+}
+
+void* AllocationTracker::allocate(size_t size) {
+  AllocationHeader* header = static_cast<AllocationHeader*>(malloc(sizeof(AllocationHeader) + size));
+  if (!header) {
+    return NULL;
+  }
+  header->size = size;
+  for (int dimension = 0; dimension < 2; dimension++) {
+    uint16 tag = currentTags[dimension];
+    header->tags[dimension] = tag;
+    TagCounters& tagCounters = counters[dimension][tag];
+    tagCounters.bytes.fetch_add(size, std::memory_order_relaxed);
+    tagCounters.allocations.fetch_add(1, std::memory_order_relaxed);
+    raisePeak(tagCounters.peak, tagCounters.live.fetch_add(size, std::memory_order_relaxed) + size);
+  }
+  raisePeak(totalPeak, totalLive.fetch_add(size, std::memory_order_relaxed) + size);
+  return header + 1;
+}
+
+void AllocationTracker::release(void* block) {
+  if (!block) {
+    return;
+  }
+  AllocationHeader* header = static_cast<AllocationHeader*>(block) - 1;
+  for (int dimension = 0; dimension < 2; dimension++) {
+    counters[dimension][header->tags[dimension]].live.fetch_sub(header->size, std::memory_order_relaxed);
+  }
+  totalLive.fetch_sub(header->size, std::memory_order_relaxed);
+  free(header);
+}
+
+std::vector<AllocationTracker::Usage> AllocationTracker::getUsage(Dimension dimension) {
+  std::vector<Usage> result;
+  unsigned count = namedTagCounts[dimension].load(std::memory_order_acquire);
+  for (unsigned tag = 0; tag <= count; tag++) {
+    const TagCounters& tagCounters = counters[dimension][tag];
+    if (tagCounters.allocations == 0) {
+      continue;
+    }
+    Usage usage;
+    usage.name = tagNames[dimension][tag];
+    usage.bytes = tagCounters.bytes;
+    usage.allocations = tagCounters.allocations;
+    usage.live = tagCounters.live;
+    usage.peak = tagCounters.peak;
+    result.push_back(usage);
+  }
+  return result;
+}
+
+uint64 AllocationTracker::getPeak() {
+  return totalPeak;
+}
+
+std::wstring AllocationTracker::format() {
+  std::wostringstream result;
+  result << L"peak: " << getPeak() << L" bytes\n";
+  const wchar_t* dimensionNames[] = { L"phase", L"component" };
+  for (int dimension = Phase; dimension <= Component; dimension++) {
+    std::vector<Usage> usages = getUsage(static_cast<Dimension>(dimension));
+    for (auto usage = usages.begin(); usage != usages.end(); ++usage) {
+      result << dimensionNames[dimension] << L" " << usage->name.c_str() << L": " << usage->allocations << L" allocations, "
+        << usage->bytes << L" bytes, peak " << usage->peak << L" bytes, " << usage->live << L" bytes still allocated\n";
+    }
+  }
+  return result.str();
+}
+
+void* operator new(size_t size) {
+  void* block = AllocationTracker::allocate(size);
+  if (!block) {
+    throw std::bad_alloc();
+  }
+  return block;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) throw() {
+  return AllocationTracker::allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) throw() {
+  return AllocationTracker::allocate(size);
+}
+
+void operator delete(void* block) throw() {
+  AllocationTracker::release(block);
+}
+
+void operator delete[](void* block) throw() {
+  AllocationTracker::release(block);
+}
+
+void operator delete(void* block, const std::nothrow_t&) throw() {
+  AllocationTracker::release(block);
+}
+
+void operator delete[](void* block, const std::nothrow_t&) throw() {
+  AllocationTracker::release(block);
+}
+
+#endif
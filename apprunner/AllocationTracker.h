@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Tracking is only compiled in when APPRUNNER_ALLOCATION_TRACKING is defined. It replaces the global
+// operator new and delete, otherwise the macros below expand to nothing and allocation is untouched.
+#ifdef APPRUNNER_ALLOCATION_TRACKING
+#define AllocationTracker_COMPONENT(name) doo::metrodriver::AllocationTracker::Scope allocationComponentScope(doo::metrodriver::AllocationTracker::Component, name)
+#else
+#define AllocationTracker_COMPONENT(name) ((void)0)
+#endif
+
+// the most phases and components that can be told apart, further ones are counted as untagged
+#define AllocationTracker_MAX_TAGS 32
+
+namespace doo {
+  namespace metrodriver {
+    // Attributes everything allocated through operator new to the phase and the component that were
+    // active on the allocating thread: bytes, number of allocations, and the peak of what was alive at
+    // the same time. Phases are opened by PhaseTimings::Scope, components by AllocationTracker_COMPONENT.
+    // Memory is credited back to its tags when it is freed, on whatever thread that happens.
+    // Allocations made by Windows itself, e.g. through HeapAlloc or COM, are not seen.
+    class AllocationTracker {
+    public:
+      enum Dimension {
+        Phase,
+        Component
+      };
+
+      // makes name the current phase or component of the thread until the scope ends
+      class Scope {
+      public:
+        Scope(Dimension dimension, const char* name);
+        ~Scope();
+
+      private:
+        Scope(const Scope&);
+        Scope& operator=(const Scope&);
+
+        Dimension dimension;
+        uint16 previous;
+      };
+
+      struct Usage {
+        // "(none)" for memory allocated outside any scope
+        std::string name;
+        uint64 bytes;
+        uint64 allocations;
+        // allocated and not freed yet
+        int64 live;
+        uint64 peak;
+      };
+
+      // the tags of a dimension that allocated anything, in the order they were first used
+      static std::vector<Usage> getUsage(Dimension dimension);
+      // the most memory that was alive at the same time, over all tags
+      static uint64 getPeak();
+
+      // one line per phase and component, for printing after a run
+      static std::wstring format();
+
+      // bookkeeping for the operator new and delete replacements
+      static void* allocate(size_t size);
+      static void release(void* block);
+    };
+  }
+}
@@ -1,12 +1,16 @@
 #include "stdafx.h"
 
 #include <wrl/client.h>
+#include <appmodel.h>
 
+#include "AllocationTracker.h"
 #include "ApplicationMetadata.h"
 #include "ziparchive.h"
 #include "helper.h"
+#include "Log.h"
 
 using doo::metrodriver::ApplicationMetadata;
+using doo::metrodriver::Log;
 
 using Windows::Data::Xml::Dom::XmlDocument;
 using Windows::Data::Xml::Dom::XmlLoadSettings;
@@ -14,6 +18,7 @@ using Windows::Data::Xml::Dom::XmlLoadSettings;
 
 // instantiate Metadata from an extracted manifest on the disk
 ApplicationMetadata^ ApplicationMetadata::CreateFromManifest(Platform::String^ manifestPath) {
+  AllocationTracker_COMPONENT("manifest");
   std::ifstream input(manifestPath->Data(), std::ifstream::in);
   if (!input.is_open()) {
     throw ref new Platform::InvalidArgumentException(L"Could not open manifest");
@@ -26,12 +31,13 @@ ApplicationMetadata^ ApplicationMetadata::CreateFromManifest(Platform::String^ m
 
 #define THROW_ERROR(msg) { \
   wchar_t* errorMsg = msg;\
-  _tprintf_s(errorMsg); \
+  Log::error(L"%s", errorMsg); \
   throw ref new Platform::InvalidArgumentException(ref new Platform::String(errorMsg));\
 }
 
 // instantiate Metadata from an appx file
 ApplicationMetadata^ ApplicationMetadata::CreateFromAppx(Platform::String^ appxPath) {
+  AllocationTracker_COMPONENT("manifest");
   try {
     Microsoft::WRL::ComPtr<IAppxFactory> appxFactory;
     auto hr = CoCreateInstance( 
@@ -65,7 +71,7 @@ ApplicationMetadata^ ApplicationMetadata::CreateFromAppx(Platform::String^ appxP
 
     return ref new ApplicationMetadata(manifestReader);
   } catch (Platform::COMException^ e) {
-    _tprintf_s(L"Error decompressing appx file from %s: %s\n", appxPath->Data(), e->Message->Data());
+    Log::error(L"Error decompressing appx file from %s: %s", appxPath->Data(), e->Message->Data());
     throw e;
   }
 }
@@ -139,11 +145,97 @@ ApplicationMetadata::ApplicationMetadata(Microsoft::WRL::ComPtr<IAppxManifestRea
 
 }
 
+// the architecture name used in manifests for the machine we are running on
+static Platform::String^ getNativeArchitecture() {
+  EmptyStruct<SYSTEM_INFO> systemInfo;
+  GetNativeSystemInfo(&systemInfo);
+  switch (systemInfo.wProcessorArchitecture) {
+  case PROCESSOR_ARCHITECTURE_AMD64:
+    return "x64";
+  case PROCESSOR_ARCHITECTURE_ARM:
+    return "arm";
+  default:
+    return "x86";
+  }
+}
+
+// convert an XML document to a string for XmlDocument, skipping the BOM (first three bytes) if it exists
+static Platform::String^ xmlToPlatformString(const char* xml, size_t length) {
+  if (length >= 3 && memcmp(xml, "\xEF\xBB\xBF", 3) == 0) {
+    xml += 3;
+    length -= 3;
+  }
+  return stringToPlatformString(xml, static_cast<int>(length));
+}
+
+// pick the application package for this machine from a bundle manifest, falling back to a neutral one
+static std::string findBundledPackage(const std::vector<byte>& bundleManifestXml) {
+  auto bundleManifest = ref new XmlDocument();
+  bundleManifest->LoadXml(xmlToPlatformString(reinterpret_cast<const char*>(bundleManifestXml.data()), bundleManifestXml.size()));
+
+  auto packages = bundleManifest->SelectNodesNS("//b:Bundle/b:Packages/b:Package[@Type='application']", "xmlns:b=\"http://schemas.microsoft.com/appx/2013/bundle\"");
+  auto nativeArchitecture = getNativeArchitecture();
+  Platform::String^ neutralPackage = nullptr;
+  for (unsigned int i = 0; i < packages->Length; i++) {
+    auto attributes = packages->Item(i)->Attributes;
+    auto fileName = attributes->GetNamedItem("FileName")->NodeValue->ToString();
+    auto architectureNode = attributes->GetNamedItem("Architecture");
+    auto architecture = architectureNode ? architectureNode->NodeValue->ToString() : "neutral";
+    if (StrCmpIW(architecture->Data(), nativeArchitecture->Data()) == 0) {
+      return platformToStdString(fileName);
+    }
+    if (StrCmpIW(architecture->Data(), L"neutral") == 0) {
+      neutralPackage = fileName;
+    }
+  }
+  if (neutralPackage == nullptr) {
+    THROW_ERROR(L"The bundle contains no package for this architecture");
+  }
+  return platformToStdString(neutralPackage);
+}
+
+// instantiate Metadata from the matching package inside an appx bundle, without extracting it
+ApplicationMetadata^ ApplicationMetadata::CreateFromBundle(Platform::String^ bundlePath) {
+  AllocationTracker_COMPONENT("manifest");
+  doo::zip::ZipArchive bundle(platformToStdString(bundlePath));
+  auto packageFile = findBundledPackage(bundle.GetFileContents("AppxMetadata/AppxBundleManifest.xml"));
+  auto package = bundle.OpenNestedArchive(packageFile);
+  auto manifest = package->GetFileContents("AppxManifest.xml");
+  return ref new ApplicationMetadata(std::string(manifest.begin(), manifest.end()));
+}
+
+// the package full name for an identity as read from a manifest
+static Platform::String^ getPackageFullName(Platform::String^ name, Platform::String^ version, Platform::String^ publisher, Platform::String^ architecture, Platform::String^ resourceId) {
+  EmptyStruct<PACKAGE_ID> packageId;
+  packageId.name = const_cast<PWSTR>(name->Data());
+  packageId.publisher = const_cast<PWSTR>(publisher->Data());
+  packageId.resourceId = resourceId ? const_cast<PWSTR>(resourceId->Data()) : nullptr;
+  swscanf_s(version->Data(), L"%hu.%hu.%hu.%hu", &packageId.version.Major, &packageId.version.Minor, &packageId.version.Build, &packageId.version.Revision);
+  if (StrCmpIW(architecture->Data(), L"x64") == 0) {
+    packageId.processorArchitecture = APPX_PACKAGE_ARCHITECTURE_X64;
+  } else if (StrCmpIW(architecture->Data(), L"arm") == 0) {
+    packageId.processorArchitecture = APPX_PACKAGE_ARCHITECTURE_ARM;
+  } else if (StrCmpIW(architecture->Data(), L"neutral") == 0) {
+    packageId.processorArchitecture = APPX_PACKAGE_ARCHITECTURE_NEUTRAL;
+  } else {
+    packageId.processorArchitecture = APPX_PACKAGE_ARCHITECTURE_X86;
+  }
+
+  UINT32 length = PACKAGE_FULL_NAME_MAX_LENGTH + 1;
+  wchar_t fullName[PACKAGE_FULL_NAME_MAX_LENGTH + 1];
+  LONG result = PackageFullNameFromId(&packageId, &length, fullName);
+  if (result != ERROR_SUCCESS) {
+    wchar_t message[128];
+    swprintf_s(message, L"Could not determine the package full name, error %ld", result);
+    THROW_ERROR(message);
+  }
+  return ref new Platform::String(fullName);
+}
+
 // read metadata from the manifest
 ApplicationMetadata::ApplicationMetadata(const std::string& xml) {
     auto manifest = ref new XmlDocument();
-    // skip the BOM (first three bytes) if it exists
-    auto platformString = stringToPlatformString(xml[0] == -17 ? xml.data()+3 : xml.data());
+    auto platformString = xmlToPlatformString(xml.data(), xml.size());
     manifest->LoadXml(platformString);
 
     auto identityNode = manifest->SelectSingleNodeNS("//mf:Package/mf:Identity", "xmlns:mf=\"http://schemas.microsoft.com/appx/2010/manifest\"");
@@ -151,6 +243,9 @@ ApplicationMetadata::ApplicationMetadata(const std::string& xml) {
     packageVersion = identityNode->Attributes->GetNamedItem("Version")->NodeValue->ToString();
     publisher = identityNode->Attributes->GetNamedItem("Publisher")->NodeValue->ToString();
     architecture = identityNode->Attributes->GetNamedItem("ProcessorArchitecture")->NodeValue->ToString();
+    auto resourceIdNode = identityNode->Attributes->GetNamedItem("ResourceId");
+    packageFullName = getPackageFullName(packageName, packageVersion, publisher, architecture,
+      resourceIdNode ? resourceIdNode->NodeValue->ToString() : nullptr);
   
     auto applicationNode = manifest->SelectSingleNodeNS("//mf:Package/mf:Applications/mf:Application[1]", "xmlns:mf=\"http://schemas.microsoft.com/appx/2010/manifest\"");
     appId = applicationNode ? applicationNode->Attributes->GetNamedItem("Id")->NodeValue->ToString() : nullptr;
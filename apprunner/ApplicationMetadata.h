@@ -11,6 +11,8 @@ namespace doo {
 
       static ApplicationMetadata^ CreateFromManifest(Platform::String^ manifestPath);
       static ApplicationMetadata^ CreateFromAppx(Platform::String^ appxPath);
+      // reads the manifest of the bundled package matching the current architecture
+      static ApplicationMetadata^ CreateFromBundle(Platform::String^ bundlePath);
 
       property Platform::String^ PackageName {
         Platform::String^ get() { return packageName; };
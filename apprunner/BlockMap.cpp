@@ -0,0 +1,138 @@
+#include "stdafx.h"
+
+#include "BlockMap.h"
+
+using doo::metrodriver::BlockMap;
+using doo::metrodriver::BlockMapDifference;
+
+#define BlockMap_FILENAME "AppxBlockMap.xml"
+
+// resolve the entities XML allows in attribute values
+static std::string unescapeXml(const std::string& value) {
+  static const char* entities[][2] = {
+    { "&amp;", "&" }, { "&lt;", "<" }, { "&gt;", ">" }, { "&quot;", "\"" }, { "&apos;", "'" }
+  };
+  std::string result;
+  result.reserve(value.size());
+  for (size_t position = 0; position < value.size();) {
+    bool replaced = false;
+    for (size_t i = 0; i < sizeof(entities) / sizeof(entities[0]) && value[position] == '&'; i++) {
+      size_t length = strlen(entities[i][0]);
+      if (value.compare(position, length, entities[i][0]) == 0) {
+        result += entities[i][1];
+        position += length;
+        replaced = true;
+        break;
+      }
+    }
+    if (!replaced) {
+      result += value[position++];
+    }
+  }
+  return result;
+}
+
+// the value of attribute name within the start tag, false if the tag doesn't have it
+static bool readAttribute(const std::string& tag, const char* name, std::string& value) {
+  std::string pattern = std::string(" ") + name + "=";
+  for (size_t position = tag.find(pattern); position != std::string::npos; position = tag.find(pattern, position + 1)) {
+    size_t quote = position + pattern.size();
+    if (quote >= tag.size() || (tag[quote] != '"' && tag[quote] != '\'')) {
+      continue;
+    }
+    size_t end = tag.find(tag[quote], quote + 1);
+    if (end == std::string::npos) {
+      return false;
+    }
+    value = unescapeXml(tag.substr(quote + 1, end - quote - 1));
+    return true;
+  }
+  return false;
+}
+
+// the next start tag of element, with whitespace normalized to spaces, npos once there are no more
+static size_t findElement(const std::string& xml, const char* element, size_t position, std::string& tag) {
+  std::string pattern = std::string("<") + element;
+  for (position = xml.find(pattern, position); position != std::string::npos; position = xml.find(pattern, position + 1)) {
+    size_t next = position + pattern.size();
+    if (next < xml.size() && (xml[next] == ' ' || xml[next] == '\t' || xml[next] == '\r' || xml[next] == '\n' || xml[next] == '/' || xml[next] == '>')) {
+      size_t end = xml.find('>', next);
+      if (end == std::string::npos) {
+        return std::string::npos;
+      }
+      tag = xml.substr(position, end - position + 1);
+      std::replace_if(tag.begin(), tag.end(), [](char c) { return c == '\t' || c == '\r' || c == '\n'; }, ' ');
+      return position;
+    }
+  }
+  return std::string::npos;
+}
+
+/************************************************************************/
+/* Only the File elements and the Block elements within them matter,    */
+/* which is simple enough to find without a full XML parser             */
+/************************************************************************/
+BlockMap BlockMap::parse(const char* data, size_t length) {
+  std::string xml(data, length);
+  BlockMap result;
+  std::string tag;
+  size_t position = findElement(xml, "File", 0, tag);
+  while (position != std::string::npos) {
+    std::string name, size;
+    if (!readAttribute(tag, "Name", name) || !readAttribute(tag, "Size", size)) {
+      throw ref new Platform::FailureException(L"Invalid block map: File without name or size");
+    }
+    File file;
+    file.size = _strtoui64(size.c_str(), NULL, 10);
+
+    std::string fileTag = tag;
+    size_t next = findElement(xml, "File", position + 1, tag);
+    // an empty file has no blocks and may close its element right away
+    if (fileTag[fileTag.size() - 2] != '/') {
+      std::string blockTag;
+      size_t block = findElement(xml, "Block", position + 1, blockTag);
+      while (block != std::string::npos && block < next) {
+        std::string hash;
+        if (!readAttribute(blockTag, "Hash", hash)) {
+          throw ref new Platform::FailureException(L"Invalid block map: Block without hash");
+        }
+        file.blockHashes += hash;
+        block = findElement(xml, "Block", block + 1, blockTag);
+      }
+    }
+    result.files[name] = file;
+    position = next;
+  }
+  if (result.files.empty()) {
+    throw ref new Platform::FailureException(L"Invalid block map: no files");
+  }
+  return result;
+}
+
+BlockMap BlockMap::read(const doo::zip::ZipArchive& package) {
+  std::vector<byte> xml = package.GetFileContents(BlockMap_FILENAME);
+  return parse(reinterpret_cast<const char*>(xml.data()), xml.size());
+}
+
+BlockMapDifference BlockMap::compare(const BlockMap& newer) const {
+  BlockMapDifference result;
+  auto oldFile = files.begin();
+  auto newFile = newer.files.begin();
+  // both maps are sorted by name, so one pass finds everything
+  while (oldFile != files.end() || newFile != newer.files.end()) {
+    if (newFile == newer.files.end() || (oldFile != files.end() && oldFile->first < newFile->first)) {
+      result.removed.push_back(oldFile->first);
+      ++oldFile;
+    } else if (oldFile == files.end() || newFile->first < oldFile->first) {
+      result.added.push_back(newFile->first);
+      ++newFile;
+    } else {
+      if (oldFile->second.size != newFile->second.size || oldFile->second.blockHashes != newFile->second.blockHashes) {
+        result.modified.push_back(newFile->first);
+      }
+      ++oldFile;
+      ++newFile;
+    }
+  }
+  return result;
+}
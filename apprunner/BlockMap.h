@@ -0,0 +1,52 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ziparchive.h"
+
+namespace doo {
+  namespace metrodriver {
+    // files that differ between two block maps
+    struct BlockMapDifference {
+      std::vector<std::string> added;
+      std::vector<std::string> removed;
+      std::vector<std::string> modified;
+
+      bool isEmpty() const {
+        return added.empty() && removed.empty() && modified.empty();
+      }
+    };
+
+    // The AppxBlockMap.xml of a package: the size and the hashes of the 64KB blocks of every file.
+    // Comparing two block maps tells which files of a package changed without extracting any of them.
+    class BlockMap {
+    public:
+      // an empty block map, everything is added compared to it
+      BlockMap() {}
+
+      // read the File and Block elements, throws if the document has none
+      static BlockMap parse(const char* xml, size_t length);
+      // the block map stored in an .appx or .appxbundle
+      static BlockMap read(const doo::zip::ZipArchive& package);
+
+      size_t getFileCount() const {
+        return files.size();
+      }
+
+      // what changed going from this block map to newer
+      BlockMapDifference compare(const BlockMap& newer) const;
+
+    private:
+      struct File {
+        uint64 size;
+        // the hashes of all blocks, one after the other
+        std::string blockHashes;
+      };
+
+      // by file name as written in the block map
+      std::map<std::string, File> files;
+    };
+  }
+}
@@ -0,0 +1,102 @@
+#include "stdafx.h"
+
+#ifdef _WIN32
+#include "helper.h"
+#else
+#include <dlfcn.h>
+#endif
+
+#include "CallbackPlugin.h"
+
+using doo::metrodriver::CallbackPlugin;
+
+#ifdef _WIN32
+#define CallbackPlugin_EXTENSION ".dll"
+#else
+#define CallbackPlugin_EXTENSION ".so"
+#endif
+
+// message followed by the plugin's path
+static Platform::FailureException^ pluginError(const char* message, const std::string& path) {
+  std::string text = message + path;
+#ifdef _WIN32
+  return ref new Platform::FailureException(stringToPlatformString(text.c_str()));
+#else
+  return ref new Platform::FailureException(text.c_str());
+#endif
+}
+
+bool CallbackPlugin::isPlugin(const std::string& path) {
+  size_t length = strlen(CallbackPlugin_EXTENSION);
+  return path.size() > length && _stricmp(path.c_str() + path.size() - length, CallbackPlugin_EXTENSION) == 0;
+}
+
+CallbackPlugin::CallbackPlugin(const std::string& path)
+  : module(nullptr), runComplete(nullptr)
+{
+#ifdef _WIN32
+  module = LoadLibraryExW(stringToPlatformString(path.c_str())->Data(), NULL, LOAD_WITH_ALTERED_SEARCH_PATH);
+  if (module == nullptr) {
+    throw pluginError("Could not load callback plugin ", path);
+  }
+  auto abiVersion = reinterpret_cast<apprunner_plugin_abi_version_fn>(GetProcAddress(module, APPRUNNER_PLUGIN_ABI_VERSION_SYMBOL));
+  runComplete = reinterpret_cast<apprunner_plugin_run_complete_fn>(GetProcAddress(module, APPRUNNER_PLUGIN_RUN_COMPLETE_SYMBOL));
+#else
+  // a path without a slash would be looked up in the library search path instead
+  std::string loadPath = path.find('/') == std::string::npos ? "./" + path : path;
+  module = dlopen(loadPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (module == nullptr) {
+    throw pluginError("Could not load callback plugin ", path);
+  }
+  auto abiVersion = reinterpret_cast<apprunner_plugin_abi_version_fn>(dlsym(module, APPRUNNER_PLUGIN_ABI_VERSION_SYMBOL));
+  runComplete = reinterpret_cast<apprunner_plugin_run_complete_fn>(dlsym(module, APPRUNNER_PLUGIN_RUN_COMPLETE_SYMBOL));
+#endif
+
+  const char* error = nullptr;
+  if (abiVersion == nullptr || runComplete == nullptr) {
+    error = "Not an apprunner plugin: ";
+  } else if (abiVersion() != APPRUNNER_PLUGIN_ABI_VERSION) {
+    error = "Unsupported plugin ABI version in ";
+  }
+  if (error) {
+#ifdef _WIN32
+    FreeLibrary(module);
+#else
+    dlclose(module);
+#endif
+    throw pluginError(error, path);
+  }
+}
+
+CallbackPlugin::~CallbackPlugin() {
+#ifdef _WIN32
+  FreeLibrary(module);
+#else
+  dlclose(module);
+#endif
+}
+
+int CallbackPlugin::invoke(const RunResult& run) {
+  // the strings stay alive until the plugin returns
+  std::vector<apprunner_phase_timing> phaseTimings(run.phases.size());
+  for (size_t i = 0; i < run.phases.size(); i++) {
+    phaseTimings[i].name = run.phases[i].name.c_str();
+    phaseTimings[i].duration_ms = run.phases[i].milliseconds;
+  }
+
+  apprunner_run_result result = {};
+  result.struct_size = sizeof(apprunner_run_result);
+  result.package_name = run.packageName.c_str();
+  result.package_full_name = run.packageFullName.c_str();
+  result.package_family_name = run.packageFamilyName.c_str();
+  result.package_version = run.packageVersion.c_str();
+  result.publisher = run.publisher.c_str();
+  result.architecture = run.architecture.c_str();
+  result.app_id = run.appId.c_str();
+  result.exit_code = run.exitCode;
+  result.phases = phaseTimings.empty() ? nullptr : phaseTimings.data();
+  result.phase_count = static_cast<uint32_t>(phaseTimings.size());
+  result.local_state_path = run.localStatePath.c_str();
+
+  return runComplete(&result);
+}
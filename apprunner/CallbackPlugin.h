@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "apprunner_plugin.h"
+#include "PhaseTimings.h"
+
+namespace doo {
+  namespace metrodriver {
+    // a callback loaded in-process from a shared library implementing apprunner_plugin.h
+    class CallbackPlugin {
+    public:
+      // what the plugin is told about a finished run, strings in UTF-8
+      struct RunResult {
+        std::string packageName;
+        std::string packageFullName;
+        std::string packageFamilyName;
+        std::string packageVersion;
+        std::string publisher;
+        std::string architecture;
+        std::string appId;
+        int exitCode;
+        std::vector<PhaseTimings::Phase> phases;
+        std::string localStatePath;
+      };
+
+      // plugins are recognized by their file extension, .dll on Windows and .so elsewhere.
+      // Everything else is run as an executable.
+      static bool isPlugin(const std::string& path);
+
+      // load the plugin at path, in UTF-8. Throws if it doesn't export both functions or was built for another ABI version.
+      CallbackPlugin(const std::string& path);
+      ~CallbackPlugin();
+
+      // hand the results of the finished run to the plugin, returns the plugin's result code
+      int invoke(const RunResult& run);
+
+    private:
+      CallbackPlugin(const CallbackPlugin&);
+      CallbackPlugin& operator=(const CallbackPlugin&);
+
+#ifdef _WIN32
+      HMODULE module;
+#else
+      void* module;
+#endif
+      apprunner_plugin_run_complete_fn runComplete;
+    };
+  }
+}
@@ -0,0 +1,81 @@
+#include "stdafx.h"
+
+#include <cctype>
+
+#include "DeploymentBackend.h"
+#include "DeploymentTrace.h"
+#include "SimulatedDeploymentBackend.h"
+#ifdef _WIN32
+#include "WindowsDeploymentBackend.h"
+#endif
+
+using doo::metrodriver::DeploymentBackend;
+using doo::metrodriver::DeploymentTrace;
+using doo::metrodriver::RecordingDeploymentBackend;
+using doo::metrodriver::SimulatedDeploymentBackend;
+
+static const char* operationNames[DeploymentBackend_OPERATION_COUNT] = {
+  "find", "stage", "register", "update", "remove", "debug", "activate", "wait"
+};
+
+// created by the first call to shared(), handed out from then on
+static std::mutex sharedBackendLock;
+static std::shared_ptr<DeploymentBackend> sharedBackend;
+
+static bool equalsIgnoringCase(const char* text, const char* other) {
+  for (; *text && *other; text++, other++) {
+    if (tolower(static_cast<unsigned char>(*text)) != tolower(static_cast<unsigned char>(*other))) {
+      return false;
+    }
+  }
+  return *text == *other;
+}
+
+const char* DeploymentBackend::getOperationName(Operation operation) {
+  return operationNames[operation];
+}
+
+bool DeploymentBackend::findOperation(const std::string& name, Operation& operation) {
+  for (int i = 0; i < DeploymentBackend_OPERATION_COUNT; i++) {
+    if (name == operationNames[i]) {
+      operation = static_cast<Operation>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+/************************************************************************/
+/* Created on first use and kept for the whole process, so a simulated  */
+/* inventory lives on between the deployments of watch mode. Without    */
+/* Windows there is only the simulation.                                */
+/************************************************************************/
+std::shared_ptr<DeploymentBackend> DeploymentBackend::shared() {
+  std::lock_guard<std::mutex> guard(sharedBackendLock);
+  if (sharedBackend) {
+    return sharedBackend;
+  }
+  const char* replayFilename = getenv("APPRUNNER_DEPLOYMENT_REPLAY");
+  const char* backendName = getenv("APPRUNNER_DEPLOYMENT");
+  std::shared_ptr<DeploymentBackend> backend;
+  if (replayFilename && *replayFilename) {
+    auto simulated = std::make_shared<SimulatedDeploymentBackend>();
+    simulated->replay(DeploymentTrace::load(replayFilename));
+    backend = simulated;
+  } else if (backendName && equalsIgnoringCase(backendName, "simulated")) {
+    backend = std::make_shared<SimulatedDeploymentBackend>();
+  } else {
+#ifdef _WIN32
+    backend = std::make_shared<doo::metrodriver::WindowsDeploymentBackend>();
+#else
+    // there is nothing to deploy to
+    backend = std::make_shared<SimulatedDeploymentBackend>();
+#endif
+  }
+  const char* traceFilename = getenv("APPRUNNER_DEPLOYMENT_TRACE");
+  if (traceFilename && *traceFilename) {
+    backend = std::make_shared<RecordingDeploymentBackend>(backend, traceFilename);
+  }
+  sharedBackend = backend;
+  return sharedBackend;
+}
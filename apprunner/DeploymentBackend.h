@@ -0,0 +1,71 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// the number of operations in DeploymentBackend::Operation
+#define DeploymentBackend_OPERATION_COUNT 8
+
+namespace doo {
+  namespace metrodriver {
+    // a package as the deployment system knows it
+    struct PackageIdentity {
+      std::wstring name;
+      std::wstring publisher;
+      // major.minor.build.revision
+      std::wstring version;
+      std::wstring fullName;
+    };
+
+    // Everything Package asks of the system to deploy and start apps, in plain C++ types so that
+    // other implementations don't need WinRT. Deployment operations report failures like
+    // PackageManager does, as an error text which is empty on success. Uris are file paths.
+    class DeploymentBackend {
+    public:
+      enum Operation {
+        FindPackages,
+        StagePackage,
+        RegisterPackage,
+        UpdatePackage,
+        RemovePackage,
+        SetDebugging,
+        ActivateApplication,
+        WaitForApplication
+      };
+
+      virtual ~DeploymentBackend() {}
+
+      // the installed versions of a package for the current user
+      virtual std::vector<PackageIdentity> findPackages(const std::wstring& name, const std::wstring& publisher) = 0;
+
+      // package is what the .appx or .appxbundle at packageUri contains
+      virtual std::wstring stagePackage(const PackageIdentity& package, const std::wstring& packageUri,
+        const std::vector<std::wstring>& dependencyUris) = 0;
+      virtual std::wstring registerPackage(const PackageIdentity& package, const std::wstring& manifestUri,
+        const std::vector<std::wstring>& dependencyUris) = 0;
+      virtual std::wstring updatePackage(const PackageIdentity& package, const std::wstring& packageUri,
+        const std::vector<std::wstring>& dependencyUris) = 0;
+      virtual std::wstring removePackage(const std::wstring& fullName) = 0;
+
+      // returns false if debugging could not be configured
+      virtual bool setDebugging(const std::wstring& fullName, bool enabled) = 0;
+
+      // start the app and return its process id, throws if it could not be started
+      virtual uint32 activateApplication(const std::wstring& appUserModelId) = 0;
+      // Wait until the app activateApplication returned processId for exits and return its exit code.
+      // peakWorkingSet gets the most memory it used, 0 if unknown. Throws if there is no such app.
+      virtual int waitForApplication(uint32 processId, uint64* peakWorkingSet) = 0;
+
+      // the name used in traces, e.g. "stage"
+      static const char* getOperationName(Operation operation);
+      // the operation with that name, returns false if there is none
+      static bool findOperation(const std::string& name, Operation& operation);
+
+      // The backend all packages of this process use. It is the Windows one unless APPRUNNER_DEPLOYMENT
+      // is "simulated" or APPRUNNER_DEPLOYMENT_REPLAY names a trace to replay. With APPRUNNER_DEPLOYMENT_TRACE
+      // every operation is recorded to the file it names.
+      static std::shared_ptr<DeploymentBackend> shared();
+    };
+  }
+}
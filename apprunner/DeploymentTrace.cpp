@@ -0,0 +1,219 @@
+#include "stdafx.h"
+
+#include "DeploymentTrace.h"
+#include "transcode.h"
+
+using doo::metrodriver::DeploymentBackend;
+using doo::metrodriver::DeploymentTrace;
+using doo::metrodriver::DeploymentTraceEvent;
+using doo::metrodriver::PackageIdentity;
+using doo::metrodriver::RecordingDeploymentBackend;
+
+namespace {
+  // wchar_t holds UTF-16 on Windows and UTF-32 elsewhere
+  std::vector<doo::text::utf16unit> toUtf16(const std::wstring& text) {
+    std::vector<doo::text::utf16unit> units;
+    units.reserve(text.size());
+    for (size_t i = 0; i < text.size(); i++) {
+      uint32 codePoint = static_cast<uint32>(text[i]);
+      if (codePoint > 0xFFFF) {
+        units.push_back(static_cast<doo::text::utf16unit>(0xD800 + ((codePoint - 0x10000) >> 10)));
+        units.push_back(static_cast<doo::text::utf16unit>(0xDC00 + ((codePoint - 0x10000) & 0x3FF)));
+      } else {
+        units.push_back(static_cast<doo::text::utf16unit>(codePoint));
+      }
+    }
+    return units;
+  }
+
+  // tabs and line breaks would end the field
+  void appendField(std::string& line, const std::wstring& text) {
+    std::vector<doo::text::utf16unit> units = toUtf16(text);
+    doo::text::SmallBuffer<char, 512> utf8(doo::text::MaximumUtf8Length(units.size()));
+    size_t length = doo::text::Utf16ToUtf8(units.data(), units.size(), utf8.data());
+    for (size_t i = 0; i < length; i++) {
+      line += utf8.data()[i] == '\t' || utf8.data()[i] == '\r' || utf8.data()[i] == '\n' ? ' ' : utf8.data()[i];
+    }
+  }
+
+  std::wstring toWide(const std::string& text) {
+    doo::text::SmallBuffer<doo::text::utf16unit, 256> units(doo::text::MaximumUtf16Length(text.size()));
+    size_t length = doo::text::Utf8ToUtf16(text.data(), text.size(), units.data());
+    std::wstring wide;
+    wide.reserve(length);
+    for (size_t i = 0; i < length; i++) {
+      uint32 unit = units.data()[i];
+      if (sizeof(wchar_t) > 2 && unit >= 0xD800 && unit < 0xDC00 && i + 1 < length
+        && units.data()[i + 1] >= 0xDC00 && units.data()[i + 1] < 0xE000) {
+        unit = 0x10000 + ((unit - 0xD800) << 10) + (units.data()[++i] - 0xDC00);
+      }
+      wide += static_cast<wchar_t>(unit);
+    }
+    return wide;
+  }
+
+  double elapsedMilliseconds(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+}
+
+std::string DeploymentTrace::format(const DeploymentTraceEvent& event) {
+  char milliseconds[32];
+  snprintf(milliseconds, sizeof(milliseconds), "%.1f", event.milliseconds);
+  std::string line = DeploymentBackend::getOperationName(event.operation);
+  line += '\t';
+  line += milliseconds;
+  line += '\t';
+  appendField(line, event.package);
+  line += '\t';
+  appendField(line, event.error);
+  return line;
+}
+
+bool DeploymentTrace::parse(const std::string& line, DeploymentTraceEvent& event) {
+  std::vector<std::string> fields;
+  size_t start = 0;
+  for (size_t tab = line.find('\t'); tab != std::string::npos; tab = line.find('\t', start)) {
+    fields.push_back(line.substr(start, tab - start));
+    start = tab + 1;
+  }
+  fields.push_back(line.substr(start));
+  if (fields.size() != 4 || !DeploymentBackend::findOperation(fields[0], event.operation)) {
+    return false;
+  }
+  char* end;
+  event.milliseconds = strtod(fields[1].c_str(), &end);
+  if (end == fields[1].c_str() || *end != 0 || event.milliseconds < 0) {
+    return false;
+  }
+  event.package = toWide(fields[2]);
+  event.error = toWide(fields[3]);
+  return true;
+}
+
+std::vector<DeploymentTraceEvent> DeploymentTrace::load(const std::string& filename) {
+  std::ifstream input(filename.c_str(), std::ifstream::in | std::ifstream::binary);
+  if (!input.is_open()) {
+    throw ref new Platform::InvalidArgumentException(L"Could not open the deployment trace");
+  }
+  std::vector<DeploymentTraceEvent> events;
+  std::string line;
+  while (std::getline(input, line)) {
+    if (!line.empty() && line[line.size() - 1] == '\r') {
+      line.resize(line.size() - 1);
+    }
+    DeploymentTraceEvent event;
+    if (parse(line, event)) {
+      events.push_back(event);
+    }
+  }
+  return events;
+}
+
+RecordingDeploymentBackend::RecordingDeploymentBackend(std::shared_ptr<DeploymentBackend> backend, const std::string& filename)
+  : backend(backend)
+{
+  output = fopen(filename.c_str(), "ab");
+  if (!output) {
+    throw ref new Platform::FailureException(L"Could not open the deployment trace");
+  }
+}
+
+RecordingDeploymentBackend::~RecordingDeploymentBackend() {
+  fclose(output);
+}
+
+/************************************************************************/
+/* Every line is flushed right away, so a trace is complete up to the   */
+/* last operation even if apprunner is killed                           */
+/************************************************************************/
+void RecordingDeploymentBackend::record(Operation operation, const std::chrono::steady_clock::time_point& start, const std::wstring& package, const std::wstring& error) {
+  DeploymentTraceEvent event;
+  event.operation = operation;
+  event.milliseconds = elapsedMilliseconds(start);
+  event.package = package;
+  event.error = error;
+  std::string line = DeploymentTrace::format(event) + "\n";
+  std::lock_guard<std::mutex> guard(lock);
+  fwrite(line.data(), 1, line.size(), output);
+  fflush(output);
+}
+
+std::vector<PackageIdentity> RecordingDeploymentBackend::findPackages(const std::wstring& name, const std::wstring& publisher) {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::vector<PackageIdentity> packages = backend->findPackages(name, publisher);
+  record(FindPackages, start, name, std::wstring());
+  return packages;
+}
+
+std::wstring RecordingDeploymentBackend::stagePackage(const PackageIdentity& package, const std::wstring& packageUri,
+  const std::vector<std::wstring>& dependencyUris)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::wstring error = backend->stagePackage(package, packageUri, dependencyUris);
+  record(StagePackage, start, package.fullName, error);
+  return error;
+}
+
+std::wstring RecordingDeploymentBackend::registerPackage(const PackageIdentity& package, const std::wstring& manifestUri,
+  const std::vector<std::wstring>& dependencyUris)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::wstring error = backend->registerPackage(package, manifestUri, dependencyUris);
+  record(RegisterPackage, start, package.fullName, error);
+  return error;
+}
+
+std::wstring RecordingDeploymentBackend::updatePackage(const PackageIdentity& package, const std::wstring& packageUri,
+  const std::vector<std::wstring>& dependencyUris)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::wstring error = backend->updatePackage(package, packageUri, dependencyUris);
+  record(UpdatePackage, start, package.fullName, error);
+  return error;
+}
+
+std::wstring RecordingDeploymentBackend::removePackage(const std::wstring& fullName) {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::wstring error = backend->removePackage(fullName);
+  record(RemovePackage, start, fullName, error);
+  return error;
+}
+
+bool RecordingDeploymentBackend::setDebugging(const std::wstring& fullName, bool enabled) {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  bool configured = backend->setDebugging(fullName, enabled);
+  record(SetDebugging, start, fullName, configured ? std::wstring() : L"Debugging could not be configured");
+  return configured;
+}
+
+/************************************************************************/
+/* A failed activation is recorded before its exception goes on         */
+/************************************************************************/
+uint32 RecordingDeploymentBackend::activateApplication(const std::wstring& appUserModelId) {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  try {
+    uint32 processId = backend->activateApplication(appUserModelId);
+    record(ActivateApplication, start, appUserModelId, std::wstring());
+    return processId;
+  } catch (Platform::Exception^ e) {
+    record(ActivateApplication, start, appUserModelId, e->Message->Data());
+    throw;
+  }
+}
+
+// the process id stands in for the package, the app's running time is what the trace is after
+int RecordingDeploymentBackend::waitForApplication(uint32 processId, uint64* peakWorkingSet) {
+  char processName[16];
+  snprintf(processName, sizeof(processName), "%u", processId);
+  std::wstring package(processName, processName + strlen(processName));
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  try {
+    int exitCode = backend->waitForApplication(processId, peakWorkingSet);
+    record(WaitForApplication, start, package, std::wstring());
+    return exitCode;
+  } catch (Platform::Exception^ e) {
+    record(WaitForApplication, start, package, e->Message->Data());
+    throw;
+  }
+}
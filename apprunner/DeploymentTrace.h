@@ -0,0 +1,67 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "DeploymentBackend.h"
+
+namespace doo {
+  namespace metrodriver {
+    // one operation as it happened
+    struct DeploymentTraceEvent {
+      DeploymentBackend::Operation operation;
+      double milliseconds;
+      // the full name the operation was about, the app user model id for activations or the
+      // process id for waits
+      std::wstring package;
+      // empty if the operation succeeded
+      std::wstring error;
+    };
+
+    // Traces are text files with one operation per line: its name, how long it took in milliseconds,
+    // the package and the error, separated by tabs and encoded as UTF-8.
+    class DeploymentTrace {
+    public:
+      static std::string format(const DeploymentTraceEvent& event);
+      // returns false for lines which are no event
+      static bool parse(const std::string& line, DeploymentTraceEvent& event);
+      // all events of a trace file in order, throws if it can't be read
+      static std::vector<DeploymentTraceEvent> load(const std::string& filename);
+    };
+
+    // Passes every operation on to another backend and appends how long it took and how it ended
+    // to a trace file, which SimulatedDeploymentBackend can replay later.
+    class RecordingDeploymentBackend : public DeploymentBackend {
+    public:
+      // appends to filename, throws if it can't be opened
+      RecordingDeploymentBackend(std::shared_ptr<DeploymentBackend> backend, const std::string& filename);
+      ~RecordingDeploymentBackend();
+
+      virtual std::vector<PackageIdentity> findPackages(const std::wstring& name, const std::wstring& publisher);
+      virtual std::wstring stagePackage(const PackageIdentity& package, const std::wstring& packageUri,
+        const std::vector<std::wstring>& dependencyUris);
+      virtual std::wstring registerPackage(const PackageIdentity& package, const std::wstring& manifestUri,
+        const std::vector<std::wstring>& dependencyUris);
+      virtual std::wstring updatePackage(const PackageIdentity& package, const std::wstring& packageUri,
+        const std::vector<std::wstring>& dependencyUris);
+      virtual std::wstring removePackage(const std::wstring& fullName);
+      virtual bool setDebugging(const std::wstring& fullName, bool enabled);
+      virtual uint32 activateApplication(const std::wstring& appUserModelId);
+      virtual int waitForApplication(uint32 processId, uint64* peakWorkingSet);
+
+    private:
+      RecordingDeploymentBackend(const RecordingDeploymentBackend&);
+      RecordingDeploymentBackend& operator=(const RecordingDeploymentBackend&);
+
+      void record(Operation operation, const std::chrono::steady_clock::time_point& start, const std::wstring& package, const std::wstring& error);
+
+      std::shared_ptr<DeploymentBackend> backend;
+      std::mutex lock;
+      FILE* output;
+    };
+  }
+}
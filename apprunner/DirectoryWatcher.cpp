@@ -0,0 +1,152 @@
+#include "stdafx.h"
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "DirectoryWatcher.h"
+#include "transcode.h"
+
+using doo::metrodriver::ChangeDebouncer;
+using doo::metrodriver::DirectoryWatcher;
+
+#define DirectoryWatcher_BUFFER_SIZE (64 * 1024)
+
+#ifdef _WIN32
+
+DirectoryWatcher::DirectoryWatcher(const std::string& path)
+  : buffer(DirectoryWatcher_BUFFER_SIZE / sizeof(DWORD))
+{
+  directory = CreateFileA(path.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+    NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+  if (directory == INVALID_HANDLE_VALUE) {
+    throw ref new Platform::FailureException(L"Could not open the directory to watch");
+  }
+  ZeroMemory(&overlapped, sizeof(overlapped));
+  overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+  if (overlapped.hEvent == NULL) {
+    CloseHandle(directory);
+    throw ref new Platform::FailureException(L"Could not create the notification event");
+  }
+  listen();
+}
+
+DirectoryWatcher::~DirectoryWatcher() {
+  CancelIo(directory);
+  DWORD transferred;
+  GetOverlappedResult(directory, &overlapped, &transferred, TRUE);
+  CloseHandle(overlapped.hEvent);
+  CloseHandle(directory);
+}
+
+void DirectoryWatcher::listen() {
+  ResetEvent(overlapped.hEvent);
+  if (!ReadDirectoryChangesW(directory, buffer.data(), static_cast<DWORD>(buffer.size() * sizeof(DWORD)), TRUE,
+      FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE, NULL, &overlapped, NULL)) {
+    throw ref new Platform::FailureException(L"Could not watch the directory");
+  }
+}
+
+bool DirectoryWatcher::wait(uint32 timeoutMilliseconds, std::vector<std::string>& changedNames) {
+  if (WaitForSingleObject(overlapped.hEvent, timeoutMilliseconds) != WAIT_OBJECT_0) {
+    return false;
+  }
+  DWORD transferred;
+  if (!GetOverlappedResult(directory, &overlapped, &transferred, FALSE)) {
+    throw ref new Platform::FailureException(L"Watching the directory failed");
+  }
+  if (transferred == 0) {
+    // the buffer overflowed and the notifications are gone
+    changedNames.push_back(std::string());
+  } else {
+    const byte* position = reinterpret_cast<const byte*>(buffer.data());
+    for (;;) {
+      const FILE_NOTIFY_INFORMATION* notification = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(position);
+      size_t nameLength = notification->FileNameLength / sizeof(WCHAR);
+      doo::text::SmallBuffer<char, 256> name(doo::text::MaximumUtf8Length(nameLength));
+      size_t length = doo::text::Utf16ToUtf8(reinterpret_cast<const doo::text::utf16unit*>(notification->FileName), nameLength, name.data());
+      changedNames.push_back(std::string(name.data(), length));
+      if (notification->NextEntryOffset == 0) {
+        break;
+      }
+      position += notification->NextEntryOffset;
+    }
+  }
+  listen();
+  return true;
+}
+
+#else
+
+DirectoryWatcher::DirectoryWatcher(const std::string& path) {
+  notifications = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (notifications < 0) {
+    throw ref new Platform::FailureException(L"Could not create the notification queue");
+  }
+  if (inotify_add_watch(notifications, path.c_str(), IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE) < 0) {
+    close(notifications);
+    throw ref new Platform::FailureException(L"Could not watch the directory");
+  }
+}
+
+DirectoryWatcher::~DirectoryWatcher() {
+  close(notifications);
+}
+
+bool DirectoryWatcher::wait(uint32 timeoutMilliseconds, std::vector<std::string>& changedNames) {
+  pollfd descriptor;
+  descriptor.fd = notifications;
+  descriptor.events = POLLIN;
+  descriptor.revents = 0;
+  if (poll(&descriptor, 1, static_cast<int>(timeoutMilliseconds)) <= 0) {
+    return false;
+  }
+  std::vector<char> buffer(DirectoryWatcher_BUFFER_SIZE);
+  ssize_t length;
+  while ((length = read(notifications, buffer.data(), buffer.size())) > 0) {
+    for (ssize_t position = 0; position < length;) {
+      const inotify_event* notification = reinterpret_cast<const inotify_event*>(buffer.data() + position);
+      if (notification->mask & IN_Q_OVERFLOW) {
+        changedNames.push_back(std::string());
+      } else if (notification->len > 0) {
+        changedNames.push_back(notification->name);
+      }
+      position += sizeof(inotify_event) + notification->len;
+    }
+  }
+  return true;
+}
+
+#endif
+
+ChangeDebouncer::ChangeDebouncer(uint32 quietMilliseconds)
+  : quietPeriod(quietMilliseconds)
+{
+}
+
+void ChangeDebouncer::notify(const std::string& name, uint64 now) {
+  deadlines[name] = now + quietPeriod;
+}
+
+std::vector<std::string> ChangeDebouncer::takeSettled(uint64 now) {
+  std::vector<std::string> result;
+  for (auto deadline = deadlines.begin(); deadline != deadlines.end();) {
+    if (deadline->second <= now) {
+      result.push_back(deadline->first);
+      deadline = deadlines.erase(deadline);
+    } else {
+      ++deadline;
+    }
+  }
+  return result;
+}
+
+uint32 ChangeDebouncer::getTimeToNextSettle(uint64 now, uint32 timeoutMilliseconds) const {
+  uint64 result = timeoutMilliseconds;
+  for (auto deadline = deadlines.begin(); deadline != deadlines.end(); ++deadline) {
+    result = std::min(result, deadline->second > now ? deadline->second - now : 0);
+  }
+  return static_cast<uint32>(result);
+}
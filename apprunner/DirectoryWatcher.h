@@ -0,0 +1,65 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace doo {
+  namespace metrodriver {
+    // Reports changes to the files of a directory as the operating system notifies about them,
+    // through ReadDirectoryChangesW on Windows and inotify elsewhere. Windows watches the whole tree,
+    // inotify only the directory itself.
+    class DirectoryWatcher {
+    public:
+      DirectoryWatcher(const std::string& directory);
+      ~DirectoryWatcher();
+
+      // wait up to timeoutMilliseconds for changes and append the names of the changed files, relative
+      // to the directory. Returns false on timeout. If notifications were lost because too many arrived
+      // at once, an empty name is reported, which stands for any file.
+      bool wait(uint32 timeoutMilliseconds, std::vector<std::string>& changedNames);
+
+    private:
+      DirectoryWatcher(const DirectoryWatcher&);
+      DirectoryWatcher& operator=(const DirectoryWatcher&);
+
+#ifdef _WIN32
+      // ask for the next batch of notifications
+      void listen();
+
+      HANDLE directory;
+      OVERLAPPED overlapped;
+      // DWORD aligned as ReadDirectoryChangesW requires
+      std::vector<DWORD> buffer;
+#else
+      int notifications;
+#endif
+    };
+
+    // Holds back changes until a file was left alone for the quiet period, so files which are still
+    // being written are only acted on once their writer is done. Times are in milliseconds and come
+    // from the caller, any monotonic clock will do.
+    class ChangeDebouncer {
+    public:
+      ChangeDebouncer(uint32 quietMilliseconds);
+
+      // a change of name at time now, restarts its quiet period
+      void notify(const std::string& name, uint64 now);
+
+      // the names whose quiet period is over by now, they are forgotten
+      std::vector<std::string> takeSettled(uint64 now);
+
+      bool isPending() const {
+        return !deadlines.empty();
+      }
+
+      // how long until the next name settles, at most timeoutMilliseconds
+      uint32 getTimeToNextSettle(uint64 now, uint32 timeoutMilliseconds) const;
+
+    private:
+      uint32 quietPeriod;
+      // when each pending name settles
+      std::map<std::string, uint64> deadlines;
+    };
+  }
+}
@@ -0,0 +1,444 @@
+#include "stdafx.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "Log.h"
+#include "transcode.h"
+
+using doo::metrodriver::ConsoleLogSink;
+using doo::metrodriver::JsonLinesLogSink;
+using doo::metrodriver::Log;
+using doo::metrodriver::LogFields;
+using doo::metrodriver::LogLevel;
+using doo::metrodriver::LogRecord;
+using doo::metrodriver::LogSink;
+
+#ifdef _MSC_VER
+#define Log_THREAD_LOCAL __declspec(thread)
+#else
+#define Log_THREAD_LOCAL __thread
+#endif
+
+// The records of one thread. head is only written by the owning thread and tail only by the writer,
+// each publishes its progress to the other, so neither has to lock.
+struct LogRing {
+  std::atomic<uint32> head;
+  // keep the two counters on separate cache lines
+  char padding[60];
+  std::atomic<uint32> tail;
+  // messages lost because the ring was full, only written by the owning thread
+  std::atomic<uint32> dropped;
+  uint32 reportedDropped;
+  uint32 threadId;
+  LogRecord slots[Log_RING_SIZE];
+};
+
+static const char* levelNames[] = { "debug", "info", "warning", "error" };
+
+// the rings of all threads that ever logged, they outlive their threads so nothing logged is lost
+static std::mutex ringsLock;
+static std::vector<std::unique_ptr<LogRing>> rings;
+static Log_THREAD_LOCAL LogRing* localRing = NULL;
+
+static LogLevel minimumLevel = doo::metrodriver::LogInfo;
+static std::vector<std::shared_ptr<LogSink>> sinks;
+// QueryPerformanceCounter and the wall clock when the writer started, to turn ticks into times
+static int64 startTicks;
+static uint64 startTime;
+static double ticksPerFileTimeUnit;
+
+static std::thread writer;
+static std::mutex writerLock;
+static std::condition_variable writerWakeup;
+static std::condition_variable flushed;
+static bool stopping = false;
+static uint64 flushRequested = 0;
+static uint64 flushCompleted = 0;
+
+static LogRing* getLocalRing() {
+  if (!localRing) {
+    std::unique_ptr<LogRing> ring(new LogRing());
+    ring->head = 0;
+    ring->tail = 0;
+    ring->dropped = 0;
+    ring->reportedDropped = 0;
+    ring->threadId = GetCurrentThreadId();
+    std::lock_guard<std::mutex> guard(ringsLock);
+    rings.push_back(std::move(ring));
+    localRing = rings.back().get();
+  }
+  return localRing;
+}
+
+static void copyString(wchar_t* target, size_t capacity, const wchar_t* source) {
+  size_t length = source ? std::min(wcslen(source), capacity - 1) : 0;
+  memcpy(target, source, length * sizeof(wchar_t));
+  target[length] = 0;
+}
+
+/************************************************************************/
+/* Hand every record that is ready to the sinks in the order they were  */
+/* logged, then give the slots back to their threads                    */
+/************************************************************************/
+static void writeRecords() {
+  std::vector<LogRing*> currentRings;
+  {
+    std::lock_guard<std::mutex> guard(ringsLock);
+    for (auto ring = rings.begin(); ring != rings.end(); ++ring) {
+      currentRings.push_back(ring->get());
+    }
+  }
+
+  std::vector<const LogRecord*> records;
+  std::vector<uint32> heads(currentRings.size());
+  LogRecord droppedRecord;
+  std::vector<LogRecord> droppedRecords;
+  droppedRecords.reserve(currentRings.size());
+  for (size_t i = 0; i < currentRings.size(); i++) {
+    LogRing* ring = currentRings[i];
+    heads[i] = ring->head.load(std::memory_order_acquire);
+    for (uint32 position = ring->tail.load(std::memory_order_relaxed); position != heads[i]; position++) {
+      records.push_back(&ring->slots[position % Log_RING_SIZE]);
+    }
+    uint32 dropped = ring->dropped.load(std::memory_order_relaxed);
+    if (dropped != ring->reportedDropped) {
+      memset(&droppedRecord, 0, sizeof(droppedRecord));
+      LARGE_INTEGER now;
+      QueryPerformanceCounter(&now);
+      droppedRecord.ticks = now.QuadPart;
+      droppedRecord.level = doo::metrodriver::LogWarning;
+      droppedRecord.threadId = ring->threadId;
+      droppedRecord.durationMilliseconds = -1;
+      _snwprintf_s(droppedRecord.message, Log_MESSAGE_LENGTH, _TRUNCATE, L"%u log messages were dropped", dropped - ring->reportedDropped);
+      droppedRecords.push_back(droppedRecord);
+      ring->reportedDropped = dropped;
+    }
+  }
+  for (auto record = droppedRecords.begin(); record != droppedRecords.end(); ++record) {
+    records.push_back(&*record);
+  }
+  std::stable_sort(records.begin(), records.end(), [](const LogRecord* first, const LogRecord* second) {
+    return first->ticks < second->ticks;
+  });
+
+  for (auto record = records.begin(); record != records.end(); ++record) {
+    uint64 time = startTime + static_cast<uint64>(((*record)->ticks - startTicks) / ticksPerFileTimeUnit);
+    for (auto sink = sinks.begin(); sink != sinks.end(); ++sink) {
+      (*sink)->write(**record, time);
+    }
+  }
+  if (!records.empty()) {
+    for (auto sink = sinks.begin(); sink != sinks.end(); ++sink) {
+      (*sink)->flush();
+    }
+  }
+  for (size_t i = 0; i < currentRings.size(); i++) {
+    currentRings[i]->tail.store(heads[i], std::memory_order_release);
+  }
+}
+
+static void runWriter() {
+  std::unique_lock<std::mutex> guard(writerLock);
+  for (;;) {
+    writerWakeup.wait_for(guard, std::chrono::milliseconds(Log_WRITE_INTERVAL));
+    bool stop = stopping;
+    uint64 requested = flushRequested;
+    guard.unlock();
+    writeRecords();
+    guard.lock();
+    flushCompleted = requested;
+    flushed.notify_all();
+    if (stop) {
+      return;
+    }
+  }
+}
+
+void Log::start() {
+  std::vector<std::shared_ptr<LogSink>> environmentSinks;
+  const char* format = getenv("APPRUNNER_LOG_FORMAT");
+  if (format && _stricmp(format, "json") == 0) {
+    environmentSinks.push_back(std::make_shared<JsonLinesLogSink>());
+  } else {
+    environmentSinks.push_back(std::make_shared<ConsoleLogSink>());
+  }
+  const char* filename = getenv("APPRUNNER_LOG_FILE");
+  if (filename && *filename) {
+    environmentSinks.push_back(std::make_shared<JsonLinesLogSink>(filename));
+  }
+  LogLevel level = LogInfo;
+  const char* levelName = getenv("APPRUNNER_LOG_LEVEL");
+  for (int i = LogDebug; levelName && i <= LogError; i++) {
+    if (_stricmp(levelName, levelNames[i]) == 0) {
+      level = static_cast<LogLevel>(i);
+    }
+  }
+  start(environmentSinks, level);
+}
+
+void Log::start(const std::vector<std::shared_ptr<LogSink>>& logSinks, LogLevel level) {
+  if (writer.joinable()) {
+    throw ref new Platform::FailureException(L"The log is already started");
+  }
+  sinks = logSinks;
+  minimumLevel = level;
+  LARGE_INTEGER now, frequency;
+  QueryPerformanceCounter(&now);
+  QueryPerformanceFrequency(&frequency);
+  FILETIME time;
+  GetSystemTimeAsFileTime(&time);
+  startTicks = now.QuadPart;
+  startTime = (static_cast<uint64>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+  // FILETIME counts in 100ns units
+  ticksPerFileTimeUnit = frequency.QuadPart / 1e7;
+  stopping = false;
+  writer = std::thread(runWriter);
+}
+
+void Log::shutdown() {
+  if (!writer.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(writerLock);
+    stopping = true;
+    flushRequested++;
+  }
+  writerWakeup.notify_one();
+  writer.join();
+}
+
+void Log::flush() {
+  std::unique_lock<std::mutex> guard(writerLock);
+  if (!writer.joinable()) {
+    return;
+  }
+  uint64 request = ++flushRequested;
+  writerWakeup.notify_one();
+  flushed.wait(guard, [request]() {
+    return flushCompleted >= request;
+  });
+}
+
+#ifndef _WIN32
+// Windows' wide printf reads %s as a wchar_t string and %S as a char one, the C library the other way
+// around. The format in Windows' terms, or the format itself if it doesn't fit into buffer.
+static const wchar_t* convertFormat(const wchar_t* format, wchar_t* buffer, size_t capacity) {
+  size_t length = 0;
+  for (const wchar_t* c = format; *c; c++) {
+    if (length + 3 > capacity) {
+      return format;
+    }
+    buffer[length++] = *c;
+    if (*c != L'%') {
+      continue;
+    }
+    // flags, width, precision and size up to the conversion
+    while (c[1] && wcschr(L"-+ #0123456789.*hlLqjzt", c[1]) && length + 3 <= capacity) {
+      buffer[length++] = *++c;
+    }
+    if (c[1] == L's' && buffer[length - 1] != L'l') {
+      buffer[length++] = L'l';
+      buffer[length++] = *++c;
+    } else if (c[1] == L'S') {
+      buffer[length++] = L's';
+      c++;
+    } else if (c[1]) {
+      buffer[length++] = *++c;
+    }
+  }
+  buffer[length] = 0;
+  return buffer;
+}
+#endif
+
+/************************************************************************/
+/* The hot path: claim the next slot of the thread's ring, fill it in   */
+/* place and publish it                                                 */
+/************************************************************************/
+void Log::writeV(LogLevel level, const LogFields& fields, const wchar_t* format, va_list arguments) {
+  if (level < minimumLevel) {
+    return;
+  }
+  LogRing* ring = getLocalRing();
+  uint32 head = ring->head.load(std::memory_order_relaxed);
+  if (head - ring->tail.load(std::memory_order_acquire) >= Log_RING_SIZE) {
+    ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    return;
+  }
+
+  LogRecord& record = ring->slots[head % Log_RING_SIZE];
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  record.ticks = now.QuadPart;
+  record.level = level;
+  record.threadId = ring->threadId;
+  record.durationMilliseconds = fields.durationMilliseconds;
+  size_t phaseLength = fields.phase ? std::min(strlen(fields.phase), sizeof(record.phase) - 1) : 0;
+  memcpy(record.phase, fields.phase, phaseLength);
+  record.phase[phaseLength] = 0;
+  copyString(record.package, sizeof(record.package) / sizeof(wchar_t), fields.package);
+  if (wcschr(format, L'%')) {
+#ifndef _WIN32
+    wchar_t converted[Log_MESSAGE_LENGTH];
+    format = convertFormat(format, converted, Log_MESSAGE_LENGTH);
+#endif
+    _vsnwprintf_s(record.message, Log_MESSAGE_LENGTH, _TRUNCATE, format, arguments);
+  } else {
+    copyString(record.message, Log_MESSAGE_LENGTH, format);
+  }
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+void Log::write(LogLevel level, const LogFields& fields, const wchar_t* format, ...) {
+  va_list arguments;
+  va_start(arguments, format);
+  writeV(level, fields, format, arguments);
+  va_end(arguments);
+}
+
+void Log::debug(const LogFields& fields, const wchar_t* format, ...) {
+  va_list arguments;
+  va_start(arguments, format);
+  writeV(LogDebug, fields, format, arguments);
+  va_end(arguments);
+}
+
+void Log::info(const wchar_t* format, ...) {
+  va_list arguments;
+  va_start(arguments, format);
+  writeV(LogInfo, LogFields(), format, arguments);
+  va_end(arguments);
+}
+
+void Log::info(const LogFields& fields, const wchar_t* format, ...) {
+  va_list arguments;
+  va_start(arguments, format);
+  writeV(LogInfo, fields, format, arguments);
+  va_end(arguments);
+}
+
+void Log::warning(const wchar_t* format, ...) {
+  va_list arguments;
+  va_start(arguments, format);
+  writeV(LogWarning, LogFields(), format, arguments);
+  va_end(arguments);
+}
+
+void Log::error(const wchar_t* format, ...) {
+  va_list arguments;
+  va_start(arguments, format);
+  writeV(LogError, LogFields(), format, arguments);
+  va_end(arguments);
+}
+
+void ConsoleLogSink::write(const LogRecord& record, uint64) {
+  fputws(record.message, stdout);
+  fputwc(L'\n', stdout);
+}
+
+void ConsoleLogSink::flush() {
+  fflush(stdout);
+}
+
+JsonLinesLogSink::JsonLinesLogSink()
+  : output(stdout), ownsOutput(false)
+{
+}
+
+JsonLinesLogSink::JsonLinesLogSink(const std::string& filename)
+  : ownsOutput(true)
+{
+  output = fopen(filename.c_str(), "ab");
+  if (!output) {
+    throw ref new Platform::FailureException(L"Could not open the log file");
+  }
+}
+
+JsonLinesLogSink::~JsonLinesLogSink() {
+  if (ownsOutput) {
+    fclose(output);
+  }
+}
+
+// append text as a JSON string including the quotes
+static void appendJsonString(std::string& line, const char* text, size_t length) {
+  line += '"';
+  for (size_t i = 0; i < length; i++) {
+    unsigned char c = static_cast<unsigned char>(text[i]);
+    if (c == '"' || c == '\\') {
+      line += '\\';
+      line += c;
+    } else if (c < 0x20) {
+      char escaped[8];
+      _snprintf_s(escaped, sizeof(escaped), _TRUNCATE, "\\u%04x", c);
+      line += escaped;
+    } else {
+      line += c;
+    }
+  }
+  line += '"';
+}
+
+static void appendJsonString(std::string& line, const wchar_t* text) {
+  size_t length = wcslen(text);
+#ifdef _WIN32
+  // wchar_t holds UTF-16 on Windows
+  const doo::text::utf16unit* utf16 = reinterpret_cast<const doo::text::utf16unit*>(text);
+#else
+  // and UTF-32 elsewhere, characters outside the BMP take two units
+  doo::text::SmallBuffer<doo::text::utf16unit, 2 * Log_MESSAGE_LENGTH> units(2 * length);
+  doo::text::utf16unit* utf16 = units.data();
+  size_t unitCount = 0;
+  for (size_t i = 0; i < length; i++) {
+    uint32 c = static_cast<uint32>(text[i]);
+    if (c > 0xFFFF) {
+      utf16[unitCount++] = static_cast<doo::text::utf16unit>(0xD800 + ((c - 0x10000) >> 10));
+      utf16[unitCount++] = static_cast<doo::text::utf16unit>(0xDC00 + ((c - 0x10000) & 0x3FF));
+    } else {
+      utf16[unitCount++] = static_cast<doo::text::utf16unit>(c);
+    }
+  }
+  length = unitCount;
+#endif
+  doo::text::SmallBuffer<char, 3 * Log_MESSAGE_LENGTH> utf8(doo::text::MaximumUtf8Length(length));
+  size_t utf8Length = doo::text::Utf16ToUtf8(utf16, length, utf8.data());
+  appendJsonString(line, utf8.data(), utf8Length);
+}
+
+void JsonLinesLogSink::write(const LogRecord& record, uint64 time) {
+  FILETIME fileTime;
+  fileTime.dwLowDateTime = static_cast<uint32>(time);
+  fileTime.dwHighDateTime = static_cast<uint32>(time >> 32);
+  SYSTEMTIME systemTime;
+  FileTimeToSystemTime(&fileTime, &systemTime);
+  char prefix[96];
+  _snprintf_s(prefix, sizeof(prefix), _TRUNCATE, "{\"time\":\"%04u-%02u-%02uT%02u:%02u:%02u.%03uZ\",\"level\":\"%s\",\"thread\":%u",
+    systemTime.wYear, systemTime.wMonth, systemTime.wDay, systemTime.wHour, systemTime.wMinute, systemTime.wSecond,
+    systemTime.wMilliseconds, levelNames[record.level], record.threadId);
+  line = prefix;
+  if (record.package[0]) {
+    line += ",\"package\":";
+    appendJsonString(line, record.package);
+  }
+  if (record.phase[0]) {
+    line += ",\"phase\":";
+    appendJsonString(line, record.phase, strlen(record.phase));
+  }
+  if (record.durationMilliseconds >= 0) {
+    char duration[32];
+    _snprintf_s(duration, sizeof(duration), _TRUNCATE, ",\"duration_ms\":%.3f", record.durationMilliseconds);
+    line += duration;
+  }
+  line += ",\"message\":";
+  appendJsonString(line, record.message);
+  line += "}\n";
+  fwrite(line.data(), 1, line.size(), output);
+}
+
+void JsonLinesLogSink::flush() {
+  fflush(output);
+}
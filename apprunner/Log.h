@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdarg>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+// the longest message a record holds, longer ones are cut off
+#define Log_MESSAGE_LENGTH 232
+// records buffered per thread before messages are dropped
+#define Log_RING_SIZE 256
+// how often the writer thread looks for new records
+#define Log_WRITE_INTERVAL 10
+
+namespace doo {
+  namespace metrodriver {
+    enum LogLevel {
+      LogDebug,
+      LogInfo,
+      LogWarning,
+      LogError
+    };
+
+    // optional structured fields of a message, null or negative for the ones that don't apply
+    struct LogFields {
+      const wchar_t* package;
+      const char* phase;
+      double durationMilliseconds;
+
+      explicit LogFields(const wchar_t* package = nullptr, const char* phase = nullptr, double durationMilliseconds = -1)
+        : package(package), phase(phase), durationMilliseconds(durationMilliseconds) {}
+    };
+
+    // one message as it sits in a thread's ring until it is written
+    struct LogRecord {
+      // QueryPerformanceCounter ticks, orders records of different threads
+      int64 ticks;
+      LogLevel level;
+      uint32 threadId;
+      double durationMilliseconds;
+      char phase[24];
+      wchar_t package[64];
+      wchar_t message[Log_MESSAGE_LENGTH];
+    };
+
+    // where records end up, only ever called from the writer thread
+    class LogSink {
+    public:
+      virtual ~LogSink() {}
+      // time is the record's wall clock time as a FILETIME
+      virtual void write(const LogRecord& record, uint64 time) = 0;
+      virtual void flush() {}
+    };
+
+    // the plain messages, like the console output always looked
+    class ConsoleLogSink : public LogSink {
+    public:
+      virtual void write(const LogRecord& record, uint64 time);
+      virtual void flush();
+    };
+
+    // one JSON object per line with all fields, for log collectors
+    class JsonLinesLogSink : public LogSink {
+    public:
+      // write to standard output
+      JsonLinesLogSink();
+      // append to a file, throws if it can't be opened
+      JsonLinesLogSink(const std::string& filename);
+      ~JsonLinesLogSink();
+
+      virtual void write(const LogRecord& record, uint64 time);
+      virtual void flush();
+
+    private:
+      JsonLinesLogSink(const JsonLinesLogSink&);
+      JsonLinesLogSink& operator=(const JsonLinesLogSink&);
+
+      FILE* output;
+      bool ownsOutput;
+      std::string line;
+    };
+
+    // Logging that never waits for the console or a file.
+    //
+    // Every thread formats its messages into a ring of its own, which only that thread writes and only
+    // the writer thread reads, so logging takes no lock and makes no system call. The writer thread
+    // collects the records of all threads every few milliseconds, orders them by time and hands them to
+    // the sinks. A thread that logs faster than the sinks keep up loses messages instead of blocking,
+    // the writer reports how many. Messages without format arguments are copied as they are.
+    class Log {
+    public:
+      // start the writer with the sinks the environment asks for: APPRUNNER_LOG_FORMAT=json writes JSON
+      // lines instead of text to the console, APPRUNNER_LOG_FILE appends JSON lines to a file as well, and
+      // APPRUNNER_LOG_LEVEL=debug|info|warning|error sets the least important level written (info).
+      static void start();
+      static void start(const std::vector<std::shared_ptr<LogSink>>& sinks, LogLevel minimumLevel);
+      // write everything logged so far and stop the writer
+      static void shutdown();
+      // wait until everything logged so far has been written
+      static void flush();
+
+      static void write(LogLevel level, const LogFields& fields, const wchar_t* format, ...);
+      static void writeV(LogLevel level, const LogFields& fields, const wchar_t* format, va_list arguments);
+
+      static void debug(const LogFields& fields, const wchar_t* format, ...);
+      static void info(const wchar_t* format, ...);
+      static void info(const LogFields& fields, const wchar_t* format, ...);
+      static void warning(const wchar_t* format, ...);
+      static void error(const wchar_t* format, ...);
+    };
+  }
+}
@@ -1,26 +1,29 @@
 #include "stdafx.h"
 
 #include <collection.h>
+#include <ShlObj.h>
 
 #include "Package.h"
-#include "SystemUtils.h"
 #include "helper.h"
+#include "Log.h"
 
 using Windows::Storage::StorageFile;
 using Windows::Data::Xml::Dom::XmlDocument;
 
-using namespace Windows::Management::Deployment;
-
+using doo::metrodriver::Log;
+using doo::metrodriver::LogFields;
 using doo::metrodriver::Package;
 
-Package::Package(Platform::String^ sourcePath) 
-  : source(sourcePath) 
+Package::Package(Platform::String^ sourcePath, std::shared_ptr<DeploymentBackend> deploymentBackend) 
+  : source(sourcePath), backend(deploymentBackend)
 {
-  packageManager = ref new PackageManager();
-
+  PhaseTimings::Scope metadataScope(timings, "metadata");
   if (isAppx()) {
     metadata = ApplicationMetadata::CreateFromAppx(sourcePath);
     findDependencyPackages();
+  } else if (isBundle()) {
+    metadata = ApplicationMetadata::CreateFromBundle(sourcePath);
+    findDependencyPackages();
   } else {
     metadata = ApplicationMetadata::CreateFromManifest(sourcePath);
   }
@@ -30,14 +33,17 @@ bool Package::isAppx() {
   return StrCmpIW(source->Data()+(source->Length()-5), L".appx") == 0;
 }
 
+bool Package::isBundle() {
+  return source->Length() > 11 && StrCmpIW(source->Data()+(source->Length()-11), L".appxbundle") == 0;
+}
+
 Platform::String^ Package::stageAppx() {
-  _tprintf_s(L"Staging package version %s\n", metadata->PackageVersion->Data());
-  auto appxUri = ref new Windows::Foundation::Uri(source);
+  Log::info(LogFields(metadata->PackageName->Data()), L"Staging package version %s", metadata->PackageVersion->Data());
 
-  auto deploymentResult = Concurrency::task<DeploymentResult^>(packageManager->StagePackageAsync(
-    appxUri, getDependencyUris())).get();
+  PhaseTimings::Scope stagingScope(timings, "staging");
+  std::wstring errorText = backend->stagePackage(getIdentity(), source->Data(), getDependencyUris());
 
-  if (deploymentResult->ErrorText->Length() > 0) {
+  if (!errorText.empty()) {
     throw ref new Platform::FailureException("Staging failed");
   }
   // not nice but working for nows
@@ -45,35 +51,56 @@ Platform::String^ Package::stageAppx() {
     return findStagedManifest(dependency);
   });
 
+  // the bundle itself has no manifest, the package staged from it does
+  if (isBundle()) {
+    return stagedManifestPath(metadata->PackageFullName);
+  }
   return findStagedManifest(source);
 }
 
-Windows::Foundation::Collections::IIterable<Windows::Foundation::Uri^>^ Package::getDependencyUris() {
-  Platform::Collections::Vector<Windows::Foundation::Uri^>^ dependencyUris = ref new Platform::Collections::Vector<Windows::Foundation::Uri^>();
-  std::for_each(dependencies.begin(), dependencies.end(), [dependencyUris](Platform::String^ dependency) {
-    dependencyUris->Append(ref new Windows::Foundation::Uri(dependency));
+std::vector<std::wstring> Package::getDependencyUris() {
+  std::vector<std::wstring> dependencyUris;
+  std::for_each(dependencies.begin(), dependencies.end(), [&dependencyUris](Platform::String^ dependency) {
+    dependencyUris.push_back(dependency->Data());
   });
   return dependencyUris;
 }
 
+// what the package is to the deployment backend
+doo::metrodriver::PackageIdentity Package::getIdentity() {
+  PackageIdentity identity;
+  identity.name = metadata->PackageName->Data();
+  identity.publisher = metadata->Publisher->Data();
+  identity.version = metadata->PackageVersion->Data();
+  identity.fullName = metadata->PackageFullName->Data();
+  return identity;
+}
+
 Platform::String^ Package::findStagedManifest(Platform::String^ appxPath) {
   auto metadata = ApplicationMetadata::CreateFromAppx(appxPath);
+  return stagedManifestPath(metadata->PackageFullName);
+}
+
+Platform::String^ Package::stagedManifestPath(Platform::String^ packageFullName) {
   std::wstring stagingDirectory = L"C:\\Program Files\\WindowsApps\\";
-  stagingDirectory += metadata->PackageFullName->Data();
+  stagingDirectory += packageFullName->Data();
   stagingDirectory += L"\\AppxManifest.xml";
   return ref new Platform::String(stagingDirectory.c_str());
 }
 
 void Package::install(InstallationMode mode) {
-  _tprintf_s(L"Installing app\n");
-
-  DeploymentResult^ deploymentResult;
-  // just to satisfy the compiler >:|
-  Windows::Foundation::Collections::IIterable<Windows::Foundation::Uri^>^ dependencyUris = nullptr;
-  auto existingPackage = findSystemPackage();
-  if (existingPackage) {
-    bool sameVersionInstalled = getPackageVersionString(existingPackage->Id->Version)->Equals(metadata->PackageVersion);
+  Log::info(LogFields(metadata->PackageName->Data()), L"Installing app");
+
+  std::wstring errorText;
+  PackageIdentity existingPackage;
+  if (findSystemPackage(existingPackage)) {
+    bool sameVersionInstalled = existingPackage.version == metadata->PackageVersion->Data();
     switch (mode) {
+    case ReinstallOrUpdate:
+      if (sameVersionInstalled) {
+        uninstall();
+        break;
+      }
     case SkipOrUpdate:
       if (sameVersionInstalled) {
         postInstall();
@@ -83,11 +110,12 @@ void Package::install(InstallationMode mode) {
       if (sameVersionInstalled) {
         throw ref new Platform::InvalidArgumentException(L"Package with the same version already installed, cannot update");
       }
-      _tprintf_s(L"Updating package from version %s to version %s\n", getPackageVersionString(existingPackage->Id->Version)->Data(), metadata->PackageVersion->Data());
-      dependencyUris = getDependencyUris();
-      deploymentResult = Concurrency::task<DeploymentResult^>(packageManager->UpdatePackageAsync(
-        ref new Windows::Foundation::Uri(source), dependencyUris, DeploymentOptions::None)).get();
-      if (deploymentResult->ErrorText->Length() > 0) {
+      Log::info(LogFields(metadata->PackageName->Data()), L"Updating package from version %s to version %s", existingPackage.version.c_str(), metadata->PackageVersion->Data());
+      {
+        PhaseTimings::Scope updateScope(timings, "update");
+        errorText = backend->updatePackage(getIdentity(), source->Data(), getDependencyUris());
+      }
+      if (!errorText.empty()) {
         throw ref new Platform::FailureException(L"Update failed");
       }
       postInstall();
@@ -97,22 +125,26 @@ void Package::install(InstallationMode mode) {
       break;
     }
   }
-  Windows::Foundation::Uri^ manifestUri = ref new Windows::Foundation::Uri(isAppx() ? stageAppx() : (source));
-  _tprintf_s(L"Registering package\n");
-  dependencyUris = getDependencyUris();
-  deploymentResult = Concurrency::task<DeploymentResult^>(packageManager->RegisterPackageAsync(
-    manifestUri, dependencyUris, DeploymentOptions::None)).get();
+  Platform::String^ manifestUri = (isAppx() || isBundle()) ? stageAppx() : source;
+  Log::info(LogFields(metadata->PackageName->Data()), L"Registering package");
+  {
+    PhaseTimings::Scope registrationScope(timings, "registration");
+    errorText = backend->registerPackage(getIdentity(), manifestUri->Data(), getDependencyUris());
+  }
 
-  if (deploymentResult->ErrorText->Length() > 0) {
+  if (!errorText.empty()) {
     throw ref new Platform::FailureException(L"Installation failed");
   }
   postInstall();
 }
 
 void Package::postInstall() {
-  systemPackage = findSystemPackage();
-  _tprintf_s(L"Installation successful. Full name is: %s\n", systemPackage->Id->FullName->Data());
-  packageSuffix = ref new Platform::String(StrRChrW(systemPackage->Id->FullName->Data(), nullptr, '_'));
+  if (!findSystemPackage(systemPackage)) {
+    throw ref new Platform::FailureException(L"Package not installed");
+  }
+  Log::info(LogFields(metadata->PackageName->Data()), L"Installation successful. Full name is: %s", systemPackage.fullName.c_str());
+  size_t suffix = systemPackage.fullName.rfind(L'_');
+  packageSuffix = ref new Platform::String(suffix == std::wstring::npos ? L"" : systemPackage.fullName.c_str() + suffix);
 }
 
 void Package::findDependencyPackages() {
@@ -137,7 +169,8 @@ void Package::findDependenciesInDirectory(std::string appxPath) {
     return;
   }
   do {
-    auto path = stringToPlatformString((appxPath+findData.cFileName).c_str());
+    std::string dependencyPath = appxPath + findData.cFileName;
+    auto path = stringToPlatformString(dependencyPath.data(), static_cast<int>(dependencyPath.size()));
     dependencies.push_back(path);
   } while (FindNextFileA(findFirstHandle, &findData));
 
@@ -145,81 +178,68 @@ void Package::findDependenciesInDirectory(std::string appxPath) {
   return;
 }
 
-Windows::ApplicationModel::Package^ Package::findSystemPackage() {
-  Windows::ApplicationModel::Package^ package = nullptr;
-  Platform::String^ userSid = SystemUtils::GetSIDForCurrentUser();
-  auto packageIterable = packageManager->FindPackagesForUser(userSid, metadata->PackageName, metadata->Publisher);
-  auto packageIterator = packageIterable->First();
-  if (packageIterator->HasCurrent) {
-    return packageIterator->Current;
-  } else {
-    return nullptr;
+Platform::String^ Package::getFullName() {
+  if (systemPackage.fullName.empty()) {
+    throw ref new Platform::FailureException(L"Package not installed");
   }
+  return ref new Platform::String(systemPackage.fullName.c_str());
 }
 
-Platform::String^ Package::getPackageVersionString(Windows::ApplicationModel::PackageVersion version) {
-  return version.Major.ToString() +
-    "." + version.Minor.ToString() +
-    "." + version.Build.ToString() +
-    "." + version.Revision.ToString();
+Platform::String^ Package::getLocalStatePath() {
+  PWSTR localAppData;
+  if FAILED(SHGetKnownFolderPath(FOLDERID_LocalAppData, 0, NULL, &localAppData)) {
+    throw ref new Platform::FailureException(L"Could not determine the local application data folder");
+  }
+  auto result = ref new Platform::String(localAppData) + L"\\Packages\\" + getFullAppId() + L"\\LocalState";
+  CoTaskMemFree(localAppData);
+  return result;
+}
+
+bool Package::findSystemPackage(PackageIdentity& package) {
+  std::vector<PackageIdentity> packages = backend->findPackages(metadata->PackageName->Data(), metadata->Publisher->Data());
+  if (packages.empty()) {
+    return false;
+  }
+  package = packages.front();
+  return true;
 }
 
 void Package::enableDebugging(bool newValue) { 
-  static ATL::CComQIPtr<IPackageDebugSettings> packageDebugSettings;
-  if (!systemPackage) {
+  if (systemPackage.fullName.empty()) {
     throw ref new Platform::FailureException(L"Package needs to be installed before configuring debugging");
   }
-  if (!packageDebugSettings) {
-    HRESULT res = packageDebugSettings.CoCreateInstance(CLSID_PackageDebugSettings, NULL, CLSCTX_ALL);
-    if FAILED(res) {
-      _tprintf_s(L"Failed to instantiate a PackageDebugSettings object. Debugging could not be configured");
-      return;
-    }  
-  }
   if (newValue) {
-    _tprintf_s(L"Enabling debugging for %s\n", systemPackage->Id->FullName->Data());
-    packageDebugSettings->EnableDebugging(systemPackage->Id->FullName->Data(), NULL, NULL);
+    Log::info(LogFields(metadata->PackageName->Data()), L"Enabling debugging for %s", systemPackage.fullName.c_str());
   } else {
-    _tprintf_s(L"Disabling debugging\n");
-    packageDebugSettings->DisableDebugging(systemPackage->Id->FullName->Data());
+    Log::info(LogFields(metadata->PackageName->Data()), L"Disabling debugging");
+  }
+  if (!backend->setDebugging(systemPackage.fullName, newValue)) {
+    Log::warning(L"Debugging could not be configured");
   }
 }
 
 // uninstall the current and all previous versions of this package
 void Package::uninstall() {
-  Windows::ApplicationModel::Package^ package = nullptr;
-  Platform::String^ userSid = SystemUtils::GetSIDForCurrentUser();
-  auto packageIterable = packageManager->FindPackagesForUser(userSid, metadata->PackageName, metadata->Publisher);
-  auto packageIterator = packageIterable->First();
-  while (packageIterator->HasCurrent) {
-    auto currentPackage = packageIterator->Current;
-    _tprintf_s(L"Uninstalling %s %s\n", currentPackage->Id->Name->Data(), getPackageVersionString(currentPackage->Id->Version)->Data());
-    auto deploymentResult = Concurrency::task<DeploymentResult^>(packageManager->RemovePackageAsync(currentPackage->Id->FullName)).get();
-    if (deploymentResult->ErrorText->Length() > 0) {
-      throw ref new Platform::FailureException(L"Could not uninstall previously installed version: " + deploymentResult->ErrorText);
+  std::vector<PackageIdentity> packages = backend->findPackages(metadata->PackageName->Data(), metadata->Publisher->Data());
+  for (auto currentPackage = packages.begin(); currentPackage != packages.end(); ++currentPackage) {
+    Log::info(LogFields(metadata->PackageName->Data()), L"Uninstalling %s %s", currentPackage->name.c_str(), currentPackage->version.c_str());
+    PhaseTimings::Scope uninstallScope(timings, "uninstall");
+    std::wstring errorText = backend->removePackage(currentPackage->fullName);
+    if (!errorText.empty()) {
+      throw ref new Platform::FailureException(L"Could not uninstall previously installed version: " + ref new Platform::String(errorText.c_str()));
     }
-    packageIterator->MoveNext();
   }
 }
 
 long long Package::startApplication() {
-  if (!systemPackage) {
+  if (systemPackage.fullName.empty()) {
     throw ref new Platform::AccessDeniedException(L"Package not installed, cannot start app");
   }
 
   auto fullAppId = metadata->PackageName + packageSuffix + "!" + metadata->AppId;
+  return backend->activateApplication(fullAppId->Data());
+}
 
-  ATL::CComPtr<IApplicationActivationManager> appManager;
-  HRESULT res = appManager.CoCreateInstance(__uuidof(ApplicationActivationManager));
-  ATLVERIFY(SUCCEEDED(res));
-  if FAILED(res) {
-    throw ref new Platform::FailureException(L"Could not create ApplicationActivationManager");
-  }
-
-  DWORD processId;
-  res = appManager->ActivateApplication(fullAppId->Data(), nullptr, AO_NONE, &processId);
-  if FAILED(res) {
-    throw ref new Platform::FailureException(L"Could not activate application %s\n" + fullAppId);
-  }
-  return processId;
+int Package::waitForApplication(long long processId, uint64* peakMemory) {
+  return backend->waitForApplication((uint32)processId, peakMemory);
 }
\ No newline at end of file
@@ -4,6 +4,8 @@
 #include <collection.h>
 
 #include "ApplicationMetadata.h"
+#include "DeploymentBackend.h"
+#include "PhaseTimings.h"
 
 namespace doo {
   namespace metrodriver {
@@ -12,11 +14,13 @@ namespace doo {
       enum InstallationMode {
         Reinstall,
         Update,
-        SkipOrUpdate
+        SkipOrUpdate,
+        // reinstall over the same version, update any other
+        ReinstallOrUpdate
       };
 
-      // create from either an .appx or AppxManifest.xml
-      Package(Platform::String^ source);
+      // create from either an .appx, .appxbundle or AppxManifest.xml, deployed through backend
+      Package(Platform::String^ source, std::shared_ptr<DeploymentBackend> backend = DeploymentBackend::shared());
 
       // when debugging is enabled, the app won't be shut down when in the background
       void enableDebugging(bool newValue);
@@ -29,6 +33,17 @@ namespace doo {
       Platform::String^ getFullAppId() {
         return metadata->PackageName + packageSuffix;
       }
+
+      // the full name of the installed package
+      Platform::String^ getFullName();
+
+      // the LocalState folder of the installed package
+      Platform::String^ getLocalStatePath();
+
+      // durations of the deployment steps performed so far
+      PhaseTimings& getTimings() {
+        return timings;
+      }
       
 
       // uninstall the app, including possible previous versions
@@ -40,9 +55,14 @@ namespace doo {
       // start the app and return the process id
       long long startApplication();
 
+      // wait for the app started with processId to exit and return its exit code, peakMemory gets
+      // its peak working set
+      int waitForApplication(long long processId, uint64* peakMemory = nullptr);
+
     private:
-      Windows::ApplicationModel::Package^ findSystemPackage();
-      Platform::String^ getPackageVersionString(Windows::ApplicationModel::PackageVersion version);
+      // the installed version of this package, returns false if there is none
+      bool findSystemPackage(PackageIdentity& package);
+      PackageIdentity getIdentity();
       void findDependencyPackages();
       void findDependenciesInDirectory(std::string appxPath);
 
@@ -53,18 +73,21 @@ namespace doo {
       void postInstall();
 
       Platform::String^ findStagedManifest(Platform::String^ appxPath);
-      Windows::Foundation::Collections::IIterable<Windows::Foundation::Uri^>^ getDependencyUris();
+      static Platform::String^ stagedManifestPath(Platform::String^ packageFullName);
+      std::vector<std::wstring> getDependencyUris();
 
       bool isAppx();
+      bool isBundle();
       Platform::String^ source;
 
       ApplicationMetadata^ metadata;
-      Windows::ApplicationModel::Package^ systemPackage;
+      // empty until the package is installed
+      PackageIdentity systemPackage;
       Platform::String^ packageSuffix;
       
-      Windows::Management::Deployment::PackageManager^ packageManager;
-      Windows::ApplicationModel::Package^ storePackage;
+      std::shared_ptr<DeploymentBackend> backend;
       std::vector<Platform::String^> dependencies;
+      PhaseTimings timings;
     };
   }
 }
@@ -0,0 +1,47 @@
+#include "stdafx.h"
+
+#include "PhaseTimings.h"
+#include "Log.h"
+
+using doo::metrodriver::Log;
+using doo::metrodriver::LogFields;
+using doo::metrodriver::PhaseTimings;
+
+static double elapsedMilliseconds(const LARGE_INTEGER& start) {
+  LARGE_INTEGER now, frequency;
+  QueryPerformanceCounter(&now);
+  QueryPerformanceFrequency(&frequency);
+  return (now.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart;
+}
+
+PhaseTimings::Scope::Scope(PhaseTimings& phaseTimings, const char* phaseName)
+  : timings(phaseTimings), name(phaseName)
+#ifdef APPRUNNER_ALLOCATION_TRACKING
+  , allocationScope(AllocationTracker::Phase, phaseName)
+#endif
+{
+  QueryPerformanceCounter(&start);
+}
+
+PhaseTimings::Scope::~Scope() {
+  double milliseconds = elapsedMilliseconds(start);
+  timings.record(name, milliseconds);
+  Log::debug(LogFields(nullptr, name, milliseconds), L"%S took %.1f ms", name, milliseconds);
+}
+
+void PhaseTimings::record(const char* name, double milliseconds) {
+  Phase phase;
+  phase.name = name;
+  phase.milliseconds = milliseconds;
+  phases.push_back(phase);
+}
+
+double PhaseTimings::getDuration(const char* name) const {
+  double total = 0;
+  std::for_each(phases.begin(), phases.end(), [name, &total](const Phase& phase) {
+    if (phase.name == name) {
+      total += phase.milliseconds;
+    }
+  });
+  return total;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "AllocationTracker.h"
+
+namespace doo {
+  namespace metrodriver {
+    // wall clock durations of the individual phases of a run
+    class PhaseTimings {
+    public:
+      struct Phase {
+        std::string name;
+        double milliseconds;
+      };
+
+      // records the lifetime of the scope as a phase
+      class Scope {
+      public:
+        Scope(PhaseTimings& timings, const char* name);
+        ~Scope();
+
+      private:
+        Scope& operator=(const Scope&);
+
+        PhaseTimings& timings;
+        const char* name;
+        LARGE_INTEGER start;
+#ifdef APPRUNNER_ALLOCATION_TRACKING
+        // the phase's allocations are attributed to it as well
+        AllocationTracker::Scope allocationScope;
+#endif
+      };
+
+      void record(const char* name, double milliseconds);
+
+      // the accumulated duration of all phases with the given name
+      double getDuration(const char* name) const;
+
+      const std::vector<Phase>& getPhases() const {
+        return phases;
+      }
+
+    private:
+      std::vector<Phase> phases;
+    };
+  }
+}
@@ -0,0 +1,245 @@
+#include "stdafx.h"
+
+#include <cmath>
+#include <limits>
+#include <map>
+
+#include "RunHistory.h"
+#include "crc32.h"
+
+using doo::metrodriver::MetricBaseline;
+using doo::metrodriver::Regression;
+using doo::metrodriver::RunHistory;
+using doo::metrodriver::RunRecord;
+using doo::metrodriver::VersionBaseline;
+
+#define RunHistory_MAGIC "RHST"
+#define RunHistory_FORMAT_VERSION 1
+
+// at the start of the file, followed by the records
+struct RunHistoryHeader {
+  char magic[4];
+  uint32 formatVersion;
+  uint32 recordSize;
+  uint32 reserved;
+};
+
+static_assert(sizeof(RunRecord) == 128, "the record layout is part of the file format");
+
+static const char* phaseNames[] = RunHistory_PHASE_NAMES;
+
+static uint32 recordChecksum(const RunRecord& record) {
+  return doo::zip::UpdateCrc32(0, reinterpret_cast<const byte*>(&record), offsetof(RunRecord, checksum));
+}
+
+RunRecord RunRecord::create(const std::string& packageName, const std::string& packageVersion, const PhaseTimings& timings) {
+  RunRecord record;
+  memset(&record, 0, sizeof(record));
+  FILETIME now;
+  GetSystemTimeAsFileTime(&now);
+  record.startTime = (static_cast<uint64>(now.dwHighDateTime) << 32) | now.dwLowDateTime;
+  strncpy(record.packageName, packageName.c_str(), sizeof(record.packageName) - 1);
+
+  const char* part = packageVersion.c_str();
+  for (int i = 0; i < 4 && *part; i++) {
+    char* end;
+    record.version[i] = static_cast<uint16>(strtoul(part, &end, 10));
+    part = *end == '.' ? end + 1 : end;
+  }
+
+  auto& phases = timings.getPhases();
+  for (auto phase = phases.begin(); phase != phases.end(); ++phase) {
+    for (unsigned i = 0; i < RunHistory_PHASE_COUNT; i++) {
+      if (phase->name == phaseNames[i]) {
+        record.phaseMilliseconds[i] += static_cast<float>(phase->milliseconds);
+      }
+    }
+  }
+  return record;
+}
+
+/************************************************************************/
+/* Records are written in one piece, a file whose end was cut short is  */
+/* padded first so the new record starts at a record boundary again     */
+/************************************************************************/
+void RunHistory::append(const std::string& filename, const RunRecord& record) {
+  std::ofstream output(filename.c_str(), std::ios::binary | std::ios::app);
+  if (!output) {
+    throw ref new Platform::FailureException(L"Could not open the run history");
+  }
+  output.seekp(0, std::ios::end);
+  uint64 size = static_cast<uint64>(output.tellp());
+  if (size == 0) {
+    RunHistoryHeader header;
+    memcpy(header.magic, RunHistory_MAGIC, sizeof(header.magic));
+    header.formatVersion = RunHistory_FORMAT_VERSION;
+    header.recordSize = sizeof(RunRecord);
+    header.reserved = 0;
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  } else if (size > sizeof(RunHistoryHeader) && (size - sizeof(RunHistoryHeader)) % sizeof(RunRecord) != 0) {
+    std::vector<char> padding(sizeof(RunRecord) - (size - sizeof(RunHistoryHeader)) % sizeof(RunRecord));
+    output.write(padding.data(), padding.size());
+  }
+
+  RunRecord stored = record;
+  stored.checksum = recordChecksum(stored);
+  output.write(reinterpret_cast<const char*>(&stored), sizeof(stored));
+  output.flush();
+  if (!output) {
+    throw ref new Platform::FailureException(L"Could not write to the run history");
+  }
+}
+
+RunHistory::RunHistory(const std::string& filename)
+  : records(NULL), count(0)
+{
+#ifdef _WIN32
+  if (GetFileAttributesA(filename.c_str()) == INVALID_FILE_ATTRIBUTES) {
+    return;
+  }
+#else
+  if (access(filename.c_str(), F_OK) != 0) {
+    return;
+  }
+#endif
+  file = std::make_shared<doo::zip::MappedFile>(filename);
+  const RunHistoryHeader* header = reinterpret_cast<const RunHistoryHeader*>(file->GetData());
+  if (file->GetSize() < sizeof(RunHistoryHeader) || memcmp(header->magic, RunHistory_MAGIC, sizeof(header->magic)) != 0
+      || header->formatVersion != RunHistory_FORMAT_VERSION || header->recordSize != sizeof(RunRecord)) {
+    throw ref new Platform::FailureException(L"Not a run history file");
+  }
+  records = reinterpret_cast<const RunRecord*>(file->GetData() + sizeof(RunHistoryHeader));
+  count = static_cast<size_t>((file->GetSize() - sizeof(RunHistoryHeader)) / sizeof(RunRecord));
+}
+
+static MetricBaseline computeBaseline(const std::vector<double>& values) {
+  MetricBaseline result;
+  result.runs = static_cast<uint32>(values.size());
+  result.mean = 0;
+  result.deviation = 0;
+  if (values.empty()) {
+    return result;
+  }
+  for (auto value = values.begin(); value != values.end(); ++value) {
+    result.mean += *value;
+  }
+  result.mean /= values.size();
+  if (values.size() > 1) {
+    for (auto value = values.begin(); value != values.end(); ++value) {
+      result.deviation += (*value - result.mean) * (*value - result.mean);
+    }
+    result.deviation = sqrt(result.deviation / (values.size() - 1));
+  }
+  return result;
+}
+
+/************************************************************************/
+/* One pass over the mapped records collects the runs of the package    */
+/* per version, then each baseline is computed from the newest runs     */
+/************************************************************************/
+std::vector<VersionBaseline> RunHistory::getBaselines(const std::string& packageName, size_t window) const {
+  std::vector<uint64> versionOrder;
+  std::map<uint64, std::vector<const RunRecord*>> runsByVersion;
+  for (size_t index = 0; index < count; index++) {
+    const RunRecord& record = records[index];
+    if (strncmp(record.packageName, packageName.c_str(), sizeof(record.packageName)) != 0
+        || record.checksum != recordChecksum(record)) {
+      continue;
+    }
+    uint64 version = (static_cast<uint64>(record.version[0]) << 48) | (static_cast<uint64>(record.version[1]) << 32)
+      | (static_cast<uint64>(record.version[2]) << 16) | record.version[3];
+    std::vector<const RunRecord*>& runs = runsByVersion[version];
+    if (runs.empty()) {
+      versionOrder.push_back(version);
+    }
+    runs.push_back(&record);
+  }
+
+  std::vector<VersionBaseline> result;
+  for (auto version = versionOrder.begin(); version != versionOrder.end(); ++version) {
+    const std::vector<const RunRecord*>& runs = runsByVersion[*version];
+    size_t first = runs.size() > window ? runs.size() - window : 0;
+    VersionBaseline baseline;
+    memcpy(baseline.version, runs.front()->version, sizeof(baseline.version));
+    for (unsigned metric = 0; metric < RunHistory_METRIC_COUNT; metric++) {
+      // phases that did not happen in a run don't count towards its baseline
+      std::vector<double> values;
+      for (size_t run = first; run < runs.size(); run++) {
+        double value = metric == RunHistory_PEAK_MEMORY ? runs[run]->peakMemory : runs[run]->phaseMilliseconds[metric];
+        if (value > 0) {
+          values.push_back(value);
+        }
+      }
+      baseline.metrics[metric] = computeBaseline(values);
+    }
+    result.push_back(baseline);
+  }
+  return result;
+}
+
+// The one-sided 99.5% quantile of Student's t distribution, rounding the degrees of freedom down.
+// All metrics of two versions are tested at once, so each test is held to 0.5% which keeps the
+// chance of a false alarm per comparison around 5% (Bonferroni).
+static double criticalT(double degreesOfFreedom) {
+  static const double limits[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 12, 15, 20, 30, 60, 120 };
+  static const double quantiles[] = { 63.657, 9.925, 5.841, 4.604, 4.032, 3.707, 3.499, 3.355, 3.250, 3.169,
+    3.055, 2.947, 2.845, 2.750, 2.660, 2.617 };
+  double result = quantiles[0];
+  for (size_t i = 0; i < sizeof(limits) / sizeof(limits[0]) && degreesOfFreedom >= limits[i]; i++) {
+    result = quantiles[i];
+  }
+  return degreesOfFreedom >= 1000 ? 2.576 : result;
+}
+
+/************************************************************************/
+/* Welch's t-test, which doesn't assume both versions vary alike, on    */
+/* every metric measured at least twice in both versions                */
+/************************************************************************/
+std::vector<Regression> RunHistory::findRegressions(const std::vector<VersionBaseline>& baselines) {
+  std::vector<Regression> result;
+  for (size_t version = 1; version < baselines.size(); version++) {
+    for (unsigned metric = 0; metric < RunHistory_METRIC_COUNT; metric++) {
+      const MetricBaseline& before = baselines[version - 1].metrics[metric];
+      const MetricBaseline& after = baselines[version].metrics[metric];
+      if (before.runs < 2 || after.runs < 2 || before.mean <= 0) {
+        continue;
+      }
+      double increase = (after.mean - before.mean) / before.mean;
+      if (increase < RunHistory_MINIMUM_INCREASE) {
+        continue;
+      }
+      double beforeVariance = before.deviation * before.deviation / before.runs;
+      double afterVariance = after.deviation * after.deviation / after.runs;
+      double t;
+      if (beforeVariance + afterVariance == 0) {
+        // no noise at all, any difference is real
+        t = std::numeric_limits<double>::infinity();
+      } else {
+        t = (after.mean - before.mean) / sqrt(beforeVariance + afterVariance);
+        double degreesOfFreedom = (beforeVariance + afterVariance) * (beforeVariance + afterVariance)
+          / (beforeVariance * beforeVariance / (before.runs - 1) + afterVariance * afterVariance / (after.runs - 1));
+        if (t < criticalT(degreesOfFreedom)) {
+          continue;
+        }
+      }
+      Regression regression;
+      regression.fromVersion = version - 1;
+      regression.toVersion = version;
+      regression.metric = metric;
+      regression.increase = increase;
+      regression.t = t;
+      result.push_back(regression);
+    }
+  }
+  return result;
+}
+
+const char* RunHistory::getMetricName(unsigned metric) {
+  return metric == RunHistory_PEAK_MEMORY ? "peak memory" : phaseNames[metric];
+}
+
+std::string RunHistory::formatVersion(const uint16 version[4]) {
+  std::ostringstream result;
+  result << version[0] << "." << version[1] << "." << version[2] << "." << version[3];
+  return result.str();
+}
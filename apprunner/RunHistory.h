@@ -0,0 +1,105 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mappedfile.h"
+#include "PhaseTimings.h"
+
+// the phases a record has room for, in this order
+#define RunHistory_PHASE_NAMES { "staging", "registration", "update", "uninstall", "launch", "application", "callback" }
+#define RunHistory_PHASE_COUNT 7
+// what a baseline is computed from: the phases plus the peak memory
+#define RunHistory_METRIC_COUNT (RunHistory_PHASE_COUNT + 1)
+#define RunHistory_PEAK_MEMORY RunHistory_PHASE_COUNT
+// the most runs of one version a baseline looks at, older ones are left out
+#define RunHistory_DEFAULT_WINDOW 20
+// regressions smaller than this are not reported however significant they are
+#define RunHistory_MINIMUM_INCREASE 0.05
+
+namespace doo {
+  namespace metrodriver {
+    // One run as stored in the history file. The size is fixed so the file can be scanned as an array.
+    struct RunRecord {
+      // when the run started, as a FILETIME
+      uint64 startTime;
+      uint64 bytesExtracted;
+      // the peak working set of the app
+      uint64 peakMemory;
+      // major, minor, build, revision
+      uint16 version[4];
+      int32 exitCode;
+      // 0 for phases that did not happen
+      float phaseMilliseconds[RunHistory_PHASE_COUNT];
+      // zero padded, package names have at most 50 characters
+      char packageName[60];
+      // CRC-32 of everything above, tells complete records from ones cut short by a crash
+      uint32 checksum;
+
+      // fill in identity, start time and phases, the rest is left to the caller
+      static RunRecord create(const std::string& packageName, const std::string& packageVersion, const PhaseTimings& timings);
+    };
+
+    // mean and standard deviation of one metric over the runs of one version
+    struct MetricBaseline {
+      double mean;
+      double deviation;
+      uint32 runs;
+    };
+
+    struct VersionBaseline {
+      uint16 version[4];
+      MetricBaseline metrics[RunHistory_METRIC_COUNT];
+    };
+
+    // a metric that got significantly worse from one version to the next
+    struct Regression {
+      size_t fromVersion;
+      size_t toVersion;
+      unsigned metric;
+      // relative to the earlier version's mean
+      double increase;
+      // Welch's t statistic
+      double t;
+    };
+
+    // The runs of all packages in one append-only file. Appending writes a single record to the end,
+    // reading maps the file and treats it as an array, so hundreds of thousands of runs are scanned
+    // without copying. Records cut short by a crash fail their checksum and are skipped.
+    class RunHistory {
+    public:
+      // add a run to the file, creating it if needed
+      static void append(const std::string& filename, const RunRecord& record);
+
+      // map the file for reading, a missing file is an empty history
+      RunHistory(const std::string& filename);
+
+      size_t getCount() const {
+        return count;
+      }
+      const RunRecord& getRecord(size_t index) const {
+        return records[index];
+      }
+
+      // the baselines of every version of a package in the order the versions were first run,
+      // each from the last window runs of that version
+      std::vector<VersionBaseline> getBaselines(const std::string& packageName, size_t window = RunHistory_DEFAULT_WINDOW) const;
+
+      // compare every version with the one run before it, reports increases that are significant at the
+      // 5% level for all metrics of a comparison together
+      static std::vector<Regression> findRegressions(const std::vector<VersionBaseline>& baselines);
+
+      static const char* getMetricName(unsigned metric);
+      static std::string formatVersion(const uint16 version[4]);
+
+    private:
+      RunHistory(const RunHistory&);
+      RunHistory& operator=(const RunHistory&);
+
+      std::shared_ptr<doo::zip::MappedFile> file;
+      const RunRecord* records;
+      size_t count;
+    };
+  }
+}
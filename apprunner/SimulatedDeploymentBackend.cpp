@@ -0,0 +1,297 @@
+#include "stdafx.h"
+
+#include <cmath>
+#include <thread>
+
+#include "SimulatedDeploymentBackend.h"
+
+using doo::metrodriver::DeploymentBackend;
+using doo::metrodriver::DeploymentTraceEvent;
+using doo::metrodriver::OperationModel;
+using doo::metrodriver::PackageIdentity;
+using doo::metrodriver::SimulatedDeploymentBackend;
+
+namespace {
+  // median milliseconds and spread by operation, in the order of DeploymentBackend::Operation
+  const double defaultModels[DeploymentBackend_OPERATION_COUNT][2] = {
+    { 40, 0.5 },
+    { 6000, 0.6 },
+    { 2500, 0.5 },
+    { 8000, 0.6 },
+    { 2000, 0.5 },
+    { 15, 0.4 },
+    { 900, 0.5 },
+    { 5000, 0.8 }
+  };
+
+  // an app user model id is the package family name, which leaves out version and architecture, and the app id
+  bool matchesAppUserModelId(const PackageIdentity& package, const std::wstring& appUserModelId) {
+    size_t separator = appUserModelId.find(L'!');
+    std::wstring familyName = appUserModelId.substr(0, separator);
+    size_t publisherId = familyName.rfind(L'_');
+    if (separator == std::wstring::npos || publisherId == std::wstring::npos) {
+      return false;
+    }
+    std::wstring suffix = familyName.substr(publisherId);
+    return familyName.substr(0, publisherId) == package.name && package.fullName.size() >= suffix.size()
+      && package.fullName.compare(package.fullName.size() - suffix.size(), suffix.size(), suffix) == 0;
+  }
+}
+
+SimulatedDeploymentBackend::SimulatedDeploymentBackend(uint32 seed, double timeScale)
+  : random(seed), timeScale(timeScale), simulatedMilliseconds(0), nextProcessId(SimulatedDeploymentBackend_FIRST_PROCESS_ID)
+{
+  for (int i = 0; i < DeploymentBackend_OPERATION_COUNT; i++) {
+    models[i].medianMilliseconds = defaultModels[i][0];
+    models[i].spread = defaultModels[i][1];
+    models[i].failureRate = 0;
+  }
+}
+
+void SimulatedDeploymentBackend::setModel(Operation operation, const OperationModel& model) {
+  std::lock_guard<std::mutex> guard(lock);
+  models[operation] = model;
+}
+
+const OperationModel& SimulatedDeploymentBackend::getModel(Operation operation) const {
+  return models[operation];
+}
+
+void SimulatedDeploymentBackend::replay(const std::vector<DeploymentTraceEvent>& events) {
+  std::lock_guard<std::mutex> guard(lock);
+  for (auto event = events.begin(); event != events.end(); ++event) {
+    recorded[event->operation].push_back(*event);
+  }
+}
+
+void SimulatedDeploymentBackend::addInstalledPackage(const PackageIdentity& package) {
+  std::lock_guard<std::mutex> guard(lock);
+  installed.push_back(package);
+}
+
+std::vector<PackageIdentity> SimulatedDeploymentBackend::getInstalledPackages() const {
+  std::lock_guard<std::mutex> guard(lock);
+  return installed;
+}
+
+double SimulatedDeploymentBackend::getSimulatedMilliseconds() const {
+  std::lock_guard<std::mutex> guard(lock);
+  return simulatedMilliseconds;
+}
+
+size_t SimulatedDeploymentBackend::findInstalled(const std::wstring& name, const std::wstring& publisher) const {
+  for (size_t i = 0; i < installed.size(); i++) {
+    if (installed[i].name == name && installed[i].publisher == publisher) {
+      return i;
+    }
+  }
+  return installed.size();
+}
+
+/************************************************************************/
+/* A recorded outcome wins over the inventory, the real system knew     */
+/* better. Without one, random failures only hit operations the         */
+/* inventory allows.                                                    */
+/************************************************************************/
+double SimulatedDeploymentBackend::complete(Operation operation, std::wstring& error) {
+  double milliseconds;
+  if (!recorded[operation].empty()) {
+    milliseconds = recorded[operation].front().milliseconds;
+    error = recorded[operation].front().error;
+    recorded[operation].pop_front();
+  } else {
+    const OperationModel& model = models[operation];
+    std::lognormal_distribution<double> duration(log(std::max(model.medianMilliseconds, 0.001)), model.spread);
+    milliseconds = duration(random);
+    if (error.empty() && model.failureRate > 0 && std::uniform_real_distribution<double>(0, 1)(random) < model.failureRate) {
+      error = L"Simulated failure";
+    }
+  }
+  simulatedMilliseconds += milliseconds;
+  return milliseconds;
+}
+
+void SimulatedDeploymentBackend::wait(double milliseconds) {
+  if (timeScale > 0) {
+    std::this_thread::sleep_for(std::chrono::microseconds(static_cast<int64>(milliseconds * timeScale * 1000)));
+  }
+}
+
+std::vector<PackageIdentity> SimulatedDeploymentBackend::findPackages(const std::wstring& name, const std::wstring& publisher) {
+  std::vector<PackageIdentity> packages;
+  double milliseconds;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    std::wstring error;
+    milliseconds = complete(FindPackages, error);
+    for (auto package = installed.begin(); package != installed.end(); ++package) {
+      if (package->name == name && package->publisher == publisher) {
+        packages.push_back(*package);
+      }
+    }
+  }
+  wait(milliseconds);
+  return packages;
+}
+
+std::wstring SimulatedDeploymentBackend::stagePackage(const PackageIdentity& package, const std::wstring&,
+  const std::vector<std::wstring>&)
+{
+  std::wstring error;
+  double milliseconds;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    milliseconds = complete(StagePackage, error);
+    if (error.empty() && std::find(staged.begin(), staged.end(), package.fullName) == staged.end()) {
+      staged.push_back(package.fullName);
+    }
+  }
+  wait(milliseconds);
+  return error;
+}
+
+std::wstring SimulatedDeploymentBackend::registerPackage(const PackageIdentity& package, const std::wstring&,
+  const std::vector<std::wstring>&)
+{
+  std::wstring error;
+  double milliseconds;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    size_t existing = findInstalled(package.name, package.publisher);
+    if (existing < installed.size() && installed[existing].version != package.version) {
+      error = L"A different version of the package is already installed";
+    }
+    milliseconds = complete(RegisterPackage, error);
+    if (error.empty()) {
+      staged.erase(std::remove(staged.begin(), staged.end(), package.fullName), staged.end());
+      if (existing < installed.size()) {
+        installed[existing] = package;
+      } else {
+        installed.push_back(package);
+      }
+    }
+  }
+  wait(milliseconds);
+  return error;
+}
+
+std::wstring SimulatedDeploymentBackend::updatePackage(const PackageIdentity& package, const std::wstring&,
+  const std::vector<std::wstring>&)
+{
+  std::wstring error;
+  double milliseconds;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    size_t existing = findInstalled(package.name, package.publisher);
+    if (existing == installed.size()) {
+      error = L"The package is not installed";
+    } else if (installed[existing].version == package.version) {
+      error = L"The same version of the package is already installed";
+    }
+    milliseconds = complete(UpdatePackage, error);
+    if (error.empty()) {
+      if (existing < installed.size()) {
+        debugged.erase(std::remove(debugged.begin(), debugged.end(), installed[existing].fullName), debugged.end());
+        installed[existing] = package;
+      } else {
+        installed.push_back(package);
+      }
+    }
+  }
+  wait(milliseconds);
+  return error;
+}
+
+std::wstring SimulatedDeploymentBackend::removePackage(const std::wstring& fullName) {
+  std::wstring error;
+  double milliseconds;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    auto package = std::find_if(installed.begin(), installed.end(), [&](const PackageIdentity& candidate) {
+      return candidate.fullName == fullName;
+    });
+    if (package == installed.end()) {
+      error = L"The package is not installed";
+    }
+    milliseconds = complete(RemovePackage, error);
+    if (error.empty() && package != installed.end()) {
+      installed.erase(package);
+      debugged.erase(std::remove(debugged.begin(), debugged.end(), fullName), debugged.end());
+    }
+  }
+  wait(milliseconds);
+  return error;
+}
+
+bool SimulatedDeploymentBackend::setDebugging(const std::wstring& fullName, bool enabled) {
+  std::wstring error;
+  double milliseconds;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    bool isInstalled = std::find_if(installed.begin(), installed.end(), [&](const PackageIdentity& candidate) {
+      return candidate.fullName == fullName;
+    }) != installed.end();
+    if (!isInstalled) {
+      error = L"The package is not installed";
+    }
+    milliseconds = complete(SetDebugging, error);
+    debugged.erase(std::remove(debugged.begin(), debugged.end(), fullName), debugged.end());
+    if (error.empty() && enabled) {
+      debugged.push_back(fullName);
+    }
+  }
+  wait(milliseconds);
+  return error.empty();
+}
+
+uint32 SimulatedDeploymentBackend::activateApplication(const std::wstring& appUserModelId) {
+  std::wstring error;
+  double milliseconds;
+  uint32 processId = 0;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    bool isInstalled = std::find_if(installed.begin(), installed.end(), [&](const PackageIdentity& candidate) {
+      return matchesAppUserModelId(candidate, appUserModelId);
+    }) != installed.end();
+    if (!isInstalled) {
+      error = L"The package is not installed";
+    }
+    milliseconds = complete(ActivateApplication, error);
+    if (error.empty()) {
+      processId = nextProcessId++;
+      running.push_back(processId);
+    }
+  }
+  wait(milliseconds);
+  if (!error.empty()) {
+    throw ref new Platform::FailureException(L"Could not activate application");
+  }
+  return processId;
+}
+
+/************************************************************************/
+/* The app runs from the wait on, each process id can be waited for     */
+/* once. A simulated app uses no memory worth reporting.                */
+/************************************************************************/
+int SimulatedDeploymentBackend::waitForApplication(uint32 processId, uint64* peakWorkingSet) {
+  std::wstring error;
+  double milliseconds;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    auto process = std::find(running.begin(), running.end(), processId);
+    if (process == running.end()) {
+      error = L"The application is not running";
+    } else {
+      running.erase(process);
+    }
+    milliseconds = complete(WaitForApplication, error);
+  }
+  wait(milliseconds);
+  if (!error.empty()) {
+    throw ref new Platform::FailureException(L"Could not wait for the application");
+  }
+  if (peakWorkingSet) {
+    *peakWorkingSet = 0;
+  }
+  return 0;
+}
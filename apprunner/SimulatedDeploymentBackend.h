@@ -0,0 +1,92 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <random>
+
+#include "DeploymentBackend.h"
+#include "DeploymentTrace.h"
+
+// process ids handed out by simulated activations start here
+#define SimulatedDeploymentBackend_FIRST_PROCESS_ID 4000
+
+namespace doo {
+  namespace metrodriver {
+    // How long an operation takes and how often it fails. Durations are log-normally distributed,
+    // spread is the standard deviation of their logarithm.
+    struct OperationModel {
+      double medianMilliseconds;
+      double spread;
+      double failureRate;
+    };
+
+    // Deploys into an inventory in memory instead of the system, so the deployment logic can be run
+    // and measured on any machine. It follows the rules PackageManager enforces: a different version
+    // of an installed package can't be registered but has to be updated, an update needs another
+    // version to be installed, and only installed packages can be removed, debugged or started.
+    // Started apps run for as long as the model of WaitForApplication says and exit with code 0.
+    //
+    // Operation durations are drawn from a model per operation, or taken in order from a recorded
+    // trace. Both are reproducible for the same seed. Each operation also adds its duration to a
+    // simulated clock, which timeScale 0 uses instead of actually waiting.
+    class SimulatedDeploymentBackend : public DeploymentBackend {
+    public:
+      // timeScale 1 waits as long as real operations would, 0.1 a tenth of that and 0 not at all
+      SimulatedDeploymentBackend(uint32 seed = 1, double timeScale = 1);
+
+      // the defaults are about what a desktop with an SSD shows, without failures
+      void setModel(Operation operation, const OperationModel& model);
+      const OperationModel& getModel(Operation operation) const;
+
+      // Take durations and outcomes from a recorded trace: each operation uses the next recorded one of
+      // its kind and fails with its error. Once the recorded ones of a kind run out the model is used.
+      void replay(const std::vector<DeploymentTraceEvent>& events);
+
+      // put a package into the inventory as if it was installed before
+      void addInstalledPackage(const PackageIdentity& package);
+      std::vector<PackageIdentity> getInstalledPackages() const;
+
+      // what all operations so far added up to, whatever the time scale
+      double getSimulatedMilliseconds() const;
+
+      virtual std::vector<PackageIdentity> findPackages(const std::wstring& name, const std::wstring& publisher);
+      virtual std::wstring stagePackage(const PackageIdentity& package, const std::wstring& packageUri,
+        const std::vector<std::wstring>& dependencyUris);
+      virtual std::wstring registerPackage(const PackageIdentity& package, const std::wstring& manifestUri,
+        const std::vector<std::wstring>& dependencyUris);
+      virtual std::wstring updatePackage(const PackageIdentity& package, const std::wstring& packageUri,
+        const std::vector<std::wstring>& dependencyUris);
+      virtual std::wstring removePackage(const std::wstring& fullName);
+      virtual bool setDebugging(const std::wstring& fullName, bool enabled);
+      virtual uint32 activateApplication(const std::wstring& appUserModelId);
+      virtual int waitForApplication(uint32 processId, uint64* peakWorkingSet);
+
+    private:
+      SimulatedDeploymentBackend(const SimulatedDeploymentBackend&);
+      SimulatedDeploymentBackend& operator=(const SimulatedDeploymentBackend&);
+
+      // Decide how the operation ends and how long it takes. error is what the inventory says and
+      // becomes the recorded or a random failure. Returns the duration, the caller waits it out.
+      double complete(Operation operation, std::wstring& error);
+      void wait(double milliseconds);
+
+      // the index of the installed package with that name, or installed.size()
+      size_t findInstalled(const std::wstring& name, const std::wstring& publisher) const;
+
+      mutable std::mutex lock;
+      std::mt19937 random;
+      double timeScale;
+      double simulatedMilliseconds;
+      OperationModel models[DeploymentBackend_OPERATION_COUNT];
+      std::deque<DeploymentTraceEvent> recorded[DeploymentBackend_OPERATION_COUNT];
+      std::vector<PackageIdentity> installed;
+      // full names of the packages staged but not registered yet
+      std::vector<std::wstring> staged;
+      // full names with debugging enabled
+      std::vector<std::wstring> debugged;
+      // process ids of the apps started and not waited for yet
+      std::vector<uint32> running;
+      uint32 nextProcessId;
+    };
+  }
+}
@@ -1,13 +1,15 @@
 #include "stdafx.h"
 #include "SystemUtils.h"
+#include "Log.h"
 
+using doo::metrodriver::Log;
 using doo::metrodriver::SystemUtils;
 
 Platform::String^ SystemUtils::GetSIDForCurrentUser() {
   ATL::CHandle processHandle(GetCurrentProcess());
   HANDLE tokenHandle;
   if(OpenProcessToken(processHandle,TOKEN_READ,&tokenHandle) == FALSE) {
-    printf("Error: Couldn't open the process token\n");
+    Log::error(L"Error: Couldn't open the process token");
     return nullptr;
   }
   PTOKEN_USER userToken;
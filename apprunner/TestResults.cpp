@@ -0,0 +1,661 @@
+#include "stdafx.h"
+
+#include <atomic>
+#include <thread>
+
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
+#include "TestResults.h"
+#include "Log.h"
+#include "mappedfile.h"
+#include "transcode.h"
+
+using doo::metrodriver::TestResults;
+using doo::metrodriver::TestSummary;
+using doo::metrodriver::TestTiming;
+using doo::metrodriver::TestFailure;
+
+namespace {
+  // A pull parser over a document in memory. It hands out one tag or piece of text at a time and only
+  // remembers where the current one is, names and values point into the document until asked for.
+  class XmlScanner {
+  public:
+    enum Token {
+      StartTag,
+      EndTag,
+      Text,
+      End
+    };
+
+    XmlScanner(const char* data, size_t length)
+      : position(data), end(data + length), emptyElement(false), rawText(false)
+    {
+    }
+
+    Token next() {
+      for (;;) {
+        if (position == end) {
+          return End;
+        }
+        if (*position != '<') {
+          text.begin = position;
+          position = find(position, "<", false);
+          text.end = position;
+          rawText = false;
+          return Text;
+        }
+        if (startsWith("<!--")) {
+          position = find(position + 4, "-->", true) + 3;
+        } else if (startsWith("<![CDATA[")) {
+          text.begin = position + 9;
+          text.end = find(text.begin, "]]>", true);
+          position = text.end + 3;
+          rawText = true;
+          return Text;
+        } else if (startsWith("<?")) {
+          position = find(position + 2, "?>", true) + 2;
+        } else if (startsWith("<!")) {
+          // a DOCTYPE, its internal subset may contain '>' itself
+          const char* close = find(position + 2, ">", true);
+          const char* subset = find(position + 2, "[", false);
+          position = (subset < close ? find(find(subset, "]", true), ">", true) : close) + 1;
+        } else if (startsWith("</")) {
+          position += 2;
+          readName();
+          skipSpace();
+          expect('>');
+          return EndTag;
+        } else {
+          position++;
+          readStartTag();
+          return StartTag;
+        }
+      }
+    }
+
+    // compares the name of the current tag, ignoring a namespace prefix
+    bool isNamed(const char* localName) const {
+      size_t length = strlen(localName);
+      return static_cast<size_t>(name.end - name.begin) == length && memcmp(name.begin, localName, length) == 0;
+    }
+
+    // true for a start tag that closes itself
+    bool isEmptyElement() const {
+      return emptyElement;
+    }
+
+    // replaces value with the decoded attribute, false if the current tag has no such attribute
+    bool getAttribute(const char* attributeName, std::string& value) const {
+      size_t length = strlen(attributeName);
+      for (auto attribute = attributes.begin(); attribute != attributes.end(); ++attribute) {
+        if (static_cast<size_t>(attribute->first.end - attribute->first.begin) == length
+            && memcmp(attribute->first.begin, attributeName, length) == 0) {
+          value.clear();
+          decode(attribute->second, value, std::string::npos);
+          return true;
+        }
+      }
+      return false;
+    }
+
+    // appends the decoded text of the current token to value until value holds limit bytes
+    void appendText(std::string& value, size_t limit) const {
+      if (rawText) {
+        value.append(text.begin, std::min<size_t>(text.end - text.begin, limit - std::min(limit, value.size())));
+      } else {
+        decode(text, value, limit);
+      }
+    }
+
+  private:
+    struct Range {
+      const char* begin;
+      const char* end;
+    };
+
+    bool startsWith(const char* prefix) const {
+      size_t length = strlen(prefix);
+      return static_cast<size_t>(end - position) >= length && memcmp(position, prefix, length) == 0;
+    }
+
+    // the next occurrence of pattern at or after from, the end of the document if there is none
+    const char* find(const char* from, const char* pattern, bool required) const {
+      const char* found;
+      if (pattern[1] == 0) {
+        found = static_cast<const char*>(memchr(from, pattern[0], end - from));
+        found = found ? found : end;
+      } else {
+        found = std::search(from, end, pattern, pattern + strlen(pattern));
+      }
+      if (found == end && required) {
+        throw ref new Platform::FailureException(L"The document ends in the middle of a tag");
+      }
+      return found;
+    }
+
+    static bool isSpace(char c) {
+      return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+    static bool isNameEnd(char c) {
+      return isSpace(c) || c == '/' || c == '>' || c == '=';
+    }
+
+    void skipSpace() {
+      while (position != end && isSpace(*position)) {
+        position++;
+      }
+    }
+
+    void expect(char c) {
+      if (position == end || *position != c) {
+        throw ref new Platform::FailureException(L"The document is not well-formed");
+      }
+      position++;
+    }
+
+    Range readRawName() {
+      Range result;
+      result.begin = position;
+      while (position != end && !isNameEnd(*position)) {
+        position++;
+      }
+      result.end = position;
+      if (result.begin == result.end) {
+        throw ref new Platform::FailureException(L"The document is not well-formed");
+      }
+      return result;
+    }
+
+    void readName() {
+      name = readRawName();
+      const char* colon = std::find(name.begin, name.end, ':');
+      if (colon != name.end) {
+        name.begin = colon + 1;
+      }
+    }
+
+    void readStartTag() {
+      readName();
+      attributes.clear();
+      emptyElement = false;
+      for (;;) {
+        skipSpace();
+        if (position == end) {
+          throw ref new Platform::FailureException(L"The document ends in the middle of a tag");
+        }
+        if (*position == '>') {
+          position++;
+          return;
+        }
+        if (*position == '/') {
+          position++;
+          expect('>');
+          emptyElement = true;
+          return;
+        }
+        Range attributeName = readRawName();
+        skipSpace();
+        expect('=');
+        skipSpace();
+        if (position == end || (*position != '"' && *position != '\'')) {
+          throw ref new Platform::FailureException(L"The document is not well-formed");
+        }
+        char quote = *position++;
+        Range value;
+        value.begin = position;
+        value.end = find(position, quote == '"' ? "\"" : "'", true);
+        position = value.end + 1;
+        attributes.push_back(std::make_pair(attributeName, value));
+      }
+    }
+
+    // append range to value with entity and character references resolved
+    static void decode(const Range& range, std::string& value, size_t limit) {
+      for (const char* c = range.begin; c != range.end && value.size() < limit; ) {
+        // references are short, a lone ampersand is taken literally
+        const char* searchEnd = range.end - c > 12 ? c + 12 : range.end;
+        const char* semicolon = *c == '&' ? std::find(c, searchEnd, ';') : searchEnd;
+        if (semicolon == searchEnd) {
+          const char* ampersand = std::find(c + 1, range.end, '&');
+          value.append(c, std::min<size_t>(ampersand - c, limit - value.size()));
+          c = ampersand;
+          continue;
+        }
+        std::string entity(c + 1, semicolon);
+        uint32 codePoint = 0;
+        if (entity == "lt") {
+          codePoint = '<';
+        } else if (entity == "gt") {
+          codePoint = '>';
+        } else if (entity == "amp") {
+          codePoint = '&';
+        } else if (entity == "quot") {
+          codePoint = '"';
+        } else if (entity == "apos") {
+          codePoint = '\'';
+        } else if (entity.size() > 1 && entity[0] == '#') {
+          bool hex = entity[1] == 'x' || entity[1] == 'X';
+          codePoint = static_cast<uint32>(strtoul(entity.c_str() + (hex ? 2 : 1), NULL, hex ? 16 : 10));
+        }
+        if (codePoint == 0 || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint < 0xE000)) {
+          // unknown entities are kept as they are
+          value.append(c, semicolon + 1);
+        } else if (codePoint < 0x80) {
+          value += static_cast<char>(codePoint);
+        } else if (codePoint < 0x800) {
+          value += static_cast<char>(0xC0 | (codePoint >> 6));
+          value += static_cast<char>(0x80 | (codePoint & 0x3F));
+        } else if (codePoint < 0x10000) {
+          value += static_cast<char>(0xE0 | (codePoint >> 12));
+          value += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+          value += static_cast<char>(0x80 | (codePoint & 0x3F));
+        } else {
+          value += static_cast<char>(0xF0 | (codePoint >> 18));
+          value += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+          value += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+          value += static_cast<char>(0x80 | (codePoint & 0x3F));
+        }
+        c = semicolon + 1;
+      }
+    }
+
+    const char* position;
+    const char* end;
+    Range name;
+    Range text;
+    std::vector<std::pair<Range, Range>> attributes;
+    bool emptyElement;
+    // CDATA is not decoded
+    bool rawText;
+  };
+
+  enum Outcome {
+    Passed,
+    Failed,
+    Error,
+    Skipped
+  };
+
+  // TRX has a whole list of outcomes, the ones that didn't run the test count as skipped
+  Outcome getTrxOutcome(const std::string& outcome) {
+    if (outcome == "Passed" || outcome == "Completed" || outcome == "Warning" || outcome == "PassedButRunAborted") {
+      return Passed;
+    } else if (outcome == "Failed") {
+      return Failed;
+    } else if (outcome == "Error" || outcome == "Timeout" || outcome == "Aborted") {
+      return Error;
+    }
+    return Skipped;
+  }
+
+  // TRX durations look like 00:01:02.5000000
+  double parseTrxDuration(const std::string& duration) {
+    char* next;
+    double hours = strtod(duration.c_str(), &next);
+    if (*next != ':') {
+      return hours;
+    }
+    double minutes = strtod(next + 1, &next);
+    if (*next != ':') {
+      return 0;
+    }
+    return hours * 3600 + minutes * 60 + strtod(next + 1, NULL);
+  }
+
+  // the slowest test first, ties in name order so merging in any order gives the same result
+  bool isSlower(const TestTiming& timing, const TestTiming& other) {
+    return timing.seconds > other.seconds || (timing.seconds == other.seconds && timing.name < other.name);
+  }
+
+  // keep the slowest tests in a heap with the fastest of them on top, so it's cheap to replace
+  void addTiming(std::vector<TestTiming>& slowest, const std::string& name, double seconds) {
+    TestTiming timing;
+    timing.seconds = seconds;
+    if (slowest.size() == TestResults_SLOWEST_COUNT) {
+      if (seconds < slowest.front().seconds || (seconds == slowest.front().seconds && name >= slowest.front().name)) {
+        return;
+      }
+      std::pop_heap(slowest.begin(), slowest.end(), isSlower);
+      slowest.pop_back();
+    }
+    timing.name = name;
+    slowest.push_back(timing);
+    std::push_heap(slowest.begin(), slowest.end(), isSlower);
+  }
+
+  // append text as a JSON string including the quotes, broken UTF-8 is replaced rather than passed on
+  void appendJsonString(std::string& json, const std::string& text) {
+    std::string valid;
+    const std::string* source = &text;
+    if (!doo::text::IsValidUtf8(text.data(), text.size())) {
+      std::vector<doo::text::utf16unit> utf16(doo::text::MaximumUtf16Length(text.size()));
+      size_t utf16Length = doo::text::Utf8ToUtf16(text.data(), text.size(), utf16.data());
+      valid.resize(doo::text::MaximumUtf8Length(utf16Length));
+      valid.resize(doo::text::Utf16ToUtf8(utf16.data(), utf16Length, &valid[0]));
+      source = &valid;
+    }
+    json += '"';
+    for (auto i = source->begin(); i != source->end(); ++i) {
+      unsigned char c = static_cast<unsigned char>(*i);
+      if (c == '"' || c == '\\') {
+        json += '\\';
+        json += c;
+      } else if (c < 0x20) {
+        char escaped[8];
+        snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        json += escaped;
+      } else {
+        json += c;
+      }
+    }
+    json += '"';
+  }
+
+  void appendJsonNumber(std::string& json, const char* name, uint64 value) {
+    char formatted[32];
+    snprintf(formatted, sizeof(formatted), "\"%s\":%llu,", name, static_cast<unsigned long long>(value));
+    json += formatted;
+  }
+
+  void appendJsonSeconds(std::string& json, double seconds) {
+    char formatted[32];
+    snprintf(formatted, sizeof(formatted), "\"seconds\":%.3f", seconds);
+    json += formatted;
+  }
+
+  // .xml or .trx in any case
+  bool hasResultExtension(const char* name) {
+    size_t length = strlen(name);
+    if (length <= 4) {
+      return false;
+    }
+    char extension[5];
+    for (int i = 0; i < 5; i++) {
+      extension[i] = static_cast<char>(tolower(static_cast<unsigned char>(name[length - 4 + i])));
+    }
+    return strcmp(extension, ".xml") == 0 || strcmp(extension, ".trx") == 0;
+  }
+}
+
+TestSummary::TestSummary()
+  : files(0), tests(0), passed(0), failed(0), errors(0), skipped(0), seconds(0)
+{
+}
+
+void TestSummary::addTest(const std::string& name, double testSeconds) {
+  seconds += testSeconds;
+  addTiming(slowest, name, testSeconds);
+}
+
+void TestSummary::merge(const TestSummary& other) {
+  files += other.files;
+  tests += other.tests;
+  passed += other.passed;
+  failed += other.failed;
+  errors += other.errors;
+  skipped += other.skipped;
+  seconds += other.seconds;
+  failures.insert(failures.end(), other.failures.begin(), other.failures.end());
+  for (auto timing = other.slowest.begin(); timing != other.slowest.end(); ++timing) {
+    addTiming(slowest, timing->name, timing->seconds);
+  }
+  unreadableFiles.insert(unreadableFiles.end(), other.unreadableFiles.begin(), other.unreadableFiles.end());
+}
+
+std::string TestSummary::toJson() const {
+  std::string json = "{";
+  appendJsonNumber(json, "files", files);
+  appendJsonNumber(json, "tests", tests);
+  appendJsonNumber(json, "passed", passed);
+  appendJsonNumber(json, "failed", failed);
+  appendJsonNumber(json, "errors", errors);
+  appendJsonNumber(json, "skipped", skipped);
+  appendJsonSeconds(json, seconds);
+  json += ",\"failures\":[";
+  for (auto failure = failures.begin(); failure != failures.end(); ++failure) {
+    json += failure == failures.begin() ? "{\"file\":" : ",{\"file\":";
+    appendJsonString(json, failure->file);
+    json += ",\"name\":";
+    appendJsonString(json, failure->name);
+    json += failure->isError ? ",\"type\":\"error\",\"message\":" : ",\"type\":\"failure\",\"message\":";
+    appendJsonString(json, failure->message);
+    json += '}';
+  }
+  json += "],\"slowest\":[";
+  for (auto timing = slowest.begin(); timing != slowest.end(); ++timing) {
+    json += timing == slowest.begin() ? "{\"name\":" : ",{\"name\":";
+    appendJsonString(json, timing->name);
+    json += ',';
+    appendJsonSeconds(json, timing->seconds);
+    json += '}';
+  }
+  json += "],\"unreadableFiles\":[";
+  for (auto file = unreadableFiles.begin(); file != unreadableFiles.end(); ++file) {
+    if (file != unreadableFiles.begin()) {
+      json += ',';
+    }
+    appendJsonString(json, *file);
+  }
+  json += "]}";
+  return json;
+}
+
+/************************************************************************/
+/* JUnit reports a testcase element per test with failure, error or    */
+/* skipped children, TRX a UnitTestResult with an outcome attribute and */
+/* the message in ErrorInfo/Message. Tests nested in a test, like TRX's */
+/* data driven inner results, are part of the outer one                 */
+/************************************************************************/
+void TestResults::parse(const char* data, size_t length, const std::string& file, TestSummary& summary) {
+  TestSummary result;
+  XmlScanner scanner(data, length);
+  std::string attribute;
+  std::string name;
+  std::string message;
+  Outcome outcome = Passed;
+  double seconds = 0;
+  // the depth of the open test element, 0 outside a test
+  int testDepth = 0;
+  bool captureMessage = false;
+  int depth = 0;
+  bool hasRoot = false;
+
+  for (;;) {
+    XmlScanner::Token token = scanner.next();
+    if (token == XmlScanner::End) {
+      break;
+    }
+    if (token == XmlScanner::Text) {
+      if (captureMessage) {
+        scanner.appendText(message, TestResults_MESSAGE_LENGTH);
+      }
+      continue;
+    }
+
+    if (token == XmlScanner::StartTag) {
+      if (depth == 0 && hasRoot) {
+        throw ref new Platform::FailureException(L"The document has more than one root element");
+      }
+      hasRoot = true;
+      depth++;
+      if (testDepth == 0 && scanner.isNamed("testcase")) {
+        if (!scanner.getAttribute("name", name)) {
+          name.clear();
+        }
+        if (scanner.getAttribute("classname", attribute) && !attribute.empty()) {
+          name.insert(0, attribute + ".");
+        }
+        seconds = scanner.getAttribute("time", attribute) ? strtod(attribute.c_str(), NULL) : 0;
+        outcome = Passed;
+        message.clear();
+        testDepth = depth;
+      } else if (testDepth == 0 && scanner.isNamed("UnitTestResult")) {
+        if (!scanner.getAttribute("testName", name)) {
+          name.clear();
+        }
+        seconds = scanner.getAttribute("duration", attribute) ? parseTrxDuration(attribute) : 0;
+        outcome = scanner.getAttribute("outcome", attribute) ? getTrxOutcome(attribute) : Passed;
+        message.clear();
+        testDepth = depth;
+      } else if (testDepth != 0 && (scanner.isNamed("failure") || scanner.isNamed("error"))) {
+        outcome = scanner.isNamed("error") || outcome == Error ? Error : Failed;
+        if (message.empty() && scanner.getAttribute("message", message)) {
+          message.resize(std::min<size_t>(message.size(), TestResults_MESSAGE_LENGTH));
+        }
+        captureMessage = message.empty();
+      } else if (testDepth != 0 && scanner.isNamed("skipped")) {
+        outcome = Skipped;
+      } else if (testDepth != 0 && scanner.isNamed("Message")) {
+        captureMessage = message.empty();
+      }
+      if (!scanner.isEmptyElement()) {
+        continue;
+      }
+    }
+
+    // an end tag, or a start tag that closed itself
+    if (depth == 0) {
+      throw ref new Platform::FailureException(L"The document is not well-formed");
+    }
+    if (depth == testDepth) {
+      result.tests++;
+      if (outcome == Passed) {
+        result.passed++;
+      } else if (outcome == Skipped) {
+        result.skipped++;
+      } else {
+        (outcome == Error ? result.errors : result.failed)++;
+        TestFailure failure;
+        failure.file = file;
+        failure.name = name;
+        failure.message = message;
+        failure.isError = outcome == Error;
+        result.failures.push_back(failure);
+      }
+      result.addTest(name, seconds);
+      testDepth = 0;
+    }
+    captureMessage = false;
+    depth--;
+  }
+
+  if (!hasRoot || depth != 0) {
+    throw ref new Platform::FailureException(L"The document ends before its root element");
+  }
+  result.files = 1;
+  summary.merge(result);
+}
+
+void TestResults::parseFile(const std::string& path, TestSummary& summary) {
+  doo::zip::MappedFile mapped(path);
+  if (static_cast<size_t>(mapped.GetSize()) != mapped.GetSize()) {
+    throw ref new Platform::OutOfMemoryException(L"Result file is too large");
+  }
+  const char* data = reinterpret_cast<const char*>(mapped.GetData());
+  size_t length = static_cast<size_t>(mapped.GetSize());
+  if (length >= 2 && static_cast<byte>(data[0]) == 0xFF && static_cast<byte>(data[1]) == 0xFE) {
+    // UTF-16, the little endian kind Windows tools write, is converted once up front
+    size_t units = (length - 2) / 2;
+    std::vector<doo::text::utf16unit> utf16(units);
+    memcpy(utf16.data(), data + 2, units * 2);
+    std::vector<char> utf8(doo::text::MaximumUtf8Length(units));
+    parse(utf8.data(), doo::text::Utf16ToUtf8(utf16.data(), units, utf8.data()), path, summary);
+    return;
+  }
+  if (length >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0) {
+    data += 3;
+    length -= 3;
+  }
+  parse(data, length, path, summary);
+}
+
+#ifdef _WIN32
+
+std::vector<std::string> TestResults::findFiles(const std::string& directory) {
+  std::vector<std::string> files;
+  WIN32_FIND_DATAA found;
+  HANDLE search = FindFirstFileA((directory + "\\*").c_str(), &found);
+  if (search == INVALID_HANDLE_VALUE) {
+    throw ref new Platform::InvalidArgumentException(L"Could not list the test result directory");
+  }
+  do {
+    if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && hasResultExtension(found.cFileName)) {
+      files.push_back(directory + "\\" + found.cFileName);
+    }
+  } while (FindNextFileA(search, &found));
+  FindClose(search);
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+#else
+
+std::vector<std::string> TestResults::findFiles(const std::string& directory) {
+  std::vector<std::string> files;
+  DIR* search = opendir(directory.c_str());
+  if (!search) {
+    throw ref new Platform::InvalidArgumentException(L"Could not list the test result directory");
+  }
+  while (dirent* found = readdir(search)) {
+    if (found->d_type != DT_DIR && hasResultExtension(found->d_name)) {
+      files.push_back(directory + "/" + found->d_name);
+    }
+  }
+  closedir(search);
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+#endif
+
+/************************************************************************/
+/* Every thread sums up the files it took into a summary of its own,   */
+/* they are merged once all are done. Failures are sorted by file       */
+/* afterwards so the output doesn't depend on which thread was faster   */
+/************************************************************************/
+TestSummary TestResults::aggregate(const std::vector<std::string>& files, unsigned threadCount) {
+  if (threadCount == 0) {
+    threadCount = std::max(1U, std::thread::hardware_concurrency());
+  }
+  size_t workerCount = std::max<size_t>(1, std::min<size_t>(threadCount, files.size()));
+  std::vector<TestSummary> summaries(workerCount);
+  std::atomic<size_t> nextFile(0);
+
+  auto work = [&](TestSummary* summary) {
+    for (size_t file = nextFile++; file < files.size(); file = nextFile++) {
+      try {
+        parseFile(files[file], *summary);
+      } catch (Platform::Exception^ e) {
+        Log::warning(L"Could not read test results from %S: %s", files[file].c_str(), e->Message->Data());
+        summary->unreadableFiles.push_back(files[file]);
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  workers.reserve(workerCount - 1);
+  for (size_t i = 1; i < workerCount; i++) {
+    workers.push_back(std::thread(work, &summaries[i]));
+  }
+  work(&summaries[0]);
+  for (auto worker = workers.begin(); worker != workers.end(); ++worker) {
+    worker->join();
+  }
+
+  TestSummary result;
+  for (auto summary = summaries.begin(); summary != summaries.end(); ++summary) {
+    result.merge(*summary);
+  }
+  std::stable_sort(result.failures.begin(), result.failures.end(), [](const TestFailure& failure, const TestFailure& other) {
+    return failure.file < other.file;
+  });
+  std::sort(result.slowest.begin(), result.slowest.end(), isSlower);
+  std::sort(result.unreadableFiles.begin(), result.unreadableFiles.end());
+  return result;
+}
+
+TestSummary TestResults::aggregateDirectory(const std::string& directory, unsigned threadCount) {
+  return aggregate(findFiles(directory), threadCount);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// how many of the slowest tests a summary keeps
+#define TestResults_SLOWEST_COUNT 20
+// failure messages are cut off after this many bytes, stack traces can be huge
+#define TestResults_MESSAGE_LENGTH 1024
+
+namespace doo {
+  namespace metrodriver {
+    struct TestFailure {
+      // the result file the test was reported in
+      std::string file;
+      // class and test name, separated by a dot
+      std::string name;
+      std::string message;
+      // false for a failed assertion, true for an error or an unexpected exception
+      bool isError;
+    };
+
+    struct TestTiming {
+      std::string name;
+      double seconds;
+    };
+
+    // The merged results of any number of result files. Only failures and the slowest tests are kept
+    // individually, passing tests just add to the totals.
+    struct TestSummary {
+      TestSummary();
+
+      uint64 files;
+      uint64 tests;
+      uint64 passed;
+      uint64 failed;
+      uint64 errors;
+      uint64 skipped;
+      // the sum of the durations of all tests
+      double seconds;
+      std::vector<TestFailure> failures;
+      // the slowest tests, slowest first once the summary is complete
+      std::vector<TestTiming> slowest;
+      // files that could not be read or are not well-formed, they don't count towards anything else
+      std::vector<std::string> unreadableFiles;
+
+      void addTest(const std::string& name, double seconds);
+      void merge(const TestSummary& other);
+
+      // compact JSON with totals, failures, slowest tests and unreadable files
+      std::string toJson() const;
+    };
+
+    // Reads JUnit and TRX test result files. Every file is scanned once from start to end, tests are
+    // counted as their elements close and no document tree is ever built, so memory doesn't grow with
+    // the size of the files. Files are read on several threads at once.
+    class TestResults {
+    public:
+      // add the tests in a result file to summary, throws if the file is not well-formed
+      static void parse(const char* data, size_t length, const std::string& file, TestSummary& summary);
+      static void parseFile(const std::string& path, TestSummary& summary);
+
+      // the .xml and .trx files directly in directory, sorted by name
+      static std::vector<std::string> findFiles(const std::string& directory);
+
+      // parse all files on threadCount threads, 0 uses one per core. Files that fail to parse are
+      // listed in the summary instead of failing the whole aggregation.
+      static TestSummary aggregate(const std::vector<std::string>& files, unsigned threadCount = 0);
+      static TestSummary aggregateDirectory(const std::string& directory, unsigned threadCount = 0);
+    };
+  }
+}
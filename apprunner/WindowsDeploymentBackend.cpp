@@ -0,0 +1,122 @@
+#include "stdafx.h"
+
+#include <collection.h>
+#include <Psapi.h>
+
+#include "WindowsDeploymentBackend.h"
+#include "SystemUtils.h"
+
+using namespace Windows::Management::Deployment;
+
+using doo::metrodriver::PackageIdentity;
+using doo::metrodriver::SystemUtils;
+using doo::metrodriver::WindowsDeploymentBackend;
+
+static std::wstring getPackageVersionString(Windows::ApplicationModel::PackageVersion version) {
+  return (version.Major.ToString() +
+    "." + version.Minor.ToString() +
+    "." + version.Build.ToString() +
+    "." + version.Revision.ToString())->Data();
+}
+
+static std::wstring getErrorText(DeploymentResult^ deploymentResult) {
+  return deploymentResult->ErrorText->Data();
+}
+
+WindowsDeploymentBackend::WindowsDeploymentBackend() {
+  packageManager = ref new PackageManager();
+}
+
+Windows::Foundation::Collections::IIterable<Windows::Foundation::Uri^>^ WindowsDeploymentBackend::getUris(const std::vector<std::wstring>& paths) {
+  Platform::Collections::Vector<Windows::Foundation::Uri^>^ uris = ref new Platform::Collections::Vector<Windows::Foundation::Uri^>();
+  std::for_each(paths.begin(), paths.end(), [uris](const std::wstring& path) {
+    uris->Append(ref new Windows::Foundation::Uri(ref new Platform::String(path.c_str())));
+  });
+  return uris;
+}
+
+std::vector<PackageIdentity> WindowsDeploymentBackend::findPackages(const std::wstring& name, const std::wstring& publisher) {
+  Platform::String^ userSid = SystemUtils::GetSIDForCurrentUser();
+  auto packageIterable = packageManager->FindPackagesForUser(userSid, ref new Platform::String(name.c_str()), ref new Platform::String(publisher.c_str()));
+  std::vector<PackageIdentity> packages;
+  for (auto packageIterator = packageIterable->First(); packageIterator->HasCurrent; packageIterator->MoveNext()) {
+    auto id = packageIterator->Current->Id;
+    PackageIdentity package;
+    package.name = id->Name->Data();
+    package.publisher = id->Publisher->Data();
+    package.version = getPackageVersionString(id->Version);
+    package.fullName = id->FullName->Data();
+    packages.push_back(package);
+  }
+  return packages;
+}
+
+std::wstring WindowsDeploymentBackend::stagePackage(const PackageIdentity&, const std::wstring& packageUri,
+  const std::vector<std::wstring>& dependencyUris)
+{
+  return getErrorText(Concurrency::task<DeploymentResult^>(packageManager->StagePackageAsync(
+    ref new Windows::Foundation::Uri(ref new Platform::String(packageUri.c_str())), getUris(dependencyUris))).get());
+}
+
+std::wstring WindowsDeploymentBackend::registerPackage(const PackageIdentity&, const std::wstring& manifestUri,
+  const std::vector<std::wstring>& dependencyUris)
+{
+  return getErrorText(Concurrency::task<DeploymentResult^>(packageManager->RegisterPackageAsync(
+    ref new Windows::Foundation::Uri(ref new Platform::String(manifestUri.c_str())), getUris(dependencyUris), DeploymentOptions::None)).get());
+}
+
+std::wstring WindowsDeploymentBackend::updatePackage(const PackageIdentity&, const std::wstring& packageUri,
+  const std::vector<std::wstring>& dependencyUris)
+{
+  return getErrorText(Concurrency::task<DeploymentResult^>(packageManager->UpdatePackageAsync(
+    ref new Windows::Foundation::Uri(ref new Platform::String(packageUri.c_str())), getUris(dependencyUris), DeploymentOptions::None)).get());
+}
+
+std::wstring WindowsDeploymentBackend::removePackage(const std::wstring& fullName) {
+  return getErrorText(Concurrency::task<DeploymentResult^>(packageManager->RemovePackageAsync(
+    ref new Platform::String(fullName.c_str()))).get());
+}
+
+bool WindowsDeploymentBackend::setDebugging(const std::wstring& fullName, bool enabled) {
+  if (!packageDebugSettings) {
+    HRESULT res = packageDebugSettings.CoCreateInstance(CLSID_PackageDebugSettings, NULL, CLSCTX_ALL);
+    if FAILED(res) {
+      return false;
+    }
+  }
+  if (enabled) {
+    return SUCCEEDED(packageDebugSettings->EnableDebugging(fullName.c_str(), NULL, NULL));
+  }
+  return SUCCEEDED(packageDebugSettings->DisableDebugging(fullName.c_str()));
+}
+
+uint32 WindowsDeploymentBackend::activateApplication(const std::wstring& appUserModelId) {
+  ATL::CComPtr<IApplicationActivationManager> appManager;
+  HRESULT res = appManager.CoCreateInstance(__uuidof(ApplicationActivationManager));
+  ATLVERIFY(SUCCEEDED(res));
+  if FAILED(res) {
+    throw ref new Platform::FailureException(L"Could not create ApplicationActivationManager");
+  }
+
+  DWORD processId;
+  res = appManager->ActivateApplication(appUserModelId.c_str(), nullptr, AO_NONE, &processId);
+  if FAILED(res) {
+    throw ref new Platform::FailureException(L"Could not activate application " + ref new Platform::String(appUserModelId.c_str()));
+  }
+  return processId;
+}
+
+int WindowsDeploymentBackend::waitForApplication(uint32 processId, uint64* peakWorkingSet) {
+  ATL::CHandle process(OpenProcess(SYNCHRONIZE | PROCESS_QUERY_LIMITED_INFORMATION, false, processId));
+  if (process == NULL) {
+    throw ref new Platform::FailureException(L"Could not open the application process");
+  }
+  WaitForSingleObjectEx(process, INFINITE, false);
+  DWORD exitCode = 0;
+  GetExitCodeProcess(process, &exitCode);
+  if (peakWorkingSet) {
+    PROCESS_MEMORY_COUNTERS memoryCounters;
+    *peakWorkingSet = GetProcessMemoryInfo(process, &memoryCounters, sizeof(memoryCounters)) ? memoryCounters.PeakWorkingSetSize : 0;
+  }
+  return (int)exitCode;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "DeploymentBackend.h"
+
+namespace doo {
+  namespace metrodriver {
+    // deploys through PackageManager for the current user, starts apps through the
+    // ApplicationActivationManager and configures debugging through PackageDebugSettings
+    class WindowsDeploymentBackend : public DeploymentBackend {
+    public:
+      WindowsDeploymentBackend();
+
+      virtual std::vector<PackageIdentity> findPackages(const std::wstring& name, const std::wstring& publisher);
+      virtual std::wstring stagePackage(const PackageIdentity& package, const std::wstring& packageUri,
+        const std::vector<std::wstring>& dependencyUris);
+      virtual std::wstring registerPackage(const PackageIdentity& package, const std::wstring& manifestUri,
+        const std::vector<std::wstring>& dependencyUris);
+      virtual std::wstring updatePackage(const PackageIdentity& package, const std::wstring& packageUri,
+        const std::vector<std::wstring>& dependencyUris);
+      virtual std::wstring removePackage(const std::wstring& fullName);
+      virtual bool setDebugging(const std::wstring& fullName, bool enabled);
+      virtual uint32 activateApplication(const std::wstring& appUserModelId);
+      virtual int waitForApplication(uint32 processId, uint64* peakWorkingSet);
+
+    private:
+      WindowsDeploymentBackend(const WindowsDeploymentBackend&);
+      WindowsDeploymentBackend& operator=(const WindowsDeploymentBackend&);
+
+      static Windows::Foundation::Collections::IIterable<Windows::Foundation::Uri^>^ getUris(const std::vector<std::wstring>& paths);
+
+      Windows::Management::Deployment::PackageManager^ packageManager;
+      // created on first use
+      ATL::CComQIPtr<IPackageDebugSettings> packageDebugSettings;
+    };
+  }
+}
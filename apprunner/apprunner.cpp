@@ -1,17 +1,35 @@
 #include "stdafx.h"
 
+#include <ShlObj.h>
+
 #include "helper.h"
+#include "AllocationTracker.h"
 #include "Package.h"
+#include "CallbackPlugin.h"
+#include "BlockMap.h"
+#include "DirectoryWatcher.h"
+#include "RunHistory.h"
+#include "TestResults.h"
+#include "Log.h"
+#include "zipcounters.h"
+#include "zippacker.h"
 
 using Platform::String;
 
 using namespace doo::metrodriver;
 
+// how long a new build has to be left alone before watch mode deploys it
+#define Watch_QUIET_PERIOD 1500
+
 enum Action {
   Run,
   Install,
   Update,
-  Uninstall
+  Uninstall,
+  Watch,
+  History,
+  Results,
+  Pack
 };
 
 Action getAction(const wchar_t* name) {
@@ -23,6 +41,14 @@ Action getAction(const wchar_t* name) {
     return Action::Update;
   } else if (StrCmpIW(name, L"uninstall") == 0) {
     return Action::Uninstall;
+  } else if (StrCmpIW(name, L"watch") == 0) {
+    return Action::Watch;
+  } else if (StrCmpIW(name, L"history") == 0) {
+    return Action::History;
+  } else if (StrCmpIW(name, L"results") == 0) {
+    return Action::Results;
+  } else if (StrCmpIW(name, L"pack") == 0) {
+    return Action::Pack;
   }
   throw ref new Platform::FailureException("Invalid action");
 }
@@ -34,25 +60,47 @@ static bool endsWith(const std::wstring& str1, const std::wstring& str2) {
 
 /*
  validate command line arguments
- the first argument must be a file called AppxManifest.xml or a valid package file ending on ".appx"
- the second argument is the action to perform: install, update, uninstall or run
- the third is optional but if present must be an existing executable file
+ the first argument must be a file called AppxManifest.xml or a valid package file ending on ".appx" or ".appxbundle"
+ the second argument is the action to perform: install, update, uninstall, run, watch, history, results or pack
+ the third is optional but if present must be an existing executable file or callback plugin
+ the results action takes a directory of test result files instead, and optionally the file to write the summary to
+ the pack action takes a layout directory instead, and the .appx or .zip file to create from it
 */
 bool validateArguments(Platform::Array<String^>^ args) {
   if (args->Length < 2) {
-    _tprintf_s(L"Please specify the AppxManifest.xml or .appx for the application that should be run.\n");
+    Log::error(L"Please specify the AppxManifest.xml, .appx or .appxbundle for the application that should be run.");
     return false;
   }
+  if (args->Length > 2 && StrCmpIW(args[2]->Data(), L"results") == 0) {
+    DWORD attributes = GetFileAttributesW(args[1]->Data());
+    if (attributes == INVALID_FILE_ATTRIBUTES || !(attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+      Log::error(L"The results action needs a directory of test result files: %s", args[1]->Data());
+      return false;
+    }
+    return true;
+  }
+  if (args->Length > 2 && StrCmpIW(args[2]->Data(), L"pack") == 0) {
+    DWORD attributes = GetFileAttributesW(args[1]->Data());
+    if (attributes == INVALID_FILE_ATTRIBUTES || !(attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+      Log::error(L"The pack action needs the directory to pack: %s", args[1]->Data());
+      return false;
+    }
+    if (args->Length < 4) {
+      Log::error(L"Please specify the .appx or .zip file to create");
+      return false;
+    }
+    return true;
+  }
   std::wstring sourceFileName(args[1]->Data());
   std::transform(sourceFileName.begin(), sourceFileName.end(), sourceFileName.begin(), ::tolower);
-  if (!(endsWith(sourceFileName, L"appxmanifest.xml") || endsWith(sourceFileName, L".appx"))) {
-    _tprintf_s(L"The first parameter needs to be a file called AppXManifest.xml or an .appx file\n");
+  if (!(endsWith(sourceFileName, L"appxmanifest.xml") || endsWith(sourceFileName, L".appx") || endsWith(sourceFileName, L".appxbundle"))) {
+    Log::error(L"The first parameter needs to be a file called AppXManifest.xml, an .appx or an .appxbundle file");
     return false;
   }
 
   std::ifstream sourceFile(args[1]->Data(), std::ifstream::in);
   if (!sourceFile.is_open()) {
-    _tprintf_s(L"Could not open %s\n", args[1]->Data());
+    Log::error(L"Could not open %s", args[1]->Data());
     return false;
   }
   sourceFile.close();
@@ -61,7 +109,7 @@ bool validateArguments(Platform::Array<String^>^ args) {
     try {
       auto action = getAction(args[2]->Data());
     } catch (...) {
-      _tprintf_s(L"Invalid action. Available commands are: run, install, uninstall\n");
+      Log::error(L"Invalid action. Available commands are: run, install, update, uninstall, watch, history, results, pack");
       return false;      
     }
   }
@@ -69,7 +117,7 @@ bool validateArguments(Platform::Array<String^>^ args) {
   if (args->Length > 3) {
     std::ifstream callback(args[3]->Data(), std::ifstream::in);
     if (!callback.is_open()) {
-      _tprintf_s(L"Callback not found: %s \n", args[3]->Data());
+      Log::error(L"Callback not found: %s", args[3]->Data());
       return false;
     }
     callback.close();
@@ -100,66 +148,392 @@ void InvokeCallback(Platform::String^ callback, Platform::String^ fullAppId) {
         MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
         (LPTSTR)&messageBuffer,
         0, NULL );
-      _tprintf_s(L"Couldn't execute callback: %s\n", messageBuffer);
+      Log::error(L"Couldn't execute callback: %s", messageBuffer);
       LocalFree(messageBuffer);
     }
 }
 
-void runPackage(Package& package) {
+// install and run the app, returns its exit code and the app's peak working set in peakMemory
+int runPackage(Package& package, uint64* peakMemory = nullptr) {
   package.install(Package::InstallationMode::SkipOrUpdate);
   package.enableDebugging(true);
 
   // start the application
-  _tprintf_s(L"Launching app %s\n", package.getFullAppId()->Data());
-  auto processId = package.startApplication();
-  auto process = ATL::CHandle(OpenProcess(SYNCHRONIZE, false, (DWORD)processId));
-  if (process == INVALID_HANDLE_VALUE) {
-    throw ref new Platform::FailureException(L"Could not start app. Terminating.\n");
+  Log::info(LogFields(package.getMetaData()->PackageName->Data()), L"Launching app %s", package.getFullAppId()->Data());
+  long long processId;
+  {
+    PhaseTimings::Scope launchScope(package.getTimings(), "launch");
+    processId = package.startApplication();
+  }
+
+  Log::info(LogFields(package.getMetaData()->PackageName->Data()), L"Waiting for application %s to finish...", package.getFullAppId()->Data());
+  int exitCode;
+  {
+    PhaseTimings::Scope applicationScope(package.getTimings(), "application");
+    exitCode = package.waitForApplication(processId, peakMemory);
+  }
+  Log::info(LogFields(package.getMetaData()->PackageName->Data()), L"Application complete");
+  return exitCode;
+}
+
+// deployments which don't reach the system are announced, DeploymentBackend::shared() picks the backend
+static void announceDeploymentBackend() {
+  char* replayFilename = getenv("APPRUNNER_DEPLOYMENT_REPLAY");
+  char* backendName = getenv("APPRUNNER_DEPLOYMENT");
+  if (replayFilename && *replayFilename) {
+    Log::info(L"Replaying the deployment trace %s", stringToPlatformString(replayFilename)->Data());
+  } else if (backendName && _stricmp(backendName, "simulated") == 0) {
+    Log::info(L"Simulating deployments, nothing is installed");
+  }
+}
+
+// what a callback plugin is told about the run of package
+static CallbackPlugin::RunResult getRunResult(Package& package, int exitCode) {
+  auto metadata = package.getMetaData();
+  CallbackPlugin::RunResult run;
+  run.packageName = platformToStdString(metadata->PackageName);
+  run.packageFullName = platformToStdString(package.getFullName());
+  run.packageFamilyName = platformToStdString(package.getFullAppId());
+  run.packageVersion = platformToStdString(metadata->PackageVersion);
+  run.publisher = platformToStdString(metadata->Publisher);
+  run.architecture = metadata->Architecture ? platformToStdString(metadata->Architecture) : "";
+  run.appId = metadata->AppId ? platformToStdString(metadata->AppId) : "";
+  run.exitCode = exitCode;
+  run.phases = package.getTimings().getPhases();
+  run.localStatePath = platformToStdString(package.getLocalStatePath());
+  return run;
+}
+
+// hand the results of a run to the callback, plugin is used if it was loaded already
+void reportResult(Package& package, int exitCode, Platform::String^ callback, CallbackPlugin* plugin) {
+  Log::info(LogFields(package.getMetaData()->PackageName->Data()), L"Invoking callback: %s", callback->Data());
+  PhaseTimings::Scope callbackScope(package.getTimings(), "callback");
+  if (CallbackPlugin::isPlugin(platformToStdString(callback))) {
+    std::unique_ptr<CallbackPlugin> loadedPlugin;
+    if (!plugin) {
+      loadedPlugin.reset(new CallbackPlugin(platformToStdString(callback)));
+      plugin = loadedPlugin.get();
+    }
+    int pluginResult = plugin->invoke(getRunResult(package, exitCode));
+    if (pluginResult != 0) {
+      Log::error(L"Callback plugin reported an error: %d", pluginResult);
+    }
+  } else {
+    InvokeCallback(callback, package.getFullAppId());
+  }
+}
+
+// the run history file, APPRUNNER_HISTORY overrides the default in the local application data folder
+static std::string getHistoryPath() {
+  char* override = getenv("APPRUNNER_HISTORY");
+  if (override && *override) {
+    return override;
+  }
+  PWSTR localAppData;
+  if FAILED(SHGetKnownFolderPath(FOLDERID_LocalAppData, 0, NULL, &localAppData)) {
+    throw ref new Platform::FailureException(L"Could not determine the local application data folder");
+  }
+  std::string directory = platformToStdString(ref new Platform::String(localAppData)) + "\\MetroDriver";
+  CoTaskMemFree(localAppData);
+  CreateDirectoryA(directory.c_str(), NULL);
+  return directory + "\\history.bin";
+}
+
+// add the finished run to the history, a history that can't be written doesn't fail the run
+void recordRun(Package& package, int exitCode, uint64 peakMemory) {
+  try {
+    auto metadata = package.getMetaData();
+    RunRecord record = RunRecord::create(platformToStdString(metadata->PackageName), platformToStdString(metadata->PackageVersion), package.getTimings());
+    record.exitCode = exitCode;
+    record.peakMemory = peakMemory;
+#ifdef APPRUNNER_ZIP_COUNTERS
+    // watch mode runs many times in one process, only count what was extracted since the last run
+    static uint64 recordedBytes = 0;
+    uint64 extractedBytes = doo::zip::ZipCounters::Total().bytesExtracted;
+    record.bytesExtracted = extractedBytes - recordedBytes;
+    recordedBytes = extractedBytes;
+#endif
+    RunHistory::append(getHistoryPath(), record);
+  } catch (Platform::Exception^ e) {
+    Log::warning(L"Could not record the run: %s", e->Message->Data());
+  }
+}
+
+// print the baselines of every recorded version of the package and the regressions between them
+void printHistory(Package& package) {
+  // this is the output of the command rather than a diagnostic, it goes to the console directly
+  Log::flush();
+  std::string packageName = platformToStdString(package.getMetaData()->PackageName);
+  RunHistory history(getHistoryPath());
+  auto baselines = history.getBaselines(packageName);
+  if (baselines.empty()) {
+    _tprintf_s(L"No runs of %S recorded\n", packageName.c_str());
+    return;
+  }
+  for (auto baseline = baselines.begin(); baseline != baselines.end(); ++baseline) {
+    _tprintf_s(L"Version %S\n", RunHistory::formatVersion(baseline->version).c_str());
+    for (unsigned metric = 0; metric < RunHistory_METRIC_COUNT; metric++) {
+      const MetricBaseline& value = baseline->metrics[metric];
+      if (value.runs == 0) {
+        continue;
+      }
+      if (metric == RunHistory_PEAK_MEMORY) {
+        _tprintf_s(L"  %S: %.1f MB +/- %.1f (%u runs)\n", RunHistory::getMetricName(metric),
+          value.mean / (1024 * 1024), value.deviation / (1024 * 1024), value.runs);
+      } else {
+        _tprintf_s(L"  %S: %.1f ms +/- %.1f (%u runs)\n", RunHistory::getMetricName(metric), value.mean, value.deviation, value.runs);
+      }
+    }
+  }
+  auto regressions = RunHistory::findRegressions(baselines);
+  for (auto regression = regressions.begin(); regression != regressions.end(); ++regression) {
+    _tprintf_s(L"Regression: %S went up by %.1f%% from %S to %S (t = %.1f)\n", RunHistory::getMetricName(regression->metric),
+      regression->increase * 100, RunHistory::formatVersion(baselines[regression->fromVersion].version).c_str(),
+      RunHistory::formatVersion(baselines[regression->toVersion].version).c_str(), regression->t);
+  }
+  if (regressions.empty()) {
+    _tprintf_s(L"No significant regressions\n");
+  }
+}
+
+// merge the test result files in directory into one summary, written to outputPath or to the console if that is empty
+void summarizeTestResults(const std::string& directory, const std::string& outputPath) {
+  TestSummary summary = TestResults::aggregateDirectory(directory);
+  std::string json = summary.toJson();
+  if (outputPath.empty()) {
+    // this is the output of the command rather than a diagnostic, it goes to the console directly
+    Log::flush();
+    fwrite(json.data(), 1, json.size(), stdout);
+    fputc('\n', stdout);
+    return;
+  }
+  std::ofstream output(outputPath.c_str(), std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+  output.write(json.data(), json.size());
+  output.close();
+  if (!output) {
+    throw ref new Platform::FailureException(L"Could not write the test result summary");
+  }
+  Log::info(L"%u tests in %u files: %u passed, %u failed, %u errors, %u skipped", (unsigned)summary.tests, (unsigned)summary.files,
+    (unsigned)summary.passed, (unsigned)summary.failed, (unsigned)summary.errors, (unsigned)summary.skipped);
+}
+
+// pack directory into filename, as an appx package if filename ends on .appx and as a plain ZIP archive otherwise
+void packDirectory(const std::string& directory, const std::string& filename) {
+  std::string extension = filename.size() > 5 ? filename.substr(filename.size() - 5) : std::string();
+  bool appx = _stricmp(extension.c_str(), ".appx") == 0;
+  auto start = GetTickCount64();
+  doo::zip::ZipPacker packer;
+  auto statistics = packer.Pack(directory, filename, appx);
+  Log::info(L"Packed %llu files, %llu bytes into %llu bytes in %llu ms", statistics.files, statistics.uncompressedSize,
+    statistics.archiveSize, GetTickCount64() - start);
+}
+
+// with APPRUNNER_TEST_RESULTS set, summarize what the app left in LocalState\TestResults into the file it names
+void harvestTestResults(Package& package) {
+  char* outputPath = getenv("APPRUNNER_TEST_RESULTS");
+  if (!outputPath || !*outputPath) {
+    return;
+  }
+  std::string directory = platformToStdString(package.getLocalStatePath()) + "\\TestResults";
+  if (GetFileAttributesA(directory.c_str()) == INVALID_FILE_ATTRIBUTES) {
+    Log::warning(L"The app left no test results in %S", directory.c_str());
+    return;
+  }
+  try {
+    summarizeTestResults(directory, outputPath);
+  } catch (Platform::Exception^ e) {
+    Log::warning(L"Could not summarize the test results: %s", e->Message->Data());
   }
+}
 
-  _tprintf_s(L"Waiting for application %s to finish...\n", package.getFullAppId()->Data());
-  WaitForSingleObjectEx(process, INFINITE, false);
-  _tprintf_s(L"Application complete\n");
+// false while another process, e.g. the build, still has the file open for writing
+static bool isWriteFinished(const std::string& path) {
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  CloseHandle(file);
+  return true;
+}
+
+// what watch mode remembers between deployments
+struct WatchState {
+  // the block map of the package deployed last, empty before the first deployment
+  BlockMap deployedBlockMap;
+  Platform::String^ deployedVersion;
+  // loaded once and kept for all runs
+  std::unique_ptr<CallbackPlugin> plugin;
+};
+
+/*
+  Deploy the package if it differs from what was deployed last, then run it.
+  For packages the block maps are compared, so rebuilding without changes does not redeploy.
+  Returns false if the package could not be read yet because it is still being written.
+*/
+bool redeploy(Platform::Array<String^>^ args, WatchState& state, bool dependenciesChanged) {
+  std::string sourcePath = platformToStdString(args[1]);
+  bool isManifest = args[1]->Length() >= 16 && StrCmpIW(args[1]->Data() + args[1]->Length() - 16, L"appxmanifest.xml") == 0;
+  BlockMap blockMap;
+  if (!isManifest) {
+    std::unique_ptr<doo::zip::ZipArchive> archive;
+    try {
+      archive.reset(new doo::zip::ZipArchive(sourcePath));
+    } catch (Platform::Exception^) {
+      return false;
+    }
+    blockMap = BlockMap::read(*archive);
+    BlockMapDifference difference = state.deployedBlockMap.compare(blockMap);
+    if (state.deployedVersion && difference.isEmpty() && !dependenciesChanged) {
+      Log::info(L"Package unchanged, nothing to deploy");
+      return true;
+    }
+    Log::info(L"%u files added, %u modified, %u removed since the last deployment", (unsigned)difference.added.size(),
+      (unsigned)difference.modified.size(), (unsigned)difference.removed.size());
+  }
+
+  Package package(args[1]);
+  // The same version can't be updated in place, its contents changed though. That goes for the first
+  // deployment too, whatever build of the version is installed may be an older one.
+  package.install(Package::InstallationMode::ReinstallOrUpdate);
+  uint64 peakMemory;
+  int exitCode = runPackage(package, &peakMemory);
+  state.deployedBlockMap = blockMap;
+  state.deployedVersion = package.getMetaData()->PackageVersion;
+  harvestTestResults(package);
+  if (args->Length > 3) {
+    reportResult(package, exitCode, args[3], state.plugin.get());
+  }
+  recordRun(package, exitCode, peakMemory);
+  return true;
+}
+
+/*
+  Deploy and run the package, then do it again whenever a new build of it lands, until the process is stopped.
+  Changes are picked up through file system notifications and only acted on once the files were left alone
+  for a moment, so partially written packages are never deployed.
+*/
+void watchPackage(Platform::Array<String^>^ args) {
+  std::string sourcePath = platformToStdString(args[1]);
+  size_t separator = sourcePath.find_last_of("\\/");
+  std::string directory = separator == std::string::npos ? "." : sourcePath.substr(0, separator);
+  std::string sourceName = separator == std::string::npos ? sourcePath : sourcePath.substr(separator + 1);
+
+  WatchState state;
+  if (args->Length > 3 && CallbackPlugin::isPlugin(platformToStdString(args[3]))) {
+    state.plugin.reset(new CallbackPlugin(platformToStdString(args[3])));
+  }
+  DirectoryWatcher watcher(directory);
+  ChangeDebouncer debouncer(Watch_QUIET_PERIOD);
+  bool deploy = true;
+  bool dependenciesChanged = false;
+  for (;;) {
+    if (deploy) {
+      deploy = false;
+      try {
+        if (!redeploy(args, state, dependenciesChanged)) {
+          // still being written, try again once it was left alone
+          debouncer.notify(sourceName, GetTickCount64());
+        } else {
+          dependenciesChanged = false;
+          Log::info(L"Watching %S for changes...", directory.c_str());
+        }
+      } catch (Platform::Exception^ e) {
+        Log::error(L"An error occurred: %s", e->Message->Data());
+      }
+    }
+
+    std::vector<std::string> changedNames;
+    watcher.wait(debouncer.getTimeToNextSettle(GetTickCount64(), INFINITE), changedNames);
+    uint64 now = GetTickCount64();
+    for (auto name = changedNames.begin(); name != changedNames.end(); ++name) {
+      // a manifest's package is the whole directory, otherwise only the package file and its dependencies matter
+      bool isDependency = _strnicmp(name->c_str(), "Dependencies\\", 13) == 0;
+      if (name->empty() || isDependency || _stricmp(name->c_str(), sourceName.c_str()) == 0
+          || _stricmp(sourceName.c_str(), "AppxManifest.xml") == 0) {
+        debouncer.notify(isDependency ? "Dependencies" : sourceName, now);
+      }
+    }
+    std::vector<std::string> settled = debouncer.takeSettled(now);
+    if (settled.empty()) {
+      continue;
+    }
+    if (!isWriteFinished(sourcePath)) {
+      debouncer.notify(sourceName, now);
+      continue;
+    }
+    dependenciesChanged = dependenciesChanged || std::find(settled.begin(), settled.end(), "Dependencies") != settled.end();
+    deploy = true;
+  }
 }
 
 /**
   Install and run the application identified by the manifest given as first parameter
   If a second parameter is given, it will be called after the application has exited
   The first parameter to the callback will be the name of the package
+  A callback ending on .dll is loaded in-process as a plugin and receives the structured run results instead
  **/
 int __cdecl main(Platform::Array<String^>^ args) {
+  Log::start();
   if (!validateArguments(args)) {
+    Log::shutdown();
     return -1;
   }
+  announceDeploymentBackend();
 
   try {
-    Package package(args[1]);
-
-    switch (getAction(args[2]->Data())) {
-    case Install:
-      package.install(Package::InstallationMode::Reinstall);
-      package.enableDebugging(false);
-      break;
-    case Update:
-      package.install(Package::InstallationMode::Update);
-      package.enableDebugging(false);
-      break;
-    case Run:
-      runPackage(package);
-      // check if there was a callback supplied
-      if (args->Length > 3) {
-        _tprintf_s(L"Invoking callback: %s\n", args[3]->Data());
-        InvokeCallback(args[3], package.getFullAppId());
+    auto action = getAction(args[2]->Data());
+    if (action == Watch) {
+      // every build is read anew, watch mode never returns on its own
+      watchPackage(args);
+    } else if (action == Results) {
+      summarizeTestResults(platformToStdString(args[1]), args->Length > 3 ? platformToStdString(args[3]) : std::string());
+    } else if (action == Pack) {
+      packDirectory(platformToStdString(args[1]), platformToStdString(args[3]));
+    } else {
+      Package package(args[1]);
+
+      switch (action) {
+      case Install:
+        package.install(Package::InstallationMode::Reinstall);
+        package.enableDebugging(false);
+        break;
+      case Update:
+        package.install(Package::InstallationMode::Update);
+        package.enableDebugging(false);
+        break;
+      case Run: {
+        uint64 peakMemory;
+        int exitCode = runPackage(package, &peakMemory);
+        harvestTestResults(package);
+        // check if there was a callback supplied
+        if (args->Length > 3) {
+          reportResult(package, exitCode, args[3], nullptr);
+        }
+        recordRun(package, exitCode, peakMemory);
+        break;
+      }
+      case History:
+        printHistory(package);
+        break;
+      case Uninstall:
+        package.uninstall();
+        break;
       }
-      break;
-    case Uninstall:
-      package.uninstall();
-      break;
     }
   } catch (Platform::Exception^ e) {
-    _tprintf_s(L"An error occurred: %s\n", e->Message->Data());
+    Log::error(L"An error occurred: %s", e->Message->Data());
   }
+
+#ifdef APPRUNNER_ZIP_COUNTERS
+  Log::flush();
+  _tprintf_s(L"Package reading counters:\n%s", doo::zip::ZipCounters::Total().Format().c_str());
+#endif
+#ifdef APPRUNNER_ALLOCATION_TRACKING
+  Log::flush();
+  _tprintf_s(L"Allocations:\n%s", AllocationTracker::format().c_str());
+#endif
   
-  _tprintf_s(L"Done. Thank you for using MetroDriver.\n");
+  Log::info(L"Done. Thank you for using MetroDriver.");
+  Log::shutdown();
   return 0;
 }
\ No newline at end of file
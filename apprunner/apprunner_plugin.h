@@ -0,0 +1,74 @@
+/*
+  C ABI for in-process apprunner callback plugins.
+
+  Instead of an executable, a shared library exporting the functions below can be passed as
+  the callback argument. apprunner loads it after the app has exited and hands it the
+  structured results of the run. All strings are UTF-8 and only valid during the call.
+
+  This header deliberately has no Windows dependencies so plugins can be built and tested
+  on any platform.
+*/
+#ifndef APPRUNNER_PLUGIN_H_INCLUDED
+#define APPRUNNER_PLUGIN_H_INCLUDED
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// bumped whenever apprunner_run_result changes in an incompatible way
+#define APPRUNNER_PLUGIN_ABI_VERSION 1
+
+#if defined(_WIN32)
+  #define APPRUNNER_PLUGIN_CALL __cdecl
+  #define APPRUNNER_PLUGIN_EXPORT __declspec(dllexport)
+#else
+  #define APPRUNNER_PLUGIN_CALL
+  #define APPRUNNER_PLUGIN_EXPORT __attribute__((visibility("default")))
+#endif
+
+// the duration of a single phase of the run, e.g. "staging" or "application"
+typedef struct apprunner_phase_timing {
+  const char* name;
+  double duration_ms;
+} apprunner_phase_timing;
+
+typedef struct apprunner_run_result {
+  // sizeof(apprunner_run_result) as seen by apprunner, new fields are only ever appended
+  uint32_t struct_size;
+
+  // package identity
+  const char* package_name;
+  const char* package_full_name;
+  const char* package_family_name;
+  const char* package_version;
+  const char* publisher;
+  const char* architecture;
+  const char* app_id;
+
+  // exit code of the application process
+  int32_t exit_code;
+
+  // phase timings in the order they happened
+  const apprunner_phase_timing* phases;
+  uint32_t phase_count;
+
+  // the LocalState folder of the package, e.g. to harvest test results
+  const char* local_state_path;
+} apprunner_run_result;
+
+// exported as "apprunner_plugin_abi_version", must return APPRUNNER_PLUGIN_ABI_VERSION
+typedef int (APPRUNNER_PLUGIN_CALL *apprunner_plugin_abi_version_fn)(void);
+
+// exported as "apprunner_plugin_run_complete", returns 0 on success
+typedef int (APPRUNNER_PLUGIN_CALL *apprunner_plugin_run_complete_fn)(const apprunner_run_result* result);
+
+#define APPRUNNER_PLUGIN_ABI_VERSION_SYMBOL "apprunner_plugin_abi_version"
+#define APPRUNNER_PLUGIN_RUN_COMPLETE_SYMBOL "apprunner_plugin_run_complete"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // APPRUNNER_PLUGIN_H_INCLUDED
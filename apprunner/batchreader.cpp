@@ -0,0 +1,209 @@
+#include "stdafx.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#endif
+
+#include "batchreader.h"
+#include "zipcounters.h"
+
+using namespace doo::zip;
+
+BatchReader::BatchReader(const RandomAccessFile& file, unsigned queueDepth)
+  : file(file), slots(std::max(1U, std::min<unsigned>(queueDepth, BatchReader_MAX_QUEUE_DEPTH)))
+{
+  for (auto slot = slots.begin(); slot != slots.end(); ++slot) {
+#ifdef _WIN32
+    slot->completed = NULL;
+#endif
+    slot->busy = false;
+  }
+#ifdef _WIN32
+  for (auto slot = slots.begin(); slot != slots.end(); ++slot) {
+    slot->completed = CreateEventEx(NULL, NULL, CREATE_EVENT_MANUAL_RESET, EVENT_ALL_ACCESS);
+    if (!slot->completed) {
+      for (auto created = slots.begin(); created != slot; ++created) {
+        CloseHandle(created->completed);
+      }
+      throw ref new Platform::FailureException(L"Could not create read event");
+    }
+  }
+#endif
+}
+
+BatchReader::~BatchReader() {
+#ifdef _WIN32
+  for (auto slot = slots.begin(); slot != slots.end(); ++slot) {
+    CloseHandle(slot->completed);
+  }
+#endif
+}
+
+/************************************************************************/
+/* Start reading whatever of the slot's request hasn't arrived yet      */
+/************************************************************************/
+void BatchReader::Issue(Slot& slot) {
+  uint64 offset = slot.request.offset + slot.received;
+  size_t chunk = std::min<size_t>(slot.request.length - slot.received, 0x40000000);
+#ifdef APPRUNNER_ZIP_COUNTERS
+  ZipCounters::Local().CountRead(&file, offset, chunk);
+#endif
+#ifdef _WIN32
+  ZeroMemory(&slot.overlapped, sizeof(slot.overlapped));
+  slot.overlapped.Offset = static_cast<DWORD>(offset);
+  slot.overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+  slot.overlapped.hEvent = slot.completed;
+  ResetEvent(slot.completed);
+  if (!ReadFile(file.GetHandle(), slot.buffer.data() + slot.received, static_cast<DWORD>(chunk), NULL, &slot.overlapped)
+    && GetLastError() != ERROR_IO_PENDING) {
+    throw ref new Platform::FailureException(L"Could not read file");
+  }
+#else
+  memset(&slot.control, 0, sizeof(slot.control));
+  slot.control.aio_fildes = file.GetHandle();
+  slot.control.aio_buf = slot.buffer.data() + slot.received;
+  slot.control.aio_nbytes = chunk;
+  slot.control.aio_offset = static_cast<off_t>(offset);
+  slot.control.aio_sigevent.sigev_notify = SIGEV_NONE;
+  if (aio_read(&slot.control) != 0) {
+    throw ref new Platform::FailureException(L"Could not read file");
+  }
+#endif
+  slot.busy = true;
+}
+
+/************************************************************************/
+/* The buffers must not go away while the system still writes to them,  */
+/* so every cancelled read is waited for                                */
+/************************************************************************/
+void BatchReader::CancelOutstanding() {
+  for (auto slot = slots.begin(); slot != slots.end(); ++slot) {
+    if (slot->busy) {
+#ifdef _WIN32
+      CancelIoEx(file.GetHandle(), &slot->overlapped);
+      DWORD bytesRead;
+      GetOverlappedResult(file.GetHandle(), &slot->overlapped, &bytesRead, TRUE);
+#else
+      aio_cancel(file.GetHandle(), &slot->control);
+      const aiocb* control = &slot->control;
+      while (aio_error(control) == EINPROGRESS) {
+        aio_suspend(&control, 1, NULL);
+      }
+      aio_return(&slot->control);
+#endif
+      slot->busy = false;
+    }
+  }
+}
+
+/************************************************************************/
+/* Slots are refilled as soon as they are handed out, so the disk keeps */
+/* working on the next reads while the caller processes the data        */
+/************************************************************************/
+void BatchReader::Read(std::vector<Request> requests, const CompletionCallback& completed) {
+  for (auto request = requests.begin(); request != requests.end(); ++request) {
+    if (request->offset > file.GetSize() || request->length > file.GetSize() - request->offset) {
+      throw ref new Platform::FailureException(L"Read beyond the end of the file");
+    }
+  }
+  std::stable_sort(requests.begin(), requests.end(), [](const Request& request, const Request& other) {
+    return request.offset < other.offset;
+  });
+
+  size_t next = 0;
+  size_t outstanding = 0;
+  uint64 bytesInFlight = 0;
+#ifdef _WIN32
+  std::vector<HANDLE> events;
+#else
+  std::vector<const aiocb*> events;
+#endif
+  std::vector<Slot*> waiting;
+  try {
+    for (;;) {
+      for (auto slot = slots.begin(); slot != slots.end() && next < requests.size(); ++slot) {
+        if (slot->busy) {
+          continue;
+        }
+        // one request on its own is always allowed, however large
+        if (outstanding > 0 && bytesInFlight + requests[next].length > BatchReader_MAX_IN_FLIGHT) {
+          break;
+        }
+        const Request& request = requests[next++];
+        if (request.length == 0) {
+          completed(request, NULL);
+          continue;
+        }
+        slot->request = request;
+        slot->received = 0;
+        if (slot->buffer.size() < request.length) {
+          slot->buffer.resize(request.length);
+        }
+        Issue(*slot);
+        outstanding++;
+        bytesInFlight += request.length;
+      }
+      if (outstanding == 0) {
+        if (next == requests.size()) {
+          break;
+        }
+        continue;
+      }
+
+      events.clear();
+      waiting.clear();
+      for (auto slot = slots.begin(); slot != slots.end(); ++slot) {
+        if (slot->busy) {
+#ifdef _WIN32
+          events.push_back(slot->completed);
+#else
+          events.push_back(&slot->control);
+#endif
+          waiting.push_back(&*slot);
+        }
+      }
+#ifdef _WIN32
+      DWORD signaled = WaitForMultipleObjectsEx(static_cast<DWORD>(events.size()), events.data(), FALSE, INFINITE, FALSE);
+      if (signaled >= WAIT_OBJECT_0 + events.size()) {
+        throw ref new Platform::FailureException(L"Could not wait for read");
+      }
+      Slot& slot = *waiting[signaled - WAIT_OBJECT_0];
+      DWORD bytesRead = 0;
+      BOOL succeeded = GetOverlappedResult(file.GetHandle(), &slot.overlapped, &bytesRead, FALSE);
+#else
+      if (aio_suspend(events.data(), static_cast<int>(events.size()), NULL) != 0 && errno != EINTR) {
+        throw ref new Platform::FailureException(L"Could not wait for read");
+      }
+      size_t signaled = 0;
+      while (signaled < waiting.size() && aio_error(events[signaled]) == EINPROGRESS) {
+        signaled++;
+      }
+      if (signaled == waiting.size()) {
+        continue;
+      }
+      Slot& slot = *waiting[signaled];
+      bool succeeded = aio_error(&slot.control) == 0;
+      ssize_t bytesRead = aio_return(&slot.control);
+#endif
+      slot.busy = false;
+      if (!succeeded || bytesRead <= 0) {
+        throw ref new Platform::FailureException(L"Could not read file");
+      }
+      slot.received += bytesRead;
+      if (slot.received < slot.request.length) {
+        Issue(slot);
+        continue;
+      }
+      outstanding--;
+      bytesInFlight -= slot.request.length;
+      completed(slot.request, slot.buffer.data());
+      // kept for the next request unless it is larger than a slot's share of what may be in flight
+      if (slot.buffer.size() > BatchReader_MAX_IN_FLIGHT / slots.size()) {
+        std::vector<byte>().swap(slot.buffer);
+      }
+    }
+  } catch (...) {
+    CancelOutstanding();
+    throw;
+  }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+#ifndef _WIN32
+#include <aio.h>
+#endif
+
+#include "randomaccessfile.h"
+
+// how many reads are outstanding at once by default
+#define BatchReader_DEFAULT_QUEUE_DEPTH 16
+#ifdef _WIN32
+// each outstanding read waits on its own event, WaitForMultipleObjects takes no more than this
+#define BatchReader_MAX_QUEUE_DEPTH MAXIMUM_WAIT_OBJECTS
+#else
+// as many as on Windows, aio_suspend is handed all outstanding reads each time
+#define BatchReader_MAX_QUEUE_DEPTH 64
+#endif
+// no more reads are started while this many bytes are outstanding, a larger request is read on its own
+#define BatchReader_MAX_IN_FLIGHT (8 * 1024 * 1024)
+
+namespace doo {
+  namespace zip {
+    // Reads many ranges of a file with several overlapped reads outstanding at once, so a cold disk
+    // sees a deep queue instead of one read after the other. Requests are issued by ascending offset
+    // and handed out as they complete on the calling thread, which can process them while the next
+    // reads are still in flight. Outside Windows the reads are POSIX asynchronous ones.
+    //
+    // A reader and its buffers belong to one thread, any number of readers may share a file.
+    class BatchReader {
+    public:
+      struct Request {
+        uint64 offset;
+        size_t length;
+        // passed back with the data, e.g. the index of the entry
+        size_t tag;
+      };
+
+      // data holds request.length bytes and is valid until the callback returns
+      typedef std::function<void (const Request& request, const byte* data)> CompletionCallback;
+
+      // queueDepth is capped at BatchReader_MAX_QUEUE_DEPTH
+      BatchReader(const RandomAccessFile& file, unsigned queueDepth = BatchReader_DEFAULT_QUEUE_DEPTH);
+      ~BatchReader();
+
+      // Read all requests and pass each to completed once its data is there, in no particular order.
+      // Returns once all have been handed out. If a read fails or completed throws, the reads still
+      // outstanding are cancelled and the error is rethrown.
+      void Read(std::vector<Request> requests, const CompletionCallback& completed);
+
+    private:
+      BatchReader(const BatchReader&);
+      BatchReader& operator=(const BatchReader&);
+
+      // one outstanding read, buffers are kept for the next batch
+      struct Slot {
+#ifdef _WIN32
+        OVERLAPPED overlapped;
+        HANDLE completed;
+#else
+        aiocb control;
+#endif
+        std::vector<byte> buffer;
+        Request request;
+        // how much of the request arrived, short reads are continued
+        size_t received;
+        bool busy;
+      };
+
+      void Issue(Slot& slot);
+      void CancelOutstanding();
+
+      const RandomAccessFile& file;
+      std::vector<Slot> slots;
+    };
+  }
+}
@@ -0,0 +1,152 @@
+#include "stdafx.h"
+
+#include "zipformat.h"
+#include "codec.h"
+#include "tinflcodec.h"
+#include "parallelinflatecodec.h"
+#include "zlibcodec.h"
+#include "lzmacodec.h"
+#include "zstdcodec.h"
+
+using namespace doo::zip;
+
+namespace {
+  // method 0, the data is copied as it is
+  class StoredCodec : public Codec {
+  public:
+    virtual uint16 GetMethod() const {
+      return ZipArchive_METHOD_STORED;
+    }
+
+    virtual const char* GetName() const {
+      return "stored";
+    }
+
+    virtual void Decompress(const RandomAccessFile& file, uint64 offset, uint64 compressedSize,
+      byte* buffer, size_t uncompressedSize, uint16) const
+    {
+      if (compressedSize != uncompressedSize) {
+        throw ref new Platform::FailureException(L"Could not extract data");
+      }
+      if (uncompressedSize > 0) {
+        file.ReadAt(offset, buffer, uncompressedSize);
+      }
+    }
+
+    virtual bool CanDecompressBuffer() const {
+      return true;
+    }
+
+    virtual void DecompressBuffer(const byte* input, size_t compressedSize,
+      byte* buffer, size_t uncompressedSize, uint16) const
+    {
+      if (compressedSize != uncompressedSize) {
+        throw ref new Platform::FailureException(L"Could not extract data");
+      }
+      memcpy(buffer, input, uncompressedSize);
+    }
+  };
+}
+
+void Codec::DecompressBuffer(const byte*, size_t, byte*, size_t, uint16) const {
+  throw ref new Platform::FailureException(L"Codec can only decompress from the file");
+}
+
+// the registry Shared() returns
+static CodecRegistry sharedRegistry;
+// returned by GetCodecs() for methods without a codec
+static const std::vector<std::shared_ptr<Codec>> noCodecs;
+
+/************************************************************************/
+/* Optional libraries are registered after tinfl, so they are preferred */
+/* whenever the build includes them                                     */
+/************************************************************************/
+CodecRegistry::CodecRegistry()
+  : frozen(false)
+{
+  Register(std::make_shared<StoredCodec>());
+  // experimental, only used when picked with SetPreferred()
+  Register(std::make_shared<ParallelInflateCodec>());
+  Register(std::make_shared<TinflCodec>(ZipArchive_METHOD_DEFLATE));
+  Register(std::make_shared<TinflCodec>(ZipArchive_METHOD_DEFLATE64));
+#ifdef APPRUNNER_USE_ZLIB
+  Register(std::make_shared<ZlibCodec>());
+#endif
+#ifdef APPRUNNER_USE_LZMA
+  Register(std::make_shared<LzmaCodec>());
+#endif
+#ifdef APPRUNNER_USE_ZSTD
+  Register(std::make_shared<ZstdCodec>());
+#endif
+}
+
+CodecRegistry& CodecRegistry::Shared() {
+  return sharedRegistry;
+}
+
+void CodecRegistry::CheckNotFrozen() const {
+  if (frozen) {
+    throw ref new Platform::FailureException(L"Codecs can't be changed once archives were extracted");
+  }
+}
+
+void CodecRegistry::Register(std::shared_ptr<Codec> codec) {
+  std::lock_guard<std::mutex> guard(lock);
+  CheckNotFrozen();
+  codecs[codec->GetMethod()].push_back(codec);
+}
+
+void CodecRegistry::SetPreferred(uint16 method, const std::string& name) {
+  std::lock_guard<std::mutex> guard(lock);
+  CheckNotFrozen();
+  auto entry = codecs.find(method);
+  if (entry != codecs.end()) {
+    std::vector<std::shared_ptr<Codec>>& candidates = entry->second;
+    for (auto codec = candidates.begin(); codec != candidates.end(); ++codec) {
+      if (name == (*codec)->GetName()) {
+        std::shared_ptr<Codec> preferred = *codec;
+        candidates.erase(codec);
+        candidates.push_back(preferred);
+        return;
+      }
+    }
+  }
+  throw ref new Platform::InvalidArgumentException(L"No such codec for this compression method");
+}
+
+/************************************************************************/
+/* Neither the map nor the table of preferred codecs changes after      */
+/* this, so every thread can read them without taking the lock          */
+/************************************************************************/
+void CodecRegistry::Freeze() {
+  std::lock_guard<std::mutex> guard(lock);
+  if (frozen) {
+    return;
+  }
+  // the map is sorted, the last method is the largest
+  preferred.resize(codecs.empty() ? 0 : codecs.rbegin()->first + 1);
+  for (auto entry = codecs.begin(); entry != codecs.end(); ++entry) {
+    if (!entry->second.empty()) {
+      preferred[entry->first] = entry->second.back();
+    }
+  }
+  frozen = true;
+}
+
+std::shared_ptr<Codec> CodecRegistry::Find(uint16 method) {
+  if (!frozen) {
+    Freeze();
+  }
+  if (method >= preferred.size()) {
+    return std::shared_ptr<Codec>();
+  }
+  return preferred[method];
+}
+
+const std::vector<std::shared_ptr<Codec>>& CodecRegistry::GetCodecs(uint16 method) {
+  if (!frozen) {
+    Freeze();
+  }
+  auto entry = codecs.find(method);
+  return entry != codecs.end() ? entry->second : noCodecs;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "randomaccessfile.h"
+
+namespace doo {
+  namespace zip {
+    // decompresses the entries of one ZIP compression method
+    class Codec {
+    public:
+      virtual ~Codec() {}
+
+      // the compression method as stored in the ZIP headers
+      virtual uint16 GetMethod() const = 0;
+      // the library doing the work, e.g. "tinfl" or "zlib"
+      virtual const char* GetName() const = 0;
+
+      // decompress the compressedSize bytes at offset into buffer, which receives exactly uncompressedSize bytes.
+      // flags are the entry's general purpose flags. Throws if the data is damaged or has a different size.
+      virtual void Decompress(const RandomAccessFile& file, uint64 offset, uint64 compressedSize,
+        byte* buffer, size_t uncompressedSize, uint16 flags) const = 0;
+
+      // whether DecompressBuffer() is supported, otherwise the compressed data is always read through Decompress()
+      virtual bool CanDecompressBuffer() const {
+        return false;
+      }
+
+      // like Decompress(), for compressed data that has already been read into memory
+      virtual void DecompressBuffer(const byte* input, size_t compressedSize,
+        byte* buffer, size_t uncompressedSize, uint16 flags) const;
+    };
+
+    // The codecs available for each compression method. The built-in ones are registered up front:
+    // stored, tinfl for deflate and Deflate64, and whatever optional libraries the build includes.
+    // The registry is frozen by the first lookup, from then on it is read without locking and
+    // Register() and SetPreferred() throw. Set it up before the first archive is extracted.
+    class CodecRegistry {
+    public:
+      CodecRegistry();
+
+      // the registry used by all archives
+      static CodecRegistry& Shared();
+
+      // add a codec, it becomes the preferred one for its method
+      void Register(std::shared_ptr<Codec> codec);
+
+      // make the codec with that name the preferred one for method, throws if there is none
+      void SetPreferred(uint16 method, const std::string& name);
+
+      // stop changes to the registry, called by the first lookup
+      void Freeze();
+
+      // the preferred codec for method, empty if the method is not supported
+      std::shared_ptr<Codec> Find(uint16 method);
+
+      // every codec for method, to compare the backends on the same data
+      const std::vector<std::shared_ptr<Codec>>& GetCodecs(uint16 method);
+
+    private:
+      CodecRegistry(const CodecRegistry&);
+      CodecRegistry& operator=(const CodecRegistry&);
+
+      // throws if the registry is frozen, call with the lock held
+      void CheckNotFrozen() const;
+
+      // serializes changes and freezing, lookups don't take it
+      std::mutex lock;
+      std::atomic<bool> frozen;
+      // the preferred codec is the last one
+      std::map<uint16, std::vector<std::shared_ptr<Codec>>> codecs;
+      // the preferred codec by method, filled when the registry is frozen
+      std::vector<std::shared_ptr<Codec>> preferred;
+    };
+  }
+}
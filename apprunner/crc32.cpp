@@ -0,0 +1,102 @@
+#include "stdafx.h"
+
+#include "crc32.h"
+
+namespace {
+  /************************************************************************/
+  /* Lookup tables for slicing-by-4, built once at startup                */
+  /************************************************************************/
+  struct Crc32Tables {
+    uint32 table[4][256];
+
+    Crc32Tables() {
+      for (uint32 i = 0; i < 256; i++) {
+        uint32 crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+          crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : (crc >> 1);
+        }
+        table[0][i] = crc;
+      }
+      for (uint32 i = 0; i < 256; i++) {
+        for (int slice = 1; slice < 4; slice++) {
+          table[slice][i] = (table[slice-1][i] >> 8) ^ table[0][table[slice-1][i] & 0xFF];
+        }
+      }
+    }
+  };
+
+  const Crc32Tables crcTables;
+
+  // multiply a 32x32 matrix over GF(2) with a vector
+  uint32 multiplyMatrix(const uint32* matrix, uint32 vector) {
+    uint32 result = 0;
+    for (; vector; vector >>= 1, matrix++) {
+      if (vector & 1) {
+        result ^= *matrix;
+      }
+    }
+    return result;
+  }
+
+  void squareMatrix(uint32* square, const uint32* matrix) {
+    for (int i = 0; i < 32; i++) {
+      square[i] = multiplyMatrix(matrix, matrix[i]);
+    }
+  }
+}
+
+uint32 doo::zip::UpdateCrc32(uint32 crc, const byte* data, size_t length) {
+  crc = ~crc;
+  // process four bytes at a time until the tail
+  while (length >= 4) {
+    crc ^= data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32)data[3] << 24);
+    crc = crcTables.table[3][crc & 0xFF] ^
+      crcTables.table[2][(crc >> 8) & 0xFF] ^
+      crcTables.table[1][(crc >> 16) & 0xFF] ^
+      crcTables.table[0][crc >> 24];
+    data += 4;
+    length -= 4;
+  }
+  while (length--) {
+    crc = (crc >> 8) ^ crcTables.table[0][(crc ^ *data++) & 0xFF];
+  }
+  return ~crc;
+}
+
+/************************************************************************/
+/* Appending length2 zero bytes to crc1 is a linear operation, applied  */
+/* by repeatedly squaring the operator for a single zero bit as zlib's  */
+/* crc32_combine does. Then the CRC of the second chunk is added        */
+/************************************************************************/
+uint32 doo::zip::CombineCrc32(uint32 crc1, uint32 crc2, uint64 length2) {
+  if (length2 == 0) {
+    return crc1;
+  }
+  uint32 even[32];
+  uint32 odd[32];
+  // the operator for one zero bit
+  odd[0] = 0xEDB88320;
+  for (int i = 1; i < 32; i++) {
+    odd[i] = 1U << (i - 1);
+  }
+  // two and four zero bits
+  squareMatrix(even, odd);
+  squareMatrix(odd, even);
+  // apply one zero byte at the first step, then double with every step
+  do {
+    squareMatrix(even, odd);
+    if (length2 & 1) {
+      crc1 = multiplyMatrix(even, crc1);
+    }
+    length2 >>= 1;
+    if (length2 == 0) {
+      break;
+    }
+    squareMatrix(odd, even);
+    if (length2 & 1) {
+      crc1 = multiplyMatrix(odd, crc1);
+    }
+    length2 >>= 1;
+  } while (length2 != 0);
+  return crc1 ^ crc2;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+namespace doo {
+  namespace zip {
+    // continue a CRC-32 (as used by ZIP) over another chunk of data, start with crc = 0
+    uint32 UpdateCrc32(uint32 crc, const byte* data, size_t length);
+
+    // the CRC-32 of two chunks one after the other from the CRC-32 of each, so chunks can be summed up on different threads
+    uint32 CombineCrc32(uint32 crc1, uint32 crc2, uint64 length2);
+  }
+}
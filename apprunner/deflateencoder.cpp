@@ -0,0 +1,495 @@
+#include "stdafx.h"
+
+#include "deflateencoder.h"
+
+using namespace doo::zip;
+
+// positions are hashed by their first three bytes into this many chains
+#define DeflateEncoder_HASH_BITS 15
+// a block is written once it holds this many symbols, blocks adapt their codes to the data
+#define DeflateEncoder_BLOCK_SYMBOLS 16384
+// matches at least this long are taken without looking for a longer one at the next position
+#define DeflateEncoder_LAZY_LENGTH 32
+// three byte matches further away than this cost more than the literals
+#define DeflateEncoder_TOO_FAR 4096
+// the end of a hash chain
+#define DeflateEncoder_NONE 0xFFFFFFFF
+
+namespace {
+  const uint16 lengthBase[29] = { 3,4,5,6,7,8,9,10,11,13, 15,17,19,23,27,31,35,43,51,59, 67,83,99,115,131,163,195,227,258 };
+  const byte lengthExtra[29] = { 0,0,0,0,0,0,0,0,1,1, 1,1,2,2,2,2,3,3,3,3, 4,4,4,4,5,5,5,5,0 };
+  const uint16 distanceBase[30] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193, 257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+  const byte distanceExtra[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+  const byte codeLengthOrder[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
+
+  /************************************************************************/
+  /* Symbol lookups for lengths and distances and the fixed codes, built  */
+  /* once at startup                                                      */
+  /************************************************************************/
+  struct EncoderTables {
+    byte lengthSymbol[259];
+    // distances up to 256 directly, larger ones by their distance - 1 shifted right by 7
+    byte distanceSymbol[512];
+    byte fixedLiteralLengths[288];
+    byte fixedDistanceLengths[30];
+
+    EncoderTables() {
+      for (int symbol = 0; symbol < 29; symbol++) {
+        int end = symbol == 28 ? 259 : lengthBase[symbol] + (1 << lengthExtra[symbol]);
+        for (int length = lengthBase[symbol]; length < end; length++) {
+          lengthSymbol[length] = static_cast<byte>(symbol);
+        }
+      }
+      for (int symbol = 0; symbol < 30; symbol++) {
+        for (int distance = distanceBase[symbol]; distance < distanceBase[symbol] + (1 << distanceExtra[symbol]); distance++) {
+          if (distance <= 256) {
+            distanceSymbol[distance - 1] = static_cast<byte>(symbol);
+          } else {
+            distanceSymbol[256 + ((distance - 1) >> 7)] = static_cast<byte>(symbol);
+          }
+        }
+      }
+      for (int symbol = 0; symbol < 288; symbol++) {
+        fixedLiteralLengths[symbol] = symbol < 144 ? 8 : symbol < 256 ? 9 : symbol < 280 ? 7 : 8;
+      }
+      memset(fixedDistanceLengths, 5, sizeof(fixedDistanceLengths));
+    }
+
+    byte GetDistanceSymbol(uint32 distance) const {
+      return distance <= 256 ? distanceSymbol[distance - 1] : distanceSymbol[256 + ((distance - 1) >> 7)];
+    }
+  };
+
+  const EncoderTables tables;
+
+  inline uint32 hash(const byte* data) {
+    uint32 value = data[0] | (data[1] << 8) | (data[2] << 16);
+    return (value * 2654435761U) >> (32 - DeflateEncoder_HASH_BITS);
+  }
+
+  // the number of equal bytes at the start of both, up to limit
+  inline uint32 matchLength(const byte* data, const byte* other, uint32 limit) {
+    uint32 length = 0;
+    while (length + 8 <= limit) {
+      uint64 word;
+      uint64 otherWord;
+      memcpy(&word, data + length, 8);
+      memcpy(&otherWord, other + length, 8);
+      uint64 difference = word ^ otherWord;
+      if (difference != 0) {
+#ifdef _MSC_VER
+        unsigned long bit;
+        _BitScanForward64(&bit, difference);
+        return length + bit / 8;
+#else
+        return length + __builtin_ctzll(difference) / 8;
+#endif
+      }
+      length += 8;
+    }
+    while (length < limit && data[length] == other[length]) {
+      length++;
+    }
+    return length;
+  }
+
+  /************************************************************************/
+  /* Huffman code lengths of at most maxBits for the given frequencies.   */
+  /* The tree is built with two queues over the leaves sorted by          */
+  /* frequency. Codes that come out too long are shortened by moving      */
+  /* leaves up the tree as in JPEG's Annex K.3, then the shortest codes   */
+  /* go to the most frequent symbols. A single used symbol gets a partner */
+  /* so the code is always complete                                       */
+  /************************************************************************/
+  void buildCodeLengths(const uint32* frequencies, int count, int maxBits, byte* lengths) {
+    memset(lengths, 0, count);
+    std::pair<uint32, int> leaves[288];
+    int leafCount = 0;
+    for (int symbol = 0; symbol < count; symbol++) {
+      if (frequencies[symbol] > 0) {
+        leaves[leafCount++] = std::make_pair(frequencies[symbol], symbol);
+      }
+    }
+    if (leafCount < 2) {
+      int used = leafCount == 1 ? leaves[0].second : 0;
+      lengths[used] = 1;
+      lengths[used == 0 ? 1 : 0] = 1;
+      return;
+    }
+    std::sort(leaves, leaves + leafCount);
+
+    // leaves are nodes 0 to leafCount - 1, the internal nodes follow in the order they are created
+    uint32 weights[2 * 288];
+    int parents[2 * 288];
+    for (int i = 0; i < leafCount; i++) {
+      weights[i] = leaves[i].first;
+    }
+    int nextLeaf = 0;
+    int nextInternal = leafCount;
+    for (int node = leafCount; node < 2 * leafCount - 1; node++) {
+      int children[2];
+      for (int child = 0; child < 2; child++) {
+        if (nextLeaf < leafCount && (nextInternal == node || weights[nextLeaf] <= weights[nextInternal])) {
+          children[child] = nextLeaf++;
+        } else {
+          children[child] = nextInternal++;
+        }
+      }
+      weights[node] = weights[children[0]] + weights[children[1]];
+      parents[children[0]] = node;
+      parents[children[1]] = node;
+    }
+    int depths[2 * 288];
+    int root = 2 * leafCount - 2;
+    depths[root] = 0;
+    int lengthCounts[288] = { 0 };
+    int longest = 0;
+    for (int node = root - 1; node >= 0; node--) {
+      depths[node] = depths[parents[node]] + 1;
+      if (node < leafCount) {
+        lengthCounts[depths[node]]++;
+        longest = std::max(longest, depths[node]);
+      }
+    }
+
+    for (int length = longest; length > maxBits; length--) {
+      while (lengthCounts[length] > 0) {
+        int shorter = length - 2;
+        while (lengthCounts[shorter] == 0) {
+          shorter--;
+        }
+        lengthCounts[length] -= 2;
+        lengthCounts[length - 1]++;
+        lengthCounts[shorter + 1] += 2;
+        lengthCounts[shorter]--;
+      }
+    }
+    int leaf = leafCount - 1;
+    for (int length = 1; length <= std::min(longest, maxBits); length++) {
+      for (int i = 0; i < lengthCounts[length]; i++) {
+        lengths[leaves[leaf--].second] = static_cast<byte>(length);
+      }
+    }
+  }
+
+  // canonical codes for the lengths, bit reversed since deflate writes codes starting with their first bit
+  void buildCodes(const byte* lengths, int count, uint16* codes) {
+    int lengthCounts[16] = { 0 };
+    for (int symbol = 0; symbol < count; symbol++) {
+      lengthCounts[lengths[symbol]]++;
+    }
+    lengthCounts[0] = 0;
+    uint16 nextCode[16];
+    uint16 code = 0;
+    for (int length = 1; length < 16; length++) {
+      code = static_cast<uint16>((code + lengthCounts[length - 1]) << 1);
+      nextCode[length] = code;
+    }
+    for (int symbol = 0; symbol < count; symbol++) {
+      int length = lengths[symbol];
+      if (length == 0) {
+        continue;
+      }
+      uint16 value = nextCode[length]++;
+      uint16 reversed = 0;
+      for (int bit = 0; bit < length; bit++) {
+        reversed = static_cast<uint16>((reversed << 1) | ((value >> bit) & 1));
+      }
+      codes[symbol] = reversed;
+    }
+  }
+}
+
+DeflateEncoder::DeflateEncoder()
+  : window(NULL), windowLength(0), head(1 << DeflateEncoder_HASH_BITS), output(NULL), bitBuffer(0), bitCount(0)
+{
+}
+
+uint32 DeflateEncoder::FindMatch(uint32 position, uint32 shortest, uint32& distance) const {
+  uint32 limit = std::min<uint32>(258, windowLength - position);
+  if (limit < 3) {
+    return 0;
+  }
+  const byte* current = window + position;
+  uint32 best = shortest;
+  uint32 candidate = head[hash(current)];
+  for (int chain = DeflateEncoder_MAX_CHAIN; candidate != DeflateEncoder_NONE && position - candidate <= DeflateEncoder_WINDOW_SIZE && chain > 0; chain--) {
+    const byte* match = window + candidate;
+    // most candidates differ at the byte that would make the match longer
+    if (best < limit && match[best] == current[best]) {
+      uint32 length = matchLength(current, match, limit);
+      if (length > best) {
+        best = length;
+        distance = position - candidate;
+        if (length == limit) {
+          break;
+        }
+      }
+    }
+    candidate = previous[candidate];
+  }
+  return best > shortest ? best : 0;
+}
+
+void DeflateEncoder::Insert(uint32 position) {
+  if (position + 3 <= windowLength) {
+    uint32& first = head[hash(window + position)];
+    previous[position] = first;
+    first = position;
+  }
+}
+
+void DeflateEncoder::AddLiteral(byte literal) {
+  symbols.push_back(literal);
+  literalFrequencies[literal]++;
+}
+
+void DeflateEncoder::AddMatch(uint32 length, uint32 distance) {
+  symbols.push_back((length << 16) | distance);
+  literalFrequencies[257 + tables.lengthSymbol[length]]++;
+  distanceFrequencies[tables.GetDistanceSymbol(distance)]++;
+}
+
+void DeflateEncoder::WriteBits(uint32 value, int count) {
+  bitBuffer |= static_cast<uint64>(value) << bitCount;
+  bitCount += count;
+  if (bitCount >= 32) {
+    byte bytes[4] = { static_cast<byte>(bitBuffer), static_cast<byte>(bitBuffer >> 8), static_cast<byte>(bitBuffer >> 16), static_cast<byte>(bitBuffer >> 24) };
+    output->insert(output->end(), bytes, bytes + 4);
+    bitBuffer >>= 32;
+    bitCount -= 32;
+  }
+}
+
+void DeflateEncoder::AlignToByte() {
+  for (bitCount = (bitCount + 7) & ~7; bitCount > 0; bitCount -= 8) {
+    output->push_back(static_cast<byte>(bitBuffer));
+    bitBuffer >>= 8;
+  }
+  bitBuffer = 0;
+}
+
+void DeflateEncoder::WriteSymbols(const byte* literalLengths, const uint16* literalCodes, const byte* distanceLengths, const uint16* distanceCodes) {
+  for (auto symbol = symbols.begin(); symbol != symbols.end(); ++symbol) {
+    if (*symbol < 256) {
+      WriteBits(literalCodes[*symbol], literalLengths[*symbol]);
+      continue;
+    }
+    uint32 length = *symbol >> 16;
+    uint32 distance = *symbol & 0xFFFF;
+    int lengthSymbol = tables.lengthSymbol[length];
+    WriteBits(literalCodes[257 + lengthSymbol], literalLengths[257 + lengthSymbol]);
+    WriteBits(length - lengthBase[lengthSymbol], lengthExtra[lengthSymbol]);
+    int distanceSymbol = tables.GetDistanceSymbol(distance);
+    WriteBits(distanceCodes[distanceSymbol], distanceLengths[distanceSymbol]);
+    WriteBits(distance - distanceBase[distanceSymbol], distanceExtra[distanceSymbol]);
+  }
+  WriteBits(literalCodes[256], literalLengths[256]);
+}
+
+/************************************************************************/
+/* The symbols collected since the last block with the smallest of the  */
+/* three block types. The sizes are exact in bits, except for stored    */
+/* blocks which pay a few bits to reach a byte boundary                 */
+/************************************************************************/
+void DeflateEncoder::WriteBlock(const byte* blockStart, size_t blockLength, bool last) {
+  literalFrequencies[256]++;
+
+  byte literalLengths[286];
+  byte distanceLengths[30];
+  buildCodeLengths(literalFrequencies, 286, 15, literalLengths);
+  buildCodeLengths(distanceFrequencies, 30, 15, distanceLengths);
+  int literalCount = 286;
+  while (literalLengths[literalCount - 1] == 0) {
+    literalCount--;
+  }
+  int distanceCount = 30;
+  while (distanceLengths[distanceCount - 1] == 0) {
+    distanceCount--;
+  }
+
+  // the code lengths of both codes run length encoded, extra bits in the upper byte
+  byte allLengths[286 + 30];
+  memcpy(allLengths, literalLengths, literalCount);
+  memcpy(allLengths + literalCount, distanceLengths, distanceCount);
+  int allCount = literalCount + distanceCount;
+  uint16 lengthSymbols[286 + 30];
+  int lengthSymbolCount = 0;
+  uint32 lengthFrequencies[19] = { 0 };
+  for (int i = 0; i < allCount; ) {
+    byte length = allLengths[i];
+    int run = 1;
+    while (i + run < allCount && allLengths[i + run] == length) {
+      run++;
+    }
+    i += run;
+    if (length == 0) {
+      for (; run >= 11; run -= std::min(run, 138)) {
+        lengthSymbols[lengthSymbolCount++] = static_cast<uint16>(18 | ((std::min(run, 138) - 11) << 8));
+      }
+      if (run >= 3) {
+        lengthSymbols[lengthSymbolCount++] = static_cast<uint16>(17 | ((run - 3) << 8));
+        run = 0;
+      }
+    } else {
+      lengthSymbols[lengthSymbolCount++] = length;
+      for (run--; run >= 3; run -= std::min(run, 6)) {
+        lengthSymbols[lengthSymbolCount++] = static_cast<uint16>(16 | ((std::min(run, 6) - 3) << 8));
+      }
+    }
+    for (; run > 0; run--) {
+      lengthSymbols[lengthSymbolCount++] = length;
+    }
+  }
+  for (int i = 0; i < lengthSymbolCount; i++) {
+    lengthFrequencies[lengthSymbols[i] & 0xFF]++;
+  }
+  byte lengthLengths[19];
+  buildCodeLengths(lengthFrequencies, 19, 7, lengthLengths);
+  int lengthCount = 19;
+  while (lengthCount > 4 && lengthLengths[codeLengthOrder[lengthCount - 1]] == 0) {
+    lengthCount--;
+  }
+
+  uint64 extraBits = 0;
+  for (int symbol = 0; symbol < 29; symbol++) {
+    extraBits += static_cast<uint64>(literalFrequencies[257 + symbol]) * lengthExtra[symbol];
+  }
+  for (int symbol = 0; symbol < 30; symbol++) {
+    extraBits += static_cast<uint64>(distanceFrequencies[symbol]) * distanceExtra[symbol];
+  }
+  uint64 dynamicBits = 3 + 5 + 5 + 4 + 3 * lengthCount + extraBits;
+  uint64 fixedBits = 3 + extraBits;
+  for (int symbol = 0; symbol < 286; symbol++) {
+    dynamicBits += static_cast<uint64>(literalFrequencies[symbol]) * literalLengths[symbol];
+    fixedBits += static_cast<uint64>(literalFrequencies[symbol]) * tables.fixedLiteralLengths[symbol];
+  }
+  for (int symbol = 0; symbol < 30; symbol++) {
+    dynamicBits += static_cast<uint64>(distanceFrequencies[symbol]) * distanceLengths[symbol];
+    fixedBits += static_cast<uint64>(distanceFrequencies[symbol]) * 5;
+  }
+  static const byte repeatExtra[3] = { 2, 3, 7 };
+  for (int symbol = 0; symbol < 19; symbol++) {
+    dynamicBits += static_cast<uint64>(lengthFrequencies[symbol]) * (lengthLengths[symbol] + (symbol >= 16 ? repeatExtra[symbol - 16] : 0));
+  }
+  uint64 storedBits = 8 * static_cast<uint64>(blockLength) + (blockLength / 65535 + 1) * 40 + 7;
+
+  if (storedBits < dynamicBits && storedBits < fixedBits) {
+    size_t position = 0;
+    do {
+      size_t chunk = std::min<size_t>(blockLength - position, 65535);
+      WriteBits(last && position + chunk == blockLength ? 1 : 0, 3);
+      AlignToByte();
+      byte header[4] = { static_cast<byte>(chunk), static_cast<byte>(chunk >> 8), static_cast<byte>(~chunk), static_cast<byte>(~chunk >> 8) };
+      output->insert(output->end(), header, header + 4);
+      output->insert(output->end(), blockStart + position, blockStart + position + chunk);
+      position += chunk;
+    } while (position < blockLength);
+  } else if (fixedBits <= dynamicBits) {
+    uint16 literalCodes[288];
+    uint16 distanceCodes[30];
+    buildCodes(tables.fixedLiteralLengths, 288, literalCodes);
+    buildCodes(tables.fixedDistanceLengths, 30, distanceCodes);
+    WriteBits(last ? 3 : 2, 3);
+    WriteSymbols(tables.fixedLiteralLengths, literalCodes, tables.fixedDistanceLengths, distanceCodes);
+  } else {
+    uint16 literalCodes[286];
+    uint16 distanceCodes[30];
+    uint16 lengthCodes[19];
+    buildCodes(literalLengths, 286, literalCodes);
+    buildCodes(distanceLengths, 30, distanceCodes);
+    buildCodes(lengthLengths, 19, lengthCodes);
+    WriteBits(last ? 5 : 4, 3);
+    WriteBits(literalCount - 257, 5);
+    WriteBits(distanceCount - 1, 5);
+    WriteBits(lengthCount - 4, 4);
+    for (int i = 0; i < lengthCount; i++) {
+      WriteBits(lengthLengths[codeLengthOrder[i]], 3);
+    }
+    for (int i = 0; i < lengthSymbolCount; i++) {
+      int symbol = lengthSymbols[i] & 0xFF;
+      WriteBits(lengthCodes[symbol], lengthLengths[symbol]);
+      if (symbol >= 16) {
+        WriteBits(lengthSymbols[i] >> 8, repeatExtra[symbol - 16]);
+      }
+    }
+    WriteSymbols(literalLengths, literalCodes, distanceLengths, distanceCodes);
+  }
+
+  symbols.clear();
+  memset(literalFrequencies, 0, sizeof(literalFrequencies));
+  memset(distanceFrequencies, 0, sizeof(distanceFrequencies));
+}
+
+/************************************************************************/
+/* Greedy matching with one step of lazy evaluation: a match is only    */
+/* taken if the next position doesn't start a longer one. All positions */
+/* are hashed, those of the dictionary first                            */
+/************************************************************************/
+void DeflateEncoder::Compress(const byte* data, size_t length, size_t dictionaryLength, bool final, std::vector<byte>& compressed) {
+  dictionaryLength = std::min<size_t>(dictionaryLength, DeflateEncoder_WINDOW_SIZE);
+  if (length > 0xFFFFFFFF - DeflateEncoder_WINDOW_SIZE) {
+    throw ref new Platform::InvalidArgumentException(L"Too much data to compress at once");
+  }
+  window = data - dictionaryLength;
+  windowLength = static_cast<uint32>(dictionaryLength + length);
+  std::fill(head.begin(), head.end(), DeflateEncoder_NONE);
+  previous.resize(windowLength);
+  symbols.clear();
+  symbols.reserve(DeflateEncoder_BLOCK_SYMBOLS);
+  memset(literalFrequencies, 0, sizeof(literalFrequencies));
+  memset(distanceFrequencies, 0, sizeof(distanceFrequencies));
+  output = &compressed;
+  bitBuffer = 0;
+  bitCount = 0;
+
+  uint32 position = 0;
+  for (; position < dictionaryLength; position++) {
+    Insert(position);
+  }
+  uint32 blockStart = position;
+  while (position < windowLength) {
+    uint32 distance = 0;
+    uint32 matched = FindMatch(position, 2, distance);
+    Insert(position);
+    if (matched >= 3 && matched < DeflateEncoder_LAZY_LENGTH && position + 1 < windowLength) {
+      uint32 nextDistance = 0;
+      uint32 nextMatched = FindMatch(position + 1, matched, nextDistance);
+      if (nextMatched > matched) {
+        AddLiteral(window[position]);
+        position++;
+        Insert(position);
+        matched = nextMatched;
+        distance = nextDistance;
+      }
+    }
+    if (matched > 3 || (matched == 3 && distance <= DeflateEncoder_TOO_FAR)) {
+      AddMatch(matched, distance);
+      for (uint32 i = 1; i < matched; i++) {
+        Insert(position + i);
+      }
+      position += matched;
+    } else {
+      AddLiteral(window[position]);
+      position++;
+    }
+    if (symbols.size() >= DeflateEncoder_BLOCK_SYMBOLS) {
+      WriteBlock(window + blockStart, position - blockStart, false);
+      blockStart = position;
+    }
+  }
+  // the final block is written even if it's empty
+  if (blockStart < windowLength || final) {
+    WriteBlock(window + blockStart, windowLength - blockStart, final);
+  }
+  if (!final) {
+    // an empty stored block ends the piece on a byte boundary, as zlib's Z_SYNC_FLUSH does
+    WriteBits(0, 3);
+    AlignToByte();
+    byte marker[4] = { 0x00, 0x00, 0xFF, 0xFF };
+    compressed.insert(compressed.end(), marker, marker + 4);
+  } else {
+    AlignToByte();
+  }
+  output = NULL;
+}
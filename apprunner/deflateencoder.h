@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+
+// how far back matches may reach, also the most of a preceding chunk that is useful as a dictionary
+#define DeflateEncoder_WINDOW_SIZE 32768
+// how many earlier positions with the same hash are compared before the longest match found is taken
+#define DeflateEncoder_MAX_CHAIN 64
+
+namespace doo {
+  namespace zip {
+    // Compresses to raw deflate, each block with whichever of dynamic Huffman codes, the fixed codes or
+    // storing comes out smallest. Matches are found through hash chains with one step of lazy evaluation,
+    // about what zlib does at its default level.
+    //
+    // Data can be compressed in independent pieces that are simply concatenated afterwards, as pigz does:
+    // a piece may be given the data preceding it as a dictionary, and every piece but the last ends with
+    // an empty stored block so the next starts on a byte boundary. Pieces can thus be compressed on
+    // different threads, and the compressed size of each piece is known.
+    //
+    // An encoder keeps its tables between calls to avoid allocating them again, use one per thread.
+    class DeflateEncoder {
+    public:
+      DeflateEncoder();
+
+      // Append the compressed length bytes at data to output. The dictionaryLength bytes in front of data
+      // are what came before in the same stream, matches may reach into them. With final the output ends
+      // the stream, otherwise it ends with an empty stored block on a byte boundary.
+      void Compress(const byte* data, size_t length, size_t dictionaryLength, bool final, std::vector<byte>& output);
+
+    private:
+      DeflateEncoder(const DeflateEncoder&);
+      DeflateEncoder& operator=(const DeflateEncoder&);
+
+      // a literal below 256, otherwise a match with its length in the upper and its distance in the lower half
+      typedef uint32 Symbol;
+
+      uint32 FindMatch(uint32 position, uint32 shortest, uint32& distance) const;
+      void Insert(uint32 position);
+      void AddLiteral(byte literal);
+      void AddMatch(uint32 length, uint32 distance);
+
+      void WriteBits(uint32 value, int count);
+      void AlignToByte();
+      void WriteBlock(const byte* blockStart, size_t blockLength, bool last);
+      void WriteSymbols(const byte* literalLengths, const uint16* literalCodes, const byte* distanceLengths, const uint16* distanceCodes);
+
+      // the dictionary followed by the data being compressed, positions are relative to its start
+      const byte* window;
+      uint32 windowLength;
+      // the most recent position with each hash and the previous position with the same hash for each position
+      std::vector<uint32> head;
+      std::vector<uint32> previous;
+      std::vector<Symbol> symbols;
+      uint32 literalFrequencies[286];
+      uint32 distanceFrequencies[30];
+
+      std::vector<byte>* output;
+      uint64 bitBuffer;
+      int bitCount;
+    };
+  }
+}
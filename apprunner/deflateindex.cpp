@@ -0,0 +1,227 @@
+#include "stdafx.h"
+
+#define TINFL_HEADER_FILE_ONLY
+#include "tinfl.c"
+
+#include "crc32.h"
+#include "deflateindex.h"
+
+using namespace doo::zip;
+
+// how much compressed data is read at once
+#define DeflateIndex_READ_SIZE (64 * 1024)
+// "DIDX" and the version of the saved format
+#define DeflateIndex_MAGIC 0x58444944
+#define DeflateIndex_VERSION 1
+
+/************************************************************************/
+/* Run the decompressor over the data from inputOffset to the end. The  */
+/* dictionary doubles as the output buffer and wraps around every 32KB. */
+/* The handler sees the result of every step and returns false to stop. */
+/************************************************************************/
+template <typename Handler>
+static void inflateFrom(const RandomAccessFile& file, uint64 dataOffset, uint64 compressedSize, uint64 inputOffset,
+  tinfl_decompressor* decompressor, std::vector<byte>& dictionary, mz_uint32 flags, Handler handler)
+{
+  std::vector<byte> input(DeflateIndex_READ_SIZE);
+  size_t inputStart = 0;
+  size_t inputEnd = 0;
+  size_t dictionaryOffset = 0;
+  for (;;) {
+    if (inputStart == inputEnd && inputOffset < compressedSize) {
+      inputStart = 0;
+      inputEnd = static_cast<size_t>(std::min<uint64>(input.size(), compressedSize - inputOffset));
+      file.ReadAt(dataOffset + inputOffset, input.data(), inputEnd);
+    }
+    bool moreInput = inputOffset + (inputEnd - inputStart) < compressedSize;
+
+    size_t inputSize = inputEnd - inputStart;
+    size_t outputSize = TINFL_LZ_DICT_SIZE - dictionaryOffset;
+    tinfl_status status = tinfl_decompress(decompressor,
+      input.data() + inputStart, &inputSize,
+      dictionary.data(), dictionary.data() + dictionaryOffset, &outputSize,
+      flags | (moreInput ? TINFL_FLAG_HAS_MORE_INPUT : 0));
+    inputStart += inputSize;
+    inputOffset += inputSize;
+    const byte* output = dictionary.data() + dictionaryOffset;
+    dictionaryOffset = (dictionaryOffset + outputSize) & (TINFL_LZ_DICT_SIZE - 1);
+
+    if (status < 0) {
+      throw ref new Platform::FailureException(L"Could not extract data");
+    }
+    if (!handler(status, output, outputSize, inputOffset, dictionaryOffset) || status == TINFL_STATUS_DONE) {
+      return;
+    }
+    if (!moreInput && inputStart == inputEnd && outputSize == 0 && status != TINFL_STATUS_BLOCK_BOUNDARY) {
+      // the decompressor pads missing input with zeros, don't let a truncated stream spin forever
+      throw ref new Platform::FailureException(L"Unexpected end of compressed data");
+    }
+  }
+}
+
+DeflateIndex::DeflateIndex()
+  : compressedSize(0), uncompressedSize(0), crc32(0)
+{
+}
+
+/************************************************************************/
+/* Inflate everything once, stopping at each block boundary to see if   */
+/* the last checkpoint is far enough behind to add another one          */
+/************************************************************************/
+std::shared_ptr<DeflateIndex> DeflateIndex::Build(const RandomAccessFile& file, uint64 dataOffset,
+  uint64 compressedSize, uint64 uncompressedSize, uint32 crc32, uint64 span)
+{
+  std::shared_ptr<DeflateIndex> index(new DeflateIndex());
+  index->compressedSize = compressedSize;
+  index->uncompressedSize = uncompressedSize;
+  index->crc32 = crc32;
+
+  std::unique_ptr<tinfl_decompressor> decompressor(new tinfl_decompressor);
+  tinfl_init(decompressor.get());
+  std::vector<byte> dictionary(TINFL_LZ_DICT_SIZE);
+  uint64 outputOffset = 0;
+  uint64 lastCheckpoint = 0;
+  uint32 crc = 0;
+
+  inflateFrom(file, dataOffset, compressedSize, 0, decompressor.get(), dictionary, TINFL_FLAG_STOP_AT_BLOCK_BOUNDARY,
+    [&](tinfl_status status, const byte* output, size_t outputSize, uint64 inputOffset, size_t dictionaryOffset) -> bool {
+      crc = UpdateCrc32(crc, output, outputSize);
+      outputOffset += outputSize;
+      if (status == TINFL_STATUS_BLOCK_BOUNDARY && outputOffset - lastCheckpoint >= span) {
+        Checkpoint checkpoint;
+        checkpoint.inputOffset = inputOffset;
+        checkpoint.outputOffset = outputOffset;
+        checkpoint.bits = decompressor->m_bit_buf;
+        checkpoint.bitCount = decompressor->m_num_bits;
+        // unwrap the dictionary so the most recent byte is the last one
+        checkpoint.window.reserve(TINFL_LZ_DICT_SIZE);
+        checkpoint.window.insert(checkpoint.window.end(), dictionary.begin() + dictionaryOffset, dictionary.end());
+        checkpoint.window.insert(checkpoint.window.end(), dictionary.begin(), dictionary.begin() + dictionaryOffset);
+        index->checkpoints.push_back(std::move(checkpoint));
+        lastCheckpoint = outputOffset;
+      }
+      return true;
+    });
+
+  if (outputOffset != uncompressedSize || crc != crc32) {
+    throw ref new Platform::FailureException(L"Entry data does not match its header");
+  }
+  return index;
+}
+
+/************************************************************************/
+/* Resume at the last checkpoint in front of offset: its window fills   */
+/* the whole dictionary, so output continues at the dictionary's start  */
+/************************************************************************/
+void DeflateIndex::Extract(const RandomAccessFile& file, uint64 dataOffset, uint64 offset, byte* target, size_t length) const {
+  if (offset > uncompressedSize || length > uncompressedSize - offset) {
+    throw ref new Platform::InvalidArgumentException(L"Range is outside of the file");
+  }
+  if (length == 0) {
+    return;
+  }
+
+  std::unique_ptr<tinfl_decompressor> decompressor(new tinfl_decompressor);
+  std::vector<byte> dictionary(TINFL_LZ_DICT_SIZE);
+  uint64 inputOffset = 0;
+  uint64 outputOffset = 0;
+
+  auto next = std::upper_bound(checkpoints.begin(), checkpoints.end(), offset,
+    [](uint64 value, const Checkpoint& checkpoint) { return value < checkpoint.outputOffset; });
+  if (next == checkpoints.begin()) {
+    tinfl_init(decompressor.get());
+  } else {
+    const Checkpoint& checkpoint = *(next - 1);
+    dictionary = checkpoint.window;
+    tinfl_init_at_block_boundary(decompressor.get(), static_cast<tinfl_bit_buf_t>(checkpoint.bits), checkpoint.bitCount);
+    inputOffset = checkpoint.inputOffset;
+    outputOffset = checkpoint.outputOffset;
+  }
+
+  uint64 end = offset + length;
+  inflateFrom(file, dataOffset, compressedSize, inputOffset, decompressor.get(), dictionary, 0,
+    [&](tinfl_status, const byte* output, size_t outputSize, uint64, size_t) -> bool {
+      uint64 outputEnd = outputOffset + outputSize;
+      if (outputEnd > offset) {
+        uint64 copyStart = std::max(outputOffset, offset);
+        uint64 copyEnd = std::min(outputEnd, end);
+        memcpy(target + (copyStart - offset), output + (copyStart - outputOffset), static_cast<size_t>(copyEnd - copyStart));
+      }
+      outputOffset = outputEnd;
+      return outputOffset < end;
+    });
+
+  if (outputOffset < end) {
+    throw ref new Platform::FailureException(L"Unexpected end of compressed data");
+  }
+}
+
+template <typename T>
+static void writeValue(std::ostream& output, const T& value) {
+  output.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+static T readValue(std::istream& input) {
+  T value;
+  if (!input.read(reinterpret_cast<char*>(&value), sizeof(value))) {
+    throw ref new Platform::FailureException(L"Could not read index");
+  }
+  return value;
+}
+
+void DeflateIndex::Save(std::ostream& output) const {
+  writeValue<uint32>(output, DeflateIndex_MAGIC);
+  writeValue<uint32>(output, DeflateIndex_VERSION);
+  writeValue(output, compressedSize);
+  writeValue(output, uncompressedSize);
+  writeValue(output, crc32);
+  writeValue<uint64>(output, checkpoints.size());
+  for (auto checkpoint = checkpoints.begin(); checkpoint != checkpoints.end(); ++checkpoint) {
+    writeValue(output, checkpoint->inputOffset);
+    writeValue(output, checkpoint->outputOffset);
+    writeValue(output, checkpoint->bits);
+    writeValue(output, checkpoint->bitCount);
+    output.write(reinterpret_cast<const char*>(checkpoint->window.data()), checkpoint->window.size());
+  }
+  if (!output) {
+    throw ref new Platform::FailureException(L"Could not write index");
+  }
+}
+
+/************************************************************************/
+/* Everything is checked that Extract() relies on, a damaged index      */
+/* file must not lead to reads beyond the data                          */
+/************************************************************************/
+std::shared_ptr<DeflateIndex> DeflateIndex::Load(std::istream& input) {
+  if (readValue<uint32>(input) != DeflateIndex_MAGIC || readValue<uint32>(input) != DeflateIndex_VERSION) {
+    throw ref new Platform::FailureException(L"Unknown index format");
+  }
+  std::shared_ptr<DeflateIndex> index(new DeflateIndex());
+  index->compressedSize = readValue<uint64>(input);
+  index->uncompressedSize = readValue<uint64>(input);
+  index->crc32 = readValue<uint32>(input);
+
+  uint64 count = readValue<uint64>(input);
+  for (uint64 i = 0; i < count; i++) {
+    Checkpoint checkpoint;
+    checkpoint.inputOffset = readValue<uint64>(input);
+    checkpoint.outputOffset = readValue<uint64>(input);
+    checkpoint.bits = readValue<uint64>(input);
+    checkpoint.bitCount = readValue<uint32>(input);
+    checkpoint.window.resize(TINFL_LZ_DICT_SIZE);
+    if (!input.read(reinterpret_cast<char*>(checkpoint.window.data()), checkpoint.window.size())) {
+      throw ref new Platform::FailureException(L"Could not read index");
+    }
+
+    uint64 previousOutput = index->checkpoints.empty() ? 0 : index->checkpoints.back().outputOffset;
+    if (checkpoint.inputOffset > index->compressedSize
+      || checkpoint.outputOffset > index->uncompressedSize
+      || checkpoint.outputOffset <= previousOutput
+      || checkpoint.bitCount >= sizeof(tinfl_bit_buf_t) * 8) {
+      throw ref new Platform::FailureException(L"Index is damaged");
+    }
+    index->checkpoints.push_back(std::move(checkpoint));
+  }
+  return index;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "randomaccessfile.h"
+
+// default distance between two checkpoints in the uncompressed data
+#define DeflateIndex_DEFAULT_SPAN (4 * 1024 * 1024)
+
+namespace doo {
+  namespace zip {
+    // Checkpoints into a raw deflate stream, so a range of the uncompressed data can be read
+    // without inflating everything in front of it. Every checkpoint sits at a block boundary
+    // and keeps the 32KB of output preceding it, which later blocks may refer back to.
+    class DeflateIndex {
+    public:
+      struct Checkpoint {
+        // position of the next block, the first bitCount bits come out of bits
+        uint64 inputOffset;
+        uint64 outputOffset;
+        uint64 bits;
+        uint32 bitCount;
+        // the last 32KB of output, ending right at outputOffset
+        std::vector<byte> window;
+      };
+
+      // inflate the compressedSize bytes at dataOffset once and drop a checkpoint every span bytes of output.
+      // Throws if the data does not inflate to uncompressedSize bytes with the given CRC.
+      static std::shared_ptr<DeflateIndex> Build(const RandomAccessFile& file, uint64 dataOffset,
+        uint64 compressedSize, uint64 uncompressedSize, uint32 crc32, uint64 span = DeflateIndex_DEFAULT_SPAN);
+
+      // fill target with length bytes of output starting at offset, inflating from the nearest checkpoint
+      void Extract(const RandomAccessFile& file, uint64 dataOffset, uint64 offset, byte* target, size_t length) const;
+
+      // the index in a binary format which Load() reads back
+      void Save(std::ostream& output) const;
+      static std::shared_ptr<DeflateIndex> Load(std::istream& input);
+
+      // the entry this index was built for
+      uint64 GetCompressedSize() const {
+        return compressedSize;
+      }
+      uint64 GetUncompressedSize() const {
+        return uncompressedSize;
+      }
+      uint32 GetCrc32() const {
+        return crc32;
+      }
+
+      const std::vector<Checkpoint>& GetCheckpoints() const {
+        return checkpoints;
+      }
+
+    private:
+      DeflateIndex();
+      DeflateIndex(const DeflateIndex&);
+      DeflateIndex& operator=(const DeflateIndex&);
+
+      uint64 compressedSize;
+      uint64 uncompressedSize;
+      uint32 crc32;
+      // sorted by offset, the start of the stream is implicit
+      std::vector<Checkpoint> checkpoints;
+    };
+  }
+}
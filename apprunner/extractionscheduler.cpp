@@ -0,0 +1,211 @@
+#include "stdafx.h"
+
+#include <atomic>
+#include <exception>
+#include <thread>
+#ifdef _WIN32
+#include <Psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "extractionscheduler.h"
+
+using namespace doo::zip;
+
+MemoryBudget::MemoryBudget(uint64 limit)
+  : limit(limit), used(0), peak(0), serving(0), nextTicket(0)
+{
+}
+
+uint64 MemoryBudget::Acquire(uint64 amount) {
+  amount = std::min(amount, limit);
+  std::unique_lock<std::mutex> guard(lock);
+  uint64 ticket = nextTicket++;
+  released.wait(guard, [&]() {
+    return ticket == serving && used + amount <= limit;
+  });
+  used += amount;
+  peak = std::max(peak, used);
+  serving++;
+  // the next in line may fit as well
+  released.notify_all();
+  return amount;
+}
+
+void MemoryBudget::Release(uint64 amount) {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    used -= amount;
+  }
+  released.notify_all();
+}
+
+uint64 MemoryBudget::GetPeak() const {
+  std::lock_guard<std::mutex> guard(lock);
+  return peak;
+}
+
+MemoryBudget::Reservation::Reservation(MemoryBudget& owner, uint64 requested)
+  : budget(owner)
+{
+  amount = budget.Acquire(requested);
+}
+
+MemoryBudget::Reservation::~Reservation() {
+  budget.Release(amount);
+}
+
+ExtractionScheduler::ExtractionScheduler(const ZipArchive& archive, uint64 memoryBudget, unsigned threadCount, uint64 streamingThreshold,
+  unsigned ioQueueDepth)
+  : archive(archive), memoryBudget(memoryBudget), threadCount(threadCount), streamingThreshold(streamingThreshold), ioQueueDepth(ioQueueDepth)
+{
+  if (memoryBudget == 0) {
+    throw ref new Platform::InvalidArgumentException(L"The memory budget must not be empty");
+  }
+  if (this->threadCount == 0) {
+    this->threadCount = std::max(1U, std::thread::hardware_concurrency());
+  }
+  if (this->streamingThreshold == 0) {
+    this->streamingThreshold = std::max<uint64>(memoryBudget / (2 * this->threadCount), ZipArchive_STREAM_CHUNK);
+  }
+}
+
+/************************************************************************/
+/* Large streamable entries become jobs of their own and go first since */
+/* they run longest, small ones are packed into batches of up to the    */
+/* streaming threshold in directory order                               */
+/************************************************************************/
+std::vector<ExtractionScheduler::Job> ExtractionScheduler::Plan(const std::vector<size_t>& indices) const {
+  const ZipEntryTable& entries = archive.GetEntries();
+  std::vector<Job> streamed;
+  std::vector<Job> inMemory;
+  Job batch;
+  batch.size = 0;
+  batch.streamed = false;
+  for (auto index = indices.begin(); index != indices.end(); ++index) {
+    if (*index >= entries.GetCount()) {
+      throw ref new Platform::InvalidArgumentException(L"No such entry");
+    }
+    uint64 size = entries.GetUncompressedSize(*index);
+    if (size > streamingThreshold) {
+      Job job;
+      job.indices.push_back(*index);
+      job.size = size;
+      job.streamed = ZipArchive::CanStream(entries.GetCompressionMethod(*index));
+      (job.streamed ? streamed : inMemory).push_back(job);
+      continue;
+    }
+    if (batch.size + size > streamingThreshold) {
+      inMemory.push_back(batch);
+      batch.indices.clear();
+      batch.size = 0;
+    }
+    batch.indices.push_back(*index);
+    batch.size += size;
+  }
+  if (!batch.indices.empty()) {
+    inMemory.push_back(batch);
+  }
+  streamed.insert(streamed.end(), inMemory.begin(), inMemory.end());
+  return streamed;
+}
+
+void ExtractionScheduler::Run(const Job& job, MemoryBudget& budget, const OutputCallback& output) const {
+  if (job.streamed) {
+    MemoryBudget::Reservation reservation(budget, ExtractionScheduler_STREAM_COST);
+    size_t index = job.indices.front();
+    uint64 offset = 0;
+    archive.ExtractStreaming(index, [&](const byte* data, size_t length) {
+      output(index, offset, data, length);
+      offset += length;
+    });
+    return;
+  }
+
+  // batched reads hold compressed data on top of the buffer
+  uint64 readCost = 0;
+  if (ioQueueDepth > 0) {
+    const ZipEntryTable& entries = archive.GetEntries();
+    for (auto index = job.indices.begin(); index != job.indices.end(); ++index) {
+      readCost += entries.GetCompressedSize(*index);
+    }
+    readCost = std::min<uint64>(readCost, BatchReader_MAX_IN_FLIGHT);
+  }
+  // reserve before allocating, the buffer is only as large as the reservation says
+  MemoryBudget::Reservation reservation(budget, job.size + ExtractionScheduler_CONTEXT_COST + readCost);
+  std::vector<byte> buffer(static_cast<size_t>(job.size));
+  if (ioQueueDepth > 0) {
+    archive.ExtractBatch(job.indices, buffer.data(), buffer.size(), ioQueueDepth, [&](size_t index, const byte* data, size_t length) {
+      if (length > 0) {
+        output(index, 0, data, length);
+      }
+    });
+    return;
+  }
+  size_t position = 0;
+  for (auto index = job.indices.begin(); index != job.indices.end(); ++index) {
+    size_t length = archive.ExtractTo(*index, buffer.data() + position, buffer.size() - position);
+    if (length > 0) {
+      output(*index, 0, buffer.data() + position, length);
+    }
+    position += length;
+  }
+}
+
+/************************************************************************/
+/* Workers take the next job until none are left, after an error the   */
+/* remaining jobs are skipped                                           */
+/************************************************************************/
+ExtractionScheduler::Statistics ExtractionScheduler::Extract(const std::vector<size_t>& indices, const OutputCallback& output) const {
+  std::vector<Job> jobs = Plan(indices);
+  MemoryBudget budget(memoryBudget);
+  std::atomic<size_t> nextJob(0);
+  std::atomic<bool> failed(false);
+  std::mutex errorLock;
+  std::exception_ptr error;
+
+  auto work = [&]() {
+    for (size_t job = nextJob++; job < jobs.size() && !failed; job = nextJob++) {
+      try {
+        Run(jobs[job], budget, output);
+      } catch (...) {
+        std::lock_guard<std::mutex> guard(errorLock);
+        if (!error) {
+          error = std::current_exception();
+        }
+        failed = true;
+      }
+    }
+  };
+  size_t workerCount = std::min<size_t>(threadCount, jobs.size());
+  std::vector<std::thread> workers;
+  workers.reserve(workerCount);
+  for (size_t i = 0; i < workerCount; i++) {
+    workers.push_back(std::thread(work));
+  }
+  for (auto worker = workers.begin(); worker != workers.end(); ++worker) {
+    worker->join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+
+  Statistics statistics;
+  statistics.peakReserved = budget.GetPeak();
+  statistics.batches = 0;
+  statistics.streamedEntries = 0;
+  for (auto job = jobs.begin(); job != jobs.end(); ++job) {
+    (job->streamed ? statistics.streamedEntries : statistics.batches)++;
+  }
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS memoryCounters;
+  statistics.peakWorkingSet = GetProcessMemoryInfo(GetCurrentProcess(), &memoryCounters, sizeof(memoryCounters))
+    ? memoryCounters.PeakWorkingSetSize : 0;
+#else
+  // the peak resident set, in KB
+  rusage usage;
+  statistics.peakWorkingSet = getrusage(RUSAGE_SELF, &usage) == 0 ? static_cast<uint64>(usage.ru_maxrss) * 1024 : 0;
+#endif
+  return statistics;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "batchreader.h"
+#include "ziparchive.h"
+
+// used when no budget is given
+#define ExtractionScheduler_DEFAULT_BUDGET (256 * 1024 * 1024)
+// charged for every streamed entry: read buffer, dictionary and decompressor
+#define ExtractionScheduler_STREAM_COST (160 * 1024)
+// charged on top of every batch for the pooled decompressor and its input buffer
+#define ExtractionScheduler_CONTEXT_COST (96 * 1024)
+
+namespace doo {
+  namespace zip {
+    // A number of bytes shared between threads. Acquire() blocks until enough has been released,
+    // requests are served first come first served so large ones don't starve.
+    class MemoryBudget {
+    public:
+      // holds bytes of the budget until going out of scope
+      class Reservation {
+      public:
+        Reservation(MemoryBudget& budget, uint64 amount);
+        ~Reservation();
+
+      private:
+        Reservation(const Reservation&);
+        Reservation& operator=(const Reservation&);
+
+        MemoryBudget& budget;
+        uint64 amount;
+      };
+
+      MemoryBudget(uint64 limit);
+
+      // waits until amount bytes are free and takes them. Amounts above the limit wait for the whole
+      // budget to be free and take all of it, returns what was actually taken.
+      uint64 Acquire(uint64 amount);
+      void Release(uint64 amount);
+
+      uint64 GetLimit() const {
+        return limit;
+      }
+
+      // the most that was ever taken at the same time
+      uint64 GetPeak() const;
+
+    private:
+      MemoryBudget(const MemoryBudget&);
+      MemoryBudget& operator=(const MemoryBudget&);
+
+      mutable std::mutex lock;
+      std::condition_variable released;
+      uint64 limit;
+      uint64 used;
+      uint64 peak;
+      // the ticket of the next request to be served and of the next one to arrive
+      uint64 serving;
+      uint64 nextTicket;
+    };
+
+    // Extracts many entries of an archive on several threads without allocating more than a budget.
+    //
+    // Entries up to the streaming threshold are extracted in memory, grouped into batches so that one
+    // buffer and one reservation serve many small files. Larger entries are streamed through a fixed
+    // size buffer instead. Workers reserve what a job needs before allocating it and wait while the
+    // budget is used up. Only an entry that can't be streamed and is larger than the whole budget
+    // goes over it, it runs alone then.
+    //
+    // With an I/O queue depth, each batch reads the compressed data of its entries through a BatchReader
+    // and decompresses them as they arrive, which keeps a cold disk busy with many reads at once.
+    class ExtractionScheduler {
+    public:
+      // receives the entry's data in order, offset is where data belongs within the entry.
+      // Entries extracted in memory arrive in one piece. Called from the worker threads, but never
+      // for the same entry at the same time. Empty entries produce no call.
+      typedef std::function<void (size_t index, uint64 offset, const byte* data, size_t length)> OutputCallback;
+
+      struct Statistics {
+        // the most bytes reserved at the same time, stays within the budget
+        uint64 peakReserved;
+        // the process' peak working set after the run, includes everything else the process allocated
+        uint64 peakWorkingSet;
+        size_t batches;
+        size_t streamedEntries;
+      };
+
+      // threadCount 0 uses one thread per core, streamingThreshold 0 picks one so that every thread can hold a batch.
+      // ioQueueDepth is how many reads each thread keeps outstanding for a batch, 0 reads one entry after the other.
+      ExtractionScheduler(const ZipArchive& archive, uint64 memoryBudget = ExtractionScheduler_DEFAULT_BUDGET,
+        unsigned threadCount = 0, uint64 streamingThreshold = 0, unsigned ioQueueDepth = 0);
+
+      // extract the entries with the given indices, rethrows the first error once all workers stopped
+      Statistics Extract(const std::vector<size_t>& indices, const OutputCallback& output) const;
+
+      uint64 GetStreamingThreshold() const {
+        return streamingThreshold;
+      }
+
+    private:
+      ExtractionScheduler(const ExtractionScheduler&);
+      ExtractionScheduler& operator=(const ExtractionScheduler&);
+
+      // a large entry on its own, or small entries extracted into one buffer
+      struct Job {
+        std::vector<size_t> indices;
+        uint64 size;
+        bool streamed;
+      };
+
+      std::vector<Job> Plan(const std::vector<size_t>& indices) const;
+      void Run(const Job& job, MemoryBudget& budget, const OutputCallback& output) const;
+
+      const ZipArchive& archive;
+      uint64 memoryBudget;
+      unsigned threadCount;
+      uint64 streamingThreshold;
+      unsigned ioQueueDepth;
+    };
+  }
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "transcode.h"
+
 template <class T>
 struct EmptyStruct : public T {
   EmptyStruct() { ZeroMemory(this, sizeof(T)); }
@@ -18,43 +20,19 @@ struct WindowsStruct : public EmptyStruct<T> {
 };
 
 
-// helper function to convert a normal string to a WinRT Platform::String
+// helper function to convert a UTF-8 string to a WinRT Platform::String, _length -1 reads up to the terminating 0
 static Platform::String^ stringToPlatformString(const char* _input, int _length = -1) {
-  DWORD dwNum = MultiByteToWideChar(CP_UTF8, 0, _input, _length, NULL, 0);
-  LPWSTR wideName = (PWSTR)malloc(sizeof(WCHAR)*dwNum);
-  MultiByteToWideChar(CP_UTF8, 0, _input, _length, wideName, dwNum);
-  Platform::String^ result = ref new Platform::String(wideName);
-  free(wideName);
-  return result;
+  size_t length = _length < 0 ? strlen(_input) : _length;
+  doo::text::SmallBuffer<doo::text::utf16unit, 256> wide(doo::text::MaximumUtf16Length(length));
+  size_t wideLength = doo::text::Utf8ToUtf16(_input, length, wide.data());
+  return ref new Platform::String(reinterpret_cast<const wchar_t*>(wide.data()), static_cast<unsigned int>(wideLength));
 }
 
 // helper to convert a Platform String to a std::string
 static std::string platformToStdString(Platform::String^ platformString) {
-  DWORD dwNum = WideCharToMultiByte(
-    CP_UTF8, 
-    NULL,
-    platformString->Data(), 
-    -1, 
-    NULL, 
-    0, 
-    NULL, 
-    NULL);
-  if (dwNum == 0) {
-    HRESULT res = HRESULT_FROM_WIN32(GetLastError());
-    throw ref new Platform::COMException(res);
-  }
-  char* multiByteUtf8Text = new char[dwNum];
-  WideCharToMultiByte(
-    CP_UTF8, 
-    NULL, 
-    platformString->Data(), 
-    -1, 
-    multiByteUtf8Text, 
-    dwNum, 
-    NULL, 
-    NULL
-    );
-  std::string result = multiByteUtf8Text;
-  delete[] multiByteUtf8Text;
-  return result;
+  const doo::text::utf16unit* wide = reinterpret_cast<const doo::text::utf16unit*>(platformString->Data());
+  size_t wideLength = platformString->Length();
+  doo::text::SmallBuffer<char, 512> utf8(doo::text::MaximumUtf8Length(wideLength));
+  size_t length = doo::text::Utf16ToUtf8(wide, wideLength, utf8.data());
+  return std::string(utf8.data(), length);
 }
@@ -0,0 +1,124 @@
+#include "stdafx.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#define TINFL_HEADER_FILE_ONLY
+#include "tinfl.c"
+
+#include "inflatecontextpool.h"
+
+using namespace doo::zip;
+
+// enough for one context per core on any machine we run on
+#define InflateContextPool_SHARED_IDLE 64
+
+InflateContext::InflateContext()
+  : decompressor(new tinfl_decompressor), input(InflateContextPool_INPUT_SIZE)
+{
+}
+
+// out of line so the unique_ptr sees the complete tinfl type
+InflateContext::~InflateContext() {
+}
+
+// the pool Shared() returns, for the contexts no thread keeps
+static InflateContextPool sharedPool(InflateContextPool_SHARED_IDLE);
+
+// every thread keeps the context it used last for itself, freed when the thread exits
+#ifdef _WIN32
+static void WINAPI freeThreadContext(void* context) {
+  delete static_cast<InflateContext*>(context);
+}
+static DWORD threadContextSlot = FlsAlloc(freeThreadContext);
+static bool hasThreadContextSlot = threadContextSlot != FLS_OUT_OF_INDEXES;
+
+static InflateContext* getThreadContext() {
+  return static_cast<InflateContext*>(FlsGetValue(threadContextSlot));
+}
+
+static bool setThreadContext(InflateContext* context) {
+  return FlsSetValue(threadContextSlot, context) != FALSE;
+}
+#else
+static void freeThreadContext(void* context) {
+  delete static_cast<InflateContext*>(context);
+}
+static pthread_key_t threadContextSlot;
+static bool hasThreadContextSlot = pthread_key_create(&threadContextSlot, freeThreadContext) == 0;
+
+static InflateContext* getThreadContext() {
+  return static_cast<InflateContext*>(pthread_getspecific(threadContextSlot));
+}
+
+static bool setThreadContext(InflateContext* context) {
+  return pthread_setspecific(threadContextSlot, context) == 0;
+}
+#endif
+
+// the calling thread's context, which is no longer its own afterwards, or nullptr
+static InflateContext* takeThreadContext() {
+  if (!hasThreadContextSlot) {
+    return nullptr;
+  }
+  InflateContext* context = getThreadContext();
+  if (context) {
+    setThreadContext(nullptr);
+  }
+  return context;
+}
+
+// keeps context for the calling thread unless it has one already
+static bool keepThreadContext(std::unique_ptr<InflateContext>& context) {
+  if (!hasThreadContextSlot || getThreadContext() != nullptr) {
+    return false;
+  }
+  if (!setThreadContext(context.get())) {
+    return false;
+  }
+  context.release();
+  return true;
+}
+
+InflateContextPool::InflateContextPool(size_t maximumIdle)
+  : maximumIdle(maximumIdle)
+{
+  // returning a context never allocates
+  idle.reserve(maximumIdle);
+}
+
+InflateContextPool& InflateContextPool::Shared() {
+  return sharedPool;
+}
+
+/************************************************************************/
+/* A thread that extracts one entry after the other gets the same       */
+/* context back every time without touching the pool's lock. The pool   */
+/* is only used for a thread's first lease and for nested leases.       */
+/************************************************************************/
+InflateContextPool::Lease::Lease(InflateContextPool& owner)
+  : pool(owner), context(takeThreadContext())
+{
+  if (!context) {
+    std::lock_guard<std::mutex> guard(pool.lock);
+    if (!pool.idle.empty()) {
+      context = std::move(pool.idle.back());
+      pool.idle.pop_back();
+    }
+  }
+  // allocate outside of the lock, only happens until the pool has warmed up
+  if (!context) {
+    context.reset(new InflateContext());
+  }
+}
+
+InflateContextPool::Lease::~Lease() {
+  if (keepThreadContext(context)) {
+    return;
+  }
+  std::lock_guard<std::mutex> guard(pool.lock);
+  if (pool.idle.size() < pool.maximumIdle) {
+    pool.idle.push_back(std::move(context));
+  }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct tinfl_decompressor_tag;
+
+// size of the input buffer each context reads compressed data into
+#define InflateContextPool_INPUT_SIZE (64 * 1024)
+
+namespace doo {
+  namespace zip {
+    // a decompressor together with a buffer for compressed input, both too large to set up per entry
+    struct InflateContext {
+      InflateContext();
+      ~InflateContext();
+
+      std::unique_ptr<tinfl_decompressor_tag> decompressor;
+      std::vector<byte> input;
+
+    private:
+      InflateContext(const InflateContext&);
+      InflateContext& operator=(const InflateContext&);
+    };
+
+    // Keeps contexts around between extractions. Each thread takes one out for as long as it
+    // extracts an entry, so after the first few entries no more allocations are necessary.
+    // A returned context stays with its thread for the next lease, contexts are only put into
+    // the pool when the thread already keeps one, and are shared by all pools.
+    class InflateContextPool {
+    public:
+      // borrows a context from the pool and returns it when going out of scope
+      class Lease {
+      public:
+        Lease(InflateContextPool& pool);
+        ~Lease();
+
+        InflateContext* operator->() const {
+          return context.get();
+        }
+
+      private:
+        Lease(const Lease&);
+        Lease& operator=(const Lease&);
+
+        InflateContextPool& pool;
+        std::unique_ptr<InflateContext> context;
+      };
+
+      InflateContextPool(size_t maximumIdle);
+
+      // the pool shared by all archives
+      static InflateContextPool& Shared();
+
+    private:
+      InflateContextPool(const InflateContextPool&);
+      InflateContextPool& operator=(const InflateContextPool&);
+
+      std::mutex lock;
+      std::vector<std::unique_ptr<InflateContext>> idle;
+      // contexts beyond this are freed instead of being kept
+      size_t maximumIdle;
+    };
+  }
+}
@@ -0,0 +1,62 @@
+#include "stdafx.h"
+
+#include "zipcounters.h"
+
+// the only file compiling the tinfl implementation, so its counters are hooked up here
+#define TINFL_COUNT(counter) ZipCounters_COUNT(counter)
+#define TINFL_COUNT_MATCH(length) ZipCounters_MATCH(length)
+#include "tinfl.c"
+
+#include "inflatestream.h"
+
+using namespace doo::zip;
+
+InflateStream::InflateStream(bool deflate64)
+  : decompressor(new tinfl_decompressor), deflate64(deflate64), dictionary(deflate64 ? 2 * TINFL_LZ_DICT_SIZE : TINFL_LZ_DICT_SIZE)
+{
+  Reset();
+}
+
+// out of line so the unique_ptr sees the complete tinfl type
+InflateStream::~InflateStream() {
+}
+
+void InflateStream::Reset() {
+  tinfl_init(decompressor.get());
+  dictionaryOffset = 0;
+  finished = false;
+}
+
+/************************************************************************/
+/* Run the decompressor over the input, the dictionary doubles as the   */
+/* output buffer and wraps around every 32KB, or 64KB for Deflate64    */
+/************************************************************************/
+size_t InflateStream::Inflate(const byte* input, size_t length, bool moreInput, const OutputCallback& output) {
+  size_t consumed = 0;
+  while (!finished) {
+    size_t inputSize = length - consumed;
+    size_t outputSize = dictionary.size() - dictionaryOffset;
+    tinfl_status status = tinfl_decompress(decompressor.get(),
+      input + consumed, &inputSize,
+      dictionary.data(), dictionary.data() + dictionaryOffset, &outputSize,
+      (moreInput ? TINFL_FLAG_HAS_MORE_INPUT : 0) | (deflate64 ? TINFL_FLAG_DEFLATE64 : 0));
+    consumed += inputSize;
+
+    if (outputSize > 0) {
+      output(dictionary.data() + dictionaryOffset, outputSize);
+    }
+    dictionaryOffset = (dictionaryOffset + outputSize) & (dictionary.size() - 1);
+
+    if (status == TINFL_STATUS_DONE) {
+      finished = true;
+    } else if (status == TINFL_STATUS_NEEDS_MORE_INPUT) {
+      break;
+    } else if (status < 0) {
+      throw ref new Platform::FailureException(L"Could not extract data");
+    } else if (!moreInput && consumed == length && outputSize == 0) {
+      // the decompressor pads missing input with zeros, don't let a truncated stream spin forever
+      throw ref new Platform::FailureException(L"Unexpected end of compressed data");
+    }
+  }
+  return consumed;
+}
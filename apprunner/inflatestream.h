@@ -0,0 +1,43 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+struct tinfl_decompressor_tag;
+
+namespace doo {
+  namespace zip {
+    // incremental decoder for raw deflate data which is fed in arbitrary chunks
+    class InflateStream {
+    public:
+      typedef std::function<void (const byte* data, size_t length)> OutputCallback;
+
+      // Deflate64 streams need a 64KB dictionary instead of 32KB
+      InflateStream(bool deflate64 = false);
+      ~InflateStream();
+
+      // start over with a new deflate stream
+      void Reset();
+
+      // decompress as much of the input as possible, passing the output on in chunks of up to the dictionary size.
+      // Returns the number of input bytes consumed. Once IsFinished(), the remaining input
+      // belongs to whatever follows the deflate stream.
+      size_t Inflate(const byte* input, size_t length, bool moreInput, const OutputCallback& output);
+
+      bool IsFinished() const {
+        return finished;
+      }
+
+    private:
+      InflateStream(const InflateStream&);
+      InflateStream& operator=(const InflateStream&);
+
+      std::unique_ptr<tinfl_decompressor_tag> decompressor;
+      bool deflate64;
+      std::vector<byte> dictionary;
+      size_t dictionaryOffset;
+      bool finished;
+    };
+  }
+}
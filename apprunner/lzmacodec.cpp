@@ -0,0 +1,106 @@
+#include "stdafx.h"
+
+#ifdef APPRUNNER_USE_LZMA
+
+#include <LzmaDec.h>
+
+#include "zipformat.h"
+#include "lzmacodec.h"
+
+using namespace doo::zip;
+
+// how much compressed data is read at once
+#define LzmaCodec_INPUT_SIZE (64 * 1024)
+
+#pragma pack(1)
+// precedes the LZMA data of an entry
+struct LzmaHeader {
+  byte versionMajor;
+  byte versionMinor;
+  uint16 propertiesSize;
+  byte properties[LZMA_PROPS_SIZE];
+};
+#pragma pack()
+
+static void* lzmaAlloc(void*, size_t size) {
+  return malloc(size);
+}
+
+static void lzmaFree(void*, void* address) {
+  free(address);
+}
+
+static ISzAlloc lzmaAllocator = { lzmaAlloc, lzmaFree };
+
+uint16 LzmaCodec::GetMethod() const {
+  return ZipArchive_METHOD_LZMA;
+}
+
+const char* LzmaCodec::GetName() const {
+  return "lzma-sdk";
+}
+
+/************************************************************************/
+/* The target buffer holds the whole file, so it serves as the LZMA     */
+/* dictionary and only the probability tables are allocated             */
+/************************************************************************/
+void LzmaCodec::Decompress(const RandomAccessFile& file, uint64 offset, uint64 compressedSize,
+  byte* buffer, size_t uncompressedSize, uint16 flags) const
+{
+  LzmaHeader header;
+  if (compressedSize < sizeof(header)) {
+    throw ref new Platform::FailureException(L"Could not extract data");
+  }
+  file.ReadAt(offset, &header, sizeof(header));
+  if (header.propertiesSize != LZMA_PROPS_SIZE) {
+    throw ref new Platform::FailureException(L"Unsupported LZMA properties");
+  }
+  offset += sizeof(header);
+  uint64 remaining = compressedSize - sizeof(header);
+
+  CLzmaDec state;
+  LzmaDec_Construct(&state);
+  if (LzmaDec_AllocateProbs(&state, header.properties, LZMA_PROPS_SIZE, &lzmaAllocator) != SZ_OK) {
+    throw ref new Platform::FailureException(L"Unsupported LZMA properties");
+  }
+  state.dic = buffer;
+  state.dicBufSize = uncompressedSize;
+  LzmaDec_Init(&state);
+
+  std::vector<byte> input(static_cast<size_t>(std::min<uint64>(remaining, LzmaCodec_INPUT_SIZE)));
+  size_t inputStart = 0;
+  size_t inputEnd = 0;
+  bool succeeded = false;
+  for (;;) {
+    if (inputStart == inputEnd && remaining > 0) {
+      inputStart = 0;
+      inputEnd = static_cast<size_t>(std::min<uint64>(input.size(), remaining));
+      file.ReadAt(offset, input.data(), inputEnd);
+      offset += inputEnd;
+      remaining -= inputEnd;
+    }
+
+    SizeT inputSize = inputEnd - inputStart;
+    ELzmaStatus status;
+    SRes result = LzmaDec_DecodeToDic(&state, uncompressedSize, input.data() + inputStart, &inputSize, LZMA_FINISH_END, &status);
+    inputStart += inputSize;
+    if (result != SZ_OK) {
+      break;
+    }
+    if (status == LZMA_STATUS_FINISHED_WITH_MARK
+      || (status == LZMA_STATUS_MAYBE_FINISHED_WITHOUT_MARK && !(flags & ZipArchive_FLAG_LZMA_END_MARKER))) {
+      succeeded = state.dicPos == uncompressedSize;
+      break;
+    }
+    if (status != LZMA_STATUS_NEEDS_MORE_INPUT || (inputStart == inputEnd && remaining == 0)) {
+      break;
+    }
+  }
+  LzmaDec_FreeProbs(&state, &lzmaAllocator);
+
+  if (!succeeded) {
+    throw ref new Platform::FailureException(L"Could not extract data");
+  }
+}
+
+#endif
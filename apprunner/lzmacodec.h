@@ -0,0 +1,20 @@
+#pragma once
+
+#ifdef APPRUNNER_USE_LZMA
+
+#include "codec.h"
+
+namespace doo {
+  namespace zip {
+    // LZMA (method 14) through LzmaDec from the LZMA SDK
+    class LzmaCodec : public Codec {
+    public:
+      virtual uint16 GetMethod() const;
+      virtual const char* GetName() const;
+      virtual void Decompress(const RandomAccessFile& file, uint64 offset, uint64 compressedSize,
+        byte* buffer, size_t uncompressedSize, uint16 flags) const;
+    };
+  }
+}
+
+#endif
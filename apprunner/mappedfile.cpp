@@ -0,0 +1,72 @@
+#include "stdafx.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mappedfile.h"
+
+using namespace doo::zip;
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string& filename)
+  : file(INVALID_HANDLE_VALUE), mapping(NULL), data(NULL), size(0)
+{
+  file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    throw ref new Platform::InvalidArgumentException(L"Could not open file");
+  }
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+    CloseHandle(file);
+    throw ref new Platform::FailureException(L"Could not map file");
+  }
+  size = fileSize.QuadPart;
+  mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mapping != NULL) {
+    data = static_cast<const byte*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+  }
+  if (data == NULL) {
+    if (mapping != NULL) {
+      CloseHandle(mapping);
+    }
+    CloseHandle(file);
+    throw ref new Platform::FailureException(L"Could not map file");
+  }
+}
+
+MappedFile::~MappedFile() {
+  UnmapViewOfFile(data);
+  CloseHandle(mapping);
+  CloseHandle(file);
+}
+#else
+// the mapping keeps the file open, the descriptor isn't needed past mmap
+MappedFile::MappedFile(const std::string& filename)
+  : data(NULL), size(0)
+{
+  int file = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (file < 0) {
+    throw ref new Platform::InvalidArgumentException(L"Could not open file");
+  }
+  struct stat status;
+  if (fstat(file, &status) != 0 || status.st_size == 0) {
+    close(file);
+    throw ref new Platform::FailureException(L"Could not map file");
+  }
+  size = status.st_size;
+  void* mapped = mmap(NULL, static_cast<size_t>(size), PROT_READ, MAP_SHARED, file, 0);
+  close(file);
+  if (mapped == MAP_FAILED) {
+    throw ref new Platform::FailureException(L"Could not map file");
+  }
+  data = static_cast<const byte*>(mapped);
+}
+
+MappedFile::~MappedFile() {
+  munmap(const_cast<byte*>(data), static_cast<size_t>(size));
+}
+#endif
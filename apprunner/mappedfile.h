@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+
+namespace doo {
+  namespace zip {
+    // a whole file mapped read-only into memory for as long as the object lives
+    class MappedFile {
+    public:
+      // throws if the file can't be opened or is empty
+      MappedFile(const std::string& filename);
+      ~MappedFile();
+
+      const byte* GetData() const {
+        return data;
+      }
+
+      uint64 GetSize() const {
+        return size;
+      }
+
+    private:
+      MappedFile(const MappedFile&);
+      MappedFile& operator=(const MappedFile&);
+
+#ifdef _WIN32
+      HANDLE file;
+      HANDLE mapping;
+#endif
+      const byte* data;
+      uint64 size;
+    };
+  }
+}
@@ -0,0 +1,183 @@
+#include "stdafx.h"
+
+#include "overlayfilesystem.h"
+
+using namespace doo::zip;
+
+OverlayFileSystem::OverlayFileSystem(size_t maximumOpenArchives, bool useSidecarIndex)
+  : maximumOpenArchives(maximumOpenArchives), useSidecarIndex(useSidecarIndex), openArchiveCount(0), useClock(0)
+{
+  if (maximumOpenArchives == 0) {
+    throw ref new Platform::InvalidArgumentException(L"At least one archive has to be allowed to be open");
+  }
+}
+
+std::string OverlayFileSystem::NormalizeName(const char* filename, size_t length) {
+  std::string result(filename, length);
+  for (auto c = result.begin(); c != result.end(); ++c) {
+    if (*c == '\\') {
+      *c = '/';
+    } else if (*c >= 'A' && *c <= 'Z') {
+      *c = *c - 'A' + 'a';
+    }
+  }
+  return result;
+}
+
+/************************************************************************/
+/* Open the archive and add every name that isn't taken yet, names of   */
+/* archives mounted earlier win                                         */
+/************************************************************************/
+size_t OverlayFileSystem::Mount(const std::string& archivePath) {
+  std::shared_ptr<const ZipArchive> archive(new ZipArchive(archivePath, useSidecarIndex));
+  const ZipEntryTable& entries = archive->GetEntries();
+  size_t mountIndex = mountPoints.size();
+  names.reserve(names.size() + entries.GetCount());
+  for (size_t index = 0; index < entries.GetCount(); index++) {
+    size_t nameLength = entries.GetNameLength(index);
+    // directories have no contents to read
+    if (nameLength == 0 || entries.GetNameData(index)[nameLength - 1] == '/') {
+      continue;
+    }
+    Location location;
+    location.mountIndex = mountIndex;
+    location.entryIndex = index;
+    location.uncompressedSize = entries.GetUncompressedSize(index);
+    names.insert(std::make_pair(NormalizeName(entries.GetNameData(index), nameLength), location));
+  }
+
+  MountPoint mountPoint;
+  mountPoint.path = archivePath;
+  mountPoint.entryCount = entries.GetCount();
+  mountPoint.lastUse = 0;
+  std::lock_guard<std::mutex> guard(lock);
+  CloseUnused();
+  mountPoint.archive = archive;
+  mountPoint.lastUse = ++useClock;
+  mountPoints.push_back(mountPoint);
+  openArchiveCount++;
+  return mountIndex;
+}
+
+size_t OverlayFileSystem::GetMountCount() const {
+  return mountPoints.size();
+}
+
+const std::string& OverlayFileSystem::GetMountPath(size_t mountIndex) const {
+  if (mountIndex >= mountPoints.size()) {
+    throw ref new Platform::InvalidArgumentException(L"No such mount point");
+  }
+  return mountPoints[mountIndex].path;
+}
+
+std::shared_ptr<const ZipArchive> OverlayFileSystem::GetArchive(size_t mountIndex) const {
+  if (mountIndex >= mountPoints.size()) {
+    throw ref new Platform::InvalidArgumentException(L"No such mount point");
+  }
+  return Open(mountIndex);
+}
+
+const OverlayFileSystem::Location& OverlayFileSystem::Find(const std::string& filename) const {
+  auto location = names.find(NormalizeName(filename.data(), filename.size()));
+  if (location == names.end()) {
+    throw ref new Platform::InvalidArgumentException(L"File not in any mounted archive");
+  }
+  return location->second;
+}
+
+bool OverlayFileSystem::Exists(const std::string& filename) const {
+  return names.find(NormalizeName(filename.data(), filename.size())) != names.end();
+}
+
+size_t OverlayFileSystem::GetFileCount() const {
+  return names.size();
+}
+
+uint64 OverlayFileSystem::GetSize(const std::string& filename) const {
+  return Find(filename).uncompressedSize;
+}
+
+size_t OverlayFileSystem::GetMountIndex(const std::string& filename) const {
+  return Find(filename).mountIndex;
+}
+
+/************************************************************************/
+/* Hand out the archive if it is open, otherwise open it without        */
+/* holding the lock so lookups in other archives go on meanwhile        */
+/************************************************************************/
+std::shared_ptr<const ZipArchive> OverlayFileSystem::Open(size_t mountIndex) const {
+  std::string path;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    MountPoint& mountPoint = mountPoints[mountIndex];
+    if (mountPoint.archive) {
+      mountPoint.lastUse = ++useClock;
+      return mountPoint.archive;
+    }
+    path = mountPoint.path;
+  }
+
+  std::shared_ptr<const ZipArchive> archive(new ZipArchive(path, useSidecarIndex));
+  std::lock_guard<std::mutex> guard(lock);
+  MountPoint& mountPoint = mountPoints[mountIndex];
+  if (archive->GetEntries().GetCount() != mountPoint.entryCount) {
+    throw ref new Platform::FailureException(L"Archive changed since it was mounted");
+  }
+  // another thread may have opened it in the meantime
+  if (!mountPoint.archive) {
+    CloseUnused();
+    mountPoint.archive = archive;
+    openArchiveCount++;
+  }
+  mountPoint.lastUse = ++useClock;
+  return mountPoint.archive;
+}
+
+void OverlayFileSystem::CloseUnused() const {
+  while (openArchiveCount >= maximumOpenArchives) {
+    MountPoint* leastRecent = NULL;
+    for (auto mountPoint = mountPoints.begin(); mountPoint != mountPoints.end(); ++mountPoint) {
+      if (mountPoint->archive && (!leastRecent || mountPoint->lastUse < leastRecent->lastUse)) {
+        leastRecent = &*mountPoint;
+      }
+    }
+    // readers still holding the archive keep it alive until they are done
+    leastRecent->archive.reset();
+    openArchiveCount--;
+  }
+}
+
+size_t OverlayFileSystem::GetOpenArchiveCount() const {
+  std::lock_guard<std::mutex> guard(lock);
+  return openArchiveCount;
+}
+
+std::shared_ptr<const ZipArchive> OverlayFileSystem::Resolve(const std::string& filename, size_t& entryIndex) const {
+  const Location& location = Find(filename);
+  std::shared_ptr<const ZipArchive> archive = Open(location.mountIndex);
+  const ZipEntryTable& entries = archive->GetEntries();
+  if (NormalizeName(entries.GetNameData(location.entryIndex), entries.GetNameLength(location.entryIndex))
+      != NormalizeName(filename.data(), filename.size())) {
+    throw ref new Platform::FailureException(L"Archive changed since it was mounted");
+  }
+  entryIndex = location.entryIndex;
+  return archive;
+}
+
+std::vector<byte> OverlayFileSystem::GetFileContents(const std::string& filename) const {
+  size_t entryIndex;
+  std::shared_ptr<const ZipArchive> archive = Resolve(filename, entryIndex);
+  return archive->GetFileContents(entryIndex);
+}
+
+std::vector<byte> OverlayFileSystem::ReadRange(const std::string& filename, uint64 offset, size_t length) const {
+  size_t entryIndex;
+  std::shared_ptr<const ZipArchive> archive = Resolve(filename, entryIndex);
+  return archive->ReadRange(archive->GetEntries().GetName(entryIndex), offset, length);
+}
+
+void OverlayFileSystem::ExtractStreaming(const std::string& filename, const InflateStream::OutputCallback& output) const {
+  size_t entryIndex;
+  std::shared_ptr<const ZipArchive> archive = Resolve(filename, entryIndex);
+  archive->ExtractStreaming(entryIndex, output);
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ziparchive.h"
+
+// used when no limit is given
+#define OverlayFileSystem_DEFAULT_OPEN_ARCHIVES 16
+
+namespace doo {
+  namespace zip {
+    // Several archives, e.g. a package and its dependencies, seen as one read-only file system.
+    //
+    // Names are resolved in mount order: a file in an archive mounted earlier hides files of the same
+    // name in archives mounted later. Mounting merges the archive's names into one hash map, so lookups
+    // take constant time no matter how many archives are mounted, and the size of a file is known without
+    // touching its archive. Names are compared case-insensitively with '\' and '/' treated alike, the way
+    // Windows resolves paths inside packages.
+    //
+    // Nothing is extracted up front. At most maximumOpenArchives archives are kept open, the least recently
+    // used one is closed when another has to be opened and is reopened on the next read. Reads that are
+    // still running keep their archive open until they finish. Mount everything before reading, after that
+    // all methods are safe to call from any thread.
+    class OverlayFileSystem {
+    public:
+      // with useSidecarIndex archives are opened through their sidecar files, which makes reopening cheap
+      OverlayFileSystem(size_t maximumOpenArchives = OverlayFileSystem_DEFAULT_OPEN_ARCHIVES, bool useSidecarIndex = false);
+
+      // add an archive below the ones mounted before, returns its mount index
+      size_t Mount(const std::string& archivePath);
+
+      size_t GetMountCount() const;
+      const std::string& GetMountPath(size_t mountIndex) const;
+      // a mounted archive on its own, for files hidden by earlier mounts such as each package's manifest
+      std::shared_ptr<const ZipArchive> GetArchive(size_t mountIndex) const;
+
+      bool Exists(const std::string& filename) const;
+      // the number of visible files, hidden ones are not counted
+      size_t GetFileCount() const;
+      uint64 GetSize(const std::string& filename) const;
+      // the mount index of the archive the name resolves to
+      size_t GetMountIndex(const std::string& filename) const;
+
+      std::vector<byte> GetFileContents(const std::string& filename) const;
+      // length bytes of the file starting at offset, see ZipArchive::ReadRange()
+      std::vector<byte> ReadRange(const std::string& filename, uint64 offset, size_t length) const;
+      // see ZipArchive::ExtractStreaming()
+      void ExtractStreaming(const std::string& filename, const InflateStream::OutputCallback& output) const;
+
+      // the number of archives open right now
+      size_t GetOpenArchiveCount() const;
+
+    private:
+      OverlayFileSystem(const OverlayFileSystem&);
+      OverlayFileSystem& operator=(const OverlayFileSystem&);
+
+      // where a visible name lives
+      struct Location {
+        size_t mountIndex;
+        size_t entryIndex;
+        uint64 uncompressedSize;
+      };
+
+      struct MountPoint {
+        std::string path;
+        // the directory as it was when mounting, a reopened archive has to match it
+        size_t entryCount;
+        // null while closed
+        std::shared_ptr<const ZipArchive> archive;
+        uint64 lastUse;
+      };
+
+      // the key names are stored under
+      static std::string NormalizeName(const char* filename, size_t length);
+      // the location of a visible file, throws if there is none
+      const Location& Find(const std::string& filename) const;
+      // the archive holding a visible file, checks that a reopened archive still has it where it was
+      std::shared_ptr<const ZipArchive> Resolve(const std::string& filename, size_t& entryIndex) const;
+      std::shared_ptr<const ZipArchive> Open(size_t mountIndex) const;
+      // close the least recently used archives until there is room for one more, call with lock held
+      void CloseUnused() const;
+
+      size_t maximumOpenArchives;
+      bool useSidecarIndex;
+      // guards the archives of the mount points and the counters below, names are only written by Mount()
+      mutable std::mutex lock;
+      mutable std::vector<MountPoint> mountPoints;
+      mutable size_t openArchiveCount;
+      mutable uint64 useClock;
+      std::unordered_map<std::string, Location> names;
+    };
+  }
+}
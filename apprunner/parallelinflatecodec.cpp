@@ -0,0 +1,539 @@
+#include "stdafx.h"
+
+#include <thread>
+
+#include "zipformat.h"
+#include "parallelinflatecodec.h"
+
+using namespace doo::zip;
+
+// how far back-references reach
+#define ParallelInflate_WINDOW_SIZE 32768
+// codes up to this length are decoded with a single table lookup
+#define ParallelInflate_FAST_BITS 10
+// the compressed data is followed by this many zero bytes, so reads only need to check for an
+// overrun once per symbol or table header
+#define ParallelInflate_PADDING 64
+// how much compressed data is searched for a block boundary before a chunk is given up,
+// incompressible data only contains stored blocks which can't be found
+#define ParallelInflate_SEARCH_LIMIT (512 * 1024)
+
+namespace {
+  static const uint16 lengthBase[29] = { 3,4,5,6,7,8,9,10,11,13, 15,17,19,23,27,31,35,43,51,59, 67,83,99,115,131,163,195,227,258 };
+  static const byte lengthExtra[29] = { 0,0,0,0,0,0,0,0,1,1, 1,1,2,2,2,2,3,3,3,3, 4,4,4,4,5,5,5,5,0 };
+  static const uint16 distanceBase[30] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193, 257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+  static const byte distanceExtra[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+  static const byte codeLengthOrder[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
+
+  // reads little endian bit fields at an arbitrary bit position
+  class BitReader {
+  public:
+    BitReader(const byte* data, uint64 size)
+      : data(data), bitSize(size * 8), position(0)
+    {
+    }
+
+    // at least 57 bits starting at the current position
+    uint64 Peek() const {
+      uint64 bits;
+      memcpy(&bits, data + (position >> 3), sizeof(bits));
+      return bits >> (position & 7);
+    }
+
+    uint32 Bits(unsigned count) {
+      uint32 value = static_cast<uint32>(Peek() & ((1ULL << count) - 1));
+      position += count;
+      return value;
+    }
+
+    void Skip(unsigned count) {
+      position += count;
+    }
+
+    void AlignToByte() {
+      position = (position + 7) & ~7ULL;
+    }
+
+    // whether more bits were consumed than there are
+    bool IsOverrun() const {
+      return position > bitSize;
+    }
+
+    const byte* data;
+    uint64 bitSize;
+    uint64 position;
+  };
+
+  // canonical Huffman code as used by deflate
+  class Huffman {
+  public:
+    // false if the code is oversubscribed, or incomplete with more than one symbol (which zlib rejects as well)
+    bool Build(const byte* lengths, unsigned symbolCount) {
+      memset(counts, 0, sizeof(counts));
+      for (unsigned symbol = 0; symbol < symbolCount; symbol++) {
+        counts[lengths[symbol]]++;
+      }
+      counts[0] = 0;
+      int left = 1;
+      unsigned codeCount = 0;
+      for (unsigned length = 1; length < 16; length++) {
+        left = (left << 1) - counts[length];
+        if (left < 0) {
+          return false;
+        }
+        codeCount += counts[length];
+      }
+      if (left > 0 && codeCount > 1) {
+        return false;
+      }
+
+      uint16 offsets[16];
+      offsets[1] = 0;
+      for (unsigned length = 1; length < 15; length++) {
+        offsets[length + 1] = offsets[length] + counts[length];
+      }
+      for (unsigned symbol = 0; symbol < symbolCount; symbol++) {
+        if (lengths[symbol] != 0) {
+          symbols[offsets[lengths[symbol]]++] = static_cast<uint16>(symbol);
+        }
+      }
+
+      // deflate sends codes starting with the most significant bit, so the table is indexed by reversed codes
+      memset(fast, 0, sizeof(fast));
+      uint32 code = 0;
+      unsigned index = 0;
+      for (unsigned length = 1; length <= ParallelInflate_FAST_BITS; length++) {
+        for (unsigned i = 0; i < counts[length]; i++, code++, index++) {
+          uint32 reversed = 0;
+          for (unsigned bit = 0; bit < length; bit++) {
+            reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+          }
+          for (uint32 fill = reversed; fill < (1U << ParallelInflate_FAST_BITS); fill += 1U << length) {
+            fast[fill] = static_cast<uint16>((symbols[index] << 4) | length);
+          }
+        }
+        code <<= 1;
+      }
+      return true;
+    }
+
+    // the next symbol, -1 if the bits match no code
+    int Decode(BitReader& input) const {
+      uint64 bits = input.Peek();
+      uint16 entry = fast[bits & ((1 << ParallelInflate_FAST_BITS) - 1)];
+      if (entry != 0) {
+        input.Skip(entry & 15);
+        return entry >> 4;
+      }
+      // longer codes are decoded one bit at a time, like zlib's puff does
+      int code = 0;
+      int first = 0;
+      int index = 0;
+      for (unsigned length = 1; length < 16; length++) {
+        code |= (bits >> (length - 1)) & 1;
+        int count = counts[length];
+        if (code - first < count) {
+          input.Skip(length);
+          return symbols[index + code - first];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+      }
+      return -1;
+    }
+
+  private:
+    // symbol << 4 | code length, 0 for codes longer than the table
+    uint16 fast[1 << ParallelInflate_FAST_BITS];
+    uint16 counts[16];
+    uint16 symbols[288];
+  };
+
+  // Decodes deflate blocks into 16 bit symbols: values below 256 are bytes, 256 + i stands for byte i
+  // of the unknown window in front of the chunk. Copies move placeholders along like any other byte.
+  class ChunkInflater {
+  public:
+    ChunkInflater(const byte* data, uint64 size, uint64 outputLimit)
+      : input(data, size), used(0), prefix(0), placeholdersReady(false), outputLimit(outputLimit)
+    {
+      byte lengths[288];
+      memset(lengths, 8, 144);
+      memset(lengths + 144, 9, 112);
+      memset(lengths + 256, 7, 24);
+      memset(lengths + 280, 8, 8);
+      fixedLiterals.Build(lengths, 288);
+      // all 32 codes, so the code is complete. 30 and 31 are rejected while decoding.
+      memset(lengths, 5, 32);
+      fixedDistances.Build(lengths, 32);
+    }
+
+    // start decoding at bitPosition. Without a window, references in front of the start are errors.
+    void Start(uint64 bitPosition, bool unknownWindow) {
+      input.position = bitPosition;
+      prefix = unknownWindow ? ParallelInflate_WINDOW_SIZE : 0;
+      if (output.size() < prefix + ParallelInflate_WINDOW_SIZE) {
+        output.resize(prefix + ParallelInflate_WINDOW_SIZE);
+      }
+      // decoding never writes in front of the prefix, so the placeholders survive restarts
+      if (unknownWindow && !placeholdersReady) {
+        for (size_t i = 0; i < prefix; i++) {
+          output[i] = static_cast<uint16>(256 + i);
+        }
+      }
+      placeholdersReady = unknownWindow;
+      used = prefix;
+    }
+
+    // decode one block, false if the data isn't valid deflate
+    bool DecodeBlock(bool& final, bool requireDynamic) {
+      final = input.Bits(1) != 0;
+      uint32 type = input.Bits(2);
+      if (requireDynamic && type != 2) {
+        return false;
+      }
+      switch (type) {
+      case 0:
+        return CopyStored();
+      case 1:
+        return DecodeSymbols(fixedLiterals, fixedDistances);
+      case 2:
+        return ReadTables() && DecodeSymbols(literals, distances);
+      default:
+        return false;
+      }
+    }
+
+    uint64 GetPosition() const {
+      return input.position;
+    }
+
+    // the decoded symbols after the placeholder window
+    const uint16* GetSymbols() const {
+      return output.data() + prefix;
+    }
+    size_t GetSymbolCount() const {
+      return used - prefix;
+    }
+
+  private:
+    bool Reserve(size_t count) {
+      if (used - prefix + count > outputLimit + 258) {
+        return false;
+      }
+      if (used + count > output.size()) {
+        output.resize(std::max(output.size() * 2, used + count));
+      }
+      return true;
+    }
+
+    bool CopyStored() {
+      input.AlignToByte();
+      uint32 length = input.Bits(16);
+      uint32 complement = input.Bits(16);
+      if (length != (~complement & 0xFFFF) || input.position + length * 8ULL > input.bitSize || !Reserve(length)) {
+        return false;
+      }
+      const byte* source = input.data + (input.position >> 3);
+      for (uint32 i = 0; i < length; i++) {
+        output[used++] = source[i];
+      }
+      input.position += length * 8ULL;
+      return true;
+    }
+
+    bool ReadTables() {
+      unsigned literalCount = input.Bits(5) + 257;
+      unsigned distanceCount = input.Bits(5) + 1;
+      unsigned codeLengthCount = input.Bits(4) + 4;
+      if (literalCount > 286 || distanceCount > 30) {
+        return false;
+      }
+
+      byte codeLengthLengths[19];
+      memset(codeLengthLengths, 0, sizeof(codeLengthLengths));
+      for (unsigned i = 0; i < codeLengthCount; i++) {
+        codeLengthLengths[codeLengthOrder[i]] = static_cast<byte>(input.Bits(3));
+      }
+      Huffman codeLengths;
+      if (input.IsOverrun() || !codeLengths.Build(codeLengthLengths, 19)) {
+        return false;
+      }
+
+      byte lengths[286 + 30];
+      unsigned index = 0;
+      while (index < literalCount + distanceCount) {
+        if (input.IsOverrun()) {
+          return false;
+        }
+        int symbol = codeLengths.Decode(input);
+        if (symbol < 0) {
+          return false;
+        }
+        if (symbol < 16) {
+          lengths[index++] = static_cast<byte>(symbol);
+          continue;
+        }
+        byte value = 0;
+        unsigned repeat;
+        if (symbol == 16) {
+          if (index == 0) {
+            return false;
+          }
+          value = lengths[index - 1];
+          repeat = 3 + input.Bits(2);
+        } else if (symbol == 17) {
+          repeat = 3 + input.Bits(3);
+        } else {
+          repeat = 11 + input.Bits(7);
+        }
+        if (index + repeat > literalCount + distanceCount) {
+          return false;
+        }
+        while (repeat-- > 0) {
+          lengths[index++] = value;
+        }
+      }
+      // a block without an end can't be valid
+      if (lengths[256] == 0) {
+        return false;
+      }
+      return literals.Build(lengths, literalCount) && distances.Build(lengths + literalCount, distanceCount);
+    }
+
+    bool DecodeSymbols(const Huffman& literalCode, const Huffman& distanceCode) {
+      for (;;) {
+        if (input.IsOverrun() || !Reserve(258)) {
+          return false;
+        }
+        int symbol = literalCode.Decode(input);
+        if (symbol < 256) {
+          if (symbol < 0) {
+            return false;
+          }
+          output[used++] = static_cast<uint16>(symbol);
+          continue;
+        }
+        if (symbol == 256) {
+          return !input.IsOverrun();
+        }
+        symbol -= 257;
+        if (symbol >= 29) {
+          return false;
+        }
+        unsigned length = lengthBase[symbol] + input.Bits(lengthExtra[symbol]);
+        int distanceSymbol = distanceCode.Decode(input);
+        if (distanceSymbol < 0 || distanceSymbol >= 30) {
+          return false;
+        }
+        size_t distance = distanceBase[distanceSymbol] + input.Bits(distanceExtra[distanceSymbol]);
+        if (distance > used) {
+          return false;
+        }
+        // byte by byte, the source may overlap what is being written
+        uint16* target = output.data() + used;
+        const uint16* source = target - distance;
+        for (unsigned i = 0; i < length; i++) {
+          target[i] = source[i];
+        }
+        used += length;
+      }
+    }
+
+    BitReader input;
+    Huffman fixedLiterals;
+    Huffman fixedDistances;
+    Huffman literals;
+    Huffman distances;
+    std::vector<uint16> output;
+    size_t used;
+    size_t prefix;
+    bool placeholdersReady;
+    uint64 outputLimit;
+  };
+
+  struct Chunk {
+    // where the thread starts looking for a block, and where it found one
+    uint64 searchStart;
+    uint64 searchEnd;
+    uint64 start;
+    bool found;
+    bool decoded;
+    std::shared_ptr<ChunkInflater> inflater;
+    size_t outputOffset;
+  };
+
+  // run work(i) for every i below count, one thread each
+  template <typename Work>
+  static void runThreads(size_t count, Work work) {
+    std::vector<std::thread> threads;
+    threads.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+      threads.push_back(std::thread([&work, i]() {
+        work(i);
+      }));
+    }
+    for (auto thread = threads.begin(); thread != threads.end(); ++thread) {
+      thread->join();
+    }
+  }
+}
+
+ParallelInflateCodec::ParallelInflateCodec(unsigned threadCount, uint64 minimumSize, uint64 minimumChunk)
+  : threadCount(threadCount), minimumSize(minimumSize), minimumChunk(std::max<uint64>(minimumChunk, 1)),
+    serial(ZipArchive_METHOD_DEFLATE)
+{
+  parallelCount = 0;
+  fallbackCount = 0;
+  if (this->threadCount == 0) {
+    this->threadCount = std::max(1U, std::thread::hardware_concurrency());
+  }
+}
+
+uint16 ParallelInflateCodec::GetMethod() const {
+  return ZipArchive_METHOD_DEFLATE;
+}
+
+const char* ParallelInflateCodec::GetName() const {
+  return "parallel";
+}
+
+void ParallelInflateCodec::Decompress(const RandomAccessFile& file, uint64 offset, uint64 compressedSize,
+  byte* buffer, size_t uncompressedSize, uint16 flags) const
+{
+  if (threadCount > 1 && compressedSize >= minimumSize) {
+    std::vector<byte> input(static_cast<size_t>(compressedSize) + ParallelInflate_PADDING);
+    file.ReadAt(offset, input.data(), static_cast<size_t>(compressedSize));
+    if (DecompressParallel(input, compressedSize, buffer, uncompressedSize)) {
+      parallelCount++;
+      return;
+    }
+    fallbackCount++;
+  }
+  serial.Decompress(file, offset, compressedSize, buffer, uncompressedSize, flags);
+}
+
+/************************************************************************/
+/* 1. every thread looks for a dynamic block in its part of the input   */
+/* 2. chunks are decoded up to where the next one starts                */
+/* 3. the tails are resolved in order, then the rest in parallel        */
+/************************************************************************/
+bool ParallelInflateCodec::DecompressParallel(const std::vector<byte>& input, uint64 compressedSize, byte* buffer, size_t uncompressedSize) const {
+  size_t chunkCount = static_cast<size_t>(std::min<uint64>(threadCount, compressedSize / minimumChunk));
+  if (chunkCount < 2) {
+    return false;
+  }
+  std::vector<Chunk> chunks(chunkCount);
+  for (size_t i = 0; i < chunkCount; i++) {
+    chunks[i].searchStart = compressedSize * i / chunkCount * 8;
+    chunks[i].searchEnd = std::min(compressedSize * (i + 1) / chunkCount * 8, chunks[i].searchStart + ParallelInflate_SEARCH_LIMIT * 8);
+    chunks[i].found = i == 0;
+    chunks[i].start = 0;
+    chunks[i].decoded = false;
+    chunks[i].inflater.reset(new ChunkInflater(input.data(), compressedSize, uncompressedSize));
+  }
+
+  // a block boundary is guessed where a complete non-final dynamic block decodes without errors
+  runThreads(chunkCount - 1, [&](size_t index) {
+    Chunk& chunk = chunks[index + 1];
+    try {
+      for (uint64 candidate = chunk.searchStart; candidate < chunk.searchEnd && !chunk.found; candidate++) {
+        bool final;
+        chunk.inflater->Start(candidate, true);
+        if (chunk.inflater->DecodeBlock(final, true) && !final) {
+          chunk.start = candidate;
+          chunk.found = true;
+        }
+      }
+    } catch (...) {
+      chunk.found = false;
+    }
+  });
+
+  std::vector<Chunk*> found;
+  for (auto chunk = chunks.begin(); chunk != chunks.end(); ++chunk) {
+    if (chunk->found) {
+      found.push_back(&*chunk);
+    }
+  }
+  if (found.size() < 2) {
+    return false;
+  }
+
+  // each chunk has to end exactly at the next guess, the first one starts at a known boundary
+  runThreads(found.size(), [&](size_t index) {
+    Chunk& chunk = *found[index];
+    uint64 end = index + 1 < found.size() ? found[index + 1]->start : 0;
+    bool last = index + 1 == found.size();
+    try {
+      chunk.inflater->Start(chunk.start, index != 0);
+      for (;;) {
+        bool final;
+        if (!chunk.inflater->DecodeBlock(final, false)) {
+          return;
+        }
+        uint64 position = chunk.inflater->GetPosition();
+        if (last) {
+          if (final) {
+            chunk.decoded = true;
+            return;
+          }
+        } else if (position == end) {
+          chunk.decoded = !final;
+          return;
+        } else if (final || position > end) {
+          return;
+        }
+      }
+    } catch (...) {
+      chunk.decoded = false;
+    }
+  });
+
+  size_t outputOffset = 0;
+  for (auto chunk = found.begin(); chunk != found.end(); ++chunk) {
+    if (!(*chunk)->decoded) {
+      return false;
+    }
+    (*chunk)->outputOffset = outputOffset;
+    outputOffset += (*chunk)->inflater->GetSymbolCount();
+  }
+  if (outputOffset != uncompressedSize) {
+    return false;
+  }
+
+  // placeholders refer to the window right in front of the chunk, which has to be resolved by then
+  auto resolve = [&](const Chunk& chunk, size_t begin, size_t end) -> bool {
+    const uint16* symbols = chunk.inflater->GetSymbols();
+    byte* target = buffer + chunk.outputOffset;
+    for (size_t i = begin; i < end; i++) {
+      uint16 symbol = symbols[i];
+      if (symbol < 256) {
+        target[i] = static_cast<byte>(symbol);
+      } else {
+        size_t windowIndex = symbol - 256;
+        if (chunk.outputOffset + windowIndex < ParallelInflate_WINDOW_SIZE) {
+          return false;
+        }
+        target[i] = buffer[chunk.outputOffset + windowIndex - ParallelInflate_WINDOW_SIZE];
+      }
+    }
+    return true;
+  };
+
+  // the last 32KB of each chunk form the window of the next one, those go in order
+  std::vector<size_t> tailStarts(found.size());
+  for (size_t i = 0; i < found.size(); i++) {
+    size_t count = found[i]->inflater->GetSymbolCount();
+    tailStarts[i] = count > ParallelInflate_WINDOW_SIZE ? count - ParallelInflate_WINDOW_SIZE : 0;
+    if (!resolve(*found[i], tailStarts[i], count)) {
+      return false;
+    }
+  }
+
+  std::vector<char> resolved(found.size(), 0);
+  runThreads(found.size(), [&](size_t index) {
+    resolved[index] = resolve(*found[index], 0, tailStarts[index]);
+  });
+  return std::find(resolved.begin(), resolved.end(), 0) == resolved.end();
+}
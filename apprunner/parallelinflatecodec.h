@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+
+#include "codec.h"
+#include "tinflcodec.h"
+
+// entries with less compressed data are always inflated serially
+#define ParallelInflateCodec_MINIMUM_SIZE (32 * 1024 * 1024)
+// the least amount of compressed data handed to one thread by default
+#define ParallelInflateCodec_MINIMUM_CHUNK (4 * 1024 * 1024)
+
+namespace doo {
+  namespace zip {
+    // Experimental: inflates one large deflate entry on several threads at once.
+    //
+    // The compressed data is cut into chunks, and each thread searches its chunk for the start of a
+    // dynamic Huffman block. Chunks are then decoded in parallel without knowing the 32KB of output
+    // in front of them, back-references into that window are kept as placeholders and filled in by a
+    // second pass once the preceding chunk is known. Every chunk has to end exactly where the next
+    // one was found to start, which proves the guessed block boundaries right. If any guess turns
+    // out wrong the entry is inflated serially with tinfl instead.
+    //
+    // Not preferred by default, CodecRegistry::SetPreferred(ZipArchive_METHOD_DEFLATE, "parallel") enables it.
+    class ParallelInflateCodec : public Codec {
+    public:
+      // threadCount 0 uses one thread per core. Entries are split into no more chunks than threads, each
+      // with at least minimumChunk bytes of compressed data.
+      ParallelInflateCodec(unsigned threadCount = 0, uint64 minimumSize = ParallelInflateCodec_MINIMUM_SIZE,
+        uint64 minimumChunk = ParallelInflateCodec_MINIMUM_CHUNK);
+
+      virtual uint16 GetMethod() const;
+      virtual const char* GetName() const;
+      virtual void Decompress(const RandomAccessFile& file, uint64 offset, uint64 compressedSize,
+        byte* buffer, size_t uncompressedSize, uint16 flags) const;
+
+      // how many entries were inflated on several threads, and how many of those large enough went
+      // to tinfl instead because the data couldn't be split up
+      uint64 GetParallelCount() const {
+        return parallelCount;
+      }
+      uint64 GetFallbackCount() const {
+        return fallbackCount;
+      }
+
+    private:
+      // false if the data could not be split up, buffer contents are undefined then
+      bool DecompressParallel(const std::vector<byte>& input, uint64 compressedSize, byte* buffer, size_t uncompressedSize) const;
+
+      unsigned threadCount;
+      uint64 minimumSize;
+      uint64 minimumChunk;
+      TinflCodec serial;
+      mutable std::atomic<uint64> parallelCount;
+      mutable std::atomic<uint64> fallbackCount;
+    };
+  }
+}
@@ -0,0 +1,143 @@
+#include "stdafx.h"
+
+#ifdef _WIN32
+#include "helper.h"
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "randomaccessfile.h"
+#include "zipcounters.h"
+
+using namespace doo::zip;
+
+#ifdef _WIN32
+namespace {
+  // every thread keeps one event for its reads, closed by Windows when the thread exits
+  void WINAPI closeReadEvent(void* event) {
+    CloseHandle(event);
+  }
+  DWORD readEventSlot = FlsAlloc(closeReadEvent);
+
+  HANDLE getReadEvent() {
+    HANDLE event = FlsGetValue(readEventSlot);
+    if (event == NULL) {
+      event = CreateEventEx(NULL, NULL, CREATE_EVENT_MANUAL_RESET, EVENT_ALL_ACCESS);
+      if (event == NULL) {
+        throw ref new Platform::FailureException(L"Could not create an event");
+      }
+      FlsSetValue(readEventSlot, event);
+    }
+    return event;
+  }
+}
+
+/************************************************************************/
+/* The handle is opened for overlapped I/O: every read carries its own  */
+/* offset and nothing depends on the handle's file pointer              */
+/************************************************************************/
+RandomAccessFile::RandomAccessFile(const std::string& filename) {
+  file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+    FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    throw ref new Platform::InvalidArgumentException(L"Could not open file");
+  }
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize)) {
+    CloseHandle(file);
+    throw ref new Platform::FailureException(L"Could not determine file size");
+  }
+  size = fileSize.QuadPart;
+}
+
+RandomAccessFile::~RandomAccessFile() {
+  CloseHandle(file);
+}
+
+uint64 RandomAccessFile::GetModificationTime() const {
+  FILETIME lastWrite;
+  if (!GetFileTime(file, NULL, NULL, &lastWrite)) {
+    throw ref new Platform::FailureException(L"Could not determine file time");
+  }
+  return (static_cast<uint64>(lastWrite.dwHighDateTime) << 32) | lastWrite.dwLowDateTime;
+}
+
+#else
+// pread carries its own offset like overlapped reads do
+RandomAccessFile::RandomAccessFile(const std::string& filename) {
+  file = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (file < 0) {
+    throw ref new Platform::InvalidArgumentException(L"Could not open file");
+  }
+  struct stat status;
+  if (fstat(file, &status) != 0) {
+    close(file);
+    throw ref new Platform::FailureException(L"Could not determine file size");
+  }
+  size = status.st_size;
+}
+
+RandomAccessFile::~RandomAccessFile() {
+  close(file);
+}
+
+uint64 RandomAccessFile::GetModificationTime() const {
+  struct stat status;
+  if (fstat(file, &status) != 0) {
+    throw ref new Platform::FailureException(L"Could not determine file time");
+  }
+  return FILETIME_UNIX_EPOCH + static_cast<uint64>(status.st_mtim.tv_sec) * 10000000 + status.st_mtim.tv_nsec / 100;
+}
+#endif
+
+void RandomAccessFile::ReadAt(uint64 offset, void* buffer, size_t length) const {
+  if (offset > size || length > size - offset) {
+    throw ref new Platform::FailureException(L"Read beyond the end of the file");
+  }
+#ifdef APPRUNNER_ZIP_COUNTERS
+  ZipCounters::Local().CountRead(this, offset, length);
+#endif
+#ifdef _WIN32
+  // each thread waits on its own event, the handle must not be used for signaling with concurrent reads.
+  // Without a slot for it the event is created for this read alone.
+  ATL::CHandle ownEvent;
+  HANDLE readComplete;
+  if (readEventSlot != FLS_OUT_OF_INDEXES) {
+    readComplete = getReadEvent();
+  } else {
+    ownEvent.Attach(CreateEventEx(NULL, NULL, CREATE_EVENT_MANUAL_RESET, EVENT_ALL_ACCESS));
+    readComplete = ownEvent;
+  }
+  byte* target = static_cast<byte*>(buffer);
+  while (length > 0) {
+    DWORD chunk = static_cast<DWORD>(std::min<size_t>(length, 0x40000000));
+    EmptyStruct<OVERLAPPED> overlapped;
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    overlapped.hEvent = readComplete;
+
+    DWORD bytesRead = 0;
+    if (!ReadFile(file, target, chunk, NULL, &overlapped) && GetLastError() != ERROR_IO_PENDING) {
+      throw ref new Platform::FailureException(L"Could not read file");
+    }
+    if (!GetOverlappedResult(file, &overlapped, &bytesRead, TRUE) || bytesRead == 0) {
+      throw ref new Platform::FailureException(L"Could not read file");
+    }
+    target += bytesRead;
+    offset += bytesRead;
+    length -= bytesRead;
+  }
+#else
+  byte* target = static_cast<byte*>(buffer);
+  while (length > 0) {
+    ssize_t bytesRead = pread(file, target, std::min<size_t>(length, 0x40000000), static_cast<off_t>(offset));
+    if (bytesRead <= 0) {
+      throw ref new Platform::FailureException(L"Could not read file");
+    }
+    target += bytesRead;
+    offset += bytesRead;
+    length -= bytesRead;
+  }
+#endif
+}
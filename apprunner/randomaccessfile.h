@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+
+namespace doo {
+  namespace zip {
+    // read-only file accessed by explicit offsets instead of a shared file pointer,
+    // so any number of threads can read from it at the same time
+    class RandomAccessFile {
+    public:
+      RandomAccessFile(const std::string& filename);
+      ~RandomAccessFile();
+
+      uint64 GetSize() const {
+        return size;
+      }
+
+      // when the file was last written, as a FILETIME
+      uint64 GetModificationTime() const;
+
+      // read exactly length bytes starting at offset, throws if the file ends before
+      void ReadAt(uint64 offset, void* buffer, size_t length) const;
+
+#ifdef _WIN32
+      // opened for overlapped I/O, for reads that are issued several at a time like BatchReader does
+      HANDLE GetHandle() const {
+        return file;
+      }
+#else
+      // the descriptor, which BatchReader issues its reads on
+      int GetHandle() const {
+        return file;
+      }
+#endif
+
+    private:
+      RandomAccessFile(const RandomAccessFile&);
+      RandomAccessFile& operator=(const RandomAccessFile&);
+
+#ifdef _WIN32
+      HANDLE file;
+#else
+      int file;
+#endif
+      uint64 size;
+    };
+  }
+}
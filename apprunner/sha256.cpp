@@ -0,0 +1,112 @@
+#include "stdafx.h"
+
+#include "sha256.h"
+
+using namespace doo::zip;
+
+namespace {
+  const uint32 roundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+  };
+
+  inline uint32 rotateRight(uint32 value, int bits) {
+    return (value >> bits) | (value << (32 - bits));
+  }
+}
+
+Sha256::Sha256()
+  : buffered(0), length(0)
+{
+  state[0] = 0x6a09e667;
+  state[1] = 0xbb67ae85;
+  state[2] = 0x3c6ef372;
+  state[3] = 0xa54ff53a;
+  state[4] = 0x510e527f;
+  state[5] = 0x9b05688c;
+  state[6] = 0x1f83d9ab;
+  state[7] = 0x5be0cd19;
+}
+
+void Sha256::Transform(const byte* block) {
+  uint32 schedule[64];
+  for (int i = 0; i < 16; i++) {
+    schedule[i] = (static_cast<uint32>(block[4 * i]) << 24) | (block[4 * i + 1] << 16) | (block[4 * i + 2] << 8) | block[4 * i + 3];
+  }
+  for (int i = 16; i < 64; i++) {
+    uint32 s0 = rotateRight(schedule[i - 15], 7) ^ rotateRight(schedule[i - 15], 18) ^ (schedule[i - 15] >> 3);
+    uint32 s1 = rotateRight(schedule[i - 2], 17) ^ rotateRight(schedule[i - 2], 19) ^ (schedule[i - 2] >> 10);
+    schedule[i] = schedule[i - 16] + s0 + schedule[i - 7] + s1;
+  }
+  uint32 a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+  for (int i = 0; i < 64; i++) {
+    uint32 t1 = h + (rotateRight(e, 6) ^ rotateRight(e, 11) ^ rotateRight(e, 25)) + ((e & f) ^ (~e & g)) + roundConstants[i] + schedule[i];
+    uint32 t2 = (rotateRight(a, 2) ^ rotateRight(a, 13) ^ rotateRight(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+void Sha256::Update(const byte* data, size_t dataLength) {
+  length += dataLength;
+  if (buffered > 0) {
+    size_t fill = std::min(dataLength, sizeof(buffer) - buffered);
+    memcpy(buffer + buffered, data, fill);
+    buffered += fill;
+    data += fill;
+    dataLength -= fill;
+    if (buffered < sizeof(buffer)) {
+      return;
+    }
+    Transform(buffer);
+    buffered = 0;
+  }
+  for (; dataLength >= sizeof(buffer); data += sizeof(buffer), dataLength -= sizeof(buffer)) {
+    Transform(data);
+  }
+  memcpy(buffer, data, dataLength);
+  buffered = dataLength;
+}
+
+void Sha256::Finish(byte digest[Sha256_DIGEST_SIZE]) {
+  uint64 bitLength = length * 8;
+  byte padding[72] = { 0x80 };
+  // pad to 56 bytes past a block boundary, then append the length in bits
+  size_t paddingLength = (buffered < 56 ? 56 : 120) - buffered;
+  for (int i = 0; i < 8; i++) {
+    padding[paddingLength + i] = static_cast<byte>(bitLength >> (56 - 8 * i));
+  }
+  Update(padding, paddingLength + 8);
+  for (int i = 0; i < 8; i++) {
+    digest[4 * i] = static_cast<byte>(state[i] >> 24);
+    digest[4 * i + 1] = static_cast<byte>(state[i] >> 16);
+    digest[4 * i + 2] = static_cast<byte>(state[i] >> 8);
+    digest[4 * i + 3] = static_cast<byte>(state[i]);
+  }
+}
+
+void Sha256::Hash(const byte* data, size_t length, byte digest[Sha256_DIGEST_SIZE]) {
+  Sha256 hash;
+  hash.Update(data, length);
+  hash.Finish(digest);
+}
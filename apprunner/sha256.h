@@ -0,0 +1,27 @@
+#pragma once
+
+#define Sha256_DIGEST_SIZE 32
+
+namespace doo {
+  namespace zip {
+    // SHA-256 as used for the block hashes of AppxBlockMap.xml
+    class Sha256 {
+    public:
+      Sha256();
+
+      void Update(const byte* data, size_t length);
+      // the digest of everything passed to Update, the object can't be updated afterwards
+      void Finish(byte digest[Sha256_DIGEST_SIZE]);
+
+      static void Hash(const byte* data, size_t length, byte digest[Sha256_DIGEST_SIZE]);
+
+    private:
+      void Transform(const byte* block);
+
+      uint32 state[8];
+      byte buffer[64];
+      size_t buffered;
+      uint64 length;
+    };
+  }
+}
@@ -5,6 +5,7 @@
 
 #pragma once
 
+#ifdef _WIN32
 #include "targetver.h"
 
 #include <tchar.h>
@@ -22,3 +23,200 @@
 
 #include <iostream>
 #include <fstream>
+
+#include <cstdarg>
+#include <cstdio>
+#else
+// Elsewhere CMakeLists.txt builds the sources that don't need WinRT, as plain C++ with "ref new"
+// turned into "new" and "Exception^" into "Exception*". This declares what they use of the Windows
+// headers and of C++/CX.
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <strings.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef uint8_t byte;
+typedef int16_t int16;
+typedef uint16_t uint16;
+typedef int32_t int32;
+typedef uint32_t uint32;
+typedef int64_t int64;
+typedef uint64_t uint64;
+
+#define _TRUNCATE static_cast<size_t>(-1)
+
+inline int _stricmp(const char* first, const char* second) {
+  return strcasecmp(first, second);
+}
+
+inline unsigned long long _strtoui64(const char* text, char** end, int base) {
+  return strtoull(text, end, base);
+}
+
+// like the Windows ones with _TRUNCATE, which is all the sources pass for count
+inline int _snprintf_s(char* buffer, size_t size, size_t, const char* format, ...) {
+  va_list arguments;
+  va_start(arguments, format);
+  int result = vsnprintf(buffer, size, format, arguments);
+  va_end(arguments);
+  return result < 0 || static_cast<size_t>(result) >= size ? -1 : result;
+}
+
+inline int _vsnwprintf_s(wchar_t* buffer, size_t size, size_t, const wchar_t* format, va_list arguments) {
+  // unlike vsnprintf, vswprintf needn't leave anything in the buffer when the text doesn't fit
+  buffer[0] = 0;
+  int result = vswprintf(buffer, size, format, arguments);
+  buffer[size - 1] = 0;
+  return result;
+}
+
+inline int _snwprintf_s(wchar_t* buffer, size_t size, size_t count, const wchar_t* format, ...) {
+  va_list arguments;
+  va_start(arguments, format);
+  int result = _vsnwprintf_s(buffer, size, count, format, arguments);
+  va_end(arguments);
+  return result;
+}
+
+// times are kept as FILETIMEs, 100ns units since 1601, in the run history and the log
+#define FILETIME_UNIX_EPOCH 116444736000000000ULL
+
+struct FILETIME {
+  uint32 dwLowDateTime;
+  uint32 dwHighDateTime;
+};
+
+struct SYSTEMTIME {
+  uint16 wYear;
+  uint16 wMonth;
+  uint16 wDayOfWeek;
+  uint16 wDay;
+  uint16 wHour;
+  uint16 wMinute;
+  uint16 wSecond;
+  uint16 wMilliseconds;
+};
+
+union LARGE_INTEGER {
+  int64 QuadPart;
+};
+
+inline void GetSystemTimeAsFileTime(FILETIME* fileTime) {
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  uint64 time = FILETIME_UNIX_EPOCH + static_cast<uint64>(now.tv_sec) * 10000000 + now.tv_nsec / 100;
+  fileTime->dwLowDateTime = static_cast<uint32>(time);
+  fileTime->dwHighDateTime = static_cast<uint32>(time >> 32);
+}
+
+inline int FileTimeToSystemTime(const FILETIME* fileTime, SYSTEMTIME* systemTime) {
+  uint64 time = ((static_cast<uint64>(fileTime->dwHighDateTime) << 32) | fileTime->dwLowDateTime) - FILETIME_UNIX_EPOCH;
+  time_t seconds = static_cast<time_t>(time / 10000000);
+  tm utc;
+  if (!gmtime_r(&seconds, &utc)) {
+    return 0;
+  }
+  systemTime->wYear = static_cast<uint16>(utc.tm_year + 1900);
+  systemTime->wMonth = static_cast<uint16>(utc.tm_mon + 1);
+  systemTime->wDayOfWeek = static_cast<uint16>(utc.tm_wday);
+  systemTime->wDay = static_cast<uint16>(utc.tm_mday);
+  systemTime->wHour = static_cast<uint16>(utc.tm_hour);
+  systemTime->wMinute = static_cast<uint16>(utc.tm_min);
+  systemTime->wSecond = static_cast<uint16>(utc.tm_sec);
+  systemTime->wMilliseconds = static_cast<uint16>(time / 10000 % 1000);
+  return 1;
+}
+
+// steady_clock stands in for the performance counter
+inline int QueryPerformanceCounter(LARGE_INTEGER* counter) {
+  counter->QuadPart = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+  return 1;
+}
+
+inline int QueryPerformanceFrequency(LARGE_INTEGER* frequency) {
+  frequency->QuadPart = 1000000000;
+  return 1;
+}
+
+inline uint32 GetCurrentThreadId() {
+  return static_cast<uint32>(syscall(SYS_gettid));
+}
+
+inline uint32 GetCurrentProcessId() {
+  return static_cast<uint32>(getpid());
+}
+
+namespace Platform {
+  class String {
+  public:
+    String(const wchar_t* text) : text(text) {}
+    const wchar_t* Data() const {
+      return text.c_str();
+    }
+
+  private:
+    std::wstring text;
+  };
+
+  // thrown and caught as pointers, so Message never dangles
+  class Exception {
+  public:
+    Exception(const wchar_t* message) : text(message), Message(&text) {}
+    Exception(const char* message) : text(std::wstring(message, message + strlen(message)).c_str()), Message(&text) {}
+    virtual ~Exception() {}
+
+  private:
+    String text;
+
+  public:
+    String* const Message;
+  };
+
+  class FailureException : public Exception {
+  public:
+    FailureException(const wchar_t* message) : Exception(message) {}
+    FailureException(const char* message) : Exception(message) {}
+  };
+
+  class InvalidArgumentException : public Exception {
+  public:
+    InvalidArgumentException(const wchar_t* message) : Exception(message) {}
+  };
+
+  class OutOfMemoryException : public Exception {
+  public:
+    OutOfMemoryException(const wchar_t* message) : Exception(message) {}
+  };
+}
+#endif
+
+// Objects shared by all threads are namespace level statics rather than function statics everywhere:
+// VS2012 doesn't initialize function statics thread-safely, two threads could both construct one.
+
+#if defined(_MSC_VER) && _MSC_VER < 1900
+// VS2012 has no C99 snprintf. This one truncates and terminates like it, only the return value of a
+// truncated call differs (-1).
+inline int snprintf(char* buffer, size_t size, const char* format, ...) {
+  va_list arguments;
+  va_start(arguments, format);
+  int result = _vsnprintf_s(buffer, size, _TRUNCATE, format, arguments);
+  va_end(arguments);
+  return result;
+}
+#endif
@@ -41,12 +41,16 @@ typedef unsigned long long mz_uint64;
 // TINFL_FLAG_HAS_MORE_INPUT: If set, there are more input bytes available beyond the end of the supplied input buffer. If clear, the input buffer contains all remaining input.
 // TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF: If set, the output buffer is large enough to hold the entire decompressed stream. If clear, the output buffer is at least the size of the dictionary (typically 32KB).
 // TINFL_FLAG_COMPUTE_ADLER32: Force adler-32 checksum computation of the decompressed bytes.
+// TINFL_FLAG_DEFLATE64: Decode Deflate64 (ZIP method 9): length code 285 takes 16 extra bits, distance codes 30 and 31 reach back 64KB. A wrapping output buffer must be at least 64KB, twice TINFL_LZ_DICT_SIZE.
+// TINFL_FLAG_STOP_AT_BLOCK_BOUNDARY: Return TINFL_STATUS_BLOCK_BOUNDARY after every block but the last one. Whole look-ahead bytes are put back, so the consumed input size is exact and m_bit_buf/m_num_bits hold the remaining bits of the last partially used byte.
 enum
 {
   TINFL_FLAG_PARSE_ZLIB_HEADER = 1,
   TINFL_FLAG_HAS_MORE_INPUT = 2,
   TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF = 4,
-  TINFL_FLAG_COMPUTE_ADLER32 = 8
+  TINFL_FLAG_COMPUTE_ADLER32 = 8,
+  TINFL_FLAG_STOP_AT_BLOCK_BOUNDARY = 16,
+  TINFL_FLAG_DEFLATE64 = 32
 };
 
 // High level decompression functions:
@@ -82,11 +86,15 @@ typedef enum
   TINFL_STATUS_FAILED = -1,
   TINFL_STATUS_DONE = 0,
   TINFL_STATUS_NEEDS_MORE_INPUT = 1,
-  TINFL_STATUS_HAS_MORE_OUTPUT = 2
+  TINFL_STATUS_HAS_MORE_OUTPUT = 2,
+  TINFL_STATUS_BLOCK_BOUNDARY = 3
 } tinfl_status;
 
 // Initializes the decompressor to its initial state.
 #define tinfl_init(r) do { (r)->m_state = 0; } MZ_MACRO_END
+// Initializes the decompressor to continue a raw deflate stream at a block boundary previously reported by TINFL_STATUS_BLOCK_BOUNDARY.
+// The input has to continue right after the bytes consumed up to that point, and the output buffer has to be a wrapping dictionary ending with the last 32KB of output.
+#define tinfl_init_at_block_boundary(r, bit_buf, num_bits) do { (r)->m_state = 54; (r)->m_final = 0; (r)->m_bit_buf = (bit_buf); (r)->m_num_bits = (num_bits); (r)->m_dist = (r)->m_counter = (r)->m_num_extra = 0; (r)->m_dist_from_out_buf_start = 0; (r)->m_z_adler32 = (r)->m_check_adler32 = 1; } MZ_MACRO_END
 #define tinfl_get_adler32(r) (r)->m_check_adler32
 
 // Main low-level decompressor coroutine function. This is the only function actually needed for decompression. All the other functions are just high-level helpers for improved usability.
@@ -124,6 +132,8 @@ struct tinfl_decompressor_tag
   tinfl_bit_buf_t m_bit_buf;
   size_t m_dist_from_out_buf_start;
   tinfl_huff_table m_tables[TINFL_MAX_HUFF_TABLES];
+  // the literal/length and distance tables of the current block, either m_tables or the precomputed fixed ones
+  const tinfl_huff_table *m_pHuff_tables[2];
   mz_uint8 m_raw_header[4], m_len_codes[TINFL_MAX_HUFF_SYMBOLS_0 + TINFL_MAX_HUFF_SYMBOLS_1 + 137];
 };
 
@@ -166,6 +176,14 @@ struct tinfl_decompressor_tag
 #define TINFL_CR_RETURN_FOREVER(state_index, result) do { for ( ; ; ) { TINFL_CR_RETURN(state_index, result); } } MZ_MACRO_END
 #define TINFL_CR_FINISH }
 
+// Instrumentation hooks, empty unless the file including the implementation defines them first
+#ifndef TINFL_COUNT
+  #define TINFL_COUNT(counter)
+#endif
+#ifndef TINFL_COUNT_MATCH
+  #define TINFL_COUNT_MATCH(length)
+#endif
+
 // TODO: If the caller has indicated that there's no more input, and we attempt to read beyond the input buf, then something is wrong with the input because the inflator never
 // reads ahead more than it needs to. Currently TINFL_GET_BYTE() pads the end of the stream with 0's in this scenario.
 #define TINFL_GET_BYTE(state_index, c) do { \
@@ -215,7 +233,7 @@ struct tinfl_decompressor_tag
   int temp; mz_uint code_len, c; \
   if (num_bits < 15) { \
     if ((pIn_buf_end - pIn_buf_cur) < 2) { \
-       TINFL_HUFF_BITBUF_FILL(state_index, pHuff); \
+       TINFL_COUNT(slowRefills); TINFL_HUFF_BITBUF_FILL(state_index, pHuff); \
     } else { \
        bit_buf |= (((tinfl_bit_buf_t)pIn_buf_cur[0]) << num_bits) | (((tinfl_bit_buf_t)pIn_buf_cur[1]) << (num_bits + 8)); pIn_buf_cur += 2; num_bits += 16; \
     } \
@@ -223,9 +241,122 @@ struct tinfl_decompressor_tag
   if ((temp = (pHuff)->m_look_up[bit_buf & (TINFL_FAST_LOOKUP_SIZE - 1)]) >= 0) \
     code_len = temp >> 9, temp &= 511; \
   else { \
-    code_len = TINFL_FAST_LOOKUP_BITS; do { temp = (pHuff)->m_tree[~temp + ((bit_buf >> code_len++) & 1)]; } while (temp < 0); \
+    TINFL_COUNT(treeWalks); code_len = TINFL_FAST_LOOKUP_BITS; do { temp = (pHuff)->m_tree[~temp + ((bit_buf >> code_len++) & 1)]; } while (temp < 0); \
   } sym = temp; bit_buf >>= code_len; num_bits -= code_len; } MZ_MACRO_END
 
+// The tables for fixed Huffman blocks (BTYPE=1), exactly as the table building code in tinfl_decompress() produces them.
+// They are generated offline instead of being rebuilt for every fixed block. The trees are empty since all fixed codes fit the fast lookup.
+static const tinfl_huff_table s_tinfl_fixed_tables[2] =
+{
+  {
+    {
+      8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,
+      8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,
+      8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,
+      9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,
+      9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,
+      9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,9,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,8,8,8,8,8,8,8,8
+    },
+    {
+      3840,4176,4112,4376,3856,4208,4144,4800,3848,4192,4128,4768,4096,4224,4160,4832,3844,4184,4120,4752,3860,4216,4152,4816,
+      3852,4200,4136,4784,4104,4232,4168,4848,3842,4180,4116,4380,3858,4212,4148,4808,3850,4196,4132,4776,4100,4228,4164,4840,
+      3846,4188,4124,4760,3862,4220,4156,4824,3854,4204,4140,4792,4108,4236,4172,4856,3841,4178,4114,4378,3857,4210,4146,4804,
+      3849,4194,4130,4772,4098,4226,4162,4836,3845,4186,4122,4756,3861,4218,4154,4820,3853,4202,4138,4788,4106,4234,4170,4852,
+      3843,4182,4118,4382,3859,4214,4150,4812,3851,4198,4134,4780,4102,4230,4166,4844,3847,4190,4126,4764,3863,4222,4158,4828,
+      3855,4206,4142,4796,4110,4238,4174,4860,3840,4177,4113,4377,3856,4209,4145,4802,3848,4193,4129,4770,4097,4225,4161,4834,
+      3844,4185,4121,4754,3860,4217,4153,4818,3852,4201,4137,4786,4105,4233,4169,4850,3842,4181,4117,4381,3858,4213,4149,4810,
+      3850,4197,4133,4778,4101,4229,4165,4842,3846,4189,4125,4762,3862,4221,4157,4826,3854,4205,4141,4794,4109,4237,4173,4858,
+      3841,4179,4115,4379,3857,4211,4147,4806,3849,4195,4131,4774,4099,4227,4163,4838,3845,4187,4123,4758,3861,4219,4155,4822,
+      3853,4203,4139,4790,4107,4235,4171,4854,3843,4183,4119,4383,3859,4215,4151,4814,3851,4199,4135,4782,4103,4231,4167,4846,
+      3847,4191,4127,4766,3863,4223,4159,4830,3855,4207,4143,4798,4111,4239,4175,4862,3840,4176,4112,4376,3856,4208,4144,4801,
+      3848,4192,4128,4769,4096,4224,4160,4833,3844,4184,4120,4753,3860,4216,4152,4817,3852,4200,4136,4785,4104,4232,4168,4849,
+      3842,4180,4116,4380,3858,4212,4148,4809,3850,4196,4132,4777,4100,4228,4164,4841,3846,4188,4124,4761,3862,4220,4156,4825,
+      3854,4204,4140,4793,4108,4236,4172,4857,3841,4178,4114,4378,3857,4210,4146,4805,3849,4194,4130,4773,4098,4226,4162,4837,
+      3845,4186,4122,4757,3861,4218,4154,4821,3853,4202,4138,4789,4106,4234,4170,4853,3843,4182,4118,4382,3859,4214,4150,4813,
+      3851,4198,4134,4781,4102,4230,4166,4845,3847,4190,4126,4765,3863,4222,4158,4829,3855,4206,4142,4797,4110,4238,4174,4861,
+      3840,4177,4113,4377,3856,4209,4145,4803,3848,4193,4129,4771,4097,4225,4161,4835,3844,4185,4121,4755,3860,4217,4153,4819,
+      3852,4201,4137,4787,4105,4233,4169,4851,3842,4181,4117,4381,3858,4213,4149,4811,3850,4197,4133,4779,4101,4229,4165,4843,
+      3846,4189,4125,4763,3862,4221,4157,4827,3854,4205,4141,4795,4109,4237,4173,4859,3841,4179,4115,4379,3857,4211,4147,4807,
+      3849,4195,4131,4775,4099,4227,4163,4839,3845,4187,4123,4759,3861,4219,4155,4823,3853,4203,4139,4791,4107,4235,4171,4855,
+      3843,4183,4119,4383,3859,4215,4151,4815,3851,4199,4135,4783,4103,4231,4167,4847,3847,4191,4127,4767,3863,4223,4159,4831,
+      3855,4207,4143,4799,4111,4239,4175,4863,3840,4176,4112,4376,3856,4208,4144,4800,3848,4192,4128,4768,4096,4224,4160,4832,
+      3844,4184,4120,4752,3860,4216,4152,4816,3852,4200,4136,4784,4104,4232,4168,4848,3842,4180,4116,4380,3858,4212,4148,4808,
+      3850,4196,4132,4776,4100,4228,4164,4840,3846,4188,4124,4760,3862,4220,4156,4824,3854,4204,4140,4792,4108,4236,4172,4856,
+      3841,4178,4114,4378,3857,4210,4146,4804,3849,4194,4130,4772,4098,4226,4162,4836,3845,4186,4122,4756,3861,4218,4154,4820,
+      3853,4202,4138,4788,4106,4234,4170,4852,3843,4182,4118,4382,3859,4214,4150,4812,3851,4198,4134,4780,4102,4230,4166,4844,
+      3847,4190,4126,4764,3863,4222,4158,4828,3855,4206,4142,4796,4110,4238,4174,4860,3840,4177,4113,4377,3856,4209,4145,4802,
+      3848,4193,4129,4770,4097,4225,4161,4834,3844,4185,4121,4754,3860,4217,4153,4818,3852,4201,4137,4786,4105,4233,4169,4850,
+      3842,4181,4117,4381,3858,4213,4149,4810,3850,4197,4133,4778,4101,4229,4165,4842,3846,4189,4125,4762,3862,4221,4157,4826,
+      3854,4205,4141,4794,4109,4237,4173,4858,3841,4179,4115,4379,3857,4211,4147,4806,3849,4195,4131,4774,4099,4227,4163,4838,
+      3845,4187,4123,4758,3861,4219,4155,4822,3853,4203,4139,4790,4107,4235,4171,4854,3843,4183,4119,4383,3859,4215,4151,4814,
+      3851,4199,4135,4782,4103,4231,4167,4846,3847,4191,4127,4766,3863,4223,4159,4830,3855,4207,4143,4798,4111,4239,4175,4862,
+      3840,4176,4112,4376,3856,4208,4144,4801,3848,4192,4128,4769,4096,4224,4160,4833,3844,4184,4120,4753,3860,4216,4152,4817,
+      3852,4200,4136,4785,4104,4232,4168,4849,3842,4180,4116,4380,3858,4212,4148,4809,3850,4196,4132,4777,4100,4228,4164,4841,
+      3846,4188,4124,4761,3862,4220,4156,4825,3854,4204,4140,4793,4108,4236,4172,4857,3841,4178,4114,4378,3857,4210,4146,4805,
+      3849,4194,4130,4773,4098,4226,4162,4837,3845,4186,4122,4757,3861,4218,4154,4821,3853,4202,4138,4789,4106,4234,4170,4853,
+      3843,4182,4118,4382,3859,4214,4150,4813,3851,4198,4134,4781,4102,4230,4166,4845,3847,4190,4126,4765,3863,4222,4158,4829,
+      3855,4206,4142,4797,4110,4238,4174,4861,3840,4177,4113,4377,3856,4209,4145,4803,3848,4193,4129,4771,4097,4225,4161,4835,
+      3844,4185,4121,4755,3860,4217,4153,4819,3852,4201,4137,4787,4105,4233,4169,4851,3842,4181,4117,4381,3858,4213,4149,4811,
+      3850,4197,4133,4779,4101,4229,4165,4843,3846,4189,4125,4763,3862,4221,4157,4827,3854,4205,4141,4795,4109,4237,4173,4859,
+      3841,4179,4115,4379,3857,4211,4147,4807,3849,4195,4131,4775,4099,4227,4163,4839,3845,4187,4123,4759,3861,4219,4155,4823,
+      3853,4203,4139,4791,4107,4235,4171,4855,3843,4183,4119,4383,3859,4215,4151,4815,3851,4199,4135,4783,4103,4231,4167,4847,
+      3847,4191,4127,4767,3863,4223,4159,4831,3855,4207,4143,4799,4111,4239,4175,4863
+    },
+    { 0 }
+  },
+  {
+    {
+      5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5
+    },
+    {
+      2560,2576,2568,2584,2564,2580,2572,2588,2562,2578,2570,2586,2566,2582,2574,2590,2561,2577,2569,2585,2565,2581,2573,2589,
+      2563,2579,2571,2587,2567,2583,2575,2591,2560,2576,2568,2584,2564,2580,2572,2588,2562,2578,2570,2586,2566,2582,2574,2590,
+      2561,2577,2569,2585,2565,2581,2573,2589,2563,2579,2571,2587,2567,2583,2575,2591,2560,2576,2568,2584,2564,2580,2572,2588,
+      2562,2578,2570,2586,2566,2582,2574,2590,2561,2577,2569,2585,2565,2581,2573,2589,2563,2579,2571,2587,2567,2583,2575,2591,
+      2560,2576,2568,2584,2564,2580,2572,2588,2562,2578,2570,2586,2566,2582,2574,2590,2561,2577,2569,2585,2565,2581,2573,2589,
+      2563,2579,2571,2587,2567,2583,2575,2591,2560,2576,2568,2584,2564,2580,2572,2588,2562,2578,2570,2586,2566,2582,2574,2590,
+      2561,2577,2569,2585,2565,2581,2573,2589,2563,2579,2571,2587,2567,2583,2575,2591,2560,2576,2568,2584,2564,2580,2572,2588,
+      2562,2578,2570,2586,2566,2582,2574,2590,2561,2577,2569,2585,2565,2581,2573,2589,2563,2579,2571,2587,2567,2583,2575,2591,
+      2560,2576,2568,2584,2564,2580,2572,2588,2562,2578,2570,2586,2566,2582,2574,2590,2561,2577,2569,2585,2565,2581,2573,2589,
+      2563,2579,2571,2587,2567,2583,2575,2591,2560,2576,2568,2584,2564,2580,2572,2588,2562,2578,2570,2586,2566,2582,2574,2590,
+      2561,2577,2569,2585,2565,2581,2573,2589,2563,2579,2571,2587,2567,2583,2575,2591,2560,2576,2568,2584,2564,2580,2572,2588,
+      2562,2578,2570,2586,2566,2582,2574,2590,2561,2577,2569,2585,2565,2581,2573,2589,2563,2579,2571,2587,2567,2583,2575,2591,
+      2560,2576,2568,2584,2564,2580,2572,2588,2562,2578,2570,2586,2566,2582,2574,2590,2561,2577,2569,2585,2565,2581,2573,2589,
+      2563,2579,2571,2587,2567,2583,2575,2591,2560,2576,2568,2584,2564,2580,2572,2588,2562,2578,2570,2586,2566,2582,2574,2590,
+      2561,2577,2569,2585,2565,2581,2573,2589,2563,2579,2571,2587,2567,2583,2575,2591,2560,2576,2568,2584,2564,2580,2572,2588,
+      2562,2578,2570,2586,2566,2582,2574,2590,2561,2577,2569,2585,2565,2581,2573,2589,2563,2579,2571,2587,2567,2583,2575,2591,
+      2560,2576,2568,2584,2564,2580,2572,2588,2562,2578,2570,2586,2566,2582,2574,2590,2561,2577,2569,2585,2565,2581,2573,2589,
+      2563,2579,2571,2587,2567,2583,2575,2591,2560,2576,2568,2584,2564,2580,2572,2588,2562,2578,2570,2586,2566,2582,2574,2590,
+      2561,2577,2569,2585,2565,2581,2573,2589,2563,2579,2571,2587,2567,2583,2575,2591,2560,2576,2568,2584,2564,2580,2572,2588,
+      2562,2578,2570,2586,2566,2582,2574,2590,2561,2577,2569,2585,2565,2581,2573,2589,2563,2579,2571,2587,2567,2583,2575,2591,
+      2560,2576,2568,2584,2564,2580,2572,2588,2562,2578,2570,2586,2566,2582,2574,2590,2561,2577,2569,2585,2565,2581,2573,2589,
+      2563,2579,2571,2587,2567,2583,2575,2591,2560,2576,2568,2584,2564,2580,2572,2588,2562,2578,2570,2586,2566,2582,2574,2590,
+      2561,2577,2569,2585,2565,2581,2573,2589,2563,2579,2571,2587,2567,2583,2575,2591,2560,2576,2568,2584,2564,2580,2572,2588,
+      2562,2578,2570,2586,2566,2582,2574,2590,2561,2577,2569,2585,2565,2581,2573,2589,2563,2579,2571,2587,2567,2583,2575,2591,
+      2560,2576,2568,2584,2564,2580,2572,2588,2562,2578,2570,2586,2566,2582,2574,2590,2561,2577,2569,2585,2565,2581,2573,2589,
+      2563,2579,2571,2587,2567,2583,2575,2591,2560,2576,2568,2584,2564,2580,2572,2588,2562,2578,2570,2586,2566,2582,2574,2590,
+      2561,2577,2569,2585,2565,2581,2573,2589,2563,2579,2571,2587,2567,2583,2575,2591,2560,2576,2568,2584,2564,2580,2572,2588,
+      2562,2578,2570,2586,2566,2582,2574,2590,2561,2577,2569,2585,2565,2581,2573,2589,2563,2579,2571,2587,2567,2583,2575,2591,
+      2560,2576,2568,2584,2564,2580,2572,2588,2562,2578,2570,2586,2566,2582,2574,2590,2561,2577,2569,2585,2565,2581,2573,2589,
+      2563,2579,2571,2587,2567,2583,2575,2591,2560,2576,2568,2584,2564,2580,2572,2588,2562,2578,2570,2586,2566,2582,2574,2590,
+      2561,2577,2569,2585,2565,2581,2573,2589,2563,2579,2571,2587,2567,2583,2575,2591,2560,2576,2568,2584,2564,2580,2572,2588,
+      2562,2578,2570,2586,2566,2582,2574,2590,2561,2577,2569,2585,2565,2581,2573,2589,2563,2579,2571,2587,2567,2583,2575,2591,
+      2560,2576,2568,2584,2564,2580,2572,2588,2562,2578,2570,2586,2566,2582,2574,2590,2561,2577,2569,2585,2565,2581,2573,2589,
+      2563,2579,2571,2587,2567,2583,2575,2591,2560,2576,2568,2584,2564,2580,2572,2588,2562,2578,2570,2586,2566,2582,2574,2590,
+      2561,2577,2569,2585,2565,2581,2573,2589,2563,2579,2571,2587,2567,2583,2575,2591,2560,2576,2568,2584,2564,2580,2572,2588,
+      2562,2578,2570,2586,2566,2582,2574,2590,2561,2577,2569,2585,2565,2581,2573,2589,2563,2579,2571,2587,2567,2583,2575,2591,
+      2560,2576,2568,2584,2564,2580,2572,2588,2562,2578,2570,2586,2566,2582,2574,2590,2561,2577,2569,2585,2565,2581,2573,2589,
+      2563,2579,2571,2587,2567,2583,2575,2591,2560,2576,2568,2584,2564,2580,2572,2588,2562,2578,2570,2586,2566,2582,2574,2590,
+      2561,2577,2569,2585,2565,2581,2573,2589,2563,2579,2571,2587,2567,2583,2575,2591,2560,2576,2568,2584,2564,2580,2572,2588,
+      2562,2578,2570,2586,2566,2582,2574,2590,2561,2577,2569,2585,2565,2581,2573,2589,2563,2579,2571,2587,2567,2583,2575,2591,
+      2560,2576,2568,2584,2564,2580,2572,2588,2562,2578,2570,2586,2566,2582,2574,2590,2561,2577,2569,2585,2565,2581,2573,2589,
+      2563,2579,2571,2587,2567,2583,2575,2591,2560,2576,2568,2584,2564,2580,2572,2588,2562,2578,2570,2586,2566,2582,2574,2590,
+      2561,2577,2569,2585,2565,2581,2573,2589,2563,2579,2571,2587,2567,2583,2575,2591
+    },
+    { 0 }
+  }
+};
+
 tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_next, size_t *pIn_buf_size, mz_uint8 *pOut_buf_start, mz_uint8 *pOut_buf_next, size_t *pOut_buf_size, const mz_uint32 decomp_flags)
 {
   static const int s_length_base[31] = { 3,4,5,6,7,8,9,10,11,13, 15,17,19,23,27,31,35,43,51,59, 67,83,99,115,131,163,195,227,258,0,0 };
@@ -260,6 +391,7 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
     TINFL_GET_BITS(3, r->m_final, 3); r->m_type = r->m_final >> 1;
     if (r->m_type == 0)
     {
+      TINFL_COUNT(storedBlocks);
       TINFL_SKIP_BITS(5, num_bits & 7);
       for (counter = 0; counter < 4; ++counter) { if (num_bits) TINFL_GET_BITS(6, r->m_raw_header[counter], 8); else TINFL_GET_BYTE(7, r->m_raw_header[counter]); }
       if ((counter = (r->m_raw_header[0] | (r->m_raw_header[1] << 8))) != (mz_uint)(0xFFFF ^ (r->m_raw_header[2] | (r->m_raw_header[3] << 8)))) { TINFL_CR_RETURN_FOREVER(39, TINFL_STATUS_FAILED); }
@@ -296,12 +428,14 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
     {
       if (r->m_type == 1)
       {
-        mz_uint8 *p = r->m_tables[0].m_code_size; mz_uint i;
-        r->m_table_sizes[0] = 288; r->m_table_sizes[1] = 32; TINFL_MEMSET(r->m_tables[1].m_code_size, 5, 32);
-        for ( i = 0; i <= 143; ++i) *p++ = 8; for ( ; i <= 255; ++i) *p++ = 9; for ( ; i <= 279; ++i) *p++ = 7; for ( ; i <= 287; ++i) *p++ = 8;
+        // nothing to build, skip the table building loop below
+        TINFL_COUNT(fixedBlocks);
+        r->m_pHuff_tables[0] = &s_tinfl_fixed_tables[0]; r->m_pHuff_tables[1] = &s_tinfl_fixed_tables[1];
+        r->m_type = (mz_uint32)-1;
       }
       else
       {
+        TINFL_COUNT(dynamicBlocks);
         for (counter = 0; counter < 3; counter++) { TINFL_GET_BITS(11, r->m_table_sizes[counter], "\05\05\04"[counter]); r->m_table_sizes[counter] += s_min_table_sizes[counter]; }
         MZ_CLEAR_OBJ(r->m_tables[2].m_code_size); for (counter = 0; counter < r->m_table_sizes[2]; counter++) { mz_uint s; TINFL_GET_BITS(14, s, 3); r->m_tables[2].m_code_size[s_length_dezigzag[counter]] = (mz_uint8)s; }
         r->m_table_sizes[2] = 19;
@@ -309,18 +443,26 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
       for ( ; (int)r->m_type >= 0; r->m_type--)
       {
         int tree_next, tree_cur; tinfl_huff_table *pTable;
-        mz_uint i, j, used_syms, total, sym_index, next_code[17], total_syms[16]; pTable = &r->m_tables[r->m_type]; MZ_CLEAR_OBJ(total_syms); MZ_CLEAR_OBJ(pTable->m_look_up); MZ_CLEAR_OBJ(pTable->m_tree);
+        mz_uint i, j, used_syms, total, sym_index, max_code_size, next_code[17], total_syms[16]; pTable = &r->m_tables[r->m_type]; MZ_CLEAR_OBJ(total_syms);
+        TINFL_COUNT(tableBuilds);
         for (i = 0; i < r->m_table_sizes[r->m_type]; ++i) total_syms[pTable->m_code_size[i]]++;
-        used_syms = 0, total = 0; next_code[0] = next_code[1] = 0;
-        for (i = 1; i <= 15; ++i) { used_syms += total_syms[i]; next_code[i + 1] = (total = ((total + total_syms[i]) << 1)); }
+        used_syms = 0, total = 0, max_code_size = 0; next_code[0] = next_code[1] = 0;
+        for (i = 1; i <= 15; ++i) { used_syms += total_syms[i]; if (total_syms[i]) max_code_size = i; next_code[i + 1] = (total = ((total + total_syms[i]) << 1)); }
         if ((65536 != total) && (used_syms > 1))
         {
           TINFL_CR_RETURN_FOREVER(35, TINFL_STATUS_FAILED);
         }
+        // A complete code whose codes all fit the fast lookup writes every lookup entry and never uses the tree, so only
+        // clear what is actually going to be read. Long codes need zeroed entries to hang their subtrees off.
+        if (max_code_size > TINFL_FAST_LOOKUP_BITS) { MZ_CLEAR_OBJ(pTable->m_look_up); MZ_CLEAR_OBJ(pTable->m_tree); }
+        else if (65536 != total) MZ_CLEAR_OBJ(pTable->m_look_up);
         for (tree_next = -1, sym_index = 0; sym_index < r->m_table_sizes[r->m_type]; ++sym_index)
         {
-          mz_uint rev_code = 0, l, cur_code, code_size = pTable->m_code_size[sym_index]; if (!code_size) continue;
-          cur_code = next_code[code_size]++; for (l = code_size; l > 0; l--, cur_code >>= 1) rev_code = (rev_code << 1) | (cur_code & 1);
+          mz_uint rev_code, cur_code, code_size = pTable->m_code_size[sym_index]; if (!code_size) continue;
+          // reverse the code's bits with a few shifts instead of a loop over every bit
+          cur_code = next_code[code_size]++;
+          rev_code = ((cur_code & 0x5555) << 1) | ((cur_code >> 1) & 0x5555); rev_code = ((rev_code & 0x3333) << 2) | ((rev_code >> 2) & 0x3333);
+          rev_code = ((rev_code & 0x0F0F) << 4) | ((rev_code >> 4) & 0x0F0F); rev_code = (((rev_code & 0x00FF) << 8) | ((rev_code >> 8) & 0x00FF)) >> (16 - code_size);
           if (code_size <= TINFL_FAST_LOOKUP_BITS) { mz_int16 k = (mz_int16)((code_size << 9) | sym_index); while (rev_code < TINFL_FAST_LOOKUP_SIZE) { pTable->m_look_up[rev_code] = k; rev_code += (1 << code_size); } continue; }
           if (0 == (tree_cur = pTable->m_look_up[rev_code & (TINFL_FAST_LOOKUP_SIZE - 1)])) { pTable->m_look_up[rev_code & (TINFL_FAST_LOOKUP_SIZE - 1)] = (mz_int16)tree_next; tree_cur = tree_next; tree_next -= 2; }
           rev_code >>= (TINFL_FAST_LOOKUP_BITS - 1);
@@ -349,6 +491,7 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
           }
           TINFL_MEMCPY(r->m_tables[0].m_code_size, r->m_len_codes, r->m_table_sizes[0]); TINFL_MEMCPY(r->m_tables[1].m_code_size, r->m_len_codes + r->m_table_sizes[0], r->m_table_sizes[1]);
         }
+        r->m_pHuff_tables[0] = &r->m_tables[0]; r->m_pHuff_tables[1] = &r->m_tables[1];
       }
       for ( ; ; )
       {
@@ -357,7 +500,7 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
         {
           if (((pIn_buf_end - pIn_buf_cur) < 4) || ((pOut_buf_end - pOut_buf_cur) < 2))
           {
-            TINFL_HUFF_DECODE(23, counter, &r->m_tables[0]);
+            TINFL_HUFF_DECODE(23, counter, r->m_pHuff_tables[0]);
             if (counter >= 256)
               break;
             while (pOut_buf_cur >= pOut_buf_end) { TINFL_CR_RETURN(24, TINFL_STATUS_HAS_MORE_OUTPUT); }
@@ -371,11 +514,11 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
 #else
             if (num_bits < 15) { bit_buf |= (((tinfl_bit_buf_t)MZ_READ_LE16(pIn_buf_cur)) << num_bits); pIn_buf_cur += 2; num_bits += 16; }
 #endif
-            if ((sym2 = r->m_tables[0].m_look_up[bit_buf & (TINFL_FAST_LOOKUP_SIZE - 1)]) >= 0)
+            if ((sym2 = r->m_pHuff_tables[0]->m_look_up[bit_buf & (TINFL_FAST_LOOKUP_SIZE - 1)]) >= 0)
               code_len = sym2 >> 9;
             else
             {
-              code_len = TINFL_FAST_LOOKUP_BITS; do { sym2 = r->m_tables[0].m_tree[~sym2 + ((bit_buf >> code_len++) & 1)]; } while (sym2 < 0);
+              TINFL_COUNT(treeWalks); code_len = TINFL_FAST_LOOKUP_BITS; do { sym2 = r->m_pHuff_tables[0]->m_tree[~sym2 + ((bit_buf >> code_len++) & 1)]; } while (sym2 < 0);
             }
             counter = sym2; bit_buf >>= code_len; num_bits -= code_len;
             if (counter & 256)
@@ -384,11 +527,11 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
 #if !TINFL_USE_64BIT_BITBUF
             if (num_bits < 15) { bit_buf |= (((tinfl_bit_buf_t)MZ_READ_LE16(pIn_buf_cur)) << num_bits); pIn_buf_cur += 2; num_bits += 16; }
 #endif
-            if ((sym2 = r->m_tables[0].m_look_up[bit_buf & (TINFL_FAST_LOOKUP_SIZE - 1)]) >= 0)
+            if ((sym2 = r->m_pHuff_tables[0]->m_look_up[bit_buf & (TINFL_FAST_LOOKUP_SIZE - 1)]) >= 0)
               code_len = sym2 >> 9;
             else
             {
-              code_len = TINFL_FAST_LOOKUP_BITS; do { sym2 = r->m_tables[0].m_tree[~sym2 + ((bit_buf >> code_len++) & 1)]; } while (sym2 < 0);
+              TINFL_COUNT(treeWalks); code_len = TINFL_FAST_LOOKUP_BITS; do { sym2 = r->m_pHuff_tables[0]->m_tree[~sym2 + ((bit_buf >> code_len++) & 1)]; } while (sym2 < 0);
             }
             bit_buf >>= code_len; num_bits -= code_len;
 
@@ -405,11 +548,14 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
         }
         if ((counter &= 511) == 256) break;
 
-        num_extra = s_length_extra[counter - 257]; counter = s_length_base[counter - 257];
+        if ((counter == 285) && (decomp_flags & TINFL_FLAG_DEFLATE64)) { num_extra = 16; counter = 3; }
+        else { num_extra = s_length_extra[counter - 257]; counter = s_length_base[counter - 257]; }
         if (num_extra) { mz_uint extra_bits; TINFL_GET_BITS(25, extra_bits, num_extra); counter += extra_bits; }
+        TINFL_COUNT_MATCH(counter);
 
-        TINFL_HUFF_DECODE(26, dist, &r->m_tables[1]);
-        num_extra = s_dist_extra[dist]; dist = s_dist_base[dist];
+        TINFL_HUFF_DECODE(26, dist, r->m_pHuff_tables[1]);
+        if ((dist >= 30) && (decomp_flags & TINFL_FLAG_DEFLATE64)) { num_extra = 14; dist = (dist == 30) ? 32769 : 49153; }
+        else { num_extra = s_dist_extra[dist]; dist = s_dist_base[dist]; }
         if (num_extra) { mz_uint extra_bits; TINFL_GET_BITS(27, extra_bits, num_extra); dist += extra_bits; }
 
         dist_from_out_buf_start = pOut_buf_cur - pOut_buf_start;
@@ -468,6 +614,10 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
         }
       }
     }
+    if ((decomp_flags & TINFL_FLAG_STOP_AT_BLOCK_BOUNDARY) && !(r->m_final & 1))
+    {
+      TINFL_CR_RETURN(54, TINFL_STATUS_BLOCK_BOUNDARY);
+    }
   } while (!(r->m_final & 1));
   if (decomp_flags & TINFL_FLAG_PARSE_ZLIB_HEADER)
   {
@@ -477,6 +627,13 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
   TINFL_CR_FINISH
 
 common_exit:
+  // Put back any whole bytes the bit buffer has looked ahead, so callers know exactly where the deflate stream ends (e.g. a ZIP data descriptor follows it).
+  // Never do this when more input is needed, the bytes are required to make progress.
+  if (status != TINFL_STATUS_NEEDS_MORE_INPUT)
+  {
+    while ((pIn_buf_cur > pIn_buf_next) && (num_bits >= 8)) { --pIn_buf_cur; num_bits -= 8; }
+    bit_buf &= (tinfl_bit_buf_t)((((mz_uint64)1) << num_bits) - (mz_uint64)1);
+  }
   r->m_num_bits = num_bits; r->m_bit_buf = bit_buf; r->m_dist = dist; r->m_counter = counter; r->m_num_extra = num_extra; r->m_dist_from_out_buf_start = dist_from_out_buf_start;
   *pIn_buf_size = pIn_buf_cur - pIn_buf_next; *pOut_buf_size = pOut_buf_cur - pOut_buf_next;
   if ((decomp_flags & (TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_COMPUTE_ADLER32)) && (status >= 0))
@@ -0,0 +1,103 @@
+#include "stdafx.h"
+
+#define TINFL_HEADER_FILE_ONLY
+#include "tinfl.c"
+
+#include "zipformat.h"
+#include "inflatecontextpool.h"
+#include "tinflcodec.h"
+
+using namespace doo::zip;
+
+TinflCodec::TinflCodec(uint16 method)
+  : method(method)
+{
+}
+
+uint16 TinflCodec::GetMethod() const {
+  return method;
+}
+
+const char* TinflCodec::GetName() const {
+  return "tinfl";
+}
+
+/************************************************************************/
+/* Inflate straight into the target buffer. The decompressor and the    */
+/* buffer for the compressed data are borrowed from the pool and read   */
+/* in large blocks.                                                     */
+/************************************************************************/
+void TinflCodec::Decompress(const RandomAccessFile& file, uint64 offset, uint64 compressedSize,
+  byte* buffer, size_t uncompressedSize, uint16) const
+{
+  InflateContextPool::Lease context(InflateContextPool::Shared());
+  tinfl_decompressor* decompressor = context->decompressor.get();
+  std::vector<byte>& input = context->input;
+  tinfl_init(decompressor);
+
+  mz_uint32 baseFlags = TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF;
+  if (method == ZipArchive_METHOD_DEFLATE64) {
+    baseFlags |= TINFL_FLAG_DEFLATE64;
+  }
+
+  uint64 remaining = compressedSize;
+  size_t inputStart = 0;
+  size_t inputEnd = 0;
+  size_t written = 0;
+  for (;;) {
+    if (inputStart == inputEnd && remaining > 0) {
+      inputStart = 0;
+      inputEnd = static_cast<size_t>(std::min<uint64>(input.size(), remaining));
+      file.ReadAt(offset, input.data(), inputEnd);
+      offset += inputEnd;
+      remaining -= inputEnd;
+    }
+
+    size_t inputSize = inputEnd - inputStart;
+    size_t outputSize = uncompressedSize - written;
+    tinfl_status status = tinfl_decompress(decompressor,
+      input.data() + inputStart, &inputSize,
+      buffer, buffer + written, &outputSize,
+      baseFlags | (remaining > 0 ? TINFL_FLAG_HAS_MORE_INPUT : 0));
+    inputStart += inputSize;
+    written += outputSize;
+
+    if (status == TINFL_STATUS_DONE) {
+      break;
+    }
+    // more output than the directory announced also ends up here
+    if (status != TINFL_STATUS_NEEDS_MORE_INPUT || remaining == 0) {
+      throw ref new Platform::FailureException(L"Could not extract data");
+    }
+  }
+
+  if (written != uncompressedSize) {
+    throw ref new Platform::FailureException(L"Could not extract data");
+  }
+}
+
+bool TinflCodec::CanDecompressBuffer() const {
+  return true;
+}
+
+/************************************************************************/
+/* All input is there, a single call inflates the whole entry           */
+/************************************************************************/
+void TinflCodec::DecompressBuffer(const byte* input, size_t compressedSize,
+  byte* buffer, size_t uncompressedSize, uint16) const
+{
+  InflateContextPool::Lease context(InflateContextPool::Shared());
+  tinfl_decompressor* decompressor = context->decompressor.get();
+  tinfl_init(decompressor);
+
+  mz_uint32 flags = TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF;
+  if (method == ZipArchive_METHOD_DEFLATE64) {
+    flags |= TINFL_FLAG_DEFLATE64;
+  }
+  size_t inputSize = compressedSize;
+  size_t outputSize = uncompressedSize;
+  tinfl_status status = tinfl_decompress(decompressor, input, &inputSize, buffer, buffer, &outputSize, flags);
+  if (status != TINFL_STATUS_DONE || outputSize != uncompressedSize) {
+    throw ref new Platform::FailureException(L"Could not extract data");
+  }
+}
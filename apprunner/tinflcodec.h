@@ -0,0 +1,26 @@
+#pragma once
+
+#include "codec.h"
+
+namespace doo {
+  namespace zip {
+    // deflate and Deflate64 through the bundled tinfl, always available.
+    // Decompressors are borrowed from the shared InflateContextPool.
+    class TinflCodec : public Codec {
+    public:
+      // method is either ZipArchive_METHOD_DEFLATE or ZipArchive_METHOD_DEFLATE64
+      TinflCodec(uint16 method);
+
+      virtual uint16 GetMethod() const;
+      virtual const char* GetName() const;
+      virtual void Decompress(const RandomAccessFile& file, uint64 offset, uint64 compressedSize,
+        byte* buffer, size_t uncompressedSize, uint16 flags) const;
+      virtual bool CanDecompressBuffer() const;
+      virtual void DecompressBuffer(const byte* input, size_t compressedSize,
+        byte* buffer, size_t uncompressedSize, uint16 flags) const;
+
+    private:
+      uint16 method;
+    };
+  }
+}
@@ -0,0 +1,246 @@
+#include "stdafx.h"
+
+#include "transcode.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define Transcode_SSE2 1
+#endif
+
+// what broken input is replaced with
+#define Transcode_REPLACEMENT 0xFFFD
+// returned by decodeUtf8() for an invalid sequence
+#define Transcode_INVALID 0xFFFFFFFF
+
+using namespace doo::text;
+
+/************************************************************************/
+/* Decode the sequence at position and move past it. An invalid         */
+/* sequence only skips its first byte, so every broken byte is replaced */
+/************************************************************************/
+static uint32 decodeUtf8(const byte* input, size_t length, size_t& position) {
+  uint32 lead = input[position];
+  if (lead < 0x80) {
+    position++;
+    return lead;
+  }
+  size_t continuationCount;
+  uint32 codePoint;
+  uint32 minimum;
+  if ((lead & 0xE0) == 0xC0) {
+    continuationCount = 1;
+    codePoint = lead & 0x1F;
+    minimum = 0x80;
+  } else if ((lead & 0xF0) == 0xE0) {
+    continuationCount = 2;
+    codePoint = lead & 0x0F;
+    minimum = 0x800;
+  } else if ((lead & 0xF8) == 0xF0) {
+    continuationCount = 3;
+    codePoint = lead & 0x07;
+    minimum = 0x10000;
+  } else {
+    position++;
+    return Transcode_INVALID;
+  }
+  if (length - position - 1 < continuationCount) {
+    position++;
+    return Transcode_INVALID;
+  }
+  for (size_t i = 1; i <= continuationCount; i++) {
+    uint32 continuation = input[position + i];
+    if ((continuation & 0xC0) != 0x80) {
+      position++;
+      return Transcode_INVALID;
+    }
+    codePoint = (codePoint << 6) | (continuation & 0x3F);
+  }
+  // overlong forms, surrogates and anything beyond Unicode are not allowed in UTF-8
+  if (codePoint < minimum || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF)) {
+    position++;
+    return Transcode_INVALID;
+  }
+  position += continuationCount + 1;
+  return codePoint;
+}
+
+/************************************************************************/
+/* Decode the unit or surrogate pair at position and move past it,      */
+/* unpaired surrogates come out as the replacement character            */
+/************************************************************************/
+static uint32 decodeUtf16(const utf16unit* input, size_t length, size_t& position) {
+  uint32 unit = input[position++];
+  if (unit < 0xD800 || unit > 0xDFFF) {
+    return unit;
+  }
+  if (unit <= 0xDBFF && position < length && input[position] >= 0xDC00 && input[position] <= 0xDFFF) {
+    return 0x10000 + ((unit - 0xD800) << 10) + (input[position++] - 0xDC00);
+  }
+  return Transcode_REPLACEMENT;
+}
+
+static size_t utf8SequenceLength(uint32 codePoint) {
+  return codePoint < 0x80 ? 1 : codePoint < 0x800 ? 2 : codePoint < 0x10000 ? 3 : 4;
+}
+
+// the number of leading bytes below 0x80, checked 16 at a time
+static size_t asciiPrefix(const byte* input, size_t length) {
+  size_t position = 0;
+#ifdef Transcode_SSE2
+  for (; length - position >= 16; position += 16) {
+    if (_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + position))) != 0) {
+      break;
+    }
+  }
+#endif
+  while (position < length && input[position] < 0x80) {
+    position++;
+  }
+  return position;
+}
+
+// the number of leading units below 0x80
+static size_t asciiPrefix(const utf16unit* input, size_t length) {
+  size_t position = 0;
+#ifdef Transcode_SSE2
+  const __m128i nonAscii = _mm_set1_epi16(static_cast<short>(0xFF80));
+  for (; length - position >= 8; position += 8) {
+    __m128i units = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + position)), nonAscii);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(units, _mm_setzero_si128())) != 0xFFFF) {
+      break;
+    }
+  }
+#endif
+  while (position < length && input[position] < 0x80) {
+    position++;
+  }
+  return position;
+}
+
+size_t doo::text::Utf16Length(const char* text, size_t length) {
+  const byte* input = reinterpret_cast<const byte*>(text);
+  size_t result = 0;
+  size_t position = 0;
+  while (position < length) {
+    size_t ascii = asciiPrefix(input + position, length - position);
+    position += ascii;
+    result += ascii;
+    if (position < length) {
+      uint32 codePoint = decodeUtf8(input, length, position);
+      result += codePoint != Transcode_INVALID && codePoint >= 0x10000 ? 2 : 1;
+    }
+  }
+  return result;
+}
+
+size_t doo::text::Utf8Length(const utf16unit* input, size_t length) {
+  size_t result = 0;
+  size_t position = 0;
+  while (position < length) {
+    size_t ascii = asciiPrefix(input + position, length - position);
+    position += ascii;
+    result += ascii;
+    if (position < length) {
+      result += utf8SequenceLength(decodeUtf16(input, length, position));
+    }
+  }
+  return result;
+}
+
+bool doo::text::IsValidUtf8(const char* text, size_t length) {
+  const byte* input = reinterpret_cast<const byte*>(text);
+  size_t position = 0;
+  while (position < length) {
+    position += asciiPrefix(input + position, length - position);
+    if (position < length && decodeUtf8(input, length, position) == Transcode_INVALID) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/************************************************************************/
+/* ASCII is widened 16 bytes at a time, everything else goes through    */
+/* the scalar decoder one sequence at a time                            */
+/************************************************************************/
+size_t doo::text::Utf8ToUtf16(const char* text, size_t length, utf16unit* output) {
+  const byte* input = reinterpret_cast<const byte*>(text);
+  size_t written = 0;
+  size_t position = 0;
+  while (position < length) {
+#ifdef Transcode_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; length - position >= 16; position += 16, written += 16) {
+      __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + position));
+      if (_mm_movemask_epi8(bytes) != 0) {
+        break;
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(output + written), _mm_unpacklo_epi8(bytes, zero));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(output + written + 8), _mm_unpackhi_epi8(bytes, zero));
+    }
+#endif
+    for (; position < length && input[position] < 0x80; position++) {
+      output[written++] = input[position];
+    }
+    if (position == length) {
+      break;
+    }
+
+    uint32 codePoint = decodeUtf8(input, length, position);
+    if (codePoint == Transcode_INVALID) {
+      output[written++] = Transcode_REPLACEMENT;
+    } else if (codePoint >= 0x10000) {
+      codePoint -= 0x10000;
+      output[written++] = static_cast<utf16unit>(0xD800 + (codePoint >> 10));
+      output[written++] = static_cast<utf16unit>(0xDC00 + (codePoint & 0x3FF));
+    } else {
+      output[written++] = static_cast<utf16unit>(codePoint);
+    }
+  }
+  return written;
+}
+
+/************************************************************************/
+/* ASCII is narrowed 16 units at a time, everything else goes through   */
+/* the scalar encoder one code point at a time                          */
+/************************************************************************/
+size_t doo::text::Utf16ToUtf8(const utf16unit* input, size_t length, char* text) {
+  byte* output = reinterpret_cast<byte*>(text);
+  size_t written = 0;
+  size_t position = 0;
+  while (position < length) {
+#ifdef Transcode_SSE2
+    const __m128i nonAscii = _mm_set1_epi16(static_cast<short>(0xFF80));
+    for (; length - position >= 16; position += 16, written += 16) {
+      __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + position));
+      __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + position + 8));
+      __m128i outside = _mm_and_si128(_mm_or_si128(low, high), nonAscii);
+      if (_mm_movemask_epi8(_mm_cmpeq_epi16(outside, _mm_setzero_si128())) != 0xFFFF) {
+        break;
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(output + written), _mm_packus_epi16(low, high));
+    }
+#endif
+    for (; position < length && input[position] < 0x80; position++) {
+      output[written++] = static_cast<byte>(input[position]);
+    }
+    if (position == length) {
+      break;
+    }
+
+    uint32 codePoint = decodeUtf16(input, length, position);
+    if (codePoint < 0x800) {
+      output[written++] = static_cast<byte>(0xC0 | (codePoint >> 6));
+    } else {
+      if (codePoint < 0x10000) {
+        output[written++] = static_cast<byte>(0xE0 | (codePoint >> 12));
+      } else {
+        output[written++] = static_cast<byte>(0xF0 | (codePoint >> 18));
+        output[written++] = static_cast<byte>(0x80 | ((codePoint >> 12) & 0x3F));
+      }
+      output[written++] = static_cast<byte>(0x80 | ((codePoint >> 6) & 0x3F));
+    }
+    output[written++] = static_cast<byte>(0x80 | (codePoint & 0x3F));
+  }
+  return written;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <memory>
+
+namespace doo {
+  namespace text {
+    // UTF-16 code units, the same size as wchar_t on Windows
+    typedef uint16 utf16unit;
+
+    // Conversions between UTF-8 and UTF-16 in a single pass into a buffer supplied by the caller.
+    // Runs of ASCII are converted 16 characters at a time with SSE2 where available. Invalid input
+    // never fails: every byte of a broken UTF-8 sequence and every unpaired surrogate becomes
+    // U+FFFD, like MultiByteToWideChar and WideCharToMultiByte without flags do.
+
+    // the most UTF-16 units length bytes of UTF-8 can turn into
+    inline size_t MaximumUtf16Length(size_t utf8Length) {
+      return utf8Length;
+    }
+    // the most UTF-8 bytes length UTF-16 units can turn into
+    inline size_t MaximumUtf8Length(size_t utf16Length) {
+      return 3 * utf16Length;
+    }
+
+    // the exact output length, for callers that want to allocate precisely before converting
+    size_t Utf16Length(const char* input, size_t length);
+    size_t Utf8Length(const utf16unit* input, size_t length);
+
+    // true if the input contains no invalid sequences
+    bool IsValidUtf8(const char* input, size_t length);
+
+    // output has to hold MaximumUtf16Length(length) units, returns the number written
+    size_t Utf8ToUtf16(const char* input, size_t length, utf16unit* output);
+    // output has to hold MaximumUtf8Length(length) bytes, returns the number written
+    size_t Utf16ToUtf8(const utf16unit* input, size_t length, char* output);
+
+    // Output storage for a conversion: inline for up to Capacity elements, on the heap beyond that.
+    // Short strings, which is almost all of them, are converted without any allocation.
+    template <typename T, size_t Capacity>
+    class SmallBuffer {
+    public:
+      SmallBuffer(size_t size) {
+        if (size > Capacity) {
+          heap.reset(new T[size]);
+        }
+      }
+
+      T* data() {
+        return heap ? heap.get() : storage;
+      }
+
+    private:
+      SmallBuffer(const SmallBuffer&);
+      SmallBuffer& operator=(const SmallBuffer&);
+
+      T storage[Capacity];
+      std::unique_ptr<T[]> heap;
+    };
+  }
+}
@@ -1,169 +1,774 @@
 ﻿#include "stdafx.h"
 
-#include <fstream>
-#include <streambuf>
-
-#include "tinfl.c"
-
+#include "AllocationTracker.h"
+#include "batchreader.h"
+#include "codec.h"
+#include "crc32.h"
 #include "ziparchive.h"
+#include "zipcounters.h"
 
-using namespace doo::zip;
-
-// the expected signatures for different parts of a ZIP file
-#define ZipArchive_ENTRY_LOCAL_HEADER_SIGNATURE 0x04034b50
-#define ZipArchive_CENTRAL_DIRECTORY_RECORD_SIGNATURE 0x02014b50
-#define ZipArchive_END_OF_CENTRAL_RECORD_SIGNATURE 0x06054b50
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define ZipArchive_SSE2 1
+#endif
 
+using namespace doo::zip;
 
 /************************************************************************/
-/* Instantiate a ZipArchiveEntry from a stream positioned at the central   */
-/* directory record for a file. Will leave the stream positioned at     */
-/* the beginning of the next record.                                    */
+/* Every signature starts with "PK". Returns the first position holding */
+/* it, or length if there is none                                       */
 /************************************************************************/
-ZipArchive::ZipArchiveEntry::ZipArchiveEntry(std::ifstream& input) 
-  : inputStream(input) 
-{
-  input.read(reinterpret_cast<char *>(&centralDirectoryHeader), sizeof(ZipArchiveEntry::CentralDirectoryHeader));
+static size_t findMarker(const byte* data, size_t length) {
+  size_t position = 0;
+#ifdef ZipArchive_SSE2
+  const __m128i p = _mm_set1_epi8('P');
+  const __m128i k = _mm_set1_epi8('K');
+  for (; length - position >= 17; position += 16) {
+    __m128i first = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + position)), p);
+    __m128i second = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + position + 1)), k);
+    int mask = _mm_movemask_epi8(_mm_and_si128(first, second));
+    if (mask != 0) {
+      int bit = 0;
+      while ((mask & (1 << bit)) == 0) {
+        bit++;
+      }
+      return position + bit;
+    }
+  }
+#endif
+  while (length - position >= 2) {
+    const byte* found = static_cast<const byte*>(memchr(data + position, 'P', length - position - 1));
+    if (found == nullptr) {
+      break;
+    }
+    position = found - data;
+    if (data[position + 1] == 'K') {
+      return position;
+    }
+    position++;
+  }
+  return length;
+}
 
-  if (centralDirectoryHeader.signature != ZipArchive_CENTRAL_DIRECTORY_RECORD_SIGNATURE) {
-    throw ref new Platform::FailureException(L"Invalid ZIP file entry header");
+/************************************************************************/
+/* The last position holding "PK", or length if there is none           */
+/************************************************************************/
+static size_t findMarkerBackward(const byte* data, size_t length) {
+  size_t end = length;
+#ifdef ZipArchive_SSE2
+  const __m128i p = _mm_set1_epi8('P');
+  const __m128i k = _mm_set1_epi8('K');
+  for (; end >= 17; end -= 16) {
+    const byte* block = data + end - 17;
+    __m128i first = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block)), p);
+    __m128i second = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 1)), k);
+    int mask = _mm_movemask_epi8(_mm_and_si128(first, second));
+    if (mask != 0) {
+      int bit = 15;
+      while ((mask & (1 << bit)) == 0) {
+        bit--;
+      }
+      return end - 17 + bit;
+    }
   }
+#endif
+  for (; end >= 2; end--) {
+    if (data[end - 2] == 'P' && data[end - 1] == 'K') {
+      return end - 2;
+    }
+  }
+  return length;
+}
 
-  filename.reserve(centralDirectoryHeader.filenameLength);
-  std::copy_n((std::istreambuf_iterator<char>(input)), centralDirectoryHeader.filenameLength, std::back_inserter(filename));
+static bool hasZip64ExtraField(const byte* extraField, size_t length) {
+  ExtraFieldHeader header;
+  for (size_t position = 0; length - position >= sizeof(header); position += sizeof(header) + header.size) {
+    memcpy(&header, extraField + position, sizeof(header));
+    if (header.id == ZipArchive_ZIP64_EXTRA_FIELD) {
+      return true;
+    }
+    if (header.size > length - position - sizeof(header)) {
+      break;
+    }
+  }
+  return false;
+}
 
-  fpos_t afterCentralDirectory = input.tellg();
-  input.seekg(centralDirectoryHeader.localHeaderOffset, std::ios_base::beg);
 
-  ReadAndCheckLocalHeader();
-  
-  contentStreamStart = centralDirectoryHeader.localHeaderOffset +
-    + sizeof(LocalFileHeader) 
-    + localHeader.filenameLength 
-    + localHeader.extraFieldLength;
+/************************************************************************/
+/* Read the local header and check it against the central directory.    */
+/* The data follows the local header's name and extra field. Both have  */
+/* to lie within the window, a nested archive never reads the outer one */
+/************************************************************************/
+uint64 ZipArchive::GetContentOffset(size_t index) const {
+  // known from the sidecar index
+  uint64 dataOffset = entries.GetDataOffset(index);
+  if (dataOffset == 0) {
+    uint64 localHeaderOffset = entries.GetLocalHeaderOffset(index);
+    uint16 filenameLength = entries.GetNameLength(index);
+    if (localHeaderOffset > archiveSize || archiveSize - localHeaderOffset < sizeof(LocalFileHeader) + filenameLength) {
+      throw ref new Platform::FailureException(L"Invalid local header");
+    }
 
-  // make sure the stream is ready to read the next header
-  input.seekg(afterCentralDirectory + 1 + centralDirectoryHeader.extraFieldLength, std::ios_base::beg);
+    // header and name are read together, short names don't need the heap
+    byte stackBuffer[sizeof(LocalFileHeader) + 256];
+    std::vector<byte> heapBuffer;
+    byte* headerBuffer = stackBuffer;
+    if (filenameLength > sizeof(stackBuffer) - sizeof(LocalFileHeader)) {
+      heapBuffer.resize(sizeof(LocalFileHeader) + filenameLength);
+      headerBuffer = heapBuffer.data();
+    }
+    file->ReadAt(archiveOffset + localHeaderOffset, headerBuffer, sizeof(LocalFileHeader) + filenameLength);
+    dataOffset = localHeaderOffset + CheckLocalHeader(index, headerBuffer);
+  }
+  if (dataOffset > archiveSize || entries.GetCompressedSize(index) > archiveSize - dataOffset) {
+    throw ref new Platform::FailureException(L"Entry data is outside of the archive");
+  }
+  return archiveOffset + dataOffset;
 }
 
 /************************************************************************/
-/* Read the local header and check it against the central directory     */
+/* header holds the local header followed by the name, returns how far  */
+/* the data is from the start of the header                             */
 /************************************************************************/
-void ZipArchive::ZipArchiveEntry::ReadAndCheckLocalHeader() {
-  inputStream.read(reinterpret_cast<char*>(&localHeader), sizeof(localHeader));
+uint64 ZipArchive::CheckLocalHeader(size_t index, const byte* header) const {
+  LocalFileHeader localHeader;
+  memcpy(&localHeader, header, sizeof(localHeader));
   if (localHeader.signature != ZipArchive_ENTRY_LOCAL_HEADER_SIGNATURE) {
     throw ref new Platform::FailureException(L"Invalid local header");
   }
-  std::string localFilename;
-  localFilename.reserve(localHeader.filenameLength);
-  std::copy_n((std::istreambuf_iterator<char>(inputStream)), localHeader.filenameLength, std::back_inserter(localFilename));
-  if (strcmp(localFilename.c_str(), filename.c_str()) != 0) {
+  uint16 filenameLength = entries.GetNameLength(index);
+  if (localHeader.filenameLength != filenameLength 
+    || memcmp(header + sizeof(LocalFileHeader), entries.GetNameData(index), filenameLength) != 0) {
     throw ref new Platform::FailureException(L"Filename in local header does not match");
   }
+
+  return sizeof(LocalFileHeader) 
+    + localHeader.filenameLength 
+    + localHeader.extraFieldLength;
 }
 
 /************************************************************************/
-/* The file isn't compressed, just pass it through from the stream      */
-/* If maxBufSize is larger 0, the buffer size will be limitied          */
+/* The codec for the entry's method does the work                       */
 /************************************************************************/
-std::vector<byte> ZipArchive::ZipArchiveEntry::UncompressedFromStream() {
-  uint32 bytesToRead = centralDirectoryHeader.compressedSize;
-  std::vector<byte> result;
-  result.reserve(centralDirectoryHeader.compressedSize);
-  std::copy_n((std::istreambuf_iterator<char>(inputStream)), centralDirectoryHeader.compressedSize, std::back_inserter(result));
-  return result;
+size_t ZipArchive::ExtractTo(size_t index, byte* buffer, size_t bufferSize) const {
+  AllocationTracker_COMPONENT("zip.extract");
+  uint64 size = entries.GetUncompressedSize(index);
+  if (bufferSize < size) {
+    throw ref new Platform::InvalidArgumentException(L"Buffer is too small for the file");
+  }
+  std::shared_ptr<Codec> codec = CodecRegistry::Shared().Find(entries.GetCompressionMethod(index));
+  if (!codec) {
+    throw ref new Platform::FailureException(L"Compression algorithm not supported");
+  }
+  // bufferSize bounds the size, so it fits a size_t from here on
+  codec->Decompress(*file, GetContentOffset(index), entries.GetCompressedSize(index), buffer, static_cast<size_t>(size), entries.GetFlags(index));
+  ZipCounters_COUNT(entriesExtracted);
+  ZipCounters_ADD(bytesExtracted, size);
+  return static_cast<size_t>(size);
+}
+
+size_t ZipArchive::ExtractTo(const std::string& filename, byte* buffer, size_t bufferSize) const {
+  return ExtractTo(FindEntry(filename), buffer, bufferSize);
+}
+
+bool ZipArchive::CanStream(uint16 compressionMethod) {
+  return compressionMethod == ZipArchive_METHOD_STORED || compressionMethod == ZipArchive_METHOD_DEFLATE
+    || compressionMethod == ZipArchive_METHOD_DEFLATE64;
 }
 
 /************************************************************************/
-/* Decompress a file compressed using the DEFLATE algorithm             */
+/* Read the compressed data in chunks and pass on whatever comes out,   */
+/* only the read buffer and the inflate dictionary are ever allocated   */
 /************************************************************************/
-std::vector<byte> ZipArchive::ZipArchiveEntry::DeflateFromStream() {
-  auto compressedBuffer = UncompressedFromStream();
-  // allocate buffer for decompression
-  std::vector<byte> decompressedData;
-  decompressedData.resize(centralDirectoryHeader.uncompressedSize);
-
-  auto decompressionResult = tinfl_decompress_mem_to_mem(
-    decompressedData.data(),
-    centralDirectoryHeader.uncompressedSize, 
-    compressedBuffer.data(), 
-    centralDirectoryHeader.compressedSize, 
-    0);
+void ZipArchive::ExtractStreaming(size_t index, const InflateStream::OutputCallback& output) const {
+  AllocationTracker_COMPONENT("zip.extract");
+  uint16 method = entries.GetCompressionMethod(index);
+  if (!CanStream(method)) {
+    throw ref new Platform::FailureException(L"Compression algorithm not supported");
+  }
+  uint64 offset = GetContentOffset(index);
+  uint64 remaining = entries.GetCompressedSize(index);
+  uint64 size = entries.GetUncompressedSize(index);
+  if (method == ZipArchive_METHOD_STORED && remaining != size) {
+    throw ref new Platform::FailureException(L"Could not extract data");
+  }
 
-  if (decompressionResult != centralDirectoryHeader.uncompressedSize) {
+  std::vector<byte> input(static_cast<size_t>(std::min<uint64>(remaining, ZipArchive_STREAM_CHUNK)));
+  std::unique_ptr<InflateStream> inflater;
+  if (method != ZipArchive_METHOD_STORED) {
+    inflater.reset(new InflateStream(method == ZipArchive_METHOD_DEFLATE64));
+  }
+  uint64 written = 0;
+  InflateStream::OutputCallback checkedOutput = [&](const byte* data, size_t length) {
+    // more output than the directory announced
+    if (length > size - written) {
+      throw ref new Platform::FailureException(L"Could not extract data");
+    }
+    written += length;
+    output(data, length);
+  };
+  while (remaining > 0 && !(inflater && inflater->IsFinished())) {
+    size_t chunk = static_cast<size_t>(std::min<uint64>(input.size(), remaining));
+    file->ReadAt(offset, input.data(), chunk);
+    offset += chunk;
+    remaining -= chunk;
+    if (inflater) {
+      inflater->Inflate(input.data(), chunk, remaining > 0, checkedOutput);
+    } else {
+      checkedOutput(input.data(), chunk);
+    }
+  }
+  if (written != size || (inflater && !inflater->IsFinished())) {
     throw ref new Platform::FailureException(L"Could not extract data");
   }
+}
 
-  return decompressedData;
+/************************************************************************/
+/* Entries whose codec can work from memory are read in one request     */
+/* each, together with their local header unless the sidecar says where */
+/* the data starts. Local extra fields are usually as long as the ones  */
+/* in the directory, some slack covers the rest and a longer one costs  */
+/* another read. Entries go to the same places in buffer as if they had */
+/* been extracted one after the other.                                  */
+/************************************************************************/
+void ZipArchive::ExtractBatch(const std::vector<size_t>& indices, byte* buffer, size_t bufferSize,
+  unsigned queueDepth, const BatchOutputCallback& output) const
+{
+  AllocationTracker_COMPONENT("zip.extract");
+  std::vector<BatchReader::Request> requests;
+  std::vector<size_t> positions(indices.size());
+  std::vector<std::shared_ptr<Codec>> codecs(indices.size());
+  uint64 position = 0;
+  for (size_t i = 0; i < indices.size(); i++) {
+    size_t index = indices[i];
+    if (index >= entries.GetCount()) {
+      throw ref new Platform::InvalidArgumentException(L"No such entry");
+    }
+    uint64 size = entries.GetUncompressedSize(index);
+    if (size > bufferSize - position) {
+      throw ref new Platform::InvalidArgumentException(L"Buffer is too small for the files");
+    }
+    positions[i] = static_cast<size_t>(position);
+    position += size;
+    codecs[i] = CodecRegistry::Shared().Find(entries.GetCompressionMethod(index));
+    if (!codecs[i]) {
+      throw ref new Platform::FailureException(L"Compression algorithm not supported");
+    }
+    if (!codecs[i]->CanDecompressBuffer() || static_cast<size_t>(entries.GetCompressedSize(index)) != entries.GetCompressedSize(index)) {
+      continue;
+    }
+    BatchReader::Request request;
+    request.tag = i;
+    uint64 start;
+    uint64 length = entries.GetCompressedSize(index);
+    if (entries.GetDataOffset(index) != 0) {
+      start = archiveOffset + entries.GetDataOffset(index);
+    } else {
+      start = archiveOffset + entries.GetLocalHeaderOffset(index);
+      length += sizeof(LocalFileHeader) + entries.GetNameLength(index) + ZipArchive_LOCAL_EXTRA_SLACK;
+    }
+    uint64 archiveEnd = archiveOffset + archiveSize;
+    if (start > archiveEnd) {
+      throw ref new Platform::FailureException(L"Invalid local header");
+    }
+    request.offset = start;
+    request.length = static_cast<size_t>(std::min(length, archiveEnd - start));
+    requests.push_back(request);
+  }
+
+  std::vector<bool> done(indices.size());
+  BatchReader reader(*file, queueDepth);
+  std::vector<byte> overflow;
+  reader.Read(requests, [&](const BatchReader::Request& request, const byte* data) {
+    size_t index = indices[request.tag];
+    uint64 compressedSize = entries.GetCompressedSize(index);
+    size_t size = static_cast<size_t>(entries.GetUncompressedSize(index));
+    const byte* compressed = data;
+    if (entries.GetDataOffset(index) == 0) {
+      if (request.length < sizeof(LocalFileHeader) + entries.GetNameLength(index)) {
+        throw ref new Platform::FailureException(L"Invalid local header");
+      }
+      uint64 headerSize = CheckLocalHeader(index, data);
+      compressed += headerSize;
+      if (headerSize + compressedSize > archiveOffset + archiveSize - request.offset) {
+        // the data would run past the end of the archive
+        throw ref new Platform::FailureException(L"Entry data is outside of the archive");
+      }
+      if (headerSize + compressedSize > request.length) {
+        overflow.resize(static_cast<size_t>(compressedSize));
+        file->ReadAt(request.offset + headerSize, overflow.data(), overflow.size());
+        compressed = overflow.data();
+      }
+    } else if (compressedSize > request.length) {
+      // the data would run past the end of the archive
+      throw ref new Platform::FailureException(L"Invalid local header");
+    }
+    codecs[request.tag]->DecompressBuffer(compressed, static_cast<size_t>(compressedSize), buffer + positions[request.tag], size, entries.GetFlags(index));
+    ZipCounters_COUNT(entriesExtracted);
+    ZipCounters_ADD(bytesExtracted, size);
+    done[request.tag] = true;
+    output(index, buffer + positions[request.tag], size);
+  });
+
+  // the rest is read by their codecs
+  for (size_t i = 0; i < indices.size(); i++) {
+    if (!done[i]) {
+      size_t length = ExtractTo(indices[i], buffer + positions[i], bufferSize - positions[i]);
+      output(indices[i], buffer + positions[i], length);
+    }
+  }
 }
 
-std::vector<byte> ZipArchive::ZipArchiveEntry::GetUncompressedFileContents() {
-  inputStream.seekg(contentStreamStart, std::ios_base::beg);
-  switch (centralDirectoryHeader.compressionMethod) {
-  case 0:  // file is uncompressed
-    return UncompressedFromStream();
-  case 8: // deflate
-    return DeflateFromStream();
-  default:
-    throw ref new Platform::FailureException(L"Compression algorithm not supported: " + 
-      centralDirectoryHeader.compressionMethod);
+std::vector<byte> ZipArchive::GetFileContents(size_t index) const {
+  AllocationTracker_COMPONENT("zip.extract");
+  uint64 size = entries.GetUncompressedSize(index);
+  if (static_cast<size_t>(size) != size) {
+    throw ref new Platform::OutOfMemoryException(L"File is too large to be extracted into memory");
   }
+  std::vector<byte> result(static_cast<size_t>(size));
+  ExtractTo(index, result.data(), result.size());
+  return result;
 }
 
 /************************************************************************/
 /* Instantiate the ZipArchive and read its directory of contents        */
 /************************************************************************/
-ZipArchive::ZipArchive(const std::string& filename) {
-  
-  fileStream = std::ifstream(filename, std::ios::binary | std::ios::in | std::ios::ate);
+ZipArchive::ZipArchive(const std::string& filename, bool useSidecarIndex) 
+  : file(new RandomAccessFile(filename)), archiveOffset(0)
+{
+  archiveSize = file->GetSize();
+  if (useSidecarIndex) {
+    UseSidecarIndex(filename + ZipArchive_SIDECAR_EXTENSION, LocateCentralDirectory());
+  } else {
+    ReadCentralDirectory(LocateCentralDirectory());
+  }
+}
+
+ZipArchive::ZipArchive(std::shared_ptr<RandomAccessFile> archiveFile, uint64 offset, uint64 size, bool salvage)
+  : file(archiveFile), archiveOffset(offset), archiveSize(size)
+{
+  if (salvage) {
+    SalvageDirectory();
+  } else {
+    ReadCentralDirectory(LocateCentralDirectory());
+  }
+}
+
+std::shared_ptr<ZipArchive> ZipArchive::Salvage(const std::string& filename) {
+  std::shared_ptr<RandomAccessFile> file(new RandomAccessFile(filename));
+  return std::shared_ptr<ZipArchive>(new ZipArchive(file, 0, file->GetSize(), true));
+}
+
+/************************************************************************/
+/* Map the sidecar if it belongs to the archive as it is now, otherwise */
+/* parse the directory, find the data of every entry and save both      */
+/************************************************************************/
+void ZipArchive::UseSidecarIndex(const std::string& indexFilename, const DirectoryLocation& location) {
+  AllocationTracker_COMPONENT("zip.directory");
+  ZipEntryTableStamp stamp;
+  stamp.archiveSize = archiveSize;
+  stamp.modificationTime = file->GetModificationTime();
+  stamp.directoryChecksum = location.checksum;
+  try {
+    if (entries.Map(std::make_shared<MappedFile>(indexFilename), stamp)) {
+      return;
+    }
+  } catch (Platform::Exception^) {
+    // there is no sidecar yet
+  }
+
+  ReadCentralDirectory(location);
+  for (size_t index = 0; index < entries.GetCount(); index++) {
+    try {
+      entries.SetDataOffset(index, GetContentOffset(index) - archiveOffset);
+    } catch (Platform::Exception^) {
+      // a broken local header is reported when the entry is extracted, like without a sidecar
+    }
+  }
+
+  // written next to it and moved in place, so a concurrent open never maps half a file
+  std::ostringstream temporaryFilename;
+  temporaryFilename << indexFilename << "." << GetCurrentProcessId() << ".tmp";
+  try {
+    {
+      std::ofstream output(temporaryFilename.str(), std::ios::binary | std::ios::trunc);
+      if (!output) {
+        return;
+      }
+      entries.Save(output, stamp);
+    }
+#ifdef _WIN32
+    if (!MoveFileExA(temporaryFilename.str().c_str(), indexFilename.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+      DeleteFileA(temporaryFilename.str().c_str());
+    }
+#else
+    if (rename(temporaryFilename.str().c_str(), indexFilename.c_str()) != 0) {
+      remove(temporaryFilename.str().c_str());
+    }
+#endif
+  } catch (Platform::Exception^) {
+    remove(temporaryFilename.str().c_str());
+  }
+}
 
-  // the central directory record is located at the end of the file
-  fpos_t fileSize = fileStream.tellg();
-  fileStream.seekg(fileSize-sizeof(ZipArchive::EndOfCentralDirectoryRecord), std::ios_base::beg);
-  EndOfCentralDirectoryRecord endOfCentralDirectoryRecord;
-  fileStream.read(reinterpret_cast<char *>(&endOfCentralDirectoryRecord), sizeof(endOfCentralDirectoryRecord));
-  if (endOfCentralDirectoryRecord.signature != ZipArchive_END_OF_CENTRAL_RECORD_SIGNATURE) {
+/************************************************************************/
+/* Find the directory of contents from the end of the archive window.   */
+/* The end record is followed by a comment and sometimes by padding, so */
+/* all of the last 64KB are searched backwards for it in one read       */
+/************************************************************************/
+ZipArchive::DirectoryLocation ZipArchive::LocateCentralDirectory() const {
+  if (archiveSize < sizeof(EndOfCentralDirectoryRecord)) {
     throw ref new Platform::FailureException("Could not read ZIP file");
   }
+  size_t tailLength = static_cast<size_t>(std::min<uint64>(archiveSize, sizeof(EndOfCentralDirectoryRecord) + ZipArchive_MAX_COMMENT_LENGTH));
+  uint64 tailStart = archiveSize - tailLength;
+  std::vector<byte> tail(tailLength);
+  file->ReadAt(archiveOffset + tailStart, tail.data(), tail.size());
+
+  // the comment may contain a signature as well, the last record that points at a directory wins
+  DirectoryLocation location;
+  size_t end = tailLength - sizeof(EndOfCentralDirectoryRecord) + 2;
+  for (;;) {
+    size_t position = findMarkerBackward(tail.data(), end);
+    if (position == end) {
+      break;
+    }
+    end = position + 1;
+    EndOfCentralDirectoryRecord endOfCentralDirectoryRecord;
+    memcpy(&endOfCentralDirectoryRecord, tail.data() + position, sizeof(endOfCentralDirectoryRecord));
+    if (endOfCentralDirectoryRecord.signature == ZipArchive_END_OF_CENTRAL_RECORD_SIGNATURE
+      && endOfCentralDirectoryRecord.zipFileCommentLength <= tailLength - position - sizeof(endOfCentralDirectoryRecord)
+      && ReadDirectoryLocation(endOfCentralDirectoryRecord, tailStart + position, location)) {
+      return location;
+    }
+  }
+  throw ref new Platform::FailureException("Could not read ZIP file");
+}
 
-  // check if the real data is in the zip64 header
-  uint64 entryCount;
-  fpos_t centralDirectoryStart;
-  if (endOfCentralDirectoryRecord.centralDirectoryOffset != -1) {
-    entryCount = endOfCentralDirectoryRecord.entryCountThisDisk;
-    centralDirectoryStart = endOfCentralDirectoryRecord.centralDirectoryOffset;
+/************************************************************************/
+/* Check if the real data is in the zip64 records, which come right     */
+/* before the end record                                                */
+/************************************************************************/
+bool ZipArchive::ReadDirectoryLocation(const EndOfCentralDirectoryRecord& endOfCentralDirectoryRecord, uint64 recordPosition,
+  DirectoryLocation& location) const
+{
+  location.checksum = UpdateCrc32(0, reinterpret_cast<const byte*>(&endOfCentralDirectoryRecord), sizeof(endOfCentralDirectoryRecord));
+  // any field that overflowed is marked
+  bool zip64 = endOfCentralDirectoryRecord.entryCountThisDisk == 0xFFFF
+    || endOfCentralDirectoryRecord.centralDirectorySize == ZipArchive_ZIP64_MARKER
+    || endOfCentralDirectoryRecord.centralDirectoryOffset == ZipArchive_ZIP64_MARKER;
+  uint64 directoryEnd = recordPosition;
+  if (!zip64) {
+    location.entryCount = endOfCentralDirectoryRecord.entryCountThisDisk;
+    location.start = endOfCentralDirectoryRecord.centralDirectoryOffset;
+    location.size = endOfCentralDirectoryRecord.centralDirectorySize;
   } else {
     Zip64EndOfCentralDirectoryRecordLocator zip64EndOfCentralDirectoryLocator;
-    fileStream.seekg(fileSize-(sizeof(EndOfCentralDirectoryRecord)+sizeof(zip64EndOfCentralDirectoryLocator)), std::ios_base::beg);
-    fileStream.read(reinterpret_cast<char*>(&zip64EndOfCentralDirectoryLocator), sizeof(zip64EndOfCentralDirectoryLocator));
-    fileStream.seekg(zip64EndOfCentralDirectoryLocator.centralDirectoryOffset, std::ios_base::beg);
+    if (recordPosition < sizeof(zip64EndOfCentralDirectoryLocator)) {
+      return false;
+    }
+    file->ReadAt(archiveOffset + recordPosition - sizeof(zip64EndOfCentralDirectoryLocator), &zip64EndOfCentralDirectoryLocator, sizeof(zip64EndOfCentralDirectoryLocator));
+    if (zip64EndOfCentralDirectoryLocator.signature != ZipArchive_ZIP64_END_OF_CENTRAL_LOCATOR_SIGNATURE
+      || zip64EndOfCentralDirectoryLocator.centralDirectoryOffset > recordPosition - sizeof(zip64EndOfCentralDirectoryLocator)
+      || recordPosition - sizeof(zip64EndOfCentralDirectoryLocator) - zip64EndOfCentralDirectoryLocator.centralDirectoryOffset < sizeof(Zip64EndOfCentralDirectoryRecord)) {
+      return false;
+    }
     Zip64EndOfCentralDirectoryRecord zip64EndOfCentralDirectoryRecord;
-    fileStream.read(reinterpret_cast<char*>(&zip64EndOfCentralDirectoryRecord), sizeof(zip64EndOfCentralDirectoryRecord));
-    
-    entryCount = zip64EndOfCentralDirectoryRecord.entryCountThisDisk;
-    centralDirectoryStart = zip64EndOfCentralDirectoryRecord.startingDiskCentralDirectoryOffset;
+    file->ReadAt(archiveOffset + zip64EndOfCentralDirectoryLocator.centralDirectoryOffset, &zip64EndOfCentralDirectoryRecord, sizeof(zip64EndOfCentralDirectoryRecord));
+    if (zip64EndOfCentralDirectoryRecord.signature != ZipArchive_ZIP64_END_OF_CENTRAL_RECORD_SIGNATURE) {
+      return false;
+    }
+
+    location.checksum = UpdateCrc32(location.checksum, reinterpret_cast<const byte*>(&zip64EndOfCentralDirectoryRecord), sizeof(zip64EndOfCentralDirectoryRecord));
+    location.entryCount = zip64EndOfCentralDirectoryRecord.entryCountThisDisk;
+    location.start = zip64EndOfCentralDirectoryRecord.startingDiskCentralDirectoryOffset;
+    location.size = zip64EndOfCentralDirectoryRecord.centralDirectorySize;
+    directoryEnd = zip64EndOfCentralDirectoryLocator.centralDirectoryOffset;
   }
+  // the directory ends where the records begin, every entry takes at least a header,
+  // which also keeps a damaged count from allocating too much
+  return location.start <= directoryEnd && location.size <= directoryEnd - location.start
+    && location.entryCount <= location.size / sizeof(CentralDirectoryHeader)
+    && static_cast<size_t>(location.size) == location.size;
+}
 
-  fileStream.seekg(centralDirectoryStart, std::ios_base::beg);
+/************************************************************************/
+/* Walk the file from the start and list every entry whose local header */
+/* and data are intact. The data of an entry is skipped, it may contain */
+/* signatures of its own, e.g. a package stored in a bundle             */
+/************************************************************************/
+void ZipArchive::SalvageDirectory() {
+  AllocationTracker_COMPONENT("zip.directory");
+  std::vector<SalvagedEntry> salvaged;
+  size_t namePoolSize = 0;
+  ScanWindow window;
+  window.data.resize(static_cast<size_t>(std::min<uint64>(archiveSize, ZipArchive_SALVAGE_CHUNK)));
+  window.start = 0;
+  window.length = 0;
+  ScanSignatures(0, window, [&](uint64 position, uint32 signature) -> uint64 {
+    SalvagedEntry entry;
+    if (signature != ZipArchive_ENTRY_LOCAL_HEADER_SIGNATURE || !SalvageEntry(position, window, entry)) {
+      return position + 1;
+    }
+    namePoolSize += entry.name.size();
+    salvaged.push_back(entry);
+    return entry.dataOffset + entry.compressedSize;
+  });
 
-  archiveEntries.reserve(entryCount);
-  for (int i = 0; i < entryCount; i++) {
-    archiveEntries.push_back(std::shared_ptr<ZipArchiveEntry>(new ZipArchiveEntry(fileStream)));
+  entries.Allocate(salvaged.size(), namePoolSize);
+  for (auto entry = salvaged.begin(); entry != salvaged.end(); ++entry) {
+    size_t index = entries.Add(entry->header, entry->name.data(), entry->compressedSize, entry->uncompressedSize, entry->localHeaderOffset);
+    entries.SetDataOffset(index, entry->dataOffset);
   }
 }
 
+bool ZipArchive::SalvageEntry(uint64 position, ScanWindow& window, SalvagedEntry& entry) const {
+  LocalFileHeader localHeader;
+  if (archiveSize - position < sizeof(localHeader)) {
+    return false;
+  }
+  file->ReadAt(archiveOffset + position, &localHeader, sizeof(localHeader));
+  entry.localHeaderOffset = position;
+  entry.dataOffset = position + sizeof(localHeader) + localHeader.filenameLength + localHeader.extraFieldLength;
+  // no version beyond 6.3 has been specified, random bytes rarely pass for a header
+  if (localHeader.filenameLength == 0 || (localHeader.version & 0xFF) > 63 || entry.dataOffset > archiveSize) {
+    return false;
+  }
+  std::vector<byte> nameAndExtraField(localHeader.filenameLength + localHeader.extraFieldLength);
+  file->ReadAt(archiveOffset + position + sizeof(localHeader), nameAndExtraField.data(), nameAndExtraField.size());
+  if (memchr(nameAndExtraField.data(), 0, localHeader.filenameLength) != nullptr) {
+    return false;
+  }
+  const byte* extraField = nameAndExtraField.data() + localHeader.filenameLength;
+  entry.compressedSize = localHeader.compressedSize;
+  entry.uncompressedSize = localHeader.uncompressedSize;
+  if (!ReadZip64ExtraField(extraField, localHeader.extraFieldLength, entry.uncompressedSize, entry.compressedSize, NULL)) {
+    return false;
+  }
+  entry.name.assign(reinterpret_cast<const char*>(nameAndExtraField.data()), localHeader.filenameLength);
+
+  // the parts of a central directory header the entry table keeps
+  memset(&entry.header, 0, sizeof(entry.header));
+  entry.header.signature = ZipArchive_CENTRAL_DIRECTORY_RECORD_SIGNATURE;
+  entry.header.versionNeeded = localHeader.version;
+  entry.header.flags = localHeader.flags;
+  entry.header.compressionMethod = localHeader.compressionMethod;
+  entry.header.lastModifiedTime = localHeader.lastModifiedTime;
+  entry.header.lastModifiedDate = localHeader.lastModifiedDate;
+  entry.header.crc32 = localHeader.crc32;
+  entry.header.filenameLength = localHeader.filenameLength;
+
+  if ((localHeader.flags & ZipArchive_FLAG_DATA_DESCRIPTOR) 
+    && !FindDataDescriptor(hasZip64ExtraField(extraField, localHeader.extraFieldLength), window, entry)) {
+    return false;
+  }
+  return entry.compressedSize <= archiveSize - entry.dataOffset;
+}
 
 /************************************************************************/
-/* Get the uncompressed file contents as an IBuffer                     */
+/* A descriptor with a signature follows it, one without ends where the */
+/* next record starts. Either way the compressed size it holds has to   */
+/* match the distance to the start of the data.                         */
 /************************************************************************/
-std::vector<byte> ZipArchive::GetFileContents(const std::string& filename) {
-  std::vector<std::shared_ptr<ZipArchiveEntry>>::iterator entry = std::find_if(archiveEntries.begin(), archiveEntries.end(), 
-    [filename](std::shared_ptr<ZipArchiveEntry> archiveEntry) -> bool {
-      return (strcmp(archiveEntry->filename.c_str(), filename.c_str()) == 0);
-    });
-  if (entry != archiveEntries.end()) {
-    return (*entry)->GetUncompressedFileContents();
-  } else {
+bool ZipArchive::FindDataDescriptor(bool zip64, ScanWindow& window, SalvagedEntry& entry) const {
+  uint64 dataOffset = entry.dataOffset;
+  uint64 descriptorSize = zip64 ? sizeof(Zip64DataDescriptor) : sizeof(DataDescriptor);
+  bool found = false;
+  ScanSignatures(dataOffset, window, [&](uint64 position, uint32 signature) -> uint64 {
+    uint64 descriptorPosition;
+    uint64 compressedSize;
+    if (signature == ZipArchive_DATA_DESCRIPTOR_SIGNATURE) {
+      descriptorPosition = position + sizeof(uint32);
+      compressedSize = position - dataOffset;
+    } else if ((signature == ZipArchive_ENTRY_LOCAL_HEADER_SIGNATURE || signature == ZipArchive_CENTRAL_DIRECTORY_RECORD_SIGNATURE)
+      && position - dataOffset >= descriptorSize) {
+      descriptorPosition = position - descriptorSize;
+      compressedSize = descriptorPosition - dataOffset;
+    } else {
+      return position + 1;
+    }
+    if (archiveSize - descriptorPosition < descriptorSize) {
+      return position + 1;
+    }
+    Zip64DataDescriptor descriptor;
+    if (zip64) {
+      file->ReadAt(archiveOffset + descriptorPosition, &descriptor, sizeof(descriptor));
+    } else {
+      DataDescriptor shortDescriptor;
+      file->ReadAt(archiveOffset + descriptorPosition, &shortDescriptor, sizeof(shortDescriptor));
+      descriptor.crc32 = shortDescriptor.crc32;
+      descriptor.compressedSize = shortDescriptor.compressedSize;
+      descriptor.uncompressedSize = shortDescriptor.uncompressedSize;
+    }
+    if (descriptor.compressedSize != compressedSize) {
+      return position + 1;
+    }
+    entry.header.crc32 = descriptor.crc32;
+    entry.compressedSize = descriptor.compressedSize;
+    entry.uncompressedSize = descriptor.uncompressedSize;
+    found = true;
+    return archiveSize;
+  });
+  return found;
+}
+
+/************************************************************************/
+/* Read the file in chunks, each one overlapping the last by the bytes  */
+/* of a signature which may have been cut off                           */
+/************************************************************************/
+void ZipArchive::ScanSignatures(uint64 start, ScanWindow& window, const std::function<uint64 (uint64 position, uint32 signature)>& found) const {
+  uint64 position = start;
+  while (position <= archiveSize && archiveSize - position >= sizeof(uint32)) {
+    if (position < window.start || position + sizeof(uint32) > window.start + window.length) {
+      window.start = position;
+      window.length = static_cast<size_t>(std::min<uint64>(window.data.size(), archiveSize - position));
+      file->ReadAt(archiveOffset + window.start, window.data.data(), window.length);
+    }
+    size_t offset = static_cast<size_t>(position - window.start);
+    size_t marker = offset + findMarker(window.data.data() + offset, window.length - offset);
+    if (window.length - marker < sizeof(uint32)) {
+      position = window.start + window.length - (sizeof(uint32) - 1);
+      continue;
+    }
+    uint32 signature;
+    memcpy(&signature, window.data.data() + marker, sizeof(signature));
+    uint64 markerPosition = window.start + marker;
+    position = std::max(found(markerPosition, signature), markerPosition + 1);
+  }
+}
+
+/************************************************************************/
+/* Read the directory of contents into the entry table                  */
+/************************************************************************/
+void ZipArchive::ReadCentralDirectory(const DirectoryLocation& location) {
+  AllocationTracker_COMPONENT("zip.directory");
+  uint64 entryCount = location.entryCount;
+  uint64 centralDirectoryStart = location.start;
+  uint64 centralDirectorySize = location.size;
+
+  // read the whole directory with a single read and parse it in memory
+  std::vector<byte> centralDirectory(static_cast<size_t>(centralDirectorySize));
+  if (!centralDirectory.empty()) {
+    file->ReadAt(archiveOffset + centralDirectoryStart, centralDirectory.data(), centralDirectory.size());
+  }
+
+  // names can't take up more than the directory itself, so one allocation covers the whole table
+  entries.Allocate(static_cast<size_t>(entryCount), centralDirectory.size());
+  size_t position = 0;
+  for (uint64 i = 0; i < entryCount; i++) {
+    CentralDirectoryHeader header;
+    if (centralDirectory.size() - position < sizeof(header)) {
+      throw ref new Platform::FailureException(L"Invalid ZIP file entry header");
+    }
+    memcpy(&header, centralDirectory.data() + position, sizeof(header));
+    size_t recordSize = sizeof(header) + header.filenameLength + header.extraFieldLength + header.fileCommentLength;
+    if (header.signature != ZipArchive_CENTRAL_DIRECTORY_RECORD_SIGNATURE || recordSize > centralDirectory.size() - position) {
+      throw ref new Platform::FailureException(L"Invalid ZIP file entry header");
+    }
+    const byte* name = centralDirectory.data() + position + sizeof(header);
+    uint64 compressedSize = header.compressedSize;
+    uint64 uncompressedSize = header.uncompressedSize;
+    uint64 localHeaderOffset = header.localHeaderOffset;
+    if (!ReadZip64ExtraField(name + header.filenameLength, header.extraFieldLength, uncompressedSize, compressedSize, &localHeaderOffset)) {
+      throw ref new Platform::FailureException(L"Invalid ZIP file entry header");
+    }
+    entries.Add(header, reinterpret_cast<const char*>(name), compressedSize, uncompressedSize, localHeaderOffset);
+    position += recordSize;
+  }
+}
+
+size_t ZipArchive::FindEntry(const std::string& filename) const {
+  size_t index = entries.Find(filename);
+  if (index == ZipEntryTable::npos) {
     throw ref new Platform::InvalidArgumentException(L"File not in archive");
   }
+  return index;
+}
+
+/************************************************************************/
+/* Nested archives are only accessible in place if they are stored      */
+/************************************************************************/
+std::shared_ptr<ZipArchive> ZipArchive::OpenNestedArchive(const std::string& filename) {
+  size_t index = FindEntry(filename);
+  if (entries.GetCompressionMethod(index) != ZipArchive_METHOD_STORED) {
+    throw ref new Platform::FailureException(L"Nested archive is compressed and cannot be opened in place");
+  }
+  return std::shared_ptr<ZipArchive>(new ZipArchive(file, GetContentOffset(index), entries.GetCompressedSize(index)));
+}
+
+
+/************************************************************************/
+/* Get the uncompressed file contents, safe to call from any thread     */
+/************************************************************************/
+std::vector<byte> ZipArchive::GetFileContents(const std::string& filename) const {
+  return GetFileContents(FindEntry(filename));
+}
+
+/************************************************************************/
+/* Indices are built outside of the lock, if two threads race for the   */
+/* same entry the first one to finish wins                              */
+/************************************************************************/
+std::shared_ptr<const DeflateIndex> ZipArchive::GetIndex(size_t index) const {
+  {
+    std::lock_guard<std::mutex> lock(indicesLock);
+    auto existing = indices.find(index);
+    if (existing != indices.end()) {
+      return existing->second;
+    }
+  }
+  if (entries.GetCompressionMethod(index) != ZipArchive_METHOD_DEFLATE) {
+    throw ref new Platform::InvalidArgumentException(L"Only deflated files can be indexed");
+  }
+  AllocationTracker_COMPONENT("zip.index");
+  std::shared_ptr<const DeflateIndex> built = DeflateIndex::Build(*file, GetContentOffset(index),
+    entries.GetCompressedSize(index), entries.GetUncompressedSize(index), entries.GetCrc32(index));
+
+  std::lock_guard<std::mutex> lock(indicesLock);
+  return indices.insert(std::make_pair(index, built)).first->second;
+}
+
+std::shared_ptr<const DeflateIndex> ZipArchive::GetIndex(const std::string& filename) const {
+  return GetIndex(FindEntry(filename));
+}
+
+void ZipArchive::SetIndex(const std::string& filename, std::shared_ptr<const DeflateIndex> index) {
+  size_t entry = FindEntry(filename);
+  if (entries.GetCompressionMethod(entry) != ZipArchive_METHOD_DEFLATE
+    || index->GetCompressedSize() != entries.GetCompressedSize(entry)
+    || index->GetUncompressedSize() != entries.GetUncompressedSize(entry)
+    || index->GetCrc32() != entries.GetCrc32(entry)) {
+    throw ref new Platform::InvalidArgumentException(L"Index does not belong to this file");
+  }
+  std::lock_guard<std::mutex> lock(indicesLock);
+  indices[entry] = index;
+}
+
+std::vector<byte> ZipArchive::ReadRange(const std::string& filename, uint64 offset, size_t length) const {
+  AllocationTracker_COMPONENT("zip.extract");
+  size_t index = FindEntry(filename);
+  uint64 size = entries.GetUncompressedSize(index);
+  if (offset > size || length > size - offset) {
+    throw ref new Platform::InvalidArgumentException(L"Range is outside of the file");
+  }
+
+  std::vector<byte> result(length);
+  if (length == 0) {
+    return result;
+  }
+  switch (entries.GetCompressionMethod(index)) {
+  case ZipArchive_METHOD_STORED:
+    file->ReadAt(GetContentOffset(index) + offset, result.data(), length);
+    break;
+  case ZipArchive_METHOD_DEFLATE:
+    GetIndex(index)->Extract(*file, GetContentOffset(index), offset, result.data(), length);
+    break;
+  default: {
+    // the other codecs can't resume in the middle, take the range out of the whole file
+    std::vector<byte> contents = GetFileContents(index);
+    memcpy(result.data(), contents.data() + offset, length);
+    break;
+  }
+  }
+  return result;
 }
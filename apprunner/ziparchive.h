@@ -1,109 +1,150 @@
 ﻿#pragma once
 
+#include <functional>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <string>
-#include <ppltasks.h>
+
+#include "zipformat.h"
+#include "randomaccessfile.h"
+#include "zipentrytable.h"
+#include "deflateindex.h"
+#include "inflatestream.h"
+
+// appended to the archive's filename for the sidecar file holding its directory
+#define ZipArchive_SIDECAR_EXTENSION ".idx"
+// how much compressed data streaming extraction reads at once
+#define ZipArchive_STREAM_CHUNK (64 * 1024)
+// read beyond the name when the local header is read along with the data, for its extra field
+#define ZipArchive_LOCAL_EXTRA_SLACK 256
+// the end of central directory record is followed by a comment of at most this many bytes
+#define ZipArchive_MAX_COMMENT_LENGTH 0xFFFF
+// how much of the file a salvage scan reads at once
+#define ZipArchive_SALVAGE_CHUNK (1024 * 1024)
 
 namespace doo {
   namespace zip {
-    // the main archive class
+    // the main archive class.
+    // All reads are positional, so entries can be extracted from any number of threads at once.
     class ZipArchive {
     public:
-      ZipArchive(const std::string& filename);
-      std::vector<byte> GetFileContents(const std::string& filename);
+      // With useSidecarIndex the directory is mapped from filename + ".idx" if that file was written
+      // for the archive as it is now. Otherwise the directory is parsed, and the sidecar is written
+      // for the next open. It also stores where each entry's data starts, so extractions skip reading
+      // the local headers. Sidecars that can't be written, e.g. next to read-only archives, are skipped.
+      ZipArchive(const std::string& filename, bool useSidecarIndex = false);
+
+      // Open an archive whose central directory is missing or damaged, e.g. a package that was only partially
+      // uploaded. The directory is rebuilt by scanning the whole file for local headers, and only entries whose
+      // data is there completely are listed. Entries with a data descriptor are found by the descriptor that
+      // follows their data, everything between the entries is skipped. Nothing is written back.
+      static std::shared_ptr<ZipArchive> Salvage(const std::string& filename);
+      std::vector<byte> GetFileContents(const std::string& filename) const;
+      std::vector<byte> GetFileContents(size_t index) const;
+
+      // extract into a buffer owned by the caller which holds at least the uncompressed size.
+      // Returns the number of bytes written, with tinfl nothing is allocated once the decompressor pool is warm.
+      // The codec is taken from CodecRegistry::Shared() by the entry's compression method.
+      size_t ExtractTo(const std::string& filename, byte* buffer, size_t bufferSize) const;
+      size_t ExtractTo(size_t index, byte* buffer, size_t bufferSize) const;
+
+      // extract piece by piece without holding the whole file, output receives it in order in chunks of at most 64KB.
+      // Needs about 150KB regardless of the file size. Only stored, deflate and Deflate64 files can be streamed.
+      void ExtractStreaming(size_t index, const InflateStream::OutputCallback& output) const;
+      static bool CanStream(uint16 compressionMethod);
+
+      // receives an entry extracted by ExtractBatch(), in one piece
+      typedef std::function<void (size_t index, const byte* data, size_t length)> BatchOutputCallback;
+
+      // Extract several entries into buffer, one after the other in the order of indices. The compressed data
+      // is read with up to queueDepth reads outstanding by ascending offset, each entry is decompressed on the
+      // calling thread as soon as it is in memory while the next reads are still in flight. output is called
+      // for every entry once it is complete, in no particular order. Entries whose codec only reads from the
+      // file are extracted last.
+      void ExtractBatch(const std::vector<size_t>& indices, byte* buffer, size_t bufferSize,
+        unsigned queueDepth, const BatchOutputCallback& output) const;
+
+      // open an archive which is stored uncompressed inside this one, e.g. an .appx inside an .appxbundle.
+      // The nested archive reads through the same file handle, nothing is extracted.
+      std::shared_ptr<ZipArchive> OpenNestedArchive(const std::string& filename);
+
+      // length bytes of the uncompressed file starting at offset. Stored files are read directly, deflated
+      // files are indexed on first use so later reads only inflate from the nearest checkpoint on.
+      std::vector<byte> ReadRange(const std::string& filename, uint64 offset, size_t length) const;
+
+      // the checkpoint index of a deflated file, built if there is none yet
+      std::shared_ptr<const DeflateIndex> GetIndex(const std::string& filename) const;
+      // use an index saved earlier instead of building a new one, throws if it belongs to a different file
+      void SetIndex(const std::string& filename, std::shared_ptr<const DeflateIndex> index);
+
+      // the directory of the archive
+      const ZipEntryTable& GetEntries() const {
+        return entries;
+      }
 
     private:
-#pragma pack(1)
-      struct EndOfCentralDirectoryRecord {
-        uint32 signature;
-        uint16 diskNumber;
-        uint16 directoryDiskNumber;
-        uint16 entryCountThisDisk;
-        uint16 entryCountTotal;
-        uint32 centralDirectorySize;
-        uint32 centralDirectoryOffset;
-        uint16 zipFileCommentLength;
-      };
+      // view the archive occupying size bytes at offset of an already opened file, with salvage its directory
+      // is rebuilt from the local headers
+      ZipArchive(std::shared_ptr<RandomAccessFile> file, uint64 offset, uint64 size, bool salvage = false);
+      ZipArchive(const ZipArchive&);
+      ZipArchive& operator=(const ZipArchive&);
 
-      struct Zip64EndOfCentralDirectoryRecord {
-        uint32 signature;
-        uint64 recordSize;
-        uint16 versionMadeBy;
-        uint16 versionToExtract;
-        uint32 diskNumber;
-        uint32 centralDirectoryDiskNumber;
-        uint64 entryCountThisDisk;
-        uint64 totalEntryCount;
-        uint64 centralDirectorySize;
-        uint64 startingDiskCentralDirectoryOffset;
+      // where the central directory is, as found in the end of central directory records
+      struct DirectoryLocation {
+        uint64 entryCount;
+        uint64 start;
+        uint64 size;
+        // CRC-32 of the end of central directory records, tells a sidecar whether the directory changed
+        uint32 checksum;
       };
+      DirectoryLocation LocateCentralDirectory() const;
+      // where the directory is according to the record found at recordPosition, false if that makes no sense
+      bool ReadDirectoryLocation(const EndOfCentralDirectoryRecord& record, uint64 recordPosition, DirectoryLocation& location) const;
+      void ReadCentralDirectory(const DirectoryLocation& location);
+      void UseSidecarIndex(const std::string& indexFilename, const DirectoryLocation& location);
 
-      struct Zip64EndOfCentralDirectoryRecordLocator {
-        uint32 signature;
-        uint32 centralDirectoryStartDiskNumber;
-        uint64 centralDirectoryOffset;
-        uint32 numberOfDisks;
+      // an entry found by a salvage scan
+      struct SalvagedEntry {
+        CentralDirectoryHeader header;
+        std::string name;
+        uint64 compressedSize;
+        uint64 uncompressedSize;
+        uint64 localHeaderOffset;
+        uint64 dataOffset;
       };
-#pragma pack()
-
-      class ZipArchiveEntry {
-      public:
-        // ctor which takes an input stream that's already positioned at
-        // the start of the central directory header for a new archive entry
-        ZipArchiveEntry(std::ifstream& centralDirectoryHeaderStream);
-
-        std::vector<byte> GetUncompressedFileContents();
-        std::string filename;
-
-      private:
-      
-  #pragma pack(1)
-        struct LocalFileHeader {
-          uint32 signature;
-          uint16 version;
-          uint16 flags;
-          uint16 compressionMethod;
-          uint16 lastModifiedTime;
-          uint16 lastModifiedDate;
-          uint32 crc32;
-          uint32 compressedSize;
-          uint32 uncompressedSize;
-          uint16 filenameLength;
-          uint16 extraFieldLength;
-        } localHeader;
-
-        struct CentralDirectoryHeader {
-          uint32 signature;
-          uint16 versionCreated;
-          uint16 versionNeeded;
-          uint16 flags;
-          uint16 compressionMethod;
-          uint16 lastModifiedTime;
-          uint16 lastModifiedDate;
-          uint32 crc32;
-          uint32 compressedSize;
-          uint32 uncompressedSize;
-          uint16 filenameLength;
-          uint16 extraFieldLength;
-          uint16 fileCommentLength;
-          uint16 diskNumberStart;
-          uint16 internalFileAttributes;
-          uint32 externalFileAttributes;
-          uint32 localHeaderOffset;
-        } centralDirectoryHeader;
-  #pragma pack()
-
-        std::ifstream& inputStream;
-        std::string extraField;
-        DWORD64 contentStreamStart;
-
-        void ReadAndCheckLocalHeader();
-        std::vector<byte> DeflateFromStream();
-        std::vector<byte> UncompressedFromStream();
+      // the part of the file a salvage scan read last, shared by the nested scans for data descriptors
+      struct ScanWindow {
+        std::vector<byte> data;
+        uint64 start;
+        size_t length;
       };
+      void SalvageDirectory();
+      // the entry whose local header is at position, false if there is none or its data is incomplete
+      bool SalvageEntry(uint64 position, ScanWindow& window, SalvagedEntry& entry) const;
+      // complete the sizes and CRC of entry from the data descriptor following its data, false if there is none
+      bool FindDataDescriptor(bool zip64, ScanWindow& window, SalvagedEntry& entry) const;
+      // Call found with the position and signature of every "PK" from start on. It returns the position
+      // the scan continues at, the end of the archive to stop it.
+      void ScanSignatures(uint64 start, ScanWindow& window, const std::function<uint64 (uint64 position, uint32 signature)>& found) const;
+
+      // the index of the entry with that name, throws if there is none
+      size_t FindEntry(const std::string& filename) const;
+
+      // position of the entry's data within the file, checks the local header on the way
+      uint64 GetContentOffset(size_t index) const;
+      uint64 CheckLocalHeader(size_t index, const byte* header) const;
+
+      std::shared_ptr<const DeflateIndex> GetIndex(size_t index) const;
 
-      std::vector<std::shared_ptr<ZipArchiveEntry>> archiveEntries;
-      std::ifstream fileStream;
+      ZipEntryTable entries;
+      std::shared_ptr<RandomAccessFile> file;
+      // the window of the file occupied by this archive
+      uint64 archiveOffset;
+      uint64 archiveSize;
+      // deflate indices by entry, built lazily
+      mutable std::mutex indicesLock;
+      mutable std::map<size_t, std::shared_ptr<const DeflateIndex>> indices;
     };
   }
 }
@@ -0,0 +1,101 @@
+#include "stdafx.h"
+
+#ifdef APPRUNNER_ZIP_COUNTERS
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "zipcounters.h"
+
+using namespace doo::zip;
+
+#ifdef _MSC_VER
+#define ZipCounters_THREAD_LOCAL __declspec(thread)
+#else
+#define ZipCounters_THREAD_LOCAL __thread
+#endif
+
+// Every set that was ever handed out. Sets outlive their threads so Total() keeps their counts,
+// the list only grows by one entry per thread and is only locked when a thread counts for the first time.
+static std::mutex threadCountersLock;
+static std::vector<std::unique_ptr<ZipCounters>> threadCounters;
+
+static ZipCounters_THREAD_LOCAL ZipCounters* localCounters = NULL;
+
+void ZipCounters::CountMatch(uint32 length) {
+  unsigned bucket = 0;
+  while (length >>= 1) {
+    ++bucket;
+  }
+  ++matchLengths[std::min<unsigned>(bucket, ZipCounters_MATCH_BUCKETS - 1)];
+}
+
+void ZipCounters::CountRead(const void* file, uint64 offset, size_t length) {
+  ++reads;
+  bytesRead += length;
+  if (file != lastFile || offset != lastReadEnd) {
+    ++seeks;
+  }
+  lastFile = file;
+  lastReadEnd = offset + length;
+}
+
+ZipCounters& ZipCounters::Local() {
+  if (!localCounters) {
+    std::unique_ptr<ZipCounters> counters(new ZipCounters());
+    std::lock_guard<std::mutex> guard(threadCountersLock);
+    threadCounters.push_back(std::move(counters));
+    localCounters = threadCounters.back().get();
+  }
+  return *localCounters;
+}
+
+ZipCounters ZipCounters::Total() {
+  ZipCounters total = ZipCounters();
+  std::lock_guard<std::mutex> guard(threadCountersLock);
+  std::for_each(threadCounters.begin(), threadCounters.end(), [&total](const std::unique_ptr<ZipCounters>& counters) {
+    total.storedBlocks += counters->storedBlocks;
+    total.fixedBlocks += counters->fixedBlocks;
+    total.dynamicBlocks += counters->dynamicBlocks;
+    total.tableBuilds += counters->tableBuilds;
+    total.slowRefills += counters->slowRefills;
+    total.treeWalks += counters->treeWalks;
+    for (int i = 0; i < ZipCounters_MATCH_BUCKETS; ++i) {
+      total.matchLengths[i] += counters->matchLengths[i];
+    }
+    total.reads += counters->reads;
+    total.bytesRead += counters->bytesRead;
+    total.seeks += counters->seeks;
+    total.entriesExtracted += counters->entriesExtracted;
+    total.bytesExtracted += counters->bytesExtracted;
+  });
+  return total;
+}
+
+void ZipCounters::Reset() {
+  std::lock_guard<std::mutex> guard(threadCountersLock);
+  std::for_each(threadCounters.begin(), threadCounters.end(), [](const std::unique_ptr<ZipCounters>& counters) {
+    *counters = ZipCounters();
+  });
+}
+
+std::wstring ZipCounters::Format() const {
+  std::wostringstream result;
+  result << L"entries extracted: " << entriesExtracted << L" (" << bytesExtracted << L" bytes)\n";
+  result << L"reads: " << reads << L" (" << bytesRead << L" bytes, " << seeks << L" seeks)\n";
+  result << L"blocks: " << storedBlocks << L" stored, " << fixedBlocks << L" fixed, " << dynamicBlocks << L" dynamic\n";
+  result << L"table builds: " << tableBuilds << L"\n";
+  result << L"slow refills: " << slowRefills << L"\n";
+  result << L"tree walks: " << treeWalks << L"\n";
+  result << L"match lengths:";
+  for (int i = 1; i < ZipCounters_MATCH_BUCKETS; ++i) {
+    if (matchLengths[i] > 0) {
+      result << L" " << (1u << i) << L"+: " << matchLengths[i];
+    }
+  }
+  result << L"\n";
+  return result.str();
+}
+
+#endif
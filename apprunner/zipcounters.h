@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+
+// Counters are only compiled in when APPRUNNER_ZIP_COUNTERS is defined, otherwise the macros below
+// expand to nothing and the hot paths stay untouched.
+#ifdef APPRUNNER_ZIP_COUNTERS
+#define ZipCounters_COUNT(counter) (++doo::zip::ZipCounters::Local().counter)
+#define ZipCounters_ADD(counter, amount) (doo::zip::ZipCounters::Local().counter += (amount))
+#define ZipCounters_MATCH(length) (doo::zip::ZipCounters::Local().CountMatch(length))
+#else
+#define ZipCounters_COUNT(counter) ((void)0)
+#define ZipCounters_ADD(counter, amount) ((void)0)
+#define ZipCounters_MATCH(length) ((void)0)
+#endif
+
+// match lengths are counted per power of two, deflate64 matches reach 65538
+#define ZipCounters_MATCH_BUCKETS 17
+
+namespace doo {
+  namespace zip {
+    // What the inflate and zip layers spent their time on. Every thread counts into its own set,
+    // so counting never contends, and Total() adds up the sets of all threads that ever counted.
+    struct ZipCounters {
+      // deflate blocks by type
+      uint64 storedBlocks;
+      uint64 fixedBlocks;
+      uint64 dynamicBlocks;
+      // Huffman tables built for dynamic blocks, three per block
+      uint64 tableBuilds;
+      // Huffman codes decoded byte by byte because the input buffer was almost used up
+      uint64 slowRefills;
+      // codes longer than the fast lookup that had to walk the tree
+      uint64 treeWalks;
+      // bucket i counts matches of 2^i up to 2^(i+1)-1 bytes
+      uint64 matchLengths[ZipCounters_MATCH_BUCKETS];
+      // reads issued to archive files and the bytes they returned
+      uint64 reads;
+      uint64 bytesRead;
+      // reads that did not continue where the thread's previous read of the same file ended
+      uint64 seeks;
+      // entries extracted through ZipArchive and their uncompressed size
+      uint64 entriesExtracted;
+      uint64 bytesExtracted;
+
+      void CountMatch(uint32 length);
+      // counts a read and whether the disk had to seek for it
+      void CountRead(const void* file, uint64 offset, size_t length);
+
+      // the counters of the calling thread
+      static ZipCounters& Local();
+      // the sum over all threads, only exact while no thread is counting
+      static ZipCounters Total();
+      // zeroes the counters of all threads, call it while no thread is counting
+      static void Reset();
+
+      // one counter per line, for printing after a run
+      std::wstring Format() const;
+
+      // where this thread's last read ended, for telling seeks from sequential reads
+      const void* lastFile;
+      uint64 lastReadEnd;
+    };
+  }
+}
@@ -0,0 +1,231 @@
+#include "stdafx.h"
+
+#include "zipentrytable.h"
+
+using namespace doo::zip;
+
+// "ZTBL" in the file
+#define ZipEntryTable_MAGIC 0x4c42545a
+#define ZipEntryTable_VERSION 2
+
+namespace {
+  // precedes the arena in a saved table, its size keeps the arena 8 byte aligned
+  struct SavedTableHeader {
+    uint32 magic;
+    uint32 version;
+    uint64 archiveSize;
+    uint64 modificationTime;
+    uint32 directoryChecksum;
+    uint32 reserved;
+    uint64 count;
+    uint64 capacity;
+    uint64 hashSlotCount;
+    uint64 namePoolSize;
+  };
+}
+
+ZipEntryTable::ZipEntryTable()
+  : arenaSize(0), count(0), capacity(0), namePoolSize(0), namePoolUsed(0), hashSlotCount(0)
+{
+}
+
+size_t ZipEntryTable::GetArenaSize(size_t capacity, size_t hashSlotCount, size_t namePoolSize) {
+  return capacity * (4 * sizeof(uint64) + 2 * sizeof(uint32) + 3 * sizeof(uint16))
+    + hashSlotCount * sizeof(uint32)
+    + namePoolSize;
+}
+
+/************************************************************************/
+/* Carve all arrays out of one block: 64 bit columns first, then the 32 */
+/* and 16 bit ones and the name pool, so everything stays aligned       */
+/************************************************************************/
+void ZipEntryTable::SetViews(byte* position) {
+  dataOffsets = reinterpret_cast<uint64*>(position); position += capacity * sizeof(uint64);
+  localHeaderOffsets = reinterpret_cast<uint64*>(position); position += capacity * sizeof(uint64);
+  compressedSizes = reinterpret_cast<uint64*>(position); position += capacity * sizeof(uint64);
+  uncompressedSizes = reinterpret_cast<uint64*>(position); position += capacity * sizeof(uint64);
+  crcs = reinterpret_cast<uint32*>(position); position += capacity * sizeof(uint32);
+  nameOffsets = reinterpret_cast<uint32*>(position); position += capacity * sizeof(uint32);
+  hashSlots = reinterpret_cast<uint32*>(position); position += hashSlotCount * sizeof(uint32);
+  nameLengths = reinterpret_cast<uint16*>(position); position += capacity * sizeof(uint16);
+  compressionMethods = reinterpret_cast<uint16*>(position); position += capacity * sizeof(uint16);
+  flags = reinterpret_cast<uint16*>(position); position += capacity * sizeof(uint16);
+  namePool = reinterpret_cast<char*>(position);
+}
+
+void ZipEntryTable::Allocate(size_t entryCount, size_t poolSize) {
+  hashSlotCount = 1;
+  while (hashSlotCount < entryCount * 2) {
+    hashSlotCount <<= 1;
+  }
+
+  arenaSize = GetArenaSize(entryCount, hashSlotCount, poolSize);
+  arena.reset(new byte[arenaSize]);
+  mapping.reset();
+  capacity = entryCount;
+  SetViews(arena.get());
+
+  memset(dataOffsets, 0, entryCount * sizeof(uint64));
+  memset(hashSlots, 0, hashSlotCount * sizeof(uint32));
+  count = 0;
+  namePoolSize = poolSize;
+  namePoolUsed = 0;
+}
+
+// FNV-1a
+uint32 ZipEntryTable::HashName(const char* name, size_t nameLength) {
+  uint32 hash = 2166136261U;
+  for (size_t i = 0; i < nameLength; i++) {
+    hash = (hash ^ static_cast<byte>(name[i])) * 16777619U;
+  }
+  return hash;
+}
+
+size_t ZipEntryTable::Add(const CentralDirectoryHeader& header, const char* name,
+  uint64 compressedSize, uint64 uncompressedSize, uint64 localHeaderOffset)
+{
+  if (mapping || count == capacity || header.filenameLength > namePoolSize - namePoolUsed) {
+    throw ref new Platform::FailureException(L"Invalid ZIP file entry header");
+  }
+  size_t index = count++;
+  localHeaderOffsets[index] = localHeaderOffset;
+  compressedSizes[index] = compressedSize;
+  uncompressedSizes[index] = uncompressedSize;
+  crcs[index] = header.crc32;
+  compressionMethods[index] = header.compressionMethod;
+  flags[index] = header.flags;
+  nameLengths[index] = header.filenameLength;
+  nameOffsets[index] = static_cast<uint32>(namePoolUsed);
+  memcpy(namePool + namePoolUsed, name, header.filenameLength);
+  namePoolUsed += header.filenameLength;
+
+  // keep the first entry for duplicate names, like a front-to-back scan would
+  size_t mask = hashSlotCount - 1;
+  size_t slot = HashName(name, header.filenameLength) & mask;
+  while (hashSlots[slot] != 0) {
+    size_t existing = hashSlots[slot] - 1;
+    if (nameLengths[existing] == header.filenameLength && memcmp(namePool + nameOffsets[existing], name, header.filenameLength) == 0) {
+      return index;
+    }
+    slot = (slot + 1) & mask;
+  }
+  hashSlots[slot] = static_cast<uint32>(index + 1);
+  return index;
+}
+
+size_t ZipEntryTable::Find(const char* name, size_t nameLength) const {
+  if (hashSlotCount == 0) {
+    return npos;
+  }
+  size_t mask = hashSlotCount - 1;
+  for (size_t slot = HashName(name, nameLength) & mask; hashSlots[slot] != 0; slot = (slot + 1) & mask) {
+    size_t index = hashSlots[slot] - 1;
+    if (nameLengths[index] == nameLength && memcmp(namePool + nameOffsets[index], name, nameLength) == 0) {
+      return index;
+    }
+  }
+  return npos;
+}
+
+void ZipEntryTable::SetDataOffset(size_t index, uint64 offset) {
+  if (mapping || index >= count) {
+    throw ref new Platform::FailureException(L"Entry table is read-only");
+  }
+  dataOffsets[index] = offset;
+}
+
+/************************************************************************/
+/* The arena is written as it is, only the unused end of the name pool  */
+/* is left out                                                          */
+/************************************************************************/
+void ZipEntryTable::Save(std::ostream& output, const ZipEntryTableStamp& stamp) const {
+  SavedTableHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = ZipEntryTable_MAGIC;
+  header.version = ZipEntryTable_VERSION;
+  header.archiveSize = stamp.archiveSize;
+  header.modificationTime = stamp.modificationTime;
+  header.directoryChecksum = stamp.directoryChecksum;
+  header.count = count;
+  header.capacity = capacity;
+  header.hashSlotCount = hashSlotCount;
+  header.namePoolSize = namePoolUsed;
+  output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  // the views start at the beginning of the arena
+  size_t size = GetArenaSize(capacity, hashSlotCount, namePoolUsed);
+  if (size > 0) {
+    output.write(reinterpret_cast<const char*>(dataOffsets), size);
+  }
+  if (!output) {
+    throw ref new Platform::FailureException(L"Could not write entry table");
+  }
+}
+
+bool ZipEntryTable::Map(std::shared_ptr<MappedFile> file, const ZipEntryTableStamp& stamp) {
+  SavedTableHeader header;
+  if (file->GetSize() < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, file->GetData(), sizeof(header));
+  if (header.magic != ZipEntryTable_MAGIC || header.version != ZipEntryTable_VERSION
+    || header.archiveSize != stamp.archiveSize
+    || header.modificationTime != stamp.modificationTime
+    || header.directoryChecksum != stamp.directoryChecksum) {
+    return false;
+  }
+  // bound the counts before computing sizes from them, nothing may overflow
+  uint64 maximum = std::min<uint64>(file->GetSize(), 0xFFFFFFFF);
+  if (header.count > header.capacity || header.capacity > maximum || header.namePoolSize > maximum
+    || header.hashSlotCount > maximum || header.hashSlotCount < header.capacity * 2
+    || (header.hashSlotCount & (header.hashSlotCount - 1)) != 0) {
+    return false;
+  }
+  size_t size = GetArenaSize(static_cast<size_t>(header.capacity), static_cast<size_t>(header.hashSlotCount),
+    static_cast<size_t>(header.namePoolSize));
+  if (size != file->GetSize() - sizeof(header)) {
+    return false;
+  }
+
+  // the previous state is restored if the contents don't add up
+  ZipEntryTable mapped;
+  mapped.mapping = file;
+  mapped.arenaSize = size;
+  mapped.count = static_cast<size_t>(header.count);
+  mapped.capacity = static_cast<size_t>(header.capacity);
+  mapped.hashSlotCount = static_cast<size_t>(header.hashSlotCount);
+  mapped.namePoolSize = mapped.namePoolUsed = static_cast<size_t>(header.namePoolSize);
+  // never written through, Add() and SetDataOffset() refuse to work on a mapped table
+  mapped.SetViews(const_cast<byte*>(file->GetData()) + sizeof(header));
+  if (!mapped.IsConsistent(stamp.archiveSize)) {
+    return false;
+  }
+
+  std::swap(arena, mapped.arena);
+  std::swap(mapping, mapped.mapping);
+  arenaSize = mapped.arenaSize;
+  count = mapped.count;
+  capacity = mapped.capacity;
+  hashSlotCount = mapped.hashSlotCount;
+  namePoolSize = mapped.namePoolSize;
+  namePoolUsed = mapped.namePoolUsed;
+  SetViews(const_cast<byte*>(file->GetData()) + sizeof(header));
+  return true;
+}
+
+bool ZipEntryTable::IsConsistent(uint64 archiveSize) const {
+  for (size_t index = 0; index < count; index++) {
+    if (nameOffsets[index] > namePoolUsed || nameLengths[index] > namePoolUsed - nameOffsets[index]
+      || dataOffsets[index] > archiveSize || localHeaderOffsets[index] > archiveSize) {
+      return false;
+    }
+  }
+  // every slot refers to an entry and at least one is empty, so lookups end
+  size_t usedSlots = 0;
+  for (size_t slot = 0; slot < hashSlotCount; slot++) {
+    if (hashSlots[slot] > count) {
+      return false;
+    }
+    usedSlots += hashSlots[slot] != 0;
+  }
+  return usedSlots < hashSlotCount || hashSlotCount == 0;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <iosfwd>
+#include <memory>
+#include <string>
+
+#include "zipformat.h"
+#include "mappedfile.h"
+
+namespace doo {
+  namespace zip {
+    // identifies the state of the archive a saved table was read from
+    struct ZipEntryTableStamp {
+      uint64 archiveSize;
+      uint64 modificationTime;
+      // CRC-32 of the end of central directory records
+      uint32 directoryChecksum;
+    };
+
+    // The directory of an archive as parallel arrays plus one pool holding all file names.
+    // Everything lives in a single allocation made when the archive is opened, and names
+    // are found through an open-addressing hash index instead of a linear scan.
+    // The arena can be saved as it is and mapped back into memory later, see Save() and Map().
+    class ZipEntryTable {
+    public:
+      static const size_t npos = static_cast<size_t>(-1);
+
+      ZipEntryTable();
+
+      // make room for entryCount entries whose names take up to namePoolSize bytes in total
+      void Allocate(size_t entryCount, size_t namePoolSize);
+
+      // append an entry read from the central directory, returns its index.
+      // Sizes and offset are passed separately since they may come from the zip64 extra field.
+      size_t Add(const CentralDirectoryHeader& header, const char* name,
+        uint64 compressedSize, uint64 uncompressedSize, uint64 localHeaderOffset);
+
+      // index of the first entry with the given name or npos
+      size_t Find(const char* name, size_t nameLength) const;
+      size_t Find(const std::string& name) const {
+        return Find(name.data(), name.size());
+      }
+
+      size_t GetCount() const {
+        return count;
+      }
+
+      std::string GetName(size_t index) const {
+        return std::string(namePool + nameOffsets[index], nameLengths[index]);
+      }
+      const char* GetNameData(size_t index) const {
+        return namePool + nameOffsets[index];
+      }
+      uint16 GetNameLength(size_t index) const {
+        return nameLengths[index];
+      }
+      uint64 GetLocalHeaderOffset(size_t index) const {
+        return localHeaderOffsets[index];
+      }
+      uint64 GetCompressedSize(size_t index) const {
+        return compressedSizes[index];
+      }
+      uint64 GetUncompressedSize(size_t index) const {
+        return uncompressedSizes[index];
+      }
+      uint32 GetCrc32(size_t index) const {
+        return crcs[index];
+      }
+      uint16 GetCompressionMethod(size_t index) const {
+        return compressionMethods[index];
+      }
+      uint16 GetFlags(size_t index) const {
+        return flags[index];
+      }
+      // where the entry's data starts behind the local header, 0 while unknown
+      uint64 GetDataOffset(size_t index) const {
+        return dataOffsets[index];
+      }
+      void SetDataOffset(size_t index, uint64 offset);
+
+      // write the table in the layout Map() expects
+      void Save(std::ostream& output, const ZipEntryTableStamp& stamp) const;
+      // use the table saved in file instead of allocating one. Returns false, and leaves the table
+      // as it was, if the file was saved for a different stamp or is damaged in any way.
+      bool Map(std::shared_ptr<MappedFile> file, const ZipEntryTableStamp& stamp);
+
+      // the number of bytes allocated for the table
+      size_t GetMemoryUsage() const {
+        return arenaSize;
+      }
+
+    private:
+      ZipEntryTable(const ZipEntryTable&);
+      ZipEntryTable& operator=(const ZipEntryTable&);
+
+      static uint32 HashName(const char* name, size_t nameLength);
+      static size_t GetArenaSize(size_t capacity, size_t hashSlotCount, size_t namePoolSize);
+      // point the columns into an arena laid out for capacity and hashSlotCount
+      void SetViews(byte* base);
+      // checks everything Find() and the getters rely on, for tables that were not built by Add()
+      bool IsConsistent(uint64 archiveSize) const;
+
+      std::unique_ptr<byte[]> arena;
+      // set instead of arena when the table is mapped from a file, which is read-only
+      std::shared_ptr<MappedFile> mapping;
+      size_t arenaSize;
+      size_t count;
+      size_t capacity;
+      size_t namePoolSize;
+      size_t namePoolUsed;
+      // a power of two, at least twice the capacity
+      size_t hashSlotCount;
+
+      // views into the arena
+      uint64* dataOffsets;
+      uint64* localHeaderOffsets;
+      uint64* compressedSizes;
+      uint64* uncompressedSizes;
+      uint32* crcs;
+      uint32* nameOffsets;
+      // entry index + 1, 0 marks an empty slot
+      uint32* hashSlots;
+      uint16* nameLengths;
+      uint16* compressionMethods;
+      uint16* flags;
+      char* namePool;
+    };
+  }
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+// on-disk records of the ZIP file format shared by the different readers
+
+// the expected signatures for different parts of a ZIP file
+#define ZipArchive_ENTRY_LOCAL_HEADER_SIGNATURE 0x04034b50
+#define ZipArchive_DATA_DESCRIPTOR_SIGNATURE 0x08074b50
+#define ZipArchive_CENTRAL_DIRECTORY_RECORD_SIGNATURE 0x02014b50
+#define ZipArchive_ZIP64_END_OF_CENTRAL_RECORD_SIGNATURE 0x06064b50
+#define ZipArchive_ZIP64_END_OF_CENTRAL_LOCATOR_SIGNATURE 0x07064b50
+#define ZipArchive_END_OF_CENTRAL_RECORD_SIGNATURE 0x06054b50
+
+// id of the zip64 extended information extra field
+#define ZipArchive_ZIP64_EXTRA_FIELD 0x0001
+// a 32 bit size or offset with this value is stored in the zip64 extra field
+#define ZipArchive_ZIP64_MARKER 0xFFFFFFFF
+
+// general purpose flag: crc and sizes are stored in a data descriptor following the data
+#define ZipArchive_FLAG_DATA_DESCRIPTOR 0x0008
+// general purpose flag for LZMA: the stream ends with an end marker
+#define ZipArchive_FLAG_LZMA_END_MARKER 0x0002
+
+// compression methods
+#define ZipArchive_METHOD_STORED 0
+#define ZipArchive_METHOD_DEFLATE 8
+#define ZipArchive_METHOD_DEFLATE64 9
+#define ZipArchive_METHOD_LZMA 14
+#define ZipArchive_METHOD_ZSTD 93
+
+namespace doo {
+  namespace zip {
+#pragma pack(1)
+    struct EndOfCentralDirectoryRecord {
+      uint32 signature;
+      uint16 diskNumber;
+      uint16 directoryDiskNumber;
+      uint16 entryCountThisDisk;
+      uint16 entryCountTotal;
+      uint32 centralDirectorySize;
+      uint32 centralDirectoryOffset;
+      uint16 zipFileCommentLength;
+    };
+
+    struct Zip64EndOfCentralDirectoryRecord {
+      uint32 signature;
+      uint64 recordSize;
+      uint16 versionMadeBy;
+      uint16 versionToExtract;
+      uint32 diskNumber;
+      uint32 centralDirectoryDiskNumber;
+      uint64 entryCountThisDisk;
+      uint64 totalEntryCount;
+      uint64 centralDirectorySize;
+      uint64 startingDiskCentralDirectoryOffset;
+    };
+
+    struct Zip64EndOfCentralDirectoryRecordLocator {
+      uint32 signature;
+      uint32 centralDirectoryStartDiskNumber;
+      uint64 centralDirectoryOffset;
+      uint32 numberOfDisks;
+    };
+
+    struct LocalFileHeader {
+      uint32 signature;
+      uint16 version;
+      uint16 flags;
+      uint16 compressionMethod;
+      uint16 lastModifiedTime;
+      uint16 lastModifiedDate;
+      uint32 crc32;
+      uint32 compressedSize;
+      uint32 uncompressedSize;
+      uint16 filenameLength;
+      uint16 extraFieldLength;
+    };
+
+    // follows the data if ZipArchive_FLAG_DATA_DESCRIPTOR is set, the signature is optional
+    struct DataDescriptor {
+      uint32 crc32;
+      uint32 compressedSize;
+      uint32 uncompressedSize;
+    };
+
+    // the data descriptor of entries with a zip64 extra field in their local header
+    struct Zip64DataDescriptor {
+      uint32 crc32;
+      uint64 compressedSize;
+      uint64 uncompressedSize;
+    };
+
+    struct ExtraFieldHeader {
+      uint16 id;
+      uint16 size;
+    };
+
+    struct CentralDirectoryHeader {
+      uint32 signature;
+      uint16 versionCreated;
+      uint16 versionNeeded;
+      uint16 flags;
+      uint16 compressionMethod;
+      uint16 lastModifiedTime;
+      uint16 lastModifiedDate;
+      uint32 crc32;
+      uint32 compressedSize;
+      uint32 uncompressedSize;
+      uint16 filenameLength;
+      uint16 extraFieldLength;
+      uint16 fileCommentLength;
+      uint16 diskNumberStart;
+      uint16 internalFileAttributes;
+      uint32 externalFileAttributes;
+      uint32 localHeaderOffset;
+    };
+#pragma pack()
+
+    // The 64 bit values of the fields which are set to ZipArchive_ZIP64_MARKER are kept in the zip64 extra
+    // field, in this order and only the marked ones. Replaces the marked values, localHeaderOffset may be
+    // NULL for local headers which have none. Returns false if a marked value is missing.
+    inline bool ReadZip64ExtraField(const byte* extraField, size_t length,
+      uint64& uncompressedSize, uint64& compressedSize, uint64* localHeaderOffset)
+    {
+      uint64* values[] = { &uncompressedSize, &compressedSize, localHeaderOffset };
+      bool marked = false;
+      for (int i = 0; i < 3; i++) {
+        marked |= values[i] && *values[i] == ZipArchive_ZIP64_MARKER;
+      }
+      if (!marked) {
+        return true;
+      }
+      for (size_t position = 0; length - position >= sizeof(ExtraFieldHeader); ) {
+        ExtraFieldHeader header;
+        memcpy(&header, extraField + position, sizeof(header));
+        position += sizeof(header);
+        if (header.size > length - position) {
+          return false;
+        }
+        if (header.id == ZipArchive_ZIP64_EXTRA_FIELD) {
+          const byte* value = extraField + position;
+          const byte* end = value + header.size;
+          for (int i = 0; i < 3; i++) {
+            if (values[i] && *values[i] == ZipArchive_ZIP64_MARKER) {
+              if (static_cast<size_t>(end - value) < sizeof(uint64)) {
+                return false;
+              }
+              memcpy(values[i], value, sizeof(uint64));
+              value += sizeof(uint64);
+            }
+          }
+          return true;
+        }
+        position += header.size;
+      }
+      return false;
+    }
+  }
+}
@@ -0,0 +1,648 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "crc32.h"
+#include "deflateencoder.h"
+#include "randomaccessfile.h"
+#include "sha256.h"
+#include "zipformat.h"
+#include "zippacker.h"
+
+using namespace doo::zip;
+
+// 1980-01-01 00:00, the earliest time ZIP can store
+#define ZipPacker_DOS_DATE 0x0021
+#define ZipPacker_DOS_TIME 0x0000
+// general purpose flag: the name is UTF-8
+#define ZipPacker_FLAG_UTF8 0x0800
+
+namespace {
+  struct SourceFile {
+    std::string path;
+    // relative to the packed directory with '/' as the separator
+    std::string name;
+    uint64 size;
+    size_t firstBlock;
+    size_t blockCount;
+  };
+
+  struct CompressedBlock {
+    std::vector<byte> data;
+    uint32 crc;
+    byte hash[Sha256_DIGEST_SIZE];
+    bool ready;
+  };
+
+  // what the central directory and the block map need to know about a written entry
+  struct PackedEntry {
+    std::string name;
+    std::string blockMapName;
+    uint16 method;
+    uint32 crc;
+    uint64 compressedSize;
+    uint64 uncompressedSize;
+    uint64 localHeaderOffset;
+    uint32 localHeaderSize;
+    // base64 SHA-256 and compressed size of every block
+    std::vector<std::pair<std::string, uint32>> blocks;
+  };
+
+  // written by explicit offsets, so headers can be filled in after the data that follows them
+  class OutputFile {
+  public:
+    OutputFile(const std::string& filename)
+      : filename(filename)
+    {
+#ifdef _WIN32
+      file = CreateFileA(filename.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+      if (file == INVALID_HANDLE_VALUE) {
+#else
+      file = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (file < 0) {
+#endif
+        throw ref new Platform::FailureException(L"Could not create the archive");
+      }
+    }
+
+    ~OutputFile() {
+#ifdef _WIN32
+      CloseHandle(file);
+#else
+      close(file);
+#endif
+    }
+
+    void WriteAt(uint64 offset, const void* data, size_t length) {
+      const byte* source = static_cast<const byte*>(data);
+      while (length > 0) {
+#ifdef _WIN32
+        DWORD chunk = static_cast<DWORD>(std::min<size_t>(length, 0x40000000));
+        OVERLAPPED overlapped;
+        ZeroMemory(&overlapped, sizeof(overlapped));
+        overlapped.Offset = static_cast<DWORD>(offset);
+        overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD written = 0;
+        if (!WriteFile(file, source, chunk, &written, &overlapped) || written == 0) {
+#else
+        ssize_t written = pwrite(file, source, std::min<size_t>(length, 0x40000000), offset);
+        if (written <= 0) {
+#endif
+          throw ref new Platform::FailureException(L"Could not write the archive");
+        }
+        source += written;
+        offset += written;
+        length -= written;
+      }
+    }
+
+    // close and delete the file, for archives that could not be completed
+    void Discard() {
+#ifdef _WIN32
+      CloseHandle(file);
+      file = INVALID_HANDLE_VALUE;
+      DeleteFileA(filename.c_str());
+#else
+      close(file);
+      file = -1;
+      unlink(filename.c_str());
+#endif
+    }
+
+  private:
+    OutputFile(const OutputFile&);
+    OutputFile& operator=(const OutputFile&);
+
+    std::string filename;
+#ifdef _WIN32
+    HANDLE file;
+#else
+    int file;
+#endif
+  };
+
+  // every file below directory, prefix is put in front of the names
+#ifdef _WIN32
+  void findFiles(const std::string& directory, const std::string& prefix, std::vector<SourceFile>& files) {
+    WIN32_FIND_DATAA found;
+    HANDLE search = FindFirstFileA((directory + "\\*").c_str(), &found);
+    if (search == INVALID_HANDLE_VALUE) {
+      throw ref new Platform::InvalidArgumentException(L"Could not list the directory to pack");
+    }
+    do {
+      if (strcmp(found.cFileName, ".") == 0 || strcmp(found.cFileName, "..") == 0) {
+        continue;
+      }
+      if (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+        findFiles(directory + "\\" + found.cFileName, prefix + found.cFileName + "/", files);
+        continue;
+      }
+      SourceFile file;
+      file.path = directory + "\\" + found.cFileName;
+      file.name = prefix + found.cFileName;
+      file.size = (static_cast<uint64>(found.nFileSizeHigh) << 32) | found.nFileSizeLow;
+      files.push_back(file);
+    } while (FindNextFileA(search, &found));
+    FindClose(search);
+  }
+#else
+  void findFiles(const std::string& directory, const std::string& prefix, std::vector<SourceFile>& files) {
+    DIR* search = opendir(directory.c_str());
+    if (!search) {
+      throw ref new Platform::InvalidArgumentException(L"Could not list the directory to pack");
+    }
+    while (dirent* found = readdir(search)) {
+      if (strcmp(found->d_name, ".") == 0 || strcmp(found->d_name, "..") == 0) {
+        continue;
+      }
+      std::string path = directory + "/" + found->d_name;
+      struct stat status;
+      if (stat(path.c_str(), &status) != 0) {
+        continue;
+      }
+      if (S_ISDIR(status.st_mode)) {
+        findFiles(path, prefix + found->d_name + "/", files);
+        continue;
+      }
+      SourceFile file;
+      file.path = path;
+      file.name = prefix + found->d_name;
+      file.size = status.st_size;
+      files.push_back(file);
+    }
+    closedir(search);
+  }
+#endif
+
+  // appx packages store names as URIs, with everything that isn't allowed in a path segment percent-encoded
+  std::string encodePartName(const std::string& name) {
+    static const char* allowed = "-._~!$&'()*+,;=:@/";
+    static const char* hexDigits = "0123456789ABCDEF";
+    std::string encoded;
+    for (auto c = name.begin(); c != name.end(); ++c) {
+      byte value = static_cast<byte>(*c);
+      if ((value >= 'A' && value <= 'Z') || (value >= 'a' && value <= 'z') || (value >= '0' && value <= '9') || (value && strchr(allowed, value))) {
+        encoded += *c;
+      } else {
+        encoded += '%';
+        encoded += hexDigits[value >> 4];
+        encoded += hexDigits[value & 0xF];
+      }
+    }
+    return encoded;
+  }
+
+  std::string encodeBase64(const byte* data, size_t length) {
+    static const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string encoded;
+    for (size_t i = 0; i < length; i += 3) {
+      uint32 group = data[i] << 16;
+      if (i + 1 < length) {
+        group |= data[i + 1] << 8;
+      }
+      if (i + 2 < length) {
+        group |= data[i + 2];
+      }
+      encoded += alphabet[group >> 18];
+      encoded += alphabet[(group >> 12) & 0x3F];
+      encoded += i + 1 < length ? alphabet[(group >> 6) & 0x3F] : '=';
+      encoded += i + 2 < length ? alphabet[group & 0x3F] : '=';
+    }
+    return encoded;
+  }
+
+  void appendXmlEscaped(std::string& xml, const std::string& text) {
+    for (auto c = text.begin(); c != text.end(); ++c) {
+      switch (*c) {
+      case '&': xml += "&amp;"; break;
+      case '<': xml += "&lt;"; break;
+      case '>': xml += "&gt;"; break;
+      case '"': xml += "&quot;"; break;
+      case '\'': xml += "&apos;"; break;
+      default: xml += *c; break;
+      }
+    }
+  }
+
+  std::string buildBlockMap(const std::vector<PackedEntry>& entries) {
+    std::string xml = "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"no\"?>\r\n"
+      "<BlockMap xmlns=\"http://schemas.microsoft.com/appx/2010/blockmap\" HashMethod=\"http://www.w3.org/2001/04/xmlenc#sha256\">";
+    char number[32];
+    for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
+      xml += "<File Name=\"";
+      appendXmlEscaped(xml, entry->blockMapName);
+      snprintf(number, sizeof(number), "%llu", static_cast<unsigned long long>(entry->uncompressedSize));
+      xml += "\" Size=\"";
+      xml += number;
+      snprintf(number, sizeof(number), "%u", entry->localHeaderSize);
+      xml += "\" LfhSize=\"";
+      xml += number;
+      xml += "\">";
+      for (auto block = entry->blocks.begin(); block != entry->blocks.end(); ++block) {
+        snprintf(number, sizeof(number), "%u", block->second);
+        xml += "<Block Hash=\"" + block->first + "\" Size=\"" + number + "\"/>";
+      }
+      xml += "</File>";
+    }
+    xml += "</BlockMap>";
+    return xml;
+  }
+
+  const char* getContentType(const std::string& extension) {
+    static const char* types[][2] = {
+      { "xml", "text/xml" }, { "png", "image/png" }, { "jpg", "image/jpeg" }, { "jpeg", "image/jpeg" },
+      { "gif", "image/gif" }, { "bmp", "image/bmp" }, { "ico", "image/vnd.microsoft.icon" }, { "dll", "application/x-msdownload" },
+      { "exe", "application/x-msdownload" }, { "js", "application/x-javascript" }, { "html", "text/html" }, { "htm", "text/html" },
+      { "css", "text/css" }, { "txt", "text/plain" }, { "json", "application/json" }
+    };
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+      if (extension == types[i][0]) {
+        return types[i][1];
+      }
+    }
+    return "application/octet-stream";
+  }
+
+  // every extension gets a default type, files without one and the package's own files are listed by name
+  std::string buildContentTypes(const std::vector<PackedEntry>& entries) {
+    std::vector<std::string> extensions;
+    std::vector<std::string> unnamed;
+    bool hasManifest = false;
+    for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
+      size_t dot = entry->name.find_last_of("./");
+      if (dot == std::string::npos || entry->name[dot] == '/') {
+        unnamed.push_back(entry->name);
+        continue;
+      }
+      std::string extension = entry->name.substr(dot + 1);
+      std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+      if (std::find(extensions.begin(), extensions.end(), extension) == extensions.end()) {
+        extensions.push_back(extension);
+      }
+      hasManifest = hasManifest || entry->name == "AppxManifest.xml";
+    }
+    std::sort(extensions.begin(), extensions.end());
+
+    std::string xml = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\r\n"
+      "<Types xmlns=\"http://schemas.openxmlformats.org/package/2006/content-types\">";
+    for (auto extension = extensions.begin(); extension != extensions.end(); ++extension) {
+      xml += "<Default Extension=\"";
+      appendXmlEscaped(xml, *extension);
+      xml += "\" ContentType=\"";
+      xml += getContentType(*extension);
+      xml += "\"/>";
+    }
+    for (auto name = unnamed.begin(); name != unnamed.end(); ++name) {
+      xml += "<Override PartName=\"/";
+      appendXmlEscaped(xml, *name);
+      xml += "\" ContentType=\"application/octet-stream\"/>";
+    }
+    if (hasManifest) {
+      xml += "<Override PartName=\"/AppxManifest.xml\" ContentType=\"application/vnd.ms-appx.manifest+xml\"/>";
+    }
+    xml += "<Override PartName=\"/AppxBlockMap.xml\" ContentType=\"application/vnd.ms-appx.blockmap+xml\"/></Types>";
+    return xml;
+  }
+
+  bool isAscii(const std::string& text) {
+    for (auto c = text.begin(); c != text.end(); ++c) {
+      if (static_cast<byte>(*c) >= 0x80) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  uint32 getLocalHeaderSize(const std::string& name, uint64 size) {
+    uint32 headerSize = static_cast<uint32>(sizeof(LocalFileHeader) + name.size());
+    return size >= ZipPacker_ZIP64_THRESHOLD ? headerSize + sizeof(ExtraFieldHeader) + 2 * sizeof(uint64) : headerSize;
+  }
+
+  // the local header of an entry whose data is complete, at the offset reserved for it
+  void writeLocalHeader(OutputFile& output, const PackedEntry& entry) {
+    bool zip64 = entry.localHeaderSize > sizeof(LocalFileHeader) + entry.name.size();
+    std::vector<byte> header(entry.localHeaderSize);
+    LocalFileHeader fields;
+    fields.signature = ZipArchive_ENTRY_LOCAL_HEADER_SIGNATURE;
+    fields.version = zip64 ? 45 : 20;
+    fields.flags = isAscii(entry.name) ? 0 : ZipPacker_FLAG_UTF8;
+    fields.compressionMethod = entry.method;
+    fields.lastModifiedTime = ZipPacker_DOS_TIME;
+    fields.lastModifiedDate = ZipPacker_DOS_DATE;
+    fields.crc32 = entry.crc;
+    fields.compressedSize = zip64 ? ZipArchive_ZIP64_MARKER : static_cast<uint32>(entry.compressedSize);
+    fields.uncompressedSize = zip64 ? ZipArchive_ZIP64_MARKER : static_cast<uint32>(entry.uncompressedSize);
+    fields.filenameLength = static_cast<uint16>(entry.name.size());
+    fields.extraFieldLength = static_cast<uint16>(entry.localHeaderSize - sizeof(LocalFileHeader) - entry.name.size());
+    memcpy(header.data(), &fields, sizeof(fields));
+    memcpy(header.data() + sizeof(fields), entry.name.data(), entry.name.size());
+    if (zip64) {
+      byte* extra = header.data() + sizeof(fields) + entry.name.size();
+      ExtraFieldHeader extraHeader = { ZipArchive_ZIP64_EXTRA_FIELD, 2 * sizeof(uint64) };
+      memcpy(extra, &extraHeader, sizeof(extraHeader));
+      memcpy(extra + sizeof(extraHeader), &entry.uncompressedSize, sizeof(uint64));
+      memcpy(extra + sizeof(extraHeader) + sizeof(uint64), &entry.compressedSize, sizeof(uint64));
+    }
+    output.WriteAt(entry.localHeaderOffset, header.data(), header.size());
+  }
+
+  // a generated file, small enough to be compressed on the writing thread in one piece
+  PackedEntry writeGeneratedEntry(OutputFile& output, uint64& position, const std::string& name, const std::string& contents) {
+    std::vector<byte> compressed;
+    DeflateEncoder encoder;
+    encoder.Compress(reinterpret_cast<const byte*>(contents.data()), contents.size(), 0, true, compressed);
+    PackedEntry entry;
+    entry.name = name;
+    entry.method = ZipArchive_METHOD_DEFLATE;
+    entry.crc = UpdateCrc32(0, reinterpret_cast<const byte*>(contents.data()), contents.size());
+    entry.compressedSize = compressed.size();
+    entry.uncompressedSize = contents.size();
+    entry.localHeaderOffset = position;
+    entry.localHeaderSize = getLocalHeaderSize(name, contents.size());
+    writeLocalHeader(output, entry);
+    output.WriteAt(position + entry.localHeaderSize, compressed.data(), compressed.size());
+    position += entry.localHeaderSize + compressed.size();
+    return entry;
+  }
+
+  // the central directory and the end records, with zip64 records where the values don't fit
+  void writeCentralDirectory(OutputFile& output, uint64& position, const std::vector<PackedEntry>& entries) {
+    std::vector<byte> directory;
+    for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
+      uint64 values[3] = { entry->uncompressedSize, entry->compressedSize, entry->localHeaderOffset };
+      std::vector<uint64> extraValues;
+      for (int i = 0; i < 3; i++) {
+        if (values[i] >= ZipArchive_ZIP64_MARKER) {
+          extraValues.push_back(values[i]);
+        }
+      }
+      CentralDirectoryHeader header;
+      header.signature = ZipArchive_CENTRAL_DIRECTORY_RECORD_SIGNATURE;
+      header.versionCreated = extraValues.empty() ? 20 : 45;
+      header.versionNeeded = header.versionCreated;
+      header.flags = isAscii(entry->name) ? 0 : ZipPacker_FLAG_UTF8;
+      header.compressionMethod = entry->method;
+      header.lastModifiedTime = ZipPacker_DOS_TIME;
+      header.lastModifiedDate = ZipPacker_DOS_DATE;
+      header.crc32 = entry->crc;
+      header.uncompressedSize = static_cast<uint32>(std::min<uint64>(values[0], ZipArchive_ZIP64_MARKER));
+      header.compressedSize = static_cast<uint32>(std::min<uint64>(values[1], ZipArchive_ZIP64_MARKER));
+      header.filenameLength = static_cast<uint16>(entry->name.size());
+      header.extraFieldLength = static_cast<uint16>(extraValues.empty() ? 0 : sizeof(ExtraFieldHeader) + extraValues.size() * sizeof(uint64));
+      header.fileCommentLength = 0;
+      header.diskNumberStart = 0;
+      header.internalFileAttributes = 0;
+      header.externalFileAttributes = 0;
+      header.localHeaderOffset = static_cast<uint32>(std::min<uint64>(values[2], ZipArchive_ZIP64_MARKER));
+      const byte* fields = reinterpret_cast<const byte*>(&header);
+      directory.insert(directory.end(), fields, fields + sizeof(header));
+      directory.insert(directory.end(), entry->name.begin(), entry->name.end());
+      if (!extraValues.empty()) {
+        ExtraFieldHeader extraHeader = { ZipArchive_ZIP64_EXTRA_FIELD, static_cast<uint16>(extraValues.size() * sizeof(uint64)) };
+        const byte* extra = reinterpret_cast<const byte*>(&extraHeader);
+        directory.insert(directory.end(), extra, extra + sizeof(extraHeader));
+        const byte* extraData = reinterpret_cast<const byte*>(extraValues.data());
+        directory.insert(directory.end(), extraData, extraData + extraValues.size() * sizeof(uint64));
+      }
+    }
+
+    uint64 directoryStart = position;
+    uint64 directorySize = directory.size();
+    if (entries.size() >= 0xFFFF || directoryStart >= ZipArchive_ZIP64_MARKER || directorySize >= ZipArchive_ZIP64_MARKER) {
+      Zip64EndOfCentralDirectoryRecord record;
+      record.signature = ZipArchive_ZIP64_END_OF_CENTRAL_RECORD_SIGNATURE;
+      record.recordSize = sizeof(record) - sizeof(record.signature) - sizeof(record.recordSize);
+      record.versionMadeBy = 45;
+      record.versionToExtract = 45;
+      record.diskNumber = 0;
+      record.centralDirectoryDiskNumber = 0;
+      record.entryCountThisDisk = entries.size();
+      record.totalEntryCount = entries.size();
+      record.centralDirectorySize = directorySize;
+      record.startingDiskCentralDirectoryOffset = directoryStart;
+      Zip64EndOfCentralDirectoryRecordLocator locator;
+      locator.signature = ZipArchive_ZIP64_END_OF_CENTRAL_LOCATOR_SIGNATURE;
+      locator.centralDirectoryStartDiskNumber = 0;
+      locator.centralDirectoryOffset = directoryStart + directorySize;
+      locator.numberOfDisks = 1;
+      const byte* recordData = reinterpret_cast<const byte*>(&record);
+      directory.insert(directory.end(), recordData, recordData + sizeof(record));
+      const byte* locatorData = reinterpret_cast<const byte*>(&locator);
+      directory.insert(directory.end(), locatorData, locatorData + sizeof(locator));
+    }
+    EndOfCentralDirectoryRecord end;
+    end.signature = ZipArchive_END_OF_CENTRAL_RECORD_SIGNATURE;
+    end.diskNumber = 0;
+    end.directoryDiskNumber = 0;
+    end.entryCountThisDisk = static_cast<uint16>(std::min<size_t>(entries.size(), 0xFFFF));
+    end.entryCountTotal = end.entryCountThisDisk;
+    end.centralDirectorySize = static_cast<uint32>(std::min<uint64>(directorySize, ZipArchive_ZIP64_MARKER));
+    end.centralDirectoryOffset = static_cast<uint32>(std::min<uint64>(directoryStart, ZipArchive_ZIP64_MARKER));
+    end.zipFileCommentLength = 0;
+    const byte* endData = reinterpret_cast<const byte*>(&end);
+    directory.insert(directory.end(), endData, endData + sizeof(end));
+
+    output.WriteAt(position, directory.data(), directory.size());
+    position += directory.size();
+  }
+}
+
+ZipPacker::ZipPacker(unsigned threadCount)
+  : threadCount(threadCount)
+{
+  if (this->threadCount == 0) {
+    this->threadCount = std::max(1U, std::thread::hardware_concurrency());
+  }
+}
+
+/************************************************************************/
+/* The threads take blocks in file order but only so far ahead of the   */
+/* writer, which bounds the memory to a few blocks per thread however   */
+/* large the directory is. After an error the threads stop, the writer  */
+/* rethrows it and the incomplete archive is deleted                    */
+/************************************************************************/
+ZipPacker::Statistics ZipPacker::Pack(const std::string& directory, const std::string& filename, bool appx) const {
+  std::vector<SourceFile> files;
+  findFiles(directory, "", files);
+  if (appx) {
+    // generated anew, or invalid once the package changes
+    files.erase(std::remove_if(files.begin(), files.end(), [](const SourceFile& file) {
+      return _stricmp(file.name.c_str(), "AppxBlockMap.xml") == 0 || _stricmp(file.name.c_str(), "[Content_Types].xml") == 0
+        || _stricmp(file.name.c_str(), "AppxSignature.p7x") == 0;
+    }), files.end());
+  }
+  std::sort(files.begin(), files.end(), [](const SourceFile& file, const SourceFile& other) {
+    return file.name < other.name;
+  });
+  std::vector<size_t> blockFiles;
+  for (size_t i = 0; i < files.size(); i++) {
+    files[i].firstBlock = blockFiles.size();
+    files[i].blockCount = static_cast<size_t>((files[i].size + ZipPacker_BLOCK_SIZE - 1) / ZipPacker_BLOCK_SIZE);
+    blockFiles.insert(blockFiles.end(), files[i].blockCount, i);
+  }
+
+  std::vector<CompressedBlock> blocks(blockFiles.size());
+  std::vector<std::shared_ptr<RandomAccessFile>> inputs(files.size());
+  std::mutex lock;
+  std::condition_variable changed;
+  size_t nextBlock = 0;
+  size_t writtenBlocks = 0;
+  size_t blocksAhead = threadCount * ZipPacker_BLOCKS_AHEAD;
+  bool failed = false;
+  std::exception_ptr error;
+
+  auto work = [&]() {
+    DeflateEncoder encoder;
+    std::vector<byte> buffer(DeflateEncoder_WINDOW_SIZE + ZipPacker_BLOCK_SIZE);
+    for (;;) {
+      size_t block;
+      std::shared_ptr<RandomAccessFile> input;
+      {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [&]() {
+          return failed || nextBlock == blocks.size() || nextBlock < writtenBlocks + blocksAhead;
+        });
+        if (failed || nextBlock == blocks.size()) {
+          return;
+        }
+        block = nextBlock++;
+      }
+      try {
+        const SourceFile& file = files[blockFiles[block]];
+        {
+          // the first block of a file to be compressed opens it for the others
+          std::lock_guard<std::mutex> guard(lock);
+          if (!inputs[blockFiles[block]]) {
+            inputs[blockFiles[block]].reset(new RandomAccessFile(file.path));
+          }
+          input = inputs[blockFiles[block]];
+        }
+        uint64 offset = static_cast<uint64>(block - file.firstBlock) * ZipPacker_BLOCK_SIZE;
+        size_t length = static_cast<size_t>(std::min<uint64>(ZipPacker_BLOCK_SIZE, file.size - offset));
+        size_t dictionaryLength = static_cast<size_t>(std::min<uint64>(offset, DeflateEncoder_WINDOW_SIZE));
+        input->ReadAt(offset - dictionaryLength, buffer.data(), dictionaryLength + length);
+        const byte* data = buffer.data() + dictionaryLength;
+
+        CompressedBlock result;
+        result.data.reserve(length / 2);
+        encoder.Compress(data, length, dictionaryLength, block == file.firstBlock + file.blockCount - 1, result.data);
+        result.crc = UpdateCrc32(0, data, length);
+        if (appx) {
+          Sha256::Hash(data, length, result.hash);
+        }
+        result.ready = true;
+        {
+          std::lock_guard<std::mutex> guard(lock);
+          std::swap(blocks[block], result);
+        }
+        changed.notify_all();
+      } catch (...) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!error) {
+          error = std::current_exception();
+        }
+        failed = true;
+        changed.notify_all();
+        return;
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < std::min<size_t>(threadCount, blocks.size()); i++) {
+    workers.push_back(std::thread(work));
+  }
+
+  OutputFile output(filename);
+  std::vector<PackedEntry> entries;
+  Statistics statistics;
+  statistics.files = files.size();
+  statistics.uncompressedSize = 0;
+  uint64 position = 0;
+  try {
+    for (size_t i = 0; i < files.size(); i++) {
+      const SourceFile& file = files[i];
+      PackedEntry entry;
+      entry.name = appx ? encodePartName(file.name) : file.name;
+      entry.blockMapName = file.name;
+      std::replace(entry.blockMapName.begin(), entry.blockMapName.end(), '/', '\\');
+      entry.method = file.size > 0 ? ZipArchive_METHOD_DEFLATE : ZipArchive_METHOD_STORED;
+      entry.crc = 0;
+      entry.compressedSize = 0;
+      entry.uncompressedSize = file.size;
+      entry.localHeaderOffset = position;
+      entry.localHeaderSize = getLocalHeaderSize(entry.name, file.size);
+      position += entry.localHeaderSize;
+
+      for (size_t block = file.firstBlock; block < file.firstBlock + file.blockCount; block++) {
+        CompressedBlock compressed;
+        {
+          std::unique_lock<std::mutex> guard(lock);
+          changed.wait(guard, [&]() {
+            return failed || blocks[block].ready;
+          });
+          if (failed) {
+            break;
+          }
+          std::swap(compressed, blocks[block]);
+          writtenBlocks++;
+          if (block == file.firstBlock + file.blockCount - 1) {
+            inputs[i].reset();
+          }
+        }
+        changed.notify_all();
+        output.WriteAt(position, compressed.data.data(), compressed.data.size());
+        position += compressed.data.size();
+        entry.compressedSize += compressed.data.size();
+        uint64 blockLength = std::min<uint64>(ZipPacker_BLOCK_SIZE, file.size - (block - file.firstBlock) * static_cast<uint64>(ZipPacker_BLOCK_SIZE));
+        entry.crc = CombineCrc32(entry.crc, compressed.crc, blockLength);
+        if (appx) {
+          entry.blocks.push_back(std::make_pair(encodeBase64(compressed.hash, Sha256_DIGEST_SIZE), static_cast<uint32>(compressed.data.size())));
+        }
+      }
+      if (failed) {
+        break;
+      }
+      writeLocalHeader(output, entry);
+      statistics.uncompressedSize += file.size;
+      entries.push_back(entry);
+    }
+  } catch (...) {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      if (!error) {
+        error = std::current_exception();
+      }
+      failed = true;
+    }
+    changed.notify_all();
+  }
+  for (auto worker = workers.begin(); worker != workers.end(); ++worker) {
+    worker->join();
+  }
+  if (error) {
+    output.Discard();
+    std::rethrow_exception(error);
+  }
+
+  if (appx) {
+    entries.push_back(writeGeneratedEntry(output, position, "AppxBlockMap.xml", buildBlockMap(entries)));
+    entries.push_back(writeGeneratedEntry(output, position, "[Content_Types].xml", buildContentTypes(entries)));
+  }
+  writeCentralDirectory(output, position, entries);
+  statistics.archiveSize = position;
+  return statistics;
+}
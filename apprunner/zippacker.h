@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+
+// files are compressed in pieces of this size, which are also the blocks listed in AppxBlockMap.xml
+#define ZipPacker_BLOCK_SIZE 65536
+// how many compressed blocks per thread may wait for the writer before the threads pause
+#define ZipPacker_BLOCKS_AHEAD 8
+// files from this size on get a zip64 extra field in their local header, their compressed size might not fit 32 bits
+#define ZipPacker_ZIP64_THRESHOLD 0xFF000000ULL
+
+namespace doo {
+  namespace zip {
+    // Packs a directory into a ZIP archive or an appx package.
+    //
+    // Every file is cut into blocks which are deflated on all threads at once, each with the 32KB before
+    // it as a dictionary, like pigz does. A block ends with an empty stored block so the compressed blocks
+    // can simply be written one after the other, a single large file is thus compressed on all cores as
+    // well. The calling thread writes the blocks in the order of the files at their final offsets and
+    // fills in each local header once its file is complete. CRCs and the SHA-256 hashes for the block map
+    // are computed in the same pass by the compressing threads.
+    //
+    // Files are packed in name order with a fixed timestamp, the same directory always gives the same archive.
+    class ZipPacker {
+    public:
+      struct Statistics {
+        uint64 files;
+        uint64 uncompressedSize;
+        uint64 archiveSize;
+      };
+
+      // threadCount 0 uses one thread per core
+      ZipPacker(unsigned threadCount = 0);
+
+      // Pack everything below directory into filename, replacing it. For an appx package AppxBlockMap.xml
+      // and [Content_Types].xml are generated and names are stored as URIs. Ones found in the directory are
+      // replaced, and an AppxSignature.p7x is left out since it doesn't match the new package.
+      Statistics Pack(const std::string& directory, const std::string& filename, bool appx) const;
+
+    private:
+      ZipPacker(const ZipPacker&);
+      ZipPacker& operator=(const ZipPacker&);
+
+      unsigned threadCount;
+    };
+  }
+}
@@ -0,0 +1,371 @@
+#include "stdafx.h"
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+#include "zipformat.h"
+#include "crc32.h"
+#include "zipstreamreader.h"
+
+using namespace doo::zip;
+
+// how much of the stream is buffered at once
+#define ZipStreamReader_BUFFER_SIZE (64 * 1024)
+// between the directories of extracted paths
+#ifdef _WIN32
+#define ZipStreamReader_SEPARATOR '\\'
+#else
+#define ZipStreamReader_SEPARATOR '/'
+#endif
+
+ZipStreamReader::ZipStreamReader(std::istream& inputStream)
+  : input(inputStream), buffer(ZipStreamReader_BUFFER_SIZE), bufferStart(0), bufferEnd(0),
+    streamOffset(0), entryRead(true), entryZip64(false), finished(false)
+{
+}
+
+/************************************************************************/
+/* Buffer at least minimum bytes. Reads block until the producer has    */
+/* written enough or closed the stream.                                 */
+/************************************************************************/
+bool ZipStreamReader::Fill(size_t minimum) {
+  if (Available() >= minimum) {
+    return true;
+  }
+  // move the remainder to the front to make room
+  if (bufferStart > 0) {
+    memmove(buffer.data(), buffer.data() + bufferStart, Available());
+    bufferEnd -= bufferStart;
+    bufferStart = 0;
+  }
+  while (Available() < minimum && input.good()) {
+    input.read(reinterpret_cast<char*>(buffer.data() + bufferEnd), buffer.size() - bufferEnd);
+    bufferEnd += static_cast<size_t>(input.gcount());
+  }
+  return Available() >= minimum;
+}
+
+void ZipStreamReader::ReadExact(void* target, size_t length) {
+  byte* output = static_cast<byte*>(target);
+  while (length > 0) {
+    if (!Fill(1)) {
+      throw ref new Platform::FailureException(L"Unexpected end of ZIP stream");
+    }
+    size_t chunk = std::min(length, Available());
+    memcpy(output, buffer.data() + bufferStart, chunk);
+    Consume(chunk);
+    output += chunk;
+    length -= chunk;
+  }
+}
+
+void ZipStreamReader::SkipExact(uint64 length) {
+  while (length > 0) {
+    if (!Fill(1)) {
+      throw ref new Platform::FailureException(L"Unexpected end of ZIP stream");
+    }
+    size_t chunk = static_cast<size_t>(std::min<uint64>(length, Available()));
+    Consume(chunk);
+    length -= chunk;
+  }
+}
+
+uint32 ZipStreamReader::PeekSignature() {
+  if (!Fill(sizeof(uint32))) {
+    throw ref new Platform::FailureException(L"Unexpected end of ZIP stream");
+  }
+  uint32 signature;
+  memcpy(&signature, buffer.data() + bufferStart, sizeof(signature));
+  return signature;
+}
+
+/************************************************************************/
+/* Read the next local header. The central directory marks the end of   */
+/* the entries and is verified against them right away, an empty        */
+/* archive starts with the end records.                                 */
+/************************************************************************/
+bool ZipStreamReader::NextEntry() {
+  if (finished) {
+    return false;
+  }
+  if (!entryRead) {
+    ReadEntry([](const byte*, size_t) {});
+  }
+
+  uint64 headerOffset = streamOffset;
+  uint32 signature = PeekSignature();
+  if (signature == ZipArchive_CENTRAL_DIRECTORY_RECORD_SIGNATURE
+    || signature == ZipArchive_ZIP64_END_OF_CENTRAL_RECORD_SIGNATURE
+    || signature == ZipArchive_END_OF_CENTRAL_RECORD_SIGNATURE) {
+    ReadCentralDirectory();
+    return false;
+  }
+  if (signature != ZipArchive_ENTRY_LOCAL_HEADER_SIGNATURE) {
+    throw ref new Platform::FailureException(L"Invalid local header");
+  }
+
+  LocalFileHeader localHeader;
+  ReadExact(&localHeader, sizeof(localHeader));
+
+  Entry entry;
+  entry.filename.resize(localHeader.filenameLength);
+  if (localHeader.filenameLength > 0) {
+    ReadExact(&entry.filename[0], localHeader.filenameLength);
+  }
+  std::vector<byte> extraField(localHeader.extraFieldLength);
+  if (!extraField.empty()) {
+    ReadExact(extraField.data(), extraField.size());
+  }
+  entry.flags = localHeader.flags;
+  entry.compressionMethod = localHeader.compressionMethod;
+  entry.crc32 = localHeader.crc32;
+  entry.compressedSize = localHeader.compressedSize;
+  entry.uncompressedSize = localHeader.uncompressedSize;
+  entry.localHeaderOffset = headerOffset;
+  if (!ReadZip64ExtraField(extraField.data(), extraField.size(), entry.uncompressedSize, entry.compressedSize, NULL)) {
+    throw ref new Platform::FailureException(L"Invalid local header");
+  }
+  entryZip64 = false;
+  for (size_t position = 0; extraField.size() - position >= sizeof(ExtraFieldHeader); ) {
+    ExtraFieldHeader extraHeader;
+    memcpy(&extraHeader, extraField.data() + position, sizeof(extraHeader));
+    entryZip64 |= extraHeader.id == ZipArchive_ZIP64_EXTRA_FIELD;
+    position += sizeof(extraHeader) + extraHeader.size;
+    if (position > extraField.size()) {
+      break;
+    }
+  }
+  entries.push_back(entry);
+
+  entryRead = false;
+  return true;
+}
+
+/************************************************************************/
+/* Stored data can only be streamed if the size is known up front       */
+/************************************************************************/
+void ZipStreamReader::ReadStored(const OutputCallback& output, uint32& crc, uint64& uncompressedSize) {
+  const Entry& entry = entries.back();
+  if (entry.flags & ZipArchive_FLAG_DATA_DESCRIPTOR) {
+    throw ref new Platform::FailureException(L"Stored entries with a data descriptor cannot be streamed");
+  }
+  uint64 remaining = entry.compressedSize;
+  while (remaining > 0) {
+    if (!Fill(1)) {
+      throw ref new Platform::FailureException(L"Unexpected end of ZIP stream");
+    }
+    size_t chunk = static_cast<size_t>(std::min<uint64>(remaining, Available()));
+    const byte* data = buffer.data() + bufferStart;
+    crc = UpdateCrc32(crc, data, chunk);
+    output(data, chunk);
+    Consume(chunk);
+    remaining -= chunk;
+  }
+  uncompressedSize = entry.compressedSize;
+}
+
+/************************************************************************/
+/* Inflate straight out of the stream buffer until the deflate stream   */
+/* ends, which also tells where a data descriptor starts                */
+/************************************************************************/
+void ZipStreamReader::ReadDeflated(const OutputCallback& output, uint32& crc, uint64& compressedSize, uint64& uncompressedSize) {
+  inflater.Reset();
+  InflateStream::OutputCallback verifyingOutput = [&](const byte* data, size_t length) {
+    crc = UpdateCrc32(crc, data, length);
+    uncompressedSize += length;
+    output(data, length);
+  };
+  while (!inflater.IsFinished()) {
+    if (!Fill(1)) {
+      throw ref new Platform::FailureException(L"Unexpected end of ZIP stream");
+    }
+    size_t consumed = inflater.Inflate(buffer.data() + bufferStart, Available(), true, verifyingOutput);
+    Consume(consumed);
+    compressedSize += consumed;
+  }
+}
+
+void ZipStreamReader::ReadDataDescriptor(Entry& entry) {
+  // the signature is optional
+  if (PeekSignature() == ZipArchive_DATA_DESCRIPTOR_SIGNATURE) {
+    Consume(sizeof(uint32));
+  }
+  if (entryZip64) {
+    Zip64DataDescriptor descriptor;
+    ReadExact(&descriptor, sizeof(descriptor));
+    entry.crc32 = descriptor.crc32;
+    entry.compressedSize = descriptor.compressedSize;
+    entry.uncompressedSize = descriptor.uncompressedSize;
+  } else {
+    DataDescriptor descriptor;
+    ReadExact(&descriptor, sizeof(descriptor));
+    entry.crc32 = descriptor.crc32;
+    entry.compressedSize = descriptor.compressedSize;
+    entry.uncompressedSize = descriptor.uncompressedSize;
+  }
+}
+
+void ZipStreamReader::ReadEntry(const OutputCallback& output) {
+  if (entryRead || finished) {
+    throw ref new Platform::FailureException(L"No entry to read");
+  }
+  entryRead = true;
+
+  Entry& entry = entries.back();
+  uint32 crc = 0;
+  uint64 compressedSize = 0;
+  uint64 uncompressedSize = 0;
+  switch (entry.compressionMethod) {
+  case 0: // file is uncompressed
+    ReadStored(output, crc, uncompressedSize);
+    compressedSize = uncompressedSize;
+    break;
+  case 8: // deflate
+    ReadDeflated(output, crc, compressedSize, uncompressedSize);
+    break;
+  default:
+    throw ref new Platform::FailureException(L"Compression algorithm not supported");
+  }
+
+  if (entry.flags & ZipArchive_FLAG_DATA_DESCRIPTOR) {
+    ReadDataDescriptor(entry);
+  }
+  if (crc != entry.crc32 || compressedSize != entry.compressedSize || uncompressedSize != entry.uncompressedSize) {
+    throw ref new Platform::FailureException(L"Entry data does not match its header");
+  }
+}
+
+/************************************************************************/
+/* The central directory has to describe exactly the entries which were */
+/* streamed, in the same order                                          */
+/************************************************************************/
+void ZipStreamReader::ReadCentralDirectory() {
+  size_t index = 0;
+  while (PeekSignature() == ZipArchive_CENTRAL_DIRECTORY_RECORD_SIGNATURE) {
+    CentralDirectoryHeader header;
+    ReadExact(&header, sizeof(header));
+    std::string filename(header.filenameLength, '\0');
+    if (header.filenameLength > 0) {
+      ReadExact(&filename[0], header.filenameLength);
+    }
+    std::vector<byte> extraField(header.extraFieldLength);
+    if (!extraField.empty()) {
+      ReadExact(extraField.data(), extraField.size());
+    }
+    SkipExact(header.fileCommentLength);
+    uint64 compressedSize = header.compressedSize;
+    uint64 uncompressedSize = header.uncompressedSize;
+    uint64 localHeaderOffset = header.localHeaderOffset;
+    if (!ReadZip64ExtraField(extraField.data(), extraField.size(), uncompressedSize, compressedSize, &localHeaderOffset)) {
+      throw ref new Platform::FailureException(L"Invalid ZIP file entry header");
+    }
+
+    if (index >= entries.size()) {
+      throw ref new Platform::FailureException(L"Central directory lists entries which are not in the archive");
+    }
+    const Entry& entry = entries[index++];
+    if (filename != entry.filename
+      || header.crc32 != entry.crc32
+      || compressedSize != entry.compressedSize
+      || uncompressedSize != entry.uncompressedSize
+      || localHeaderOffset != entry.localHeaderOffset) {
+      throw ref new Platform::FailureException(L"Central directory does not match the local headers");
+    }
+  }
+  if (index != entries.size()) {
+    throw ref new Platform::FailureException(L"Central directory is missing entries");
+  }
+
+  // the optional zip64 records are of no further interest here
+  if (PeekSignature() == ZipArchive_ZIP64_END_OF_CENTRAL_RECORD_SIGNATURE) {
+    Zip64EndOfCentralDirectoryRecord zip64Record;
+    ReadExact(&zip64Record, sizeof(zip64Record));
+    // recordSize excludes the signature and the size field itself
+    SkipExact(zip64Record.recordSize - (sizeof(zip64Record) - sizeof(uint32) - sizeof(uint64)));
+  }
+  if (PeekSignature() == ZipArchive_ZIP64_END_OF_CENTRAL_LOCATOR_SIGNATURE) {
+    SkipExact(sizeof(Zip64EndOfCentralDirectoryRecordLocator));
+  }
+
+  EndOfCentralDirectoryRecord endOfCentralDirectoryRecord;
+  ReadExact(&endOfCentralDirectoryRecord, sizeof(endOfCentralDirectoryRecord));
+  if (endOfCentralDirectoryRecord.signature != ZipArchive_END_OF_CENTRAL_RECORD_SIGNATURE) {
+    throw ref new Platform::FailureException(L"Could not read ZIP file");
+  }
+  if (endOfCentralDirectoryRecord.entryCountTotal != 0xFFFF && endOfCentralDirectoryRecord.entryCountTotal != entries.size()) {
+    throw ref new Platform::FailureException(L"Central directory is missing entries");
+  }
+  SkipExact(endOfCentralDirectoryRecord.zipFileCommentLength);
+  finished = true;
+}
+
+/************************************************************************/
+/* Names have to stay below the target directory: no drive, no leading  */
+/* separator and no ".." component. Dots inside a name are fine.        */
+/************************************************************************/
+static bool isSafeName(const std::string& name) {
+  if (name.empty() || name[0] == '/' || name[0] == '\\' || name.find(':') != std::string::npos) {
+    return false;
+  }
+  size_t start = 0;
+  for (;;) {
+    size_t separator = name.find_first_of("/\\", start);
+    if (name.compare(start, separator == std::string::npos ? std::string::npos : separator - start, "..") == 0) {
+      return false;
+    }
+    if (separator == std::string::npos) {
+      return true;
+    }
+    start = separator + 1;
+  }
+}
+
+/************************************************************************/
+/* Create every directory along path                                    */
+/************************************************************************/
+static void createDirectory(const std::string& path) {
+#ifdef _WIN32
+  CreateDirectoryA(path.c_str(), NULL);
+#else
+  mkdir(path.c_str(), 0755);
+#endif
+}
+
+static void createDirectories(const std::string& path) {
+  for (size_t separator = path.find(ZipStreamReader_SEPARATOR, 1); separator != std::string::npos;
+    separator = path.find(ZipStreamReader_SEPARATOR, separator + 1)) {
+    createDirectory(path.substr(0, separator));
+  }
+  createDirectory(path);
+}
+
+void ZipStreamReader::ExtractAll(const std::string& directory) {
+  while (NextEntry()) {
+    std::string name = CurrentEntry().filename;
+    // never write outside of the target directory
+    if (!isSafeName(name)) {
+      throw ref new Platform::FailureException(L"Invalid file name in ZIP stream");
+    }
+#ifdef _WIN32
+    std::replace(name.begin(), name.end(), '/', '\\');
+#else
+    std::replace(name.begin(), name.end(), '\\', '/');
+#endif
+    std::string path = directory + ZipStreamReader_SEPARATOR + name;
+
+    if (path.back() == ZipStreamReader_SEPARATOR) {
+      createDirectories(path.substr(0, path.size() - 1));
+      ReadEntry([](const byte*, size_t) {});
+      continue;
+    }
+    createDirectories(path.substr(0, path.rfind(ZipStreamReader_SEPARATOR)));
+    std::ofstream output(path, std::ios::binary | std::ios::out | std::ios::trunc);
+    if (!output.is_open()) {
+      throw ref new Platform::FailureException(L"Could not create extracted file");
+    }
+    ReadEntry([&output](const byte* data, size_t length) {
+      output.write(reinterpret_cast<const char*>(data), length);
+    });
+  }
+}
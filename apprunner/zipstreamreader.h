@@ -0,0 +1,84 @@
+#pragma once
+
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "inflatestream.h"
+
+namespace doo {
+  namespace zip {
+    // Forward-only reader for ZIP data that is still arriving, e.g. through a pipe from a build agent.
+    // Entries are read from their local headers in the order they appear in the stream. Once the
+    // central directory arrives, it is checked against everything that has been read.
+    class ZipStreamReader {
+    public:
+      struct Entry {
+        std::string filename;
+        uint16 flags;
+        uint16 compressionMethod;
+        uint32 crc32;
+        uint64 compressedSize;
+        uint64 uncompressedSize;
+        uint64 localHeaderOffset;
+      };
+
+      typedef std::function<void (const byte* data, size_t length)> OutputCallback;
+
+      // the stream has to be positioned at the start of the archive
+      ZipStreamReader(std::istream& input);
+
+      // advance to the next entry, skipping whatever was not read of the current one.
+      // Returns false once the central directory has been reached and verified.
+      bool NextEntry();
+
+      // the entry NextEntry() moved to, crc and sizes may only be known after ReadEntry()
+      const Entry& CurrentEntry() const {
+        return entries.back();
+      }
+
+      // stream the uncompressed contents of the current entry and verify them
+      void ReadEntry(const OutputCallback& output);
+
+      // extract all remaining entries below directory while the data arrives
+      void ExtractAll(const std::string& directory);
+
+    private:
+      ZipStreamReader(const ZipStreamReader&);
+      ZipStreamReader& operator=(const ZipStreamReader&);
+
+      // make sure at least minimum bytes are buffered, false if the stream ends before
+      bool Fill(size_t minimum);
+      void ReadExact(void* target, size_t length);
+      void SkipExact(uint64 length);
+      uint32 PeekSignature();
+      size_t Available() const {
+        return bufferEnd - bufferStart;
+      }
+      void Consume(size_t length) {
+        bufferStart += length;
+        streamOffset += length;
+      }
+
+      void ReadStored(const OutputCallback& output, uint32& crc, uint64& uncompressedSize);
+      void ReadDeflated(const OutputCallback& output, uint32& crc, uint64& compressedSize, uint64& uncompressedSize);
+      void ReadDataDescriptor(Entry& entry);
+      void ReadCentralDirectory();
+
+      std::istream& input;
+      std::vector<byte> buffer;
+      size_t bufferStart;
+      size_t bufferEnd;
+      // offset of buffer[bufferStart] from the start of the archive
+      uint64 streamOffset;
+
+      std::vector<Entry> entries;
+      bool entryRead;
+      // the current entry has a zip64 extra field, its data descriptor holds 64 bit sizes then
+      bool entryZip64;
+      bool finished;
+      InflateStream inflater;
+    };
+  }
+}
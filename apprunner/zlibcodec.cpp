@@ -0,0 +1,61 @@
+#include "stdafx.h"
+
+#ifdef APPRUNNER_USE_ZLIB
+
+#include <zlib.h>
+
+#include "zipformat.h"
+#include "zlibcodec.h"
+
+using namespace doo::zip;
+
+// how much compressed data is read at once
+#define ZlibCodec_INPUT_SIZE (64 * 1024)
+
+uint16 ZlibCodec::GetMethod() const {
+  return ZipArchive_METHOD_DEFLATE;
+}
+
+const char* ZlibCodec::GetName() const {
+  return "zlib";
+}
+
+/************************************************************************/
+/* ZIP entries are raw deflate streams, hence the negative window bits  */
+/************************************************************************/
+void ZlibCodec::Decompress(const RandomAccessFile& file, uint64 offset, uint64 compressedSize,
+  byte* buffer, size_t uncompressedSize, uint16) const
+{
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+    throw ref new Platform::OutOfMemoryException(L"Could not initialize zlib");
+  }
+
+  std::vector<byte> input(static_cast<size_t>(std::min<uint64>(compressedSize, ZlibCodec_INPUT_SIZE)));
+  uint64 remaining = compressedSize;
+  // zlib rejects a missing output buffer even for empty files
+  byte emptyOutput;
+  stream.next_out = uncompressedSize > 0 ? buffer : &emptyOutput;
+  stream.avail_out = static_cast<uInt>(uncompressedSize);
+  int result = Z_OK;
+  while (result == Z_OK) {
+    if (stream.avail_in == 0 && remaining > 0) {
+      size_t chunk = static_cast<size_t>(std::min<uint64>(input.size(), remaining));
+      file.ReadAt(offset, input.data(), chunk);
+      offset += chunk;
+      remaining -= chunk;
+      stream.next_in = input.data();
+      stream.avail_in = static_cast<uInt>(chunk);
+    }
+    result = inflate(&stream, remaining > 0 ? Z_NO_FLUSH : Z_FINISH);
+  }
+  size_t written = uncompressedSize - stream.avail_out;
+  inflateEnd(&stream);
+
+  if (result != Z_STREAM_END || written != uncompressedSize) {
+    throw ref new Platform::FailureException(L"Could not extract data");
+  }
+}
+
+#endif
@@ -0,0 +1,20 @@
+#pragma once
+
+#ifdef APPRUNNER_USE_ZLIB
+
+#include "codec.h"
+
+namespace doo {
+  namespace zip {
+    // deflate through zlib, or any drop-in replacement with a faster inflate built from the same zlib.h
+    class ZlibCodec : public Codec {
+    public:
+      virtual uint16 GetMethod() const;
+      virtual const char* GetName() const;
+      virtual void Decompress(const RandomAccessFile& file, uint64 offset, uint64 compressedSize,
+        byte* buffer, size_t uncompressedSize, uint16 flags) const;
+    };
+  }
+}
+
+#endif
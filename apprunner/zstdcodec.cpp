@@ -0,0 +1,73 @@
+#include "stdafx.h"
+
+#ifdef APPRUNNER_USE_ZSTD
+
+#include <zstd.h>
+
+#include "zipformat.h"
+#include "zstdcodec.h"
+
+using namespace doo::zip;
+
+// how much compressed data is read at once
+#define ZstdCodec_INPUT_SIZE (64 * 1024)
+
+uint16 ZstdCodec::GetMethod() const {
+  return ZipArchive_METHOD_ZSTD;
+}
+
+const char* ZstdCodec::GetName() const {
+  return "zstd";
+}
+
+/************************************************************************/
+/* An entry may consist of several frames, it is complete once a frame  */
+/* ends together with the input                                         */
+/************************************************************************/
+void ZstdCodec::Decompress(const RandomAccessFile& file, uint64 offset, uint64 compressedSize,
+  byte* buffer, size_t uncompressedSize, uint16) const
+{
+  ZSTD_DCtx* context = ZSTD_createDCtx();
+  if (!context) {
+    throw ref new Platform::OutOfMemoryException(L"Could not initialize zstd");
+  }
+
+  std::vector<byte> input(static_cast<size_t>(std::min<uint64>(compressedSize, ZstdCodec_INPUT_SIZE)));
+  uint64 remaining = compressedSize;
+  ZSTD_inBuffer inputBuffer = { input.data(), 0, 0 };
+  ZSTD_outBuffer outputBuffer = { buffer, uncompressedSize, 0 };
+  bool succeeded = false;
+  for (;;) {
+    if (inputBuffer.pos == inputBuffer.size && remaining > 0) {
+      size_t chunk = static_cast<size_t>(std::min<uint64>(input.size(), remaining));
+      file.ReadAt(offset, input.data(), chunk);
+      offset += chunk;
+      remaining -= chunk;
+      inputBuffer.size = chunk;
+      inputBuffer.pos = 0;
+    }
+
+    size_t inputBefore = inputBuffer.pos;
+    size_t outputBefore = outputBuffer.pos;
+    size_t result = ZSTD_decompressStream(context, &outputBuffer, &inputBuffer);
+    if (ZSTD_isError(result)) {
+      break;
+    }
+    bool inputDone = inputBuffer.pos == inputBuffer.size && remaining == 0;
+    if (result == 0 && inputDone) {
+      succeeded = outputBuffer.pos == uncompressedSize;
+      break;
+    }
+    // no progress means truncated data or more output than the directory announced
+    if (inputBuffer.pos == inputBefore && outputBuffer.pos == outputBefore) {
+      break;
+    }
+  }
+  ZSTD_freeDCtx(context);
+
+  if (!succeeded) {
+    throw ref new Platform::FailureException(L"Could not extract data");
+  }
+}
+
+#endif
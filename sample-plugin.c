@@ -0,0 +1,26 @@
+/*
+  Sample in-process callback plugin for apprunner.
+
+  Prints the results of the run it is handed. Build it as a shared library and pass it as
+  the callback argument instead of an executable:
+
+    Windows: cl /LD /Iapprunner sample-plugin.c /Fesample-plugin.dll
+    Linux:   cc -shared -fPIC -Iapprunner sample-plugin.c -o sample-plugin.so
+*/
+#include <stdio.h>
+
+#include "apprunner_plugin.h"
+
+APPRUNNER_PLUGIN_EXPORT int APPRUNNER_PLUGIN_CALL apprunner_plugin_abi_version(void) {
+  return APPRUNNER_PLUGIN_ABI_VERSION;
+}
+
+APPRUNNER_PLUGIN_EXPORT int APPRUNNER_PLUGIN_CALL apprunner_plugin_run_complete(const apprunner_run_result* result) {
+  uint32_t i;
+  printf("%s %s (%s) exited with code %d\n", result->package_name, result->package_version, result->package_full_name, result->exit_code);
+  for (i = 0; i < result->phase_count; i++) {
+    printf("  %-14s %10.1f ms\n", result->phases[i].name, result->phases[i].duration_ms);
+  }
+  printf("LocalState: %s\n", result->local_state_path);
+  return 0;
+}